@@ -0,0 +1,61 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/access_policy.h"
+
+#include <atomic>
+
+#include "src/string_util.h"
+
+namespace reflection {
+
+namespace {
+
+thread_local AccessError last_error;
+
+std::atomic<AccessErrorHandler> error_handler{nullptr};
+
+const char* GetCodeName(AccessErrorCode code) {
+  switch (code) {
+    case AccessErrorCode::kNone:
+      return "no error";
+    case AccessErrorCode::kNullObject:
+      return "null object";
+    case AccessErrorCode::kInvalidId:
+      return "invalid field id";
+    case AccessErrorCode::kTypeMismatch:
+      return "type mismatch";
+  }
+  return "unknown error";
+}
+
+}  // namespace
+
+/* AccessError methods */
+
+std::string AccessError::ToString() const {
+  std::string field =
+      field_name.empty()
+          ? StringUtil::Concat("#", field_id)
+          : StringUtil::Concat(field_name, " (id ", field_id, ")");
+  if (code == AccessErrorCode::kTypeMismatch) {
+    return StringUtil::Concat(class_name, "::", field, ": expected ",
+                              expected_type, ", found ", actual_type);
+  }
+  return StringUtil::Concat(class_name, "::", field, ": ", GetCodeName(code));
+}
+
+const AccessError& GetLastAccessError() { return last_error; }
+
+void ClearLastAccessError() { last_error = AccessError(); }
+
+void SetAccessErrorHandler(AccessErrorHandler handler) {
+  error_handler.store(handler, std::memory_order_release);
+}
+
+void InternalReportAccessError(const AccessError& error) {
+  last_error = error;
+  AccessErrorHandler handler = error_handler.load(std::memory_order_acquire);
+  if (handler != nullptr) handler(error);
+}
+
+}  // namespace reflection
@@ -0,0 +1,93 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "src/descriptor_base.h"
+
+namespace reflection {
+
+/**
+ * Access policies of typed field accessors of ClassDescriptor.
+ *
+ * Checked accesses validate ids, objects and field types. On failure they
+ * return nullptr and record an AccessError naming the class, the field and
+ * the expected and actual types, readable with GetLastAccessError() on the
+ * failing thread and passed to the handler set by SetAccessErrorHandler().
+ *
+ * Unchecked accesses trust the caller: the id is valid, the object is not
+ * null and the field is of the requested type, e.g. for ids resolved once
+ * with GetFieldId() before a hot loop. They only assert() this, so debug
+ * builds still catch misuse, and are not recorded by instrumentation.
+ *
+ * The policy is chosen per call site by passing kChecked or kUnchecked, or
+ * for all call sites without one by DefaultAccess: checked, unless
+ * SSR_UNCHECKED_ACCESS is defined at compile time (bazel build --define
+ * ssr_access=unchecked).
+ *
+ * Usage:
+ *   int32_t id = desc->GetFieldId("x");
+ *   for (const auto& point : points) {
+ *     sum += *desc->GetField<float>(&point, id, reflection::kUnchecked);
+ *   }
+ *
+ *   reflection::SetAccessErrorHandler([](const reflection::AccessError& e) {
+ *     LOG(FATAL) << e.ToString();
+ *   });
+ */
+
+struct CheckedAccess {};
+struct UncheckedAccess {};
+
+constexpr CheckedAccess kChecked{};
+constexpr UncheckedAccess kUnchecked{};
+
+#ifdef SSR_UNCHECKED_ACCESS
+using DefaultAccess = UncheckedAccess;
+#else
+using DefaultAccess = CheckedAccess;
+#endif
+
+enum class AccessErrorCode : uint8_t {
+  kNone = 0,
+  kNullObject,
+  kInvalidId,
+  kTypeMismatch,
+};
+
+// Failed checked access. Names are views of interned names, valid for the
+// whole program.
+struct AccessError {
+  AccessErrorCode code{AccessErrorCode::kNone};
+  // Class accessed.
+  string_view class_name;
+  // Field accessed, empty for invalid ids.
+  string_view field_name;
+  int32_t field_id{-1};
+  // Types requested and found, for type mismatches.
+  string_view expected_type;
+  string_view actual_type;
+
+  // Get a message like "Pose::x_ (id 1): expected double, found float".
+  std::string ToString() const;
+};
+
+using AccessErrorHandler = void (*)(const AccessError& error);
+
+// Get the last failed checked access of calling thread. Code is kNone if
+// none failed since ClearLastAccessError().
+const AccessError& GetLastAccessError();
+
+void ClearLastAccessError();
+
+// Call |handler| on every failed checked access, in the failing thread, e.g.
+// to abort in tests. nullptr removes it.
+void SetAccessErrorHandler(AccessErrorHandler handler);
+
+// **FOR INTERNAL USE ONLY**
+// Record |error| as last error of calling thread and call handler if any.
+void InternalReportAccessError(const AccessError& error);
+
+}  // namespace reflection
@@ -0,0 +1,58 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/bench/alloc_count.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<int64_t> g_alloc_count{0};
+
+void* CountedAlloc(size_t size) noexcept {
+  g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+}  // namespace
+
+int64_t GetAllocCount() {
+  return g_alloc_count.load(std::memory_order_relaxed);
+}
+
+// Every form is replaced, so that none is paired with the library's
+// counterpart. Aligned forms are C++17, beyond the build standard.
+void* operator new(size_t size) {
+  if (void* ptr = CountedAlloc(size)) return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+  if (void* ptr = CountedAlloc(size)) return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return CountedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return CountedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
@@ -0,0 +1,11 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+
+// Number of heap allocations made by the process so far, counted by
+// replacements of every form of operator new. They live in their own
+// translation unit, so that the compiler can't inline them into allocation
+// sites and pair the library's new with free().
+int64_t GetAllocCount();
@@ -0,0 +1,19 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/bench/bench_types.h"
+
+ADD_REFLECTION_CLASS_MEMBER(BenchWidth4, f0_, f1_, f2_, f3_);
+
+ADD_REFLECTION_CLASS_MEMBER(BenchWidth8, f0_, f1_, f2_, f3_, f4_, f5_, f6_,
+                            f7_);
+
+ADD_REFLECTION_CLASS_MEMBER(BenchWidth16, f0_, f1_, f2_, f3_, f4_, f5_, f6_,
+                            f7_, f8_, f9_, f10_, f11_, f12_, f13_, f14_, f15_);
+
+ADD_REFLECTION_CLASS_MEMBER(BenchContainers, vec_, map_, umap_, set_, objs_,
+                            uptr_, sptr_);
+
+REGISTER(BenchWidth4, BenchWidth4)
+REGISTER(BenchWidth8, BenchWidth8)
+REGISTER(BenchWidth16, BenchWidth16)
+REGISTER(BenchContainers, BenchContainers)
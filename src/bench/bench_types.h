@@ -0,0 +1,67 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include "src/reflection.h"
+
+// Reflected classes of different widths used by benchmarks. Fields are public
+// so that benchmarks can compare reflective access with direct access.
+
+class BenchWidth4 {
+ public:
+  USE_REFLECTION_CLASS();
+
+  int32_t f0_{0};
+  float f1_{1.0f};
+  double f2_{2.0};
+  std::string f3_{"three"};
+};
+
+class BenchWidth8 {
+ public:
+  USE_REFLECTION_CLASS();
+
+  int32_t f0_{0};
+  float f1_{1.0f};
+  double f2_{2.0};
+  std::string f3_{"three"};
+  int64_t f4_{4};
+  bool f5_{true};
+  glm::vec3 f6_{6.0f, 6.0f, 6.0f};
+  int32_t f7_{7};
+};
+
+class BenchWidth16 {
+ public:
+  USE_REFLECTION_CLASS();
+
+  int32_t f0_{0};
+  float f1_{1.0f};
+  double f2_{2.0};
+  std::string f3_{"three"};
+  int64_t f4_{4};
+  bool f5_{true};
+  glm::vec3 f6_{6.0f, 6.0f, 6.0f};
+  int32_t f7_{7};
+  int32_t f8_{8};
+  float f9_{9.0f};
+  double f10_{10.0};
+  std::string f11_{"eleven"};
+  int64_t f12_{12};
+  bool f13_{false};
+  glm::vec4 f14_{14.0f, 14.0f, 14.0f, 14.0f};
+  int32_t f15_{15};
+};
+
+class BenchContainers {
+ public:
+  USE_REFLECTION_CLASS();
+
+  std::vector<int32_t> vec_;
+  std::map<int32_t, int32_t> map_;
+  std::unordered_map<int32_t, int32_t> umap_;
+  std::set<int32_t> set_;
+  std::vector<BenchWidth4> objs_;
+  std::unique_ptr<BenchWidth4> uptr_;
+  std::shared_ptr<BenchWidth4> sptr_;
+};
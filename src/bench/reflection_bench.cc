@@ -0,0 +1,919 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+//
+// Overhead of each descriptor operation against direct C++ access. Every
+// reflective benchmark has a "Direct" counterpart with the same shape, so the
+// ratio of the two is the cost of reflection. Besides ns/op reported by
+// Google Benchmark, each benchmark reports heap allocations per iteration as
+// "allocs/op".
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "benchmark/benchmark.h"
+#include "src/bench/alloc_count.h"
+#include "src/bench/bench_types.h"
+#include "src/columnar.h"
+#include "src/data_generator.h"
+#include "src/field_index.h"
+#include "src/field_path.h"
+#include "src/footprint.h"
+#include "src/parallel_traversal.h"
+#include "src/replay_log.h"
+#include "src/row_filter.h"
+#include "src/snapshot_pipeline.h"
+
+namespace reflection {
+namespace {
+
+// Count allocations made during the measured loop, and report them as average
+// allocations per iteration.
+class AllocCounter {
+ public:
+  explicit AllocCounter(benchmark::State* state)
+      : state_(state), start_(GetAllocCount()) {}
+
+  ~AllocCounter() {
+    state_->counters["allocs/op"] =
+        benchmark::Counter(static_cast<double>(GetAllocCount() - start_),
+                           benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  benchmark::State* state_;
+  int64_t start_;
+};
+
+ClassDescriptor* ClassDesc(Descriptor* desc) {
+  return ClassDescriptor::ToClassDescriptor(desc);
+}
+
+ContainerDescriptor* FieldContainerDesc(const std::string& field) {
+  return ContainerDescriptor::ToContainerDescriptor(
+      ClassDesc(DESC("BenchContainers"))->GetDescriptorByName(field));
+}
+
+void FillContainers(BenchContainers* obj, int32_t size) {
+  obj->vec_.clear();
+  obj->map_.clear();
+  obj->umap_.clear();
+  obj->set_.clear();
+  obj->objs_.clear();
+  for (int32_t i = 0; i < size; ++i) {
+    obj->vec_.push_back(i);
+    obj->map_[i] = i;
+    obj->umap_[i] = i;
+    obj->set_.insert(i);
+    obj->objs_.emplace_back();
+  }
+  obj->uptr_.reset(new BenchWidth4);
+  obj->sptr_ = std::make_shared<BenchWidth4>();
+}
+
+#define BENCH_CONTAINER_SIZES ->Arg(16)->Arg(1024)->Arg(65536)
+
+/* Factory */
+
+void BM_DirectDescriptorAccessor(benchmark::State& state) {
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(DescriptorAccessor<BenchWidth8>::Get());
+  }
+}
+BENCHMARK(BM_DirectDescriptorAccessor);
+
+void BM_FactoryDescriptorByName(benchmark::State& state) {
+  const std::string name = "BenchWidth8";
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(DESC(name));
+  }
+}
+BENCHMARK(BM_FactoryDescriptorByName);
+
+void BM_FactoryDescriptorByRtti(benchmark::State& state) {
+  BenchWidth8 obj;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(DESC_BY_BASE_PTR(&obj));
+  }
+}
+BENCHMARK(BM_FactoryDescriptorByRtti);
+
+void BM_DirectNew(benchmark::State& state) {
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    auto* obj = new BenchWidth8;
+    benchmark::DoNotOptimize(obj);
+    delete obj;
+  }
+}
+BENCHMARK(BM_DirectNew);
+
+void BM_FactoryNewByName(benchmark::State& state) {
+  const std::string name = "BenchWidth8";
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    auto* obj = static_cast<BenchWidth8*>(NEW_CLASS_PTR(name));
+    benchmark::DoNotOptimize(obj);
+    delete obj;
+  }
+}
+BENCHMARK(BM_FactoryNewByName);
+
+/* Names */
+
+void BM_TypeNameView(benchmark::State& state) {
+  auto* desc = FieldContainerDesc("map_");
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->GetTypeNameView().data());
+  }
+}
+BENCHMARK(BM_TypeNameView);
+
+void BM_TypeNameString(benchmark::State& state) {
+  auto* desc = FieldContainerDesc("map_");
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->GetTypeName());
+  }
+}
+BENCHMARK(BM_TypeNameString);
+
+/* Field access */
+
+template <typename T>
+void BM_DirectFieldAccess(benchmark::State& state) {
+  T obj;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&obj.f0_);
+    benchmark::DoNotOptimize(&obj.f3_);
+  }
+}
+BENCHMARK_TEMPLATE(BM_DirectFieldAccess, BenchWidth4);
+BENCHMARK_TEMPLATE(BM_DirectFieldAccess, BenchWidth16);
+
+// Touch every field once per iteration.
+template <typename T>
+void BM_FieldById(benchmark::State& state) {
+  T obj;
+  auto* desc = ClassDesc(DescriptorAccessor<T>::Get());
+  int32_t size = desc->GetFieldSize();
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    for (int32_t i = 0; i < size; ++i) {
+      benchmark::DoNotOptimize(desc->MutableFieldValueById(&obj, i));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK_TEMPLATE(BM_FieldById, BenchWidth4);
+BENCHMARK_TEMPLATE(BM_FieldById, BenchWidth8);
+BENCHMARK_TEMPLATE(BM_FieldById, BenchWidth16);
+
+template <typename T>
+void BM_ConstFieldById(benchmark::State& state) {
+  const T obj;
+  const auto* desc = ClassDesc(DescriptorAccessor<T>::Get());
+  int32_t size = desc->GetFieldSize();
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    for (int32_t i = 0; i < size; ++i) {
+      benchmark::DoNotOptimize(desc->GetFieldValueById(&obj, i));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK_TEMPLATE(BM_ConstFieldById, BenchWidth4);
+BENCHMARK_TEMPLATE(BM_ConstFieldById, BenchWidth16);
+
+template <typename T>
+void BM_TypedFieldById(benchmark::State& state) {
+  const T obj;
+  const auto* desc = ClassDesc(DescriptorAccessor<T>::Get());
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->template GetField<int32_t>(&obj, 0));
+    benchmark::DoNotOptimize(desc->template GetField<std::string>(&obj, 3));
+  }
+}
+BENCHMARK_TEMPLATE(BM_TypedFieldById, BenchWidth4);
+BENCHMARK_TEMPLATE(BM_TypedFieldById, BenchWidth16);
+
+template <typename T>
+void BM_UncheckedFieldById(benchmark::State& state) {
+  const T obj;
+  const auto* desc = ClassDesc(DescriptorAccessor<T>::Get());
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        desc->template GetField<int32_t>(&obj, 0, kUnchecked));
+    benchmark::DoNotOptimize(
+        desc->template GetField<std::string>(&obj, 3, kUnchecked));
+  }
+}
+BENCHMARK_TEMPLATE(BM_UncheckedFieldById, BenchWidth4);
+BENCHMARK_TEMPLATE(BM_UncheckedFieldById, BenchWidth16);
+
+// Look up the last field, which is the worst case of a linear name search.
+template <typename T>
+void BM_FieldByName(benchmark::State& state) {
+  T obj;
+  auto* desc = ClassDesc(DescriptorAccessor<T>::Get());
+  const std::string name = desc->GetFieldName(desc->GetFieldSize() - 1);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->MutableFieldValueByName(&obj, name));
+  }
+}
+BENCHMARK_TEMPLATE(BM_FieldByName, BenchWidth4);
+BENCHMARK_TEMPLATE(BM_FieldByName, BenchWidth8);
+BENCHMARK_TEMPLATE(BM_FieldByName, BenchWidth16);
+
+/* Container element access */
+
+void BM_DirectVectorIndex(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  int32_t size = state.range(0);
+  int32_t i = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&obj.vec_[i]);
+    if (++i == size) i = 0;
+  }
+}
+BENCHMARK(BM_DirectVectorIndex) BENCH_CONTAINER_SIZES;
+
+void BM_VectorIndex(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  auto* desc = FieldContainerDesc("vec_");
+  int32_t size = state.range(0);
+  int32_t i = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->GetValueByIndex(&obj.vec_, i));
+    if (++i == size) i = 0;
+  }
+}
+BENCHMARK(BM_VectorIndex) BENCH_CONTAINER_SIZES;
+
+void BM_DirectMapFind(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  int32_t size = state.range(0);
+  int32_t key = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&obj.map_.find(key)->second);
+    if (++key == size) key = 0;
+  }
+}
+BENCHMARK(BM_DirectMapFind) BENCH_CONTAINER_SIZES;
+
+void BM_MapValueByKey(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  auto* desc = FieldContainerDesc("map_");
+  int32_t size = state.range(0);
+  int32_t key = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->GetValueByKey(&obj.map_, &key));
+    if (++key == size) key = 0;
+  }
+}
+BENCHMARK(BM_MapValueByKey) BENCH_CONTAINER_SIZES;
+
+void BM_DirectUnorderedMapFind(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  int32_t size = state.range(0);
+  int32_t key = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&obj.umap_.find(key)->second);
+    if (++key == size) key = 0;
+  }
+}
+BENCHMARK(BM_DirectUnorderedMapFind) BENCH_CONTAINER_SIZES;
+
+void BM_UnorderedMapValueByKey(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  auto* desc = FieldContainerDesc("umap_");
+  int32_t size = state.range(0);
+  int32_t key = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->GetValueByKey(&obj.umap_, &key));
+    if (++key == size) key = 0;
+  }
+}
+BENCHMARK(BM_UnorderedMapValueByKey) BENCH_CONTAINER_SIZES;
+
+void BM_SetHasValue(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  auto* desc = FieldContainerDesc("set_");
+  int32_t size = state.range(0);
+  int32_t val = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(desc->HasKeyOrValue(&obj.set_, &val));
+    if (++val == size) val = 0;
+  }
+}
+BENCHMARK(BM_SetHasValue) BENCH_CONTAINER_SIZES;
+
+/* Iteration */
+
+void BM_DirectVectorIterate(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const auto& val : obj.vec_) sum += val;
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DirectVectorIterate) BENCH_CONTAINER_SIZES;
+
+void BM_VectorIterate(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  auto* desc = FieldContainerDesc("vec_");
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    int64_t sum = 0;
+    int32_t size = desc->GetContainerSize(&obj.vec_);
+    for (int32_t i = 0; i < size; ++i) {
+      sum += *static_cast<const int32_t*>(desc->GetValueByIndex(&obj.vec_, i));
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_VectorIterate) BENCH_CONTAINER_SIZES;
+
+void BM_DirectMapIterate(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const auto& pair : obj.map_) sum += pair.second;
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DirectMapIterate) BENCH_CONTAINER_SIZES;
+
+void BM_MapIterate(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  auto* desc = FieldContainerDesc("map_");
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const void* key : desc->GetContainerKeys(&obj.map_)) {
+      sum += *static_cast<const int32_t*>(desc->GetValueByKey(&obj.map_, key));
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MapIterate) BENCH_CONTAINER_SIZES;
+
+// Iterate over reflected elements and read a field of each one.
+void BM_ClassVectorIterate(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, state.range(0));
+  auto* desc = FieldContainerDesc("objs_");
+  auto* elem_desc = ClassDesc(desc->GetValueDescriptor());
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    int64_t sum = 0;
+    int32_t size = desc->GetContainerSize(&obj.objs_);
+    for (int32_t i = 0; i < size; ++i) {
+      const void* elem = desc->GetValueByIndex(&obj.objs_, i);
+      sum += *elem_desc->GetField<int32_t>(elem, 0);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ClassVectorIterate) BENCH_CONTAINER_SIZES;
+
+/* Insertion */
+
+void BM_DirectVectorPushBack(benchmark::State& state) {
+  std::vector<int32_t> vec;
+  int32_t size = state.range(0);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    vec.clear();
+    for (int32_t i = 0; i < size; ++i) vec.push_back(i);
+    benchmark::DoNotOptimize(vec.data());
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_DirectVectorPushBack) BENCH_CONTAINER_SIZES;
+
+void BM_VectorAddValue(benchmark::State& state) {
+  std::vector<int32_t> vec;
+  auto* desc = FieldContainerDesc("vec_");
+  int32_t size = state.range(0);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    desc->Clear(&vec);
+    for (int32_t i = 0; i < size; ++i) desc->AddValue(&vec, &i);
+    benchmark::DoNotOptimize(vec.data());
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_VectorAddValue) BENCH_CONTAINER_SIZES;
+
+void BM_VectorAddValues(benchmark::State& state) {
+  std::vector<int32_t> source(state.range(0), 1);
+  std::vector<int32_t> vec;
+  auto* desc = FieldContainerDesc("vec_");
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    std::vector<int32_t>().swap(vec);
+    desc->AddValues(&vec, source.data(), source.size());
+    benchmark::DoNotOptimize(vec.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_VectorAddValues) BENCH_CONTAINER_SIZES;
+
+void BM_ClassVectorEmplaceDefault(benchmark::State& state) {
+  std::vector<BenchWidth4> vec;
+  auto* desc = FieldContainerDesc("objs_");
+  int32_t size = state.range(0);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    std::vector<BenchWidth4>().swap(vec);
+    desc->Reserve(&vec, size);
+    for (int32_t i = 0; i < size; ++i) {
+      benchmark::DoNotOptimize(desc->EmplaceDefault(&vec));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_ClassVectorEmplaceDefault) BENCH_CONTAINER_SIZES;
+
+void BM_DirectMapInsert(benchmark::State& state) {
+  std::map<int32_t, int32_t> map;
+  int32_t size = state.range(0);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    map.clear();
+    for (int32_t i = 0; i < size; ++i) map.insert({i, i});
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_DirectMapInsert) BENCH_CONTAINER_SIZES;
+
+void BM_MapAddValue(benchmark::State& state) {
+  std::map<int32_t, int32_t> map;
+  auto* desc = FieldContainerDesc("map_");
+  int32_t size = state.range(0);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    desc->Clear(&map);
+    for (int32_t i = 0; i < size; ++i) {
+      std::pair<int32_t, int32_t> pair{i, i};
+      desc->AddValue(&map, &pair);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_MapAddValue) BENCH_CONTAINER_SIZES;
+
+/* Smart pointers */
+
+void BM_DirectSmartPtrDeref(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 0);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(obj.uptr_.get());
+    benchmark::DoNotOptimize(obj.sptr_.get());
+  }
+}
+BENCHMARK(BM_DirectSmartPtrDeref);
+
+void BM_SmartPtrDeref(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 0);
+  auto* class_desc = ClassDesc(DESC("BenchContainers"));
+  auto* uptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(
+      class_desc->GetDescriptorByName("uptr_"));
+  auto* sptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(
+      class_desc->GetDescriptorByName("sptr_"));
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(uptr_desc->GetRawPtr(&obj.uptr_));
+    benchmark::DoNotOptimize(sptr_desc->GetRawPtr(&obj.sptr_));
+  }
+}
+BENCHMARK(BM_SmartPtrDeref);
+
+/* Fixed arrays */
+
+// Copy a float[16] matrix element by element through the descriptor.
+void BM_ArrayCopyByIndex(benchmark::State& state) {
+  float src[16] = {1.0f};
+  float dst[16];
+  auto* desc = ContainerDescriptor::ToContainerDescriptor(
+      DescriptorAccessor<float[16]>::Get());
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    int32_t size = desc->GetContainerSize(src);
+    for (int32_t i = 0; i < size; ++i) {
+      *static_cast<float*>(desc->MutableValueByIndex(dst, i)) =
+          *static_cast<const float*>(desc->GetValueByIndex(src, i));
+    }
+    benchmark::DoNotOptimize(dst);
+  }
+}
+BENCHMARK(BM_ArrayCopyByIndex);
+
+// Copy the same matrix as one contiguous span.
+void BM_ArrayCopyContiguous(benchmark::State& state) {
+  float src[16] = {1.0f};
+  float dst[16];
+  auto* desc = ContainerDescriptor::ToContainerDescriptor(
+      DescriptorAccessor<float[16]>::Get());
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    std::memcpy(desc->MutableContiguousData(dst), desc->GetContiguousData(src),
+                desc->GetFixedSize() * desc->GetValueDescriptor()->size_);
+    benchmark::DoNotOptimize(dst);
+  }
+}
+BENCHMARK(BM_ArrayCopyContiguous);
+
+/* Field paths */
+
+// Read objs_[3].f3_, then uptr_.f2_.
+void BM_DirectFieldPath(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 16);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&obj.objs_[3].f3_);
+    benchmark::DoNotOptimize(&obj.uptr_->f2_);
+  }
+}
+BENCHMARK(BM_DirectFieldPath);
+
+// Walk descriptors by name on every access, as hand-written code does.
+void BM_FieldPathByHand(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 16);
+  auto* class_desc = ClassDesc(DESC("BenchContainers"));
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    auto* objs_desc = ContainerDescriptor::ToContainerDescriptor(
+        class_desc->GetDescriptorByName("objs_"));
+    const void* elem = objs_desc->GetValueByIndex(
+        class_desc->GetFieldValueByName(&obj, "objs_"), 3);
+    benchmark::DoNotOptimize(
+        ClassDesc(objs_desc->GetValueDescriptor())
+            ->GetFieldValueByName(elem, "f3_"));
+    auto* uptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(
+        class_desc->GetDescriptorByName("uptr_"));
+    const void* content =
+        uptr_desc->GetRawPtr(class_desc->GetFieldValueByName(&obj, "uptr_"));
+    benchmark::DoNotOptimize(
+        ClassDesc(uptr_desc->GetContentDescriptor())
+            ->GetFieldValueByName(content, "f2_"));
+  }
+}
+BENCHMARK(BM_FieldPathByHand);
+
+void BM_FieldPathCompiled(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 16);
+  auto* desc = DESC("BenchContainers");
+  auto elem_path = FieldPath::Compile(desc, "objs_[3].f3_");
+  auto ptr_path = FieldPath::Compile(desc, "uptr_.f2_");
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(elem_path->Get(&obj));
+    benchmark::DoNotOptimize(ptr_path->Get(&obj));
+  }
+}
+BENCHMARK(BM_FieldPathCompiled);
+
+// Resolve string paths through the cache on every access.
+void BM_FieldPathCached(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 16);
+  auto* desc = DESC("BenchContainers");
+  FieldPathCache cache;
+  const std::string elem_path = "objs_[3].f3_";
+  const std::string ptr_path = "uptr_.f2_";
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cache.Get(desc, elem_path)->Get(&obj));
+    benchmark::DoNotOptimize(cache.Get(desc, ptr_path)->Get(&obj));
+  }
+}
+BENCHMARK(BM_FieldPathCached);
+
+/* Parallel traversal */
+
+// Sum a field of 1M reflected elements. Argument is the number of threads.
+void BM_ParallelReduce(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 1 << 20);
+  auto* desc = FieldContainerDesc("objs_");
+  auto* elem_desc = ClassDesc(desc->GetValueDescriptor());
+  WorkStealingPool pool(state.range(0));
+  ContainerChunks chunks(&obj.objs_, desc, 4096);
+  for (auto _ : state) {
+    int64_t sum = ParallelReduce<int64_t>(
+        &pool, chunks, 0,
+        [elem_desc](int64_t* partial, const void* key, const void* value) {
+          *partial += *elem_desc->GetField<int32_t>(value, 0);
+        },
+        [](int64_t* total, const int64_t& partial) { *total += partial; });
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * obj.objs_.size());
+}
+BENCHMARK(BM_ParallelReduce)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+
+/* Synthetic data */
+
+// Generate 16K objects with 8 elements per container on average. Argument is
+// the number of threads.
+void BM_Generate(benchmark::State& state) {
+  GeneratorOptions options;
+  options.container_size = {SizeDistribution::Shape::kUniform, 0, 16, 0};
+  DataGenerator generator(options);
+  WorkStealingPool pool(state.range(0));
+  std::vector<BenchContainers> objs;
+  for (auto _ : state) {
+    generator.Generate(&pool, 16384, &objs);
+    benchmark::DoNotOptimize(objs.data());
+  }
+  state.SetItemsProcessed(state.iterations() * objs.size());
+}
+BENCHMARK(BM_Generate)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+/* Footprint */
+
+// Argument is the sample threshold, 0 walks every element.
+void BM_DeepSizeOf(benchmark::State& state) {
+  BenchContainers obj;
+  FillContainers(&obj, 65536);
+  auto* desc = DESC("BenchContainers");
+  FootprintOptions options;
+  options.sample_threshold = state.range(0);
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(DeepSizeOf(&obj, desc, options));
+  }
+}
+BENCHMARK(BM_DeepSizeOf)->Arg(0)->Arg(1024);
+
+/* Columnar */
+
+// Export 64K rows with 14 fixed-width and 2 string columns.
+void BM_ColumnarWrite(benchmark::State& state) {
+  std::vector<BenchWidth16> rows(65536);
+  ColumnarWriter writer(ClassDesc(DESC("BenchWidth16")));
+  for (auto _ : state) {
+    std::stringstream stream;
+    writer.Write(rows, &stream);
+    benchmark::DoNotOptimize(stream);
+  }
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+BENCHMARK(BM_ColumnarWrite);
+
+// Read back all columns when argument is 0, or only f4_ otherwise.
+void BM_ColumnarRead(benchmark::State& state) {
+  std::vector<BenchWidth16> rows(65536);
+  std::stringstream stream;
+  ColumnarWriter(ClassDesc(DESC("BenchWidth16"))).Write(rows, &stream);
+  ColumnarReader reader(&stream);
+  std::vector<std::string> projection;
+  if (state.range(0) != 0) projection.push_back("f4_");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(reader.ReadRows(&rows, projection));
+  }
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+BENCHMARK(BM_ColumnarRead)->Arg(0)->Arg(1);
+
+/* Sort and index */
+
+// Rows with random f0_ and f3_, from 16K distinct values.
+std::vector<BenchWidth8> MakeSortRows() {
+  std::vector<BenchWidth8> rows(65536);
+  uint32_t seed = 1;
+  for (auto& row : rows) {
+    seed = seed * 1664525 + 1013904223;
+    row.f0_ = seed >> 18;
+    row.f3_ = std::to_string(row.f0_);
+  }
+  return rows;
+}
+
+// Sort by f0_ when argument is 0, or f3_ otherwise, with a comparator looking
+// fields up by name on every comparison.
+void BM_SortByFieldName(benchmark::State& state) {
+  const std::vector<BenchWidth8> input = MakeSortRows();
+  auto* desc = ClassDesc(DESC("BenchWidth8"));
+  const std::string field = state.range(0) == 0 ? "f0_" : "f3_";
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<BenchWidth8> rows = input;
+    state.ResumeTiming();
+    if (state.range(0) == 0) {
+      std::stable_sort(rows.begin(), rows.end(),
+                       [&](const BenchWidth8& lhs, const BenchWidth8& rhs) {
+                         return *static_cast<const int32_t*>(
+                                    desc->GetFieldValueByName(&lhs, field)) <
+                                *static_cast<const int32_t*>(
+                                    desc->GetFieldValueByName(&rhs, field));
+                       });
+    } else {
+      std::stable_sort(rows.begin(), rows.end(),
+                       [&](const BenchWidth8& lhs, const BenchWidth8& rhs) {
+                         return *static_cast<const std::string*>(
+                                    desc->GetFieldValueByName(&lhs, field)) <
+                                *static_cast<const std::string*>(
+                                    desc->GetFieldValueByName(&rhs, field));
+                       });
+    }
+    benchmark::DoNotOptimize(rows.data());
+  }
+  state.SetItemsProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_SortByFieldName)->Arg(0)->Arg(1);
+
+// Same sorts over a key column extracted first.
+void BM_SortByField(benchmark::State& state) {
+  const std::vector<BenchWidth8> input = MakeSortRows();
+  const std::string field = state.range(0) == 0 ? "f0_" : "f3_";
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<BenchWidth8> rows = input;
+    state.ResumeTiming();
+    SortByField(&rows, field);
+    benchmark::DoNotOptimize(rows.data());
+  }
+  state.SetItemsProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_SortByField)->Arg(0)->Arg(1);
+
+// Find rows of a f0_ value by scanning with name lookups.
+void BM_FieldScanByName(benchmark::State& state) {
+  const std::vector<BenchWidth8> rows = MakeSortRows();
+  auto* desc = ClassDesc(DESC("BenchWidth8"));
+  const std::string field = "f0_";
+  int32_t key = 0;
+  for (auto _ : state) {
+    size_t found = 0;
+    for (const auto& row : rows) {
+      found += *static_cast<const int32_t*>(
+                   desc->GetFieldValueByName(&row, field)) == key;
+    }
+    benchmark::DoNotOptimize(found);
+    key = (key + 1) & 16383;
+  }
+}
+BENCHMARK(BM_FieldScanByName);
+
+// Find rows of a f0_ value in a sorted index when argument is 0, or a hash
+// index otherwise.
+void BM_FieldIndexFind(benchmark::State& state) {
+  const std::vector<BenchWidth8> rows = MakeSortRows();
+  auto index = FieldIndex::Build(
+      rows, "f0_", state.range(0) == 0 ? IndexKind::kSorted : IndexKind::kHash);
+  int32_t key = 0;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index->Find(key).size());
+    key = (key + 1) & 16383;
+  }
+}
+BENCHMARK(BM_FieldIndexFind)->Arg(0)->Arg(1);
+
+/* Filters */
+
+// Select rows with f0_ < 4096 and f2_ > 1.5, about a quarter of rows, looking
+// fields up by name on every row.
+void BM_FilterByName(benchmark::State& state) {
+  const std::vector<BenchWidth8> rows = MakeSortRows();
+  auto* desc = ClassDesc(DESC("BenchWidth8"));
+  const std::string f0 = "f0_", f2 = "f2_";
+  std::vector<uint32_t> ids;
+  for (auto _ : state) {
+    ids.clear();
+    for (size_t i = 0; i < rows.size(); ++i) {
+      if (*static_cast<const int32_t*>(
+              desc->GetFieldValueByName(&rows[i], f0)) < 4096 &&
+          *static_cast<const double*>(
+              desc->GetFieldValueByName(&rows[i], f2)) > 1.5) {
+        ids.push_back(i);
+      }
+    }
+    benchmark::DoNotOptimize(ids.data());
+  }
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+BENCHMARK(BM_FilterByName);
+
+// Same selection by a compiled filter.
+void BM_RowFilterSelect(benchmark::State& state) {
+  const std::vector<BenchWidth8> rows = MakeSortRows();
+  auto filter =
+      RowFilter::Compile(DESC("BenchWidth8"), "f0_ < 4096 && f2_ > 1.5");
+  std::vector<uint32_t> ids;
+  for (auto _ : state) {
+    ids.clear();
+    filter->Select(rows, &ids);
+    benchmark::DoNotOptimize(ids.data());
+  }
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+BENCHMARK(BM_RowFilterSelect);
+
+/* Snapshots */
+
+// Copy 16 fields, 14 of them in memcpy runs, into a reused buffer.
+void BM_TakeSnapshot(benchmark::State& state) {
+  BenchWidth16 obj;
+  auto* desc = DESC("BenchWidth16");
+  Snapshot snapshot;
+  AllocCounter counter(&state);
+  for (auto _ : state) {
+    TakeSnapshot(&obj, desc, &snapshot);
+    benchmark::DoNotOptimize(snapshot.data.data());
+  }
+}
+BENCHMARK(BM_TakeSnapshot);
+
+// Cost paid by the caller of a pipeline encoding JSON in background.
+void BM_PipelineSubmit(benchmark::State& state) {
+  BenchWidth16 obj;
+  auto* desc = DESC("BenchWidth16");
+  PipelineOptions options;
+  options.encoding = SnapshotEncoding::kJson;
+  SnapshotPipeline pipeline([](const std::string&) { return true; }, options);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(pipeline.Submit(&obj, desc));
+  }
+  pipeline.Flush();
+  state.counters["dropped"] = pipeline.GetStats().dropped;
+}
+BENCHMARK(BM_PipelineSubmit);
+
+/* Replay log */
+
+// Record 256 slowly changing objects per frame, a keyframe every 100 frames,
+// against binary snapshots of the same frame.
+void BM_ReplayLogAppend(benchmark::State& state) {
+  BenchContainers obj;
+  obj.objs_.resize(256);
+  auto* desc = DESC("BenchContainers");
+  std::stringstream out;
+  ReplayLogWriter writer(desc, &out);
+  for (auto _ : state) {
+    for (auto& row : obj.objs_) {
+      row.f0_ += 1;
+      row.f1_ += 0.01f;
+      row.f2_ += 0.001;
+    }
+    writer.Append(&obj);
+    // Drop recorded bytes from time to time, the writer only counts them.
+    if (writer.GetFrameSize() % 4096 == 0) out.str(std::string());
+  }
+  Snapshot snapshot;
+  std::string binary;
+  TakeSnapshot(&obj, desc, &snapshot);
+  EncodeSnapshotBinary(snapshot, &binary);
+  state.counters["bytes_per_frame"] =
+      static_cast<double>(writer.GetOffset()) / writer.GetFrameSize();
+  state.counters["snapshot_bytes"] = binary.size();
+}
+BENCHMARK(BM_ReplayLogAppend);
+
+}  // namespace
+}  // namespace reflection
+
+BENCHMARK_MAIN();
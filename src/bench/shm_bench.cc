@@ -0,0 +1,227 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+//
+// Latency of handing a frame of reflected objects to another process, through
+// a shared segment against a snapshot sent over a pipe. A child process is
+// forked once. Every round the parent publishes a frame both ways and the
+// child reports when it has read a scalar and a string field of every object:
+// for the segment, in place; for the pipe, after receiving all snapshot bytes
+// and restoring them into a frame reused across rounds. Times are measured
+// from the start of publishing, on the monotonic clock shared by both
+// processes. Which way goes first alternates between rounds, so that neither
+// always finds caches warmed by the other.
+//
+// The segment is created once and reset every round, like a producer would
+// reuse it. A fresh segment costs page faults on first touch, reported
+// separately as "first round".
+//
+// Usage: shm_bench [object count] [rounds]
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "src/bench/bench_types.h"
+#include "src/shared_segment.h"
+#include "src/snapshot.h"
+
+class ShmBenchFrame {
+ public:
+  USE_REFLECTION_CLASS();
+  int64_t sequence_{0};
+  std::vector<BenchWidth8> objs_;
+};
+
+ADD_REFLECTION_CLASS_MEMBER(ShmBenchFrame, sequence_, objs_);
+
+REGISTER(ShmBenchFrame, ShmBenchFrame)
+
+namespace {
+
+const char kSegmentName[] = "/reflection_shm_bench";
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool ReadAll(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = read(fd, bytes, size);
+    if (n <= 0) return false;
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, bytes, size);
+    if (n <= 0) return false;
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Messages from parent to child.
+enum Command : char { kReadSegment = 's', kReadPipe = 'p', kExit = 'x' };
+
+struct ChildReport {
+  int64_t done_ns;
+  int64_t checksum;
+};
+
+int64_t ReadSegment(const reflection::SharedSegment& segment,
+                    reflection::ClassDescriptor* desc) {
+  reflection::RelocatableView frame = segment.GetRoot(desc);
+  reflection::RelocatableView objs = frame.GetField("objs_");
+  auto* obj_desc = TO_CLASS_DESC(DESC("BenchWidth8"));
+  int32_t f0_id = obj_desc->GetFieldId("f0_");
+  int32_t f3_id = obj_desc->GetFieldId("f3_");
+  int64_t checksum = 0;
+  size_t size = objs.GetSize();
+  for (size_t i = 0; i < size; ++i) {
+    reflection::RelocatableView obj = objs.GetElement(i);
+    checksum += *obj.GetField(f0_id).As<int32_t>();
+    checksum += obj.GetField(f3_id).GetString().size();
+  }
+  return checksum;
+}
+
+int64_t ReadFrame(const ShmBenchFrame& frame) {
+  int64_t checksum = 0;
+  for (const auto& obj : frame.objs_) {
+    checksum += obj.f0_;
+    checksum += obj.f3_.size();
+  }
+  return checksum;
+}
+
+void ChildLoop(int command_fd, int data_fd, int report_fd) {
+  auto* desc = TO_CLASS_DESC(DESC("ShmBenchFrame"));
+  std::unique_ptr<reflection::SharedSegment> segment;
+  reflection::Snapshot snapshot;
+  snapshot.desc = desc;
+  ShmBenchFrame frame;
+  char command;
+  while (ReadAll(command_fd, &command, 1) && command != kExit) {
+    ChildReport report{0, 0};
+    if (command == kReadSegment) {
+      if (segment == nullptr) {
+        segment = reflection::SharedSegment::Open(kSegmentName);
+      }
+      report.checksum = segment == nullptr ? -1 : ReadSegment(*segment, desc);
+    } else {
+      uint64_t size;
+      ReadAll(data_fd, &size, sizeof(size));
+      snapshot.data.resize(size);
+      ReadAll(data_fd, &snapshot.data[0], size);
+      report.checksum = reflection::RestoreSnapshot(snapshot, &frame)
+                            ? ReadFrame(frame)
+                            : -1;
+    }
+    report.done_ns = NowNanos();
+    WriteAll(report_fd, &report, sizeof(report));
+  }
+}
+
+int64_t Median(std::vector<int64_t> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t object_size = argc > 1 ? std::atoll(argv[1]) : 10000;
+  int rounds = argc > 2 ? std::atoi(argv[2]) : 20;
+  if (rounds < 1) {
+    std::cerr << "rounds must be at least 1\n";
+    return 1;
+  }
+  ShmBenchFrame frame;
+  frame.objs_.resize(object_size);
+  for (size_t i = 0; i < object_size; ++i) frame.objs_[i].f0_ = i;
+
+  int command_pipe[2], data_pipe[2], report_pipe[2];
+  if (pipe(command_pipe) != 0 || pipe(data_pipe) != 0 ||
+      pipe(report_pipe) != 0) {
+    std::cerr << "pipe failed\n";
+    return 1;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    ChildLoop(command_pipe[0], data_pipe[0], report_pipe[1]);
+    _exit(0);
+  }
+
+  auto* desc = DESC("ShmBenchFrame");
+  int64_t start = NowNanos();
+  auto segment = reflection::SharedSegment::Create(kSegmentName, 256ull << 20);
+  if (segment == nullptr) {
+    std::cerr << "segment creation failed\n";
+    return 1;
+  }
+  std::vector<int64_t> segment_write, segment_total, snapshot_write,
+      pipe_total;
+  int64_t first_write = 0;
+  int64_t expected = ReadFrame(frame);
+  reflection::Snapshot snapshot;
+  for (int round = 0; round < rounds; ++round) {
+    frame.sequence_ = round;
+    for (int turn = 0; turn < 2; ++turn) {
+      ChildReport report;
+      if ((round + turn) % 2 == 0) {
+        if (round > 0 || turn > 0) start = NowNanos();
+        segment->Reset();
+        uint64_t offset = segment->Write(&frame, desc);
+        segment->SetRoot(offset, TO_CLASS_DESC(desc));
+        segment_write.push_back(NowNanos() - start);
+        if (round == 0) first_write = segment_write.back();
+        char command = kReadSegment;
+        WriteAll(command_pipe[1], &command, 1);
+        ReadAll(report_pipe[0], &report, sizeof(report));
+        segment_total.push_back(report.done_ns - start);
+      } else {
+        start = NowNanos();
+        reflection::TakeSnapshot(&frame, desc, &snapshot);
+        snapshot_write.push_back(NowNanos() - start);
+        char command = kReadPipe;
+        WriteAll(command_pipe[1], &command, 1);
+        uint64_t size = snapshot.data.size();
+        WriteAll(data_pipe[1], &size, sizeof(size));
+        WriteAll(data_pipe[1], snapshot.data.data(), size);
+        ReadAll(report_pipe[0], &report, sizeof(report));
+        pipe_total.push_back(report.done_ns - start);
+      }
+      if (report.checksum != expected) {
+        std::cerr << "child read a wrong frame\n";
+        return 1;
+      }
+    }
+  }
+  char command = kExit;
+  WriteAll(command_pipe[1], &command, 1);
+  waitpid(pid, nullptr, 0);
+  reflection::SharedSegment::Unlink(kSegmentName);
+
+  std::cout << "objects=" << object_size << " rounds=" << rounds << "\n"
+            << "segment: bytes=" << segment->GetUsedSize()
+            << " first_round_write=" << first_write / 1000
+            << "us write_p50=" << Median(segment_write) / 1000
+            << "us total_p50=" << Median(segment_total) / 1000 << "us\n"
+            << "snapshot+pipe: bytes=" << snapshot.data.size()
+            << " snapshot_p50=" << Median(snapshot_write) / 1000
+            << "us total_p50=" << Median(pipe_total) / 1000 << "us\n";
+  return 0;
+}
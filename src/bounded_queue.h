@@ -0,0 +1,119 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace reflection {
+
+/**
+ * Bounded lock-free queue for any number of producers and consumers. Every
+ * slot carries a sequence number telling whether it is free for the push of
+ * a given round or holds a value for the pop of that round, so pushes and pops
+ * only contend on their own index. Capacity is rounded up to a power of two.
+ *
+ * Usage:
+ *   BoundedQueue<Item*> queue(1024);
+ *   if (!queue.TryPush(item)) Drop(item);  // producer
+ *   Item* item;
+ *   while (queue.TryPop(&item)) Handle(item);  // consumer
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+    for (size_t i = 0; i < size; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  size_t GetCapacity() const { return mask_ + 1; }
+
+  // Push |value| unless queue is full. Return whether it is pushed, in which
+  // case |value| is moved from.
+  bool TryPush(T&& value) {
+    size_t pos = push_pos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (push_pos_.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = push_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = std::move(value);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPush(const T& value) {
+    T copy = value;
+    return TryPush(std::move(copy));
+  }
+
+  // Pop the oldest value into |value|. Return false if queue is empty.
+  bool TryPop(T* value) {
+    size_t pos = pop_pos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (pop_pos_.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = pop_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    *value = std::move(slot->value);
+    slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Get number of values queued. Only a hint while others push or pop.
+  size_t GetSizeHint() const {
+    size_t push_pos = push_pos_.load(std::memory_order_relaxed);
+    size_t pop_pos = pop_pos_.load(std::memory_order_relaxed);
+    return push_pos > pop_pos ? push_pos - pop_pos : 0;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // Keep indices of producers and consumers on separate cache lines.
+  alignas(64) std::atomic<size_t> push_pos_{0};
+  alignas(64) std::atomic<size_t> pop_pos_{0};
+  alignas(64) size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+};
+
+}  // namespace reflection
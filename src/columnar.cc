@@ -0,0 +1,539 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/columnar.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include "src/copy_plan.h"
+
+namespace reflection {
+
+namespace {
+
+const char kMagic[4] = {'S', 'S', 'R', 'C'};
+const uint32_t kVersion = 2;
+// Rows gathered or scattered per batch, bounding buffer size for wide columns.
+const size_t kBatchRows = 4096;
+// Footer offset and magic at end of file.
+const size_t kTrailerSize = sizeof(uint64_t) + sizeof(kMagic);
+
+template <typename Word>
+void GatherWords(const char* src, size_t stride, size_t count, char* dst) {
+  for (size_t i = 0; i < count; ++i) {
+    std::memcpy(dst + i * sizeof(Word), src + i * stride, sizeof(Word));
+  }
+}
+
+template <typename Word>
+void ScatterWords(const char* src, size_t count, size_t stride, char* dst) {
+  for (size_t i = 0; i < count; ++i) {
+    std::memcpy(dst + i * stride, src + i * sizeof(Word), sizeof(Word));
+  }
+}
+
+void AppendColumns(const ClassDescriptor* desc, const std::string& prefix,
+                   size_t base_offset, std::vector<ColumnSchema>* columns) {
+  for (int32_t i = 0; i < desc->GetFieldSize(); ++i) {
+    if (desc->HasFieldFlag(i, kMemberTransient)) continue;
+    Descriptor* field_desc = desc->GetDescriptorById(i);
+    ColumnSchema column;
+    column.name = prefix + desc->GetFieldName(i);
+    column.offset = base_offset + desc->GetFieldOffset(i);
+
+    auto* class_desc = ClassDescriptor::ToClassDescriptor(field_desc);
+    if (class_desc != nullptr) {
+      AppendColumns(class_desc, column.name + ".", column.offset, columns);
+      continue;
+    }
+    // Fixed arrays holding transient members would export them.
+    if ((field_desc->IsByteCopyable() && !HasTransientBytes(field_desc)) ||
+        field_desc->GetPrimitiveType() == PrimitiveType::kString) {
+      column.type_name = field_desc->GetTypeName();
+      column.primitive_type = field_desc->GetPrimitiveType();
+      if (column.primitive_type == PrimitiveType::kString) {
+        column.encoding = ColumnEncoding::kDictionary;
+      } else {
+        column.width = static_cast<uint32_t>(field_desc->size_);
+      }
+      columns->push_back(std::move(column));
+    }
+  }
+}
+
+// Appends native-order integers and length-prefixed strings to a stream,
+// counting written bytes.
+class BinaryWriter {
+ public:
+  explicit BinaryWriter(std::ostream* out) : out_(out) {}
+
+  void Write(const void* data, size_t size) {
+    out_->write(static_cast<const char*>(data), size);
+    offset_ += size;
+  }
+
+  template <typename T>
+  void WriteInt(T value) {
+    Write(&value, sizeof(T));
+  }
+
+  void WriteString(const std::string& str) {
+    WriteInt(static_cast<uint32_t>(str.size()));
+    Write(str.data(), str.size());
+  }
+
+  uint64_t GetOffset() const { return offset_; }
+
+  bool IsGood() const { return out_->good(); }
+
+ private:
+  std::ostream* out_;
+  uint64_t offset_{0};
+};
+
+// Reads what BinaryWriter writes from memory, failing past end.
+class BufferReader {
+ public:
+  BufferReader(const char* data, size_t size) : pos_(data), end_(data + size) {}
+
+  bool Read(void* data, size_t size) {
+    if (static_cast<size_t>(end_ - pos_) < size) return false;
+    std::memcpy(data, pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  template <typename T>
+  bool ReadInt(T* value) {
+    return Read(value, sizeof(T));
+  }
+
+  bool ReadString(std::string* str) {
+    uint32_t size = 0;
+    if (!ReadInt(&size) || static_cast<size_t>(end_ - pos_) < size) {
+      return false;
+    }
+    str->assign(pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  bool IsEnd() const { return pos_ == end_; }
+
+  size_t GetRemaining() const { return end_ - pos_; }
+
+ private:
+  const char* pos_;
+  const char* end_;
+};
+
+void WriteFixedColumn(const ColumnSchema& column, const char* rows,
+                      size_t row_count, size_t stride,
+                      std::vector<char>* buffer, BinaryWriter* writer) {
+  buffer->resize(std::min(row_count, kBatchRows) * column.width);
+  for (size_t begin = 0; begin < row_count; begin += kBatchRows) {
+    size_t count = std::min(kBatchRows, row_count - begin);
+    GatherStrided(rows + begin * stride + column.offset, stride, count,
+                  column.width, buffer->data());
+    writer->Write(buffer->data(), count * column.width);
+  }
+}
+
+void WriteDictionaryColumn(const ColumnSchema& column, const char* rows,
+                           size_t row_count, size_t stride,
+                           BinaryWriter* writer) {
+  std::unordered_map<std::string, uint32_t> ids;
+  std::vector<const std::string*> dictionary;
+  std::vector<uint32_t> row_ids(row_count);
+  for (size_t i = 0; i < row_count; ++i) {
+    const char* field = rows + i * stride + column.offset;
+    const auto& value = *reinterpret_cast<const std::string*>(field);
+    auto it = ids.find(value);
+    if (it == ids.end()) {
+      it = ids.emplace(value, static_cast<uint32_t>(dictionary.size())).first;
+      dictionary.push_back(&it->first);
+    }
+    row_ids[i] = it->second;
+  }
+  writer->WriteInt(static_cast<uint32_t>(dictionary.size()));
+  for (const auto* value : dictionary) writer->WriteString(*value);
+  writer->Write(row_ids.data(), row_ids.size() * sizeof(uint32_t));
+}
+
+bool IsSelected(const std::string& name, const std::string& entry) {
+  return name.compare(0, entry.size(), entry) == 0 &&
+         (name.size() == entry.size() || name[entry.size()] == '.');
+}
+
+}  // namespace
+
+/* Columnar functions */
+
+std::vector<ColumnSchema> GetColumnSchemas(const ClassDescriptor* desc) {
+  std::vector<ColumnSchema> columns;
+  if (desc != nullptr) AppendColumns(desc, "", 0, &columns);
+  return columns;
+}
+
+void GatherStrided(const void* src, size_t stride, size_t count, size_t width,
+                   void* dst) {
+  auto* src_bytes = static_cast<const char*>(src);
+  auto* dst_bytes = static_cast<char*>(dst);
+  switch (width) {
+    case 1:
+      return GatherWords<uint8_t>(src_bytes, stride, count, dst_bytes);
+    case 2:
+      return GatherWords<uint16_t>(src_bytes, stride, count, dst_bytes);
+    case 4:
+      return GatherWords<uint32_t>(src_bytes, stride, count, dst_bytes);
+    case 8:
+      return GatherWords<uint64_t>(src_bytes, stride, count, dst_bytes);
+    default:
+      for (size_t i = 0; i < count; ++i) {
+        std::memcpy(dst_bytes + i * width, src_bytes + i * stride, width);
+      }
+  }
+}
+
+void ScatterStrided(const void* src, size_t width, size_t count, size_t stride,
+                    void* dst) {
+  auto* src_bytes = static_cast<const char*>(src);
+  auto* dst_bytes = static_cast<char*>(dst);
+  switch (width) {
+    case 1:
+      return ScatterWords<uint8_t>(src_bytes, count, stride, dst_bytes);
+    case 2:
+      return ScatterWords<uint16_t>(src_bytes, count, stride, dst_bytes);
+    case 4:
+      return ScatterWords<uint32_t>(src_bytes, count, stride, dst_bytes);
+    case 8:
+      return ScatterWords<uint64_t>(src_bytes, count, stride, dst_bytes);
+    default:
+      for (size_t i = 0; i < count; ++i) {
+        std::memcpy(dst_bytes + i * stride, src_bytes + i * width, width);
+      }
+  }
+}
+
+/* ColumnarWriter methods */
+
+ColumnarWriter::ColumnarWriter(const ClassDescriptor* desc)
+    : desc_(desc), columns_(GetColumnSchemas(desc)) {}
+
+bool ColumnarWriter::Write(const void* rows, size_t row_count,
+                           std::ostream* out) {
+  error_.clear();
+  if (desc_ == nullptr) {
+    error_ = "not a reflected class";
+    return false;
+  }
+  if (rows == nullptr && row_count > 0) {
+    error_ = "no rows";
+    return false;
+  }
+  auto* row_bytes = static_cast<const char*>(rows);
+
+  BinaryWriter writer(out);
+  writer.Write(kMagic, sizeof(kMagic));
+  writer.WriteInt(kVersion);
+  std::vector<uint64_t> offsets;
+  for (const auto& column : columns_) {
+    offsets.push_back(writer.GetOffset());
+    if (column.encoding == ColumnEncoding::kFixed) {
+      WriteFixedColumn(column, row_bytes, row_count, desc_->size_, &buffer_,
+                       &writer);
+    } else {
+      WriteDictionaryColumn(column, row_bytes, row_count, desc_->size_,
+                            &writer);
+    }
+  }
+  offsets.push_back(writer.GetOffset());
+
+  uint64_t footer_offset = writer.GetOffset();
+  writer.WriteInt(static_cast<uint64_t>(row_count));
+  writer.WriteInt(desc_->GetFingerprint());
+  writer.WriteInt(static_cast<uint32_t>(columns_.size()));
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    const auto& column = columns_[i];
+    writer.WriteString(column.name);
+    writer.WriteString(column.type_name);
+    writer.WriteInt(static_cast<uint8_t>(column.encoding));
+    writer.WriteInt(static_cast<uint8_t>(column.primitive_type));
+    writer.WriteInt(column.width);
+    writer.WriteInt(static_cast<uint64_t>(column.offset));
+    writer.WriteInt(offsets[i]);
+    writer.WriteInt(offsets[i + 1] - offsets[i]);
+  }
+  writer.WriteInt(footer_offset);
+  writer.Write(kMagic, sizeof(kMagic));
+  if (!writer.IsGood()) {
+    error_ = "failed to write stream";
+    return false;
+  }
+  return true;
+}
+
+/* ColumnarReader methods */
+
+ColumnarReader::ColumnarReader(std::istream* in) : in_(in) {
+  valid_ = ReadFooter();
+}
+
+bool ColumnarReader::ReadFooter() {
+  if (in_ == nullptr) return Fail("no stream");
+  in_->seekg(0, std::ios::end);
+  auto end = in_->tellg();
+  if (end < 0) return Fail("stream is not seekable");
+  uint64_t file_size = static_cast<uint64_t>(end);
+  size_t header_size = sizeof(kMagic) + sizeof(kVersion);
+  if (file_size < header_size + kTrailerSize) return Fail("file too small");
+
+  char header[sizeof(kMagic) + sizeof(kVersion)];
+  in_->seekg(0);
+  in_->read(header, sizeof(header));
+  char trailer[kTrailerSize];
+  in_->seekg(file_size - kTrailerSize);
+  in_->read(trailer, sizeof(trailer));
+  if (!in_->good()) return Fail("failed to read stream");
+  uint32_t version = 0;
+  std::memcpy(&version, header + sizeof(kMagic), sizeof(version));
+  if (std::memcmp(header, kMagic, sizeof(kMagic)) != 0 ||
+      std::memcmp(trailer + sizeof(uint64_t), kMagic, sizeof(kMagic)) != 0) {
+    return Fail("not a columnar file");
+  }
+  if (version != kVersion) return Fail("unsupported version");
+
+  uint64_t footer_offset = 0;
+  std::memcpy(&footer_offset, trailer, sizeof(footer_offset));
+  if (footer_offset < header_size ||
+      footer_offset > file_size - kTrailerSize) {
+    return Fail("corrupted footer offset");
+  }
+  buffer_.resize(file_size - kTrailerSize - footer_offset);
+  in_->seekg(footer_offset);
+  in_->read(buffer_.data(), buffer_.size());
+  if (!in_->good()) return Fail("failed to read stream");
+
+  BufferReader reader(buffer_.data(), buffer_.size());
+  uint32_t column_size = 0;
+  if (!reader.ReadInt(&row_count_) || !reader.ReadInt(&fingerprint_) ||
+      !reader.ReadInt(&column_size)) {
+    return Fail("corrupted footer");
+  }
+  for (uint32_t i = 0; i < column_size; ++i) {
+    ColumnSchema column;
+    ColumnBlock block;
+    uint8_t encoding = 0;
+    uint8_t primitive_type = 0;
+    uint64_t offset = 0;
+    if (!reader.ReadString(&column.name) ||
+        !reader.ReadString(&column.type_name) || !reader.ReadInt(&encoding) ||
+        !reader.ReadInt(&primitive_type) || !reader.ReadInt(&column.width) ||
+        !reader.ReadInt(&offset) || !reader.ReadInt(&block.offset) ||
+        !reader.ReadInt(&block.size)) {
+      return Fail("corrupted footer");
+    }
+    column.offset = offset;
+    column.encoding = static_cast<ColumnEncoding>(encoding);
+    column.primitive_type = static_cast<PrimitiveType>(primitive_type);
+    bool fixed = column.encoding == ColumnEncoding::kFixed;
+    if (encoding > static_cast<uint8_t>(ColumnEncoding::kDictionary) ||
+        block.offset < header_size || block.offset > footer_offset ||
+        block.size > footer_offset - block.offset ||
+        (fixed && (column.width == 0 ||
+                   row_count_ > block.size / column.width ||
+                   block.size != row_count_ * column.width)) ||
+        (!fixed && (column.width != 0 ||
+                    column.primitive_type != PrimitiveType::kString ||
+                    row_count_ > block.size / sizeof(uint32_t)))) {
+      return Fail("corrupted column " + column.name);
+    }
+    columns_.push_back(std::move(column));
+    blocks_.push_back(block);
+  }
+  if (!reader.IsEnd()) return Fail("corrupted footer");
+  return true;
+}
+
+const ColumnSchema* ColumnarReader::FindColumn(const std::string& name) const {
+  for (const auto& column : columns_) {
+    if (column.name == name) return &column;
+  }
+  return nullptr;
+}
+
+bool ColumnarReader::ReadFixedColumn(const std::string& name, size_t width,
+                                     void* values) {
+  if (!valid_) return false;
+  const ColumnSchema* column = FindColumn(name);
+  if (column == nullptr) return Fail("no column " + name);
+  if (column->encoding != ColumnEncoding::kFixed || column->width != width) {
+    return Fail("column " + name + " is not " + std::to_string(width) +
+                " bytes wide");
+  }
+  const ColumnBlock& block = blocks_[column - columns_.data()];
+  in_->seekg(block.offset);
+  in_->read(static_cast<char*>(values), block.size);
+  if (!in_->good()) return Fail("failed to read stream");
+  return true;
+}
+
+bool ColumnarReader::ReadColumn(const std::string& name,
+                                std::vector<std::string>* values) {
+  if (!valid_) return false;
+  const ColumnSchema* column = FindColumn(name);
+  if (column == nullptr) return Fail("no column " + name);
+  if (column->encoding != ColumnEncoding::kDictionary) {
+    return Fail("column " + name + " is not a string column");
+  }
+  std::vector<std::string> dictionary;
+  std::vector<uint32_t> ids;
+  if (!ReadDictionary(column - columns_.data(), &dictionary, &ids)) {
+    return false;
+  }
+  values->resize(ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) (*values)[i] = dictionary[ids[i]];
+  return true;
+}
+
+bool ColumnarReader::ReadRows(const ClassDescriptor* desc, void* rows,
+                              size_t row_count,
+                              const std::vector<std::string>& projection) {
+  if (!valid_) return false;
+  if (desc == nullptr) return Fail("not a reflected class");
+  if (row_count != row_count_) {
+    return Fail("expect " + std::to_string(row_count_) + " rows, got " +
+                std::to_string(row_count));
+  }
+
+  // Match every selected column of file to one of |desc| before reading any.
+  // Offsets always come from |desc|, never from file, which may be corrupted
+  // or written by a different build of the same class. Rows of the same
+  // schema as in file have the same columns in the same order, so they are
+  // mapped by index, and only checked against what file records.
+  std::vector<ColumnSchema> row_columns = GetColumnSchemas(desc);
+  bool same_schema = fingerprint_ == desc->GetFingerprint();
+  if (same_schema && row_columns.size() != columns_.size()) {
+    return Fail("columns don't match fingerprint of " + desc->GetTypeName());
+  }
+  std::vector<std::pair<size_t, const ColumnSchema*>> plan;
+  std::vector<bool> entry_used(projection.size(), false);
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    const auto& column = columns_[i];
+    bool selected = projection.empty();
+    for (size_t j = 0; j < projection.size(); ++j) {
+      if (IsSelected(column.name, projection[j])) {
+        selected = true;
+        entry_used[j] = true;
+      }
+    }
+    if (!selected) continue;
+    if (same_schema) {
+      const ColumnSchema& row_column = row_columns[i];
+      if (row_column.name != column.name ||
+          row_column.type_name != column.type_name ||
+          row_column.encoding != column.encoding ||
+          row_column.width != column.width ||
+          row_column.offset != column.offset) {
+        return Fail("corrupted column " + column.name);
+      }
+      plan.emplace_back(i, &row_column);
+      continue;
+    }
+    const ColumnSchema* row_column = nullptr;
+    for (const auto& candidate : row_columns) {
+      if (candidate.name == column.name) {
+        row_column = &candidate;
+        break;
+      }
+    }
+    if (row_column == nullptr) {
+      if (projection.empty()) continue;
+      return Fail("no field " + column.name + " in " + desc->GetTypeName());
+    }
+    if (row_column->type_name != column.type_name ||
+        row_column->encoding != column.encoding ||
+        row_column->width != column.width) {
+      return Fail("column " + column.name + " is " + column.type_name +
+                  ", field is " + row_column->type_name);
+    }
+    plan.emplace_back(i, row_column);
+  }
+  for (size_t j = 0; j < projection.size(); ++j) {
+    if (!entry_used[j]) return Fail("no column " + projection[j]);
+  }
+
+  for (const auto& step : plan) {
+    if (!ReadColumnIntoRows(step.first, *step.second, static_cast<char*>(rows),
+                            desc->size_, row_count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ColumnarReader::ReadColumnIntoRows(size_t index,
+                                        const ColumnSchema& column, char* rows,
+                                        size_t stride, size_t row_count) {
+  if (column.encoding == ColumnEncoding::kDictionary) {
+    std::vector<std::string> dictionary;
+    std::vector<uint32_t> ids;
+    if (!ReadDictionary(index, &dictionary, &ids)) return false;
+    for (size_t i = 0; i < row_count; ++i) {
+      *reinterpret_cast<std::string*>(rows + i * stride + column.offset) =
+          dictionary[ids[i]];
+    }
+    return true;
+  }
+
+  in_->seekg(blocks_[index].offset);
+  buffer_.resize(std::min(row_count, kBatchRows) * column.width);
+  for (size_t begin = 0; begin < row_count; begin += kBatchRows) {
+    size_t count = std::min(kBatchRows, row_count - begin);
+    in_->read(buffer_.data(), count * column.width);
+    if (!in_->good()) return Fail("failed to read stream");
+    ScatterStrided(buffer_.data(), column.width, count, stride,
+                   rows + begin * stride + column.offset);
+  }
+  return true;
+}
+
+bool ColumnarReader::ReadDictionary(size_t index,
+                                    std::vector<std::string>* dictionary,
+                                    std::vector<uint32_t>* ids) {
+  const ColumnBlock& block = blocks_[index];
+  buffer_.resize(block.size);
+  in_->seekg(block.offset);
+  in_->read(buffer_.data(), buffer_.size());
+  if (!in_->good()) return Fail("failed to read stream");
+
+  const std::string& name = columns_[index].name;
+  BufferReader reader(buffer_.data(), buffer_.size());
+  uint32_t dictionary_size = 0;
+  // Every entry takes at least its length prefix.
+  if (!reader.ReadInt(&dictionary_size) ||
+      dictionary_size > reader.GetRemaining() / sizeof(uint32_t)) {
+    return Fail("corrupted column " + name);
+  }
+  dictionary->resize(dictionary_size);
+  for (auto& value : *dictionary) {
+    if (!reader.ReadString(&value)) return Fail("corrupted column " + name);
+  }
+  ids->resize(row_count_);
+  if (!reader.Read(ids->data(), ids->size() * sizeof(uint32_t)) ||
+      !reader.IsEnd()) {
+    return Fail("corrupted column " + name);
+  }
+  for (uint32_t id : *ids) {
+    if (id >= dictionary_size) return Fail("corrupted column " + name);
+  }
+  return true;
+}
+
+bool ColumnarReader::Fail(const std::string& error) {
+  error_ = error;
+  return false;
+}
+
+}  // namespace reflection
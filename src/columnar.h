@@ -0,0 +1,189 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * Columnar export of arrays of a reflected class, for offline analytics.
+ *
+ * Every leaf field becomes one column, and fields of nested classes are
+ * flattened into dotted names, e.g. "pose.position". Leaves are pre-defined
+ * scalars and glm types, enums, and fixed arrays of trivially copyable values,
+ * all stored at native width, as well as strings, which are dictionary
+ * encoded. Containers, smart pointers, variants, messages and members
+ * annotated kMemberTransient are not exported, nor are fixed arrays of classes
+ * with such members.
+ *
+ * Fixed-width columns are gathered from rows with strided batch copies, and
+ * reads can be projected to some columns, in which case nothing else of the
+ * file is read. Rows whose class fingerprint matches the one in file have
+ * their columns mapped by index, checked against the offsets recorded there,
+ * otherwise columns are matched to fields by name, type and width, so fields
+ * can be added, removed or reordered in between. Rows are only ever written
+ * at offsets of the row class, never at ones read from file.
+ *
+ * File layout, all integers in native byte order:
+ *   column data blocks, one per column
+ *   footer: row count, fingerprint of row class (see
+ *           ClassDescriptor::GetFingerprint()), and column schemas with
+ *           offset and size of their block
+ *   footer offset (uint64) and magic "SSRC"
+ *
+ * Usage:
+ *   std::ofstream out("poses.ssrc", std::ios::binary);
+ *   ColumnarWriter writer(TO_CLASS_DESC(DESC("Pose")));
+ *   writer.Write(poses, &out);
+ *
+ *   std::ifstream in("poses.ssrc", std::ios::binary);
+ *   ColumnarReader reader(&in);
+ *   std::vector<Pose> rows;
+ *   reader.ReadRows(&rows, {"timestamp", "pose.position"});
+ */
+
+enum class ColumnEncoding : uint8_t {
+  // Values at native width, |width| bytes each.
+  kFixed = 0,
+  // Dictionary of distinct strings, followed by a uint32 id per row.
+  kDictionary,
+};
+
+struct ColumnSchema {
+  // Dotted field name.
+  std::string name;
+  std::string type_name;
+  ColumnEncoding encoding{ColumnEncoding::kFixed};
+  PrimitiveType primitive_type{PrimitiveType::kNone};
+  // Bytes per value for kFixed, 0 for kDictionary.
+  uint32_t width{0};
+  // Byte offset of the field in a row.
+  size_t offset{0};
+};
+
+// Get columns of rows described by |desc|, in field declaration order.
+std::vector<ColumnSchema> GetColumnSchemas(const ClassDescriptor* desc);
+
+// Copy |width| bytes at |src| + i * |stride| to |dst| + i * |width| for every
+// i < |count|. Widths of 1, 2, 4 and 8 bytes are copied word by word.
+void GatherStrided(const void* src, size_t stride, size_t count, size_t width,
+                   void* dst);
+
+// Reverse of GatherStrided(): copy |width| bytes at |src| + i * |width| to
+// |dst| + i * |stride|.
+void ScatterStrided(const void* src, size_t width, size_t count, size_t stride,
+                    void* dst);
+
+class ColumnarWriter {
+ public:
+  explicit ColumnarWriter(const ClassDescriptor* desc);
+
+  // Write |row_count| rows stored contiguously from |rows|, e.g. data of a
+  // std::vector. Return false on stream failure, see GetError().
+  bool Write(const void* rows, size_t row_count, std::ostream* out);
+
+  template <typename T>
+  bool Write(const std::vector<T>& rows, std::ostream* out) {
+    return Write(rows.data(), rows.size(), out);
+  }
+
+  const std::vector<ColumnSchema>& GetColumns() const { return columns_; }
+
+  const std::string& GetError() const { return error_; }
+
+ private:
+  const ClassDescriptor* desc_;
+  std::vector<ColumnSchema> columns_;
+  std::vector<char> buffer_;
+  std::string error_;
+};
+
+class ColumnarReader {
+ public:
+  // Read footer of |in|, which must be seekable and outlive the reader. Check
+  // IsValid() afterwards.
+  explicit ColumnarReader(std::istream* in);
+
+  bool IsValid() const { return valid_; }
+
+  uint64_t GetRowCount() const { return row_count_; }
+
+  // Get fingerprint of the class rows were written from.
+  uint64_t GetFingerprint() const { return fingerprint_; }
+
+  const std::vector<ColumnSchema>& GetColumns() const { return columns_; }
+
+  // Return nullptr if no column is named so.
+  const ColumnSchema* FindColumn(const std::string& name) const;
+
+  // Read a kFixed column into |values|, which is resized to GetRowCount().
+  // Fail if sizeof(T) differs from column width.
+  template <typename T>
+  bool ReadColumn(const std::string& name, std::vector<T>* values) {
+    values->resize(row_count_);
+    return ReadFixedColumn(name, sizeof(T), values->data());
+  }
+
+  bool ReadColumn(const std::string& name, std::vector<std::string>* values);
+
+  // Read columns in |projection| into |row_count| rows described by |desc|
+  // stored contiguously from |rows|. A projection entry selects the column
+  // of that name, or all columns nested under it (e.g. "pose" for
+  // "pose.position"). Empty projection reads every column known to both file
+  // and |desc|. Fields not read are left untouched. Return false if a
+  // projected column is missing in file or |desc|, or types don't match.
+  bool ReadRows(const ClassDescriptor* desc, void* rows, size_t row_count,
+                const std::vector<std::string>& projection =
+                    std::vector<std::string>());
+
+  // Resize |rows| to GetRowCount() and read into them, see above.
+  template <typename T>
+  bool ReadRows(std::vector<T>* rows,
+                const std::vector<std::string>& projection =
+                    std::vector<std::string>()) {
+    if (!valid_) return false;
+    rows->resize(row_count_);
+    return ReadRows(
+        ClassDescriptor::ToClassDescriptor(DescriptorAccessor<T>::Get()),
+        rows->data(), rows->size(), projection);
+  }
+
+  const std::string& GetError() const { return error_; }
+
+ private:
+  struct ColumnBlock {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  bool ReadFooter();
+
+  bool ReadFixedColumn(const std::string& name, size_t width, void* values);
+
+  // Read column |index| into |rows| at |column|.offset of every row.
+  bool ReadColumnIntoRows(size_t index, const ColumnSchema& column, char* rows,
+                          size_t stride, size_t row_count);
+
+  bool ReadDictionary(size_t index, std::vector<std::string>* dictionary,
+                      std::vector<uint32_t>* ids);
+
+  bool Fail(const std::string& error);
+
+  std::istream* in_;
+  bool valid_{false};
+  uint64_t row_count_{0};
+  uint64_t fingerprint_{0};
+  std::vector<ColumnSchema> columns_;
+  std::vector<ColumnBlock> blocks_;
+  std::vector<char> buffer_;
+  std::string error_;
+};
+
+}  // namespace reflection
@@ -0,0 +1,49 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/copy_plan.h"
+
+#include <algorithm>
+
+namespace reflection {
+
+bool HasTransientBytes(Descriptor* desc) {
+  if (auto* class_desc = ClassDescriptor::ToClassDescriptor(desc)) {
+    for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+      if (class_desc->HasFieldFlag(i, kMemberTransient) ||
+          HasTransientBytes(class_desc->GetDescriptorById(i))) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // Only elements of fixed arrays are inline, and values can't hold
+  // themselves inline, so this ends.
+  auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc);
+  return container_desc != nullptr && container_desc->GetFixedSize() >= 0 &&
+         HasTransientBytes(container_desc->GetValueDescriptor());
+}
+
+bool IsBulkCopyable(ContainerDescriptor* container_desc) {
+  return container_desc->IsValueTriviallyCopyable() &&
+         !HasTransientBytes(container_desc->GetValueDescriptor());
+}
+
+std::vector<CopyRun> MergeCopyRuns(std::vector<CopyRun> runs) {
+  std::sort(runs.begin(), runs.end(),
+            [](const CopyRun& lhs, const CopyRun& rhs) {
+              return lhs.offset < rhs.offset;
+            });
+  std::vector<CopyRun> merged;
+  for (const auto& run : runs) {
+    if (run.size == 0) continue;
+    if (!merged.empty() &&
+        merged.back().offset + merged.back().size == run.offset) {
+      merged.back().size += run.size;
+    } else {
+      merged.push_back(run);
+    }
+  }
+  return merged;
+}
+
+}  // namespace reflection
@@ -0,0 +1,156 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "src/epoch_reclaimer.h"
+#include "src/reflection.h"
+
+namespace reflection {
+
+// **FOR INTERNAL USE ONLY**
+// Plans of descriptor-driven copies shared by snapshots (snapshot.h) and
+// shared segments (shared_segment.h).
+
+// Bytes copied with one memcpy, at the same offset in object and copy.
+struct CopyRun {
+  size_t offset;
+  size_t size;
+};
+
+// Whether values of |desc| hold bytes of members annotated kMemberTransient
+// inline, in nested classes or in elements of fixed arrays.
+bool HasTransientBytes(Descriptor* desc);
+
+// Whether all values of |container_desc| can be copied with one memcpy:
+// trivially copyable, and without transient bytes.
+bool IsBulkCopyable(ContainerDescriptor* container_desc);
+
+// Sort |runs| by offset, drop empty ones and merge adjacent ones.
+std::vector<CopyRun> MergeCopyRuns(std::vector<CopyRun> runs);
+
+/**
+ * Plans of type |Plan|, built once per descriptor. Values are walked through
+ * nested classes, skipping transient members, and byte-copyable fields become
+ * copy runs of the plan, merged when adjacent. Other fields are handed to
+ * |Builder|, which adds steps of its own. Plans need members
+ *   Descriptor* desc;
+ *   std::vector<CopyRun> runs;
+ * and builders static functions
+ *   // Add a step for a field of |desc| at |offset| in values of |plan|, if
+ *   // supported. Plans of nested values are got with GetPlanLocked().
+ *   static void AddStep(PlanCache<Plan, Builder>* cache, Descriptor* desc,
+ *                       size_t offset, Plan* plan);
+ *   // Complete |plan| once its runs and steps are added.
+ *   static void Finish(Plan* plan);
+ *
+ * Plans are dropped whenever a class is unregistered, as freed descriptors
+ * can be followed by new ones at the same address. Plans in use stay valid
+ * until their users leave guards of GetReclaimer().
+ */
+template <typename Plan, typename Builder>
+class PlanCache {
+ public:
+  static PlanCache& Get() {
+    static PlanCache instance;
+    return instance;
+  }
+
+  // Get plan of |desc|. Call inside a guard of GetReclaimer(), and don't
+  // keep the plan past it.
+  const Plan* GetPlan(Descriptor* desc) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t unregister_count = ClassReflFactory::Get().GetUnregisterCount();
+    if (unregister_count != unregister_count_) {
+      auto* plans = new PlanMap(std::move(plans_));
+      plans_.clear();
+      reclaimer_.Retire([plans]() { delete plans; });
+      reclaimer_.TryReclaim();
+      unregister_count_ = unregister_count;
+    }
+    return GetPlanLocked(desc);
+  }
+
+  // Get plan of |desc| while building another one, see Builder::AddStep().
+  // Plans are registered before being built, so that recursive types find
+  // them.
+  const Plan* GetPlanLocked(Descriptor* desc) {
+    auto& plan = plans_[desc];
+    if (plan != nullptr) return plan.get();
+    plan.reset(new Plan);
+    Plan* raw_plan = plan.get();
+    raw_plan->desc = desc;
+    if (desc == nullptr) return raw_plan;
+
+    std::vector<CopyRun> runs;
+    AddValue(desc, 0, raw_plan, &runs);
+    raw_plan->runs = MergeCopyRuns(std::move(runs));
+    Builder::Finish(raw_plan);
+    return raw_plan;
+  }
+
+  EpochReclaimer* GetReclaimer() { return &reclaimer_; }
+
+ private:
+  using PlanMap = std::unordered_map<const Descriptor*, std::unique_ptr<Plan>>;
+
+  PlanCache() = default;
+
+  void AddValue(Descriptor* desc, size_t offset, Plan* plan,
+                std::vector<CopyRun>* runs) {
+    if (desc == nullptr) return;
+    if (auto* class_desc = ClassDescriptor::ToClassDescriptor(desc)) {
+      for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+        if (class_desc->HasFieldFlag(i, kMemberTransient)) continue;
+        AddValue(class_desc->GetDescriptorById(i),
+                 offset + class_desc->GetFieldOffset(i), plan, runs);
+      }
+      return;
+    }
+    if (desc->IsByteCopyable()) {
+      if (!HasTransientBytes(desc)) {
+        runs->push_back({offset, desc->size_});
+        return;
+      }
+      // Fixed arrays of classes with transient members, element by element.
+      auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc);
+      Descriptor* value_desc = container_desc->GetValueDescriptor();
+      for (int64_t i = 0; i < container_desc->GetFixedSize(); ++i) {
+        AddValue(value_desc, offset + i * value_desc->size_, plan, runs);
+      }
+      return;
+    }
+    Builder::AddStep(this, desc, offset, plan);
+  }
+
+  std::mutex mutex_;
+  PlanMap plans_;
+  uint64_t unregister_count_{0};
+  EpochReclaimer reclaimer_;
+};
+
+// Get plan of |desc| from PlanCache<Plan, Builder>::Get(). Values are usually
+// copied of the same type over and over, so the last plan per thread is
+// remembered to skip the lock. Call inside a guard, see PlanCache::GetPlan().
+template <typename Plan, typename Builder>
+const Plan* GetCachedPlan(Descriptor* desc) {
+  thread_local Descriptor* last_desc = nullptr;
+  thread_local const Plan* last_plan = nullptr;
+  thread_local uint64_t last_unregister_count = 0;
+  uint64_t unregister_count = ClassReflFactory::Get().GetUnregisterCount();
+  if (last_plan == nullptr || desc != last_desc ||
+      unregister_count != last_unregister_count) {
+    last_plan = PlanCache<Plan, Builder>::Get().GetPlan(desc);
+    last_desc = desc;
+    last_unregister_count = unregister_count;
+  }
+  return last_plan;
+}
+
+}  // namespace reflection
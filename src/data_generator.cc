@@ -0,0 +1,299 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/data_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
+namespace reflection {
+
+namespace {
+
+const char kAlphabet[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+
+// Finalizer of SplitMix64, a bijection scattering nearby inputs.
+uint64_t Mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// SplitMix64 generator: one add and a mix per number, cheap enough to seed
+// per object.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() { return Mix(state_ += 0x9e3779b97f4a7c15ull); }
+
+  // Uniform in [0, bound), or any 64 bits if |bound| is 0.
+  uint64_t Uniform(uint64_t bound) {
+    return bound == 0 ? Next() : Next() % bound;
+  }
+
+  // Uniform in [0, 1).
+  double UniformDouble() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+ private:
+  uint64_t state_;
+};
+
+// Key or set value of a scalar, enum or string type built out of place.
+struct KeyBuffer {
+  alignas(8) char scalar[8];
+  std::string string;
+};
+
+class Filler {
+ public:
+  Filler(const GeneratorOptions& options, uint64_t index)
+      : options_(options), random_(Mix(options.seed ^ Mix(index))) {}
+
+  void Fill(void* obj, Descriptor* desc, int32_t depth) {
+    switch (desc->GetKind()) {
+      case DescriptorKind::kPreDefined:
+        return FillPreDefined(obj, desc);
+      case DescriptorKind::kEnum:
+        return FillEnum(obj, static_cast<EnumDescriptor*>(desc));
+      case DescriptorKind::kClass: {
+        auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+        char* bytes = static_cast<char*>(obj);
+        for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+          Fill(bytes + class_desc->GetFieldOffset(i),
+               class_desc->GetDescriptorById(i), depth);
+        }
+        return;
+      }
+      case DescriptorKind::kSmartPtr:
+        return FillSmartPtr(obj, static_cast<SmartPtrDescriptor*>(desc),
+                            depth);
+      case DescriptorKind::kContainer:
+        return FillContainer(obj, static_cast<ContainerDescriptor*>(desc),
+                             depth);
+      case DescriptorKind::kVariant: {
+        auto* variant_desc = static_cast<VariantDescriptor*>(desc);
+        int32_t size = variant_desc->GetAlternativeSize();
+        if (size <= 0) return;
+        int32_t index = random_.Uniform(size);
+        void* value = variant_desc->EmplaceAlternative(obj, index);
+        if (value == nullptr) return;
+        return Fill(value, variant_desc->GetAlternativeDescriptor(index),
+                    depth);
+      }
+      case DescriptorKind::kMessage:
+        return;
+    }
+  }
+
+ private:
+  void FillPreDefined(void* obj, Descriptor* desc) {
+    switch (desc->GetPrimitiveType()) {
+      case PrimitiveType::kBool:
+        *static_cast<bool*>(obj) = random_.Next() & 1;
+        return;
+      case PrimitiveType::kChar:
+        *static_cast<char*>(obj) = kAlphabet[random_.Next() & 63];
+        return;
+      case PrimitiveType::kInt8:
+        return FillInteger<int8_t>(obj);
+      case PrimitiveType::kInt16:
+        return FillInteger<int16_t>(obj);
+      case PrimitiveType::kInt32:
+        return FillInteger<int32_t>(obj);
+      case PrimitiveType::kInt64:
+        return FillInteger<int64_t>(obj);
+      case PrimitiveType::kUInt8:
+        return FillInteger<uint8_t>(obj);
+      case PrimitiveType::kUInt16:
+        return FillInteger<uint16_t>(obj);
+      case PrimitiveType::kUInt32:
+        return FillInteger<uint32_t>(obj);
+      case PrimitiveType::kUInt64:
+        return FillInteger<uint64_t>(obj);
+      case PrimitiveType::kFloat:
+        *static_cast<float*>(obj) = NextFloat();
+        return;
+      case PrimitiveType::kDouble:
+        *static_cast<double*>(obj) = NextFloat();
+        return;
+      case PrimitiveType::kString:
+        return FillString(static_cast<std::string*>(obj));
+      case PrimitiveType::kNone: {
+        // glm vectors, matrices and quaternions, made of floats only.
+        auto* values = static_cast<float*>(obj);
+        for (size_t i = 0; i < desc->size_ / sizeof(float); ++i) {
+          values[i] = NextFloat();
+        }
+        return;
+      }
+    }
+  }
+
+  template <typename T>
+  void FillInteger(void* obj) {
+    const int64_t type_min = std::numeric_limits<T>::min();
+    const int64_t type_max =
+        static_cast<uint64_t>(std::numeric_limits<T>::max()) >
+                static_cast<uint64_t>(std::numeric_limits<int64_t>::max())
+            ? std::numeric_limits<int64_t>::max()
+            : static_cast<int64_t>(std::numeric_limits<T>::max());
+    // Both bounds within T, so that no drawn value is truncated.
+    int64_t min = std::min(std::max(options_.int_min, type_min), type_max);
+    int64_t max =
+        std::max(min, std::min(std::max(options_.int_max, type_min), type_max));
+    uint64_t value = static_cast<uint64_t>(min) +
+                     random_.Uniform(static_cast<uint64_t>(max) -
+                                     static_cast<uint64_t>(min) + 1);
+    *static_cast<T*>(obj) = static_cast<T>(value);
+  }
+
+  double NextFloat() {
+    return options_.float_min +
+           random_.UniformDouble() * (options_.float_max - options_.float_min);
+  }
+
+  void FillString(std::string* str) {
+    str->resize(NextSize(options_.string_size));
+    uint64_t bits = 0;
+    for (size_t i = 0; i < str->size(); ++i) {
+      // 10 characters out of every 64 random bits.
+      if (i % 10 == 0) bits = random_.Next();
+      (*str)[i] = kAlphabet[bits & 63];
+      bits >>= 6;
+    }
+  }
+
+  void FillEnum(void* obj, EnumDescriptor* desc) {
+    const auto& value_names = desc->GetValueNames();
+    // Enums without named values, not to leave previous bytes, e.g. of a key.
+    if (value_names.empty()) {
+      desc->SetValue(obj, 0);
+      return;
+    }
+    desc->SetValue(obj, value_names[random_.Uniform(value_names.size())].value);
+  }
+
+  void FillSmartPtr(void* obj, SmartPtrDescriptor* desc, int32_t depth) {
+    void* content = nullptr;
+    if (depth < options_.max_depth && desc->GetContentDescriptor() != nullptr &&
+        random_.UniformDouble() >= options_.null_probability) {
+      content = desc->EmplaceContent(obj);
+    }
+    if (content == nullptr) {
+      desc->Reset(obj);
+      return;
+    }
+    Fill(content, desc->GetContentDescriptor(), depth + 1);
+  }
+
+  void FillContainer(void* obj, ContainerDescriptor* desc, int32_t depth) {
+    Descriptor* value_desc = desc->GetValueDescriptor();
+    int64_t fixed_size = desc->GetFixedSize();
+    if (fixed_size >= 0) {
+      for (int64_t i = 0; i < fixed_size; ++i) {
+        Fill(desc->MutableValueByIndex(obj, i), value_desc, depth);
+      }
+      return;
+    }
+    desc->Clear(obj);
+    if (depth >= options_.max_depth) return;
+    uint32_t size = NextSize(options_.container_size);
+    if (size == 0) return;
+    KeyBuffer key;
+    if (Descriptor* key_desc = desc->GetKeyDescriptor()) {
+      // Maps, with fewer elements than |size| if keys collide.
+      for (uint32_t i = 0; i < size; ++i) {
+        void* key_ptr = MakeKey(key_desc, &key);
+        if (key_ptr == nullptr) return;
+        void* value = desc->EmplaceByKey(obj, key_ptr);
+        if (value != nullptr) Fill(value, value_desc, depth + 1);
+      }
+      return;
+    }
+    desc->Reserve(obj, size);
+    if (void* value = desc->EmplaceDefault(obj)) {
+      Fill(value, value_desc, depth + 1);
+      for (uint32_t i = 1; i < size; ++i) {
+        Fill(desc->EmplaceDefault(obj), value_desc, depth + 1);
+      }
+      return;
+    }
+    // Sets.
+    for (uint32_t i = 0; i < size; ++i) {
+      void* value = MakeKey(value_desc, &key);
+      if (value == nullptr) return;
+      desc->AddValue(obj, value);
+    }
+  }
+
+  // Fill a key of a scalar, enum or string type into |key|, and return a
+  // pointer to it. Return nullptr for other types.
+  void* MakeKey(Descriptor* desc, KeyBuffer* key) {
+    PrimitiveType type = desc->GetPrimitiveType();
+    if (type == PrimitiveType::kString) {
+      FillString(&key->string);
+      return &key->string;
+    }
+    if (type == PrimitiveType::kNone || desc->size_ > sizeof(key->scalar)) {
+      return nullptr;
+    }
+    Fill(key->scalar, desc, 0);
+    return key->scalar;
+  }
+
+  uint32_t NextSize(const SizeDistribution& distribution) {
+    uint32_t min = distribution.min;
+    uint32_t max = std::max(min, distribution.max);
+    if (distribution.shape == SizeDistribution::Shape::kUniform) {
+      return min + random_.Uniform(static_cast<uint64_t>(max - min) + 1);
+    }
+    // Number of failures before a success of probability p has mean
+    // (1 - p) / p, sampled by inversion.
+    double excess = distribution.mean - min;
+    if (excess <= 0) return min;
+    double p = 1.0 / (excess + 1.0);
+    double size = std::floor(std::log(1.0 - random_.UniformDouble()) /
+                             std::log(1.0 - p));
+    return size >= max - min ? max : min + static_cast<uint32_t>(size);
+  }
+
+  const GeneratorOptions& options_;
+  Random random_;
+};
+
+}  // namespace
+
+/* DataGenerator methods */
+
+const size_t DataGenerator::kChunkSize;
+
+bool DataGenerator::Fill(void* obj, Descriptor* desc, uint64_t index) const {
+  if (desc == nullptr) return false;
+  Filler(options_, index).Fill(obj, desc, 0);
+  return true;
+}
+
+bool DataGenerator::FillArray(WorkStealingPool* pool, void* objs,
+                              size_t count, Descriptor* desc,
+                              uint64_t first_index) const {
+  if (desc == nullptr) return false;
+  char* bytes = static_cast<char*>(objs);
+  auto fill_chunk = [&](size_t chunk) {
+    size_t end = std::min(count, (chunk + 1) * kChunkSize);
+    for (size_t i = chunk * kChunkSize; i < end; ++i) {
+      Filler(options_, first_index + i).Fill(bytes + i * desc->size_, desc, 0);
+    }
+  };
+  size_t chunk_size = (count + kChunkSize - 1) / kChunkSize;
+  if (pool == nullptr) {
+    for (size_t chunk = 0; chunk < chunk_size; ++chunk) fill_chunk(chunk);
+  } else {
+    pool->ParallelFor(chunk_size, fill_chunk);
+  }
+  return true;
+}
+
+}  // namespace reflection
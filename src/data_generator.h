@@ -0,0 +1,103 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "src/reflection.h"
+#include "src/work_stealing_pool.h"
+
+namespace reflection {
+
+/**
+ * Synthetic reflected objects for load tests and benchmarks. Every field
+ * reachable from a descriptor is filled with random values: scalars and glm
+ * types in configured ranges, enums with one of their named values, strings
+ * and dynamic containers with sizes drawn from configured distributions,
+ * smart pointers and optionals with new content unless drawn null, and
+ * variants with a random alternative. Protobuf messages are left untouched.
+ *
+ * Object |index| is filled from a random stream derived from the seed and
+ * |index| only, so output is deterministic per seed, and the same on any
+ * number of threads.
+ *
+ * Usage:
+ *   GeneratorOptions options;
+ *   options.seed = 42;
+ *   options.container_size = {SizeDistribution::Shape::kGeometric, 0, 1000,
+ *                             8.0};
+ *   WorkStealingPool pool;
+ *   std::vector<Frame> frames;
+ *   DataGenerator(options).Generate(&pool, 100000, &frames);
+ */
+
+// Distribution of string lengths or container sizes.
+struct SizeDistribution {
+  enum class Shape : uint8_t {
+    // Every size in [min, max] is equally likely.
+    kUniform = 0,
+    // Sizes decay geometrically from min, with given mean, and are clamped to
+    // max: mostly small, sometimes large.
+    kGeometric,
+  };
+
+  Shape shape;
+  uint32_t min;
+  uint32_t max;
+  // Mean of geometric distributions.
+  double mean;
+};
+
+struct GeneratorOptions {
+  uint64_t seed{0};
+  // Range of integers, clamped to range of each field type.
+  int64_t int_min{-1000};
+  int64_t int_max{1000};
+  // Range of floating point values, including components of glm types.
+  double float_min{-1000.0};
+  double float_max{1000.0};
+  SizeDistribution string_size{SizeDistribution::Shape::kUniform, 0, 16, 0};
+  SizeDistribution container_size{SizeDistribution::Shape::kUniform, 0, 8, 0};
+  // Nesting depth of smart pointers and dynamic containers from the root
+  // object. Deeper ones are left empty, which also bounds recursive types.
+  int32_t max_depth{3};
+  // Probability of leaving a smart pointer or optional empty.
+  double null_probability{0.1};
+};
+
+class DataGenerator {
+ public:
+  // Objects per task of FillArray().
+  static const size_t kChunkSize = 256;
+
+  explicit DataGenerator(const GeneratorOptions& options = GeneratorOptions())
+      : options_(options) {}
+
+  const GeneratorOptions& GetOptions() const { return options_; }
+
+  // Fill |obj| described by |desc| as object |index|. Return false if |desc|
+  // is nullptr.
+  bool Fill(void* obj, Descriptor* desc, uint64_t index) const;
+
+  // Fill |count| objects described by |desc| stored contiguously from |objs|
+  // as objects first_index, first_index + 1, ..., in chunks on |pool|, or in
+  // the calling thread if |pool| is nullptr.
+  bool FillArray(WorkStealingPool* pool, void* objs, size_t count,
+                 Descriptor* desc, uint64_t first_index = 0) const;
+
+  // Replace content of |objs| with |count| generated objects.
+  template <typename T>
+  bool Generate(WorkStealingPool* pool, size_t count, std::vector<T>* objs,
+                uint64_t first_index = 0) const {
+    objs->clear();
+    objs->resize(count);
+    return FillArray(pool, objs->data(), count, DescriptorAccessor<T>::Get(),
+                     first_index);
+  }
+
+ private:
+  GeneratorOptions options_;
+};
+
+}  // namespace reflection
@@ -2,11 +2,50 @@
 // Author: Yuchen Liu (yuchenliu@deeproute.ai)
 #pragma once
 
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
 #include <functional>
+#include <mutex>
 #include <string>
 
 namespace reflection {
 
+// Non-owning view of interned names. Descriptors outlive every caller, so views
+// returned by *View() accessors stay valid for the whole program.
+using string_view = boost::string_view;
+
+// Kind tag of a descriptor. Set once by constructors of each descriptor family
+// so that type checks and downcasts need neither RTTI nor virtual calls.
+enum class DescriptorKind : uint8_t {
+  kPreDefined = 0,
+  kMessage,
+  kSmartPtr,
+  kContainer,
+  kClass,
+  kVariant,
+  kEnum,
+};
+
+// Scalar type of a pre-defined descriptor, so that encoders can store values
+// at native width without knowing C++ types. kNone for all other descriptors.
+// Enums report their underlying type.
+enum class PrimitiveType : uint8_t {
+  kNone = 0,
+  kBool,
+  kChar,
+  kInt8,
+  kInt16,
+  kInt32,
+  kInt64,
+  kUInt8,
+  kUInt16,
+  kUInt32,
+  kUInt64,
+  kFloat,
+  kDouble,
+  kString,
+};
+
 /** Base class to all descriptors. It provides reloaded interfaces for users to
  * determine its type. You can cast it to ContainerDescriptor or ClassDescriptor
  * when certain rules fulfilled. You can also visit raw values of pre-defined
@@ -15,35 +54,78 @@ namespace reflection {
 class Descriptor {
  public:
   Descriptor() {}
-  explicit Descriptor(const std::string& type_name, size_t size)
-      : type_name_(type_name), size_(size) {}
+  explicit Descriptor(const std::string& type_name, size_t size,
+                      DescriptorKind kind = DescriptorKind::kPreDefined)
+      : type_name_(type_name), size_(size), kind_(kind) {}
+  explicit Descriptor(DescriptorKind kind) : kind_(kind) {}
+  Descriptor(const std::string& type_name, size_t size,
+             PrimitiveType primitive_type)
+      : type_name_(type_name), size_(size), primitive_type_(primitive_type) {}
   virtual ~Descriptor() {}
 
-  virtual std::string GetTypeName() const { return type_name_; }
+  // Get kind tag of this descriptor.
+  DescriptorKind GetKind() const { return kind_; }
+
+  // Get scalar type of described values, kNone if they are not scalars.
+  PrimitiveType GetPrimitiveType() const { return primitive_type_; }
+
+  // Allocating convenience wrapper of GetTypeNameView().
+  virtual std::string GetTypeName() const {
+    return GetTypeNameView().to_string();
+  }
+
+  // Get type name without allocation. Names are interned once per descriptor.
+  virtual string_view GetTypeNameView() const { return type_name_; }
 
   // If target is a pre-defined type (a POD type or a data structure
   // supported by reflection system). Return false for classes using reflection,
   // which means that if it returns false, you can cast this decriptor to
   // ClassDescriptor.
-  virtual bool IsTypePreDefined() const { return true; };
+  virtual bool IsTypePreDefined() const {
+    return kind_ != DescriptorKind::kClass;
+  };
 
   // If target is a supported container. If it returns true, you can cast this
   // descriptor to ContainerDescriptor.
-  virtual bool IsContainer() const { return false; }
+  virtual bool IsContainer() const {
+    return kind_ == DescriptorKind::kContainer;
+  }
 
   // If target is a derived class of google::protobuf::Message. If it returns
   // true, you can cast this descriptor to MessageDescriptor, and use static
   // function to get Message* instead of void* to use reflection provided by
   // protobuf.
-  virtual bool IsProtobufMessage() const { return false; }
+  virtual bool IsProtobufMessage() const {
+    return kind_ == DescriptorKind::kMessage;
+  }
 
   // If target is a supported smart pointer. If it returns true, you can cast
   // this descriptor to SmartPtrDescriptor.
-  virtual bool IsSmartPtr() const { return false; }
+  virtual bool IsSmartPtr() const { return kind_ == DescriptorKind::kSmartPtr; }
+
+  // If target is a supported variant. If it returns true, you can cast this
+  // descriptor to VariantDescriptor.
+  virtual bool IsVariant() const { return kind_ == DescriptorKind::kVariant; }
+
+  // If target is an enum. If it returns true, you can cast this descriptor to
+  // EnumDescriptor.
+  virtual bool IsEnum() const { return kind_ == DescriptorKind::kEnum; }
+
+  // If values can be copied with memcpy and read back from the copy: scalars,
+  // glm types, enums, and fixed arrays of trivially copyable values.
+  bool IsByteCopyable() const;
 
   // Get raw value.
   virtual void* MutableVal(void* obj) { return obj; }
 
+  // Get const raw value.
+  virtual const void* GetVal(const void* obj) const { return obj; }
+
+  // Get heap bytes allocated directly by |obj|, e.g. buffer of a string or
+  // nodes of a map, excluding heap owned by values nested inside. Node-based
+  // overheads are estimated for libstdc++. Return 0 for inline-only types.
+  virtual size_t GetHeapBytes(const void* obj) const { return 0; }
+
   // Get pointer to value in its type.
   template <typename T>
   T* ToTypePtr(void* val_ptr) {
@@ -58,11 +140,34 @@ class Descriptor {
 
   std::string type_name_;
   size_t size_;
+
+ protected:
+  DescriptorKind kind_{DescriptorKind::kPreDefined};
+  PrimitiveType primitive_type_{PrimitiveType::kNone};
+
+  // Build full type name once and keep it for later calls. Used by descriptors
+  // whose name depends on nested descriptors, which may not be initialized
+  // yet when this descriptor is constructed.
+  string_view InternTypeName() const {
+    std::call_once(interned_once_,
+                   [this]() { interned_type_name_ = BuildTypeName(); });
+    return interned_type_name_;
+  }
+
+  // Compose full type name. Only called once by InternTypeName().
+  virtual std::string BuildTypeName() const { return type_name_; }
+
+ private:
+  mutable std::once_flag interned_once_;
+  mutable std::string interned_type_name_;
 };
 
 template <typename T>
 Descriptor* GetDescriptor();
 
+template <typename T>
+Descriptor* GetEnumDescriptor();
+
 struct DescPair {
  public:
   DescPair(Descriptor* value_) : key(nullptr), value(value_) {}
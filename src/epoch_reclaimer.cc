@@ -0,0 +1,123 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/epoch_reclaimer.h"
+
+#include <limits>
+#include <memory>
+
+namespace reflection {
+
+// Reader state of one thread for one reclaimer. Releases its slot on thread
+// exit.
+struct EpochReclaimer::LocalState {
+  ~LocalState() {
+    slot->epoch.store(0);
+    slot->in_use.store(false);
+  }
+
+  Slot* slot{nullptr};
+  int32_t depth{0};
+};
+
+namespace {
+
+// (reclaimer, state) pairs of current thread. Few reclaimers exist, so a
+// linear search is the fastest lookup. Deleters of states are type-erased by
+// std::shared_ptr<void>.
+thread_local std::vector<std::pair<const void*, std::shared_ptr<void>>>
+    local_states;
+
+}  // namespace
+
+/* EpochReclaimer::Guard methods */
+
+EpochReclaimer::Guard::Guard(EpochReclaimer* reclaimer)
+    : state_(reclaimer->GetLocalState()) {
+  if (state_->depth++ == 0) {
+    // Sequentially consistent, so that either a writer sees this announcement
+    // before freeing, or this reader sees the writer's unpublish.
+    state_->slot->epoch.store(reclaimer->global_epoch_.load());
+  }
+}
+
+EpochReclaimer::Guard::~Guard() {
+  if (--state_->depth == 0) {
+    state_->slot->epoch.store(0, std::memory_order_release);
+  }
+}
+
+/* EpochReclaimer methods */
+
+EpochReclaimer::~EpochReclaimer() {
+  std::lock_guard<std::mutex> lock(retired_mutex_);
+  for (auto& retired : retired_) retired.second();
+  retired_.clear();
+}
+
+void EpochReclaimer::Retire(std::function<void()> deleter) {
+  uint64_t epoch = global_epoch_.fetch_add(1);
+  std::lock_guard<std::mutex> lock(retired_mutex_);
+  retired_.emplace_back(epoch, std::move(deleter));
+}
+
+size_t EpochReclaimer::TryReclaim() {
+  std::vector<std::function<void()>> deleters;
+  size_t pending = 0;
+  {
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    uint64_t min_active = GetMinActiveEpoch();
+    auto kept = retired_.begin();
+    for (auto iter = retired_.begin(); iter != retired_.end(); ++iter) {
+      // Readers entered at an epoch later than retirement cannot see it.
+      if (iter->first < min_active) {
+        deleters.push_back(std::move(iter->second));
+      } else {
+        *kept++ = std::move(*iter);
+      }
+    }
+    retired_.erase(kept, retired_.end());
+    pending = retired_.size();
+  }
+  for (auto& deleter : deleters) deleter();
+  return pending;
+}
+
+EpochReclaimer::Slot* EpochReclaimer::AcquireSlot() {
+  for (Slot* slot = slots_.load(); slot != nullptr; slot = slot->next) {
+    bool expected = false;
+    if (!slot->in_use.load() &&
+        slot->in_use.compare_exchange_strong(expected, true)) {
+      return slot;
+    }
+  }
+  auto* slot = new Slot;
+  slot->in_use.store(true);
+  Slot* head = slots_.load();
+  do {
+    slot->next = head;
+  } while (!slots_.compare_exchange_weak(head, slot));
+  return slot;
+}
+
+EpochReclaimer::LocalState* EpochReclaimer::GetLocalState() {
+  for (auto& state : local_states) {
+    if (state.first == this) {
+      return static_cast<LocalState*>(state.second.get());
+    }
+  }
+  std::shared_ptr<LocalState> state = std::make_shared<LocalState>();
+  state->slot = AcquireSlot();
+  local_states.emplace_back(this, state);
+  return state.get();
+}
+
+uint64_t EpochReclaimer::GetMinActiveEpoch() const {
+  uint64_t min_epoch = std::numeric_limits<uint64_t>::max();
+  for (Slot* slot = slots_.load(); slot != nullptr; slot = slot->next) {
+    uint64_t epoch = slot->epoch.load();
+    if (epoch != 0 && epoch < min_epoch) min_epoch = epoch;
+  }
+  return min_epoch;
+}
+
+}  // namespace reflection
@@ -0,0 +1,89 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace reflection {
+
+/**
+ * Epoch-based memory reclamation. Readers enter a critical section with a
+ * Guard, which costs one store to a thread-owned slot and never locks.
+ * Writers unpublish an object (e.g. swap an atomic pointer), then Retire() it;
+ * it is freed once every reader that might still hold it has left its
+ * critical section.
+ *
+ * Usage:
+ *   // reader
+ *   EpochReclaimer::Guard guard(&reclaimer);
+ *   const Table* table = table_.load();
+ *   // ... use table, never keep it after guard is destroyed
+ *
+ *   // writer
+ *   const Table* old = table_.exchange(new_table);
+ *   reclaimer.Retire([old]() { delete old; });
+ *   reclaimer.TryReclaim();
+ */
+class EpochReclaimer {
+ private:
+  struct LocalState;
+
+ public:
+  // Keep the calling thread inside a critical section while alive. Guards can
+  // be nested.
+  class Guard {
+   public:
+    explicit Guard(EpochReclaimer* reclaimer);
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    LocalState* state_;
+  };
+
+  EpochReclaimer() = default;
+  EpochReclaimer(const EpochReclaimer&) = delete;
+  EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+  // Run every pending deleter. No reader should be active.
+  ~EpochReclaimer();
+
+  // Schedule |deleter| to run once no reader can observe the object it frees.
+  // The object should already be unreachable for new readers.
+  void Retire(std::function<void()> deleter);
+
+  // Run deleters of objects no longer visible to any reader. Return the number
+  // of objects still pending.
+  size_t TryReclaim();
+
+ private:
+  // Per-thread announcement of the epoch a reader entered at. 0 means the
+  // thread is not reading. Slots are never freed, so that exiting threads can
+  // always release theirs.
+  struct Slot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> in_use{false};
+    Slot* next{nullptr};
+  };
+
+  Slot* AcquireSlot();
+
+  LocalState* GetLocalState();
+
+  uint64_t GetMinActiveEpoch() const;
+
+  std::atomic<uint64_t> global_epoch_{1};
+  std::atomic<Slot*> slots_{nullptr};
+
+  std::mutex retired_mutex_;
+  std::vector<std::pair<uint64_t, std::function<void()>>> retired_;
+};
+
+}  // namespace reflection
@@ -0,0 +1,505 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/field_index.h"
+
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <cmath>
+#include <unordered_map>
+
+#include "src/field_path.h"
+
+namespace reflection {
+
+namespace {
+
+const double kTwoPow63 = 9223372036854775808.0;
+const double kTwoPow64 = 18446744073709551616.0;
+
+// Row ids are 32 bits, so that key columns stay small.
+const uint64_t kMaxRowCount = uint64_t{1} << 32;
+
+template <typename K>
+using KeyColumn = std::vector<std::pair<K, uint32_t>>;
+
+// Get key type of fields of |primitive_type|. Return false for other fields.
+bool GetKeyType(PrimitiveType primitive_type, KeyType* key_type) {
+  switch (primitive_type) {
+    case PrimitiveType::kBool:
+    case PrimitiveType::kChar:
+    case PrimitiveType::kInt8:
+    case PrimitiveType::kInt16:
+    case PrimitiveType::kInt32:
+    case PrimitiveType::kInt64:
+      *key_type = KeyType::kInt;
+      return true;
+    case PrimitiveType::kUInt8:
+    case PrimitiveType::kUInt16:
+    case PrimitiveType::kUInt32:
+    case PrimitiveType::kUInt64:
+      *key_type = KeyType::kUInt;
+      return true;
+    case PrimitiveType::kFloat:
+    case PrimitiveType::kDouble:
+      *key_type = KeyType::kFloat;
+      return true;
+    case PrimitiveType::kString:
+      *key_type = KeyType::kString;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Compile |path| against |desc| and check that it addresses a key field of
+// |count| rows, few enough to be given ids.
+std::unique_ptr<FieldPath> CompileKeyPath(Descriptor* desc, size_t count,
+                                          const std::string& path,
+                                          KeyType* key_type,
+                                          std::string* error) {
+  if (static_cast<uint64_t>(count) >= kMaxRowCount) {
+    if (error != nullptr) {
+      *error = std::to_string(count) + " rows exceed 32-bit row ids";
+    }
+    return nullptr;
+  }
+  auto compiled = FieldPath::Compile(desc, path, error);
+  if (compiled == nullptr) return nullptr;
+  if (!GetKeyType(compiled->GetResultDescriptor()->GetPrimitiveType(),
+                  key_type)) {
+    if (error != nullptr) {
+      *error = "field " + path + " of type " +
+               compiled->GetResultDescriptor()->GetTypeName() +
+               " is not a scalar, enum or string";
+    }
+    return nullptr;
+  }
+  return compiled;
+}
+
+template <typename Field, typename K>
+void ExtractKeys(const char* rows, size_t count, size_t stride,
+                 const FieldPath& path, KeyColumn<K>* keys) {
+  keys->reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    const void* value = path.Get(rows + i * stride);
+    if (value == nullptr) continue;
+    keys->emplace_back(static_cast<K>(*static_cast<const Field*>(value)), i);
+  }
+}
+
+// Extract keys of every row having one, specialized once by field type.
+template <typename K>
+void ExtractKeys(const void* rows, size_t count, Descriptor* desc,
+                 const FieldPath& path, KeyColumn<K>* keys) {
+  const char* bytes = static_cast<const char*>(rows);
+  size_t stride = desc->size_;
+  switch (path.GetResultDescriptor()->GetPrimitiveType()) {
+    case PrimitiveType::kBool:
+      return ExtractKeys<bool>(bytes, count, stride, path, keys);
+    case PrimitiveType::kChar:
+      return ExtractKeys<char>(bytes, count, stride, path, keys);
+    case PrimitiveType::kInt8:
+      return ExtractKeys<int8_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kInt16:
+      return ExtractKeys<int16_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kInt32:
+      return ExtractKeys<int32_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kInt64:
+      return ExtractKeys<int64_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kUInt8:
+      return ExtractKeys<uint8_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kUInt16:
+      return ExtractKeys<uint16_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kUInt32:
+      return ExtractKeys<uint32_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kUInt64:
+      return ExtractKeys<uint64_t>(bytes, count, stride, path, keys);
+    case PrimitiveType::kFloat:
+      return ExtractKeys<float>(bytes, count, stride, path, keys);
+    case PrimitiveType::kDouble:
+      return ExtractKeys<double>(bytes, count, stride, path, keys);
+    default:
+      return;
+  }
+}
+
+template <>
+void ExtractKeys<string_view>(const void* rows, size_t count, Descriptor* desc,
+                              const FieldPath& path,
+                              KeyColumn<string_view>* keys) {
+  ExtractKeys<std::string>(static_cast<const char*>(rows), count, desc->size_,
+                           path, keys);
+}
+
+template <typename K>
+bool KeyLess(const K& lhs, const K& rhs) {
+  return lhs < rhs;
+}
+
+// NaN after every number, so that ordering is strict weak.
+template <>
+bool KeyLess<double>(const double& lhs, const double& rhs) {
+  return lhs < rhs || (!std::isnan(lhs) && std::isnan(rhs));
+}
+
+template <typename K>
+void SortKeys(SortOrder sort_order, KeyColumn<K>* keys) {
+  if (sort_order == SortOrder::kAscending) {
+    std::stable_sort(keys->begin(), keys->end(),
+                     [](const std::pair<K, uint32_t>& lhs,
+                        const std::pair<K, uint32_t>& rhs) {
+                       return KeyLess(lhs.first, rhs.first);
+                     });
+  } else {
+    std::stable_sort(keys->begin(), keys->end(),
+                     [](const std::pair<K, uint32_t>& lhs,
+                        const std::pair<K, uint32_t>& rhs) {
+                       return KeyLess(rhs.first, lhs.first);
+                     });
+  }
+}
+
+template <typename K>
+void GetSortedOrder(const void* rows, size_t count, Descriptor* desc,
+                    const FieldPath& path, SortOrder sort_order,
+                    std::vector<uint32_t>* order) {
+  KeyColumn<K> keys;
+  ExtractKeys(rows, count, desc, path, &keys);
+  SortKeys(sort_order, &keys);
+  order->clear();
+  order->reserve(count);
+  for (const auto& key : keys) order->push_back(key.second);
+  // Rows without key go last, in row order.
+  if (keys.size() < count) {
+    std::vector<bool> has_key(count, false);
+    for (const auto& key : keys) has_key[key.second] = true;
+    for (size_t i = 0; i < count; ++i) {
+      if (!has_key[i]) order->push_back(i);
+    }
+  }
+}
+
+// Compare keys with probes of their type, strings as views.
+template <typename K>
+const K& ToProbe(const K& key) {
+  return key;
+}
+
+string_view ToProbe(const std::string& key) { return key; }
+
+struct ProbeLess {
+  template <typename Lhs, typename Rhs>
+  bool operator()(const Lhs& lhs, const Rhs& rhs) const {
+    return KeyLess(ToProbe(lhs), ToProbe(rhs));
+  }
+};
+
+struct StringViewHash {
+  size_t operator()(const string_view& str) const {
+    return boost::hash_range(str.begin(), str.end());
+  }
+};
+
+}  // namespace
+
+bool GetSortedOrder(const void* rows, size_t count, Descriptor* desc,
+                    const std::string& path, SortOrder sort_order,
+                    std::vector<uint32_t>* order) {
+  KeyType key_type;
+  auto compiled = CompileKeyPath(desc, count, path, &key_type, nullptr);
+  if (compiled == nullptr) return false;
+  switch (key_type) {
+    case KeyType::kInt:
+      GetSortedOrder<int64_t>(rows, count, desc, *compiled, sort_order, order);
+      break;
+    case KeyType::kUInt:
+      GetSortedOrder<uint64_t>(rows, count, desc, *compiled, sort_order,
+                               order);
+      break;
+    case KeyType::kFloat:
+      GetSortedOrder<double>(rows, count, desc, *compiled, sort_order, order);
+      break;
+    case KeyType::kString:
+      GetSortedOrder<string_view>(rows, count, desc, *compiled, sort_order,
+                                  order);
+      break;
+  }
+  return true;
+}
+
+/* FieldIndex::Tables methods */
+
+// Sorted keys of the key type in use, with ids of their rows. Tables of other
+// key types stay empty.
+struct FieldIndex::Tables {
+  // Rows of a key are [begin, end) in |rows|.
+  struct Range {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  template <typename K, typename Probe = K, typename Hash = std::hash<Probe>>
+  struct Table {
+    std::vector<K> keys;
+    std::vector<uint32_t> rows;
+    // Only for IndexKind::kHash.
+    std::unordered_map<Probe, Range, Hash> ranges;
+
+    template <typename ColumnKey>
+    void Build(IndexKind kind, KeyColumn<ColumnKey>* column) {
+      SortKeys(SortOrder::kAscending, column);
+      keys.reserve(column->size());
+      rows.reserve(column->size());
+      for (const auto& key : *column) {
+        keys.emplace_back(key.first);
+        rows.push_back(key.second);
+      }
+      if (kind != IndexKind::kHash) return;
+      for (size_t begin = 0; begin < keys.size();) {
+        size_t end = begin + 1;
+        while (end < keys.size() && !ProbeLess()(keys[begin], keys[end])) {
+          ++end;
+        }
+        ranges.emplace(ToProbe(keys[begin]),
+                       Range{static_cast<uint32_t>(begin),
+                             static_cast<uint32_t>(end)});
+        begin = end;
+      }
+    }
+
+    RowSpan Find(IndexKind kind, const Probe& key) const {
+      if (kind == IndexKind::kHash) {
+        auto iter = ranges.find(key);
+        if (iter == ranges.end()) return RowSpan();
+        return GetRows(iter->second.begin, iter->second.end);
+      }
+      auto range = std::equal_range(keys.begin(), keys.end(), key, ProbeLess());
+      return GetRows(range.first - keys.begin(), range.second - keys.begin());
+    }
+
+    // Get position of the first key not less than |key|.
+    size_t LowerBound(const Probe& key) const {
+      return std::lower_bound(keys.begin(), keys.end(), key, ProbeLess()) -
+             keys.begin();
+    }
+
+    RowSpan GetRows(size_t begin, size_t end) const {
+      if (begin >= end) return RowSpan();
+      return RowSpan(rows.data() + begin, rows.data() + end);
+    }
+  };
+
+  Table<int64_t> int_table;
+  Table<uint64_t> uint_table;
+  Table<double> float_table;
+  Table<std::string, string_view, StringViewHash> string_table;
+
+  // Convert |key| to the key type exactly. Return false if no key of the type
+  // equals it.
+  static bool ToInt(const Key& key, int64_t* value) {
+    switch (key.type) {
+      case KeyType::kInt:
+        *value = key.int_value;
+        return true;
+      case KeyType::kUInt:
+        *value = key.uint_value;
+        return key.uint_value <= static_cast<uint64_t>(INT64_MAX);
+      case KeyType::kFloat:
+        if (!(key.float_value >= -kTwoPow63 && key.float_value < kTwoPow63)) {
+          return false;
+        }
+        *value = key.float_value;
+        return *value == key.float_value;
+      default:
+        return false;
+    }
+  }
+
+  static bool ToUInt(const Key& key, uint64_t* value) {
+    switch (key.type) {
+      case KeyType::kInt:
+        *value = key.int_value;
+        return key.int_value >= 0;
+      case KeyType::kUInt:
+        *value = key.uint_value;
+        return true;
+      case KeyType::kFloat:
+        if (!(key.float_value >= 0 && key.float_value < kTwoPow64)) {
+          return false;
+        }
+        *value = key.float_value;
+        return *value == key.float_value;
+      default:
+        return false;
+    }
+  }
+
+  static bool ToFloat(const Key& key, double* value) {
+    switch (key.type) {
+      case KeyType::kInt:
+        *value = key.int_value;
+        return true;
+      case KeyType::kUInt:
+        *value = key.uint_value;
+        return true;
+      case KeyType::kFloat:
+        *value = key.float_value;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Get position of the first key not less than |bound| in a table. Number
+  // bounds of integer tables are rounded up, and NaN is past every number.
+  static size_t LowerBound(const Table<int64_t>& table, const Key& bound) {
+    int64_t value;
+    if (bound.type == KeyType::kFloat) {
+      double rounded = std::ceil(bound.float_value);
+      if (rounded < -kTwoPow63) return 0;
+      if (!(rounded < kTwoPow63)) return table.keys.size();
+      value = rounded;
+    } else if (!ToInt(bound, &value)) {
+      return table.keys.size();
+    }
+    return table.LowerBound(value);
+  }
+
+  static size_t LowerBound(const Table<uint64_t>& table, const Key& bound) {
+    uint64_t value;
+    if (bound.type == KeyType::kFloat) {
+      double rounded = std::ceil(bound.float_value);
+      if (rounded < 0) return 0;
+      if (!(rounded < kTwoPow64)) return table.keys.size();
+      value = rounded;
+    } else if (bound.type == KeyType::kInt && bound.int_value < 0) {
+      return 0;
+    } else if (!ToUInt(bound, &value)) {
+      return table.keys.size();
+    }
+    return table.LowerBound(value);
+  }
+
+  static size_t LowerBound(const Table<double>& table, const Key& bound) {
+    double value;
+    if (!ToFloat(bound, &value)) return table.keys.size();
+    return table.LowerBound(value);
+  }
+
+  static size_t LowerBound(
+      const Table<std::string, string_view, StringViewHash>& table,
+      const Key& bound) {
+    if (bound.type != KeyType::kString) return table.keys.size();
+    return table.LowerBound(bound.string_value);
+  }
+
+  template <typename T>
+  static RowSpan FindRange(const T& table, const Key& lower,
+                           const Key& upper) {
+    return table.GetRows(LowerBound(table, lower), LowerBound(table, upper));
+  }
+};
+
+/* FieldIndex methods */
+
+std::unique_ptr<FieldIndex> FieldIndex::Build(const void* rows, size_t count,
+                                              Descriptor* desc,
+                                              const std::string& path,
+                                              IndexKind kind,
+                                              std::string* error) {
+  KeyType key_type;
+  auto compiled = CompileKeyPath(desc, count, path, &key_type, error);
+  if (compiled == nullptr) return nullptr;
+  std::unique_ptr<FieldIndex> index(new FieldIndex(kind, key_type));
+  Tables* tables = index->tables_.get();
+  switch (key_type) {
+    case KeyType::kInt: {
+      KeyColumn<int64_t> column;
+      ExtractKeys(rows, count, desc, *compiled, &column);
+      tables->int_table.Build(kind, &column);
+      break;
+    }
+    case KeyType::kUInt: {
+      KeyColumn<uint64_t> column;
+      ExtractKeys(rows, count, desc, *compiled, &column);
+      tables->uint_table.Build(kind, &column);
+      break;
+    }
+    case KeyType::kFloat: {
+      KeyColumn<double> column;
+      ExtractKeys(rows, count, desc, *compiled, &column);
+      tables->float_table.Build(kind, &column);
+      break;
+    }
+    case KeyType::kString: {
+      KeyColumn<string_view> column;
+      ExtractKeys(rows, count, desc, *compiled, &column);
+      tables->string_table.Build(kind, &column);
+      break;
+    }
+  }
+  return index;
+}
+
+FieldIndex::FieldIndex(IndexKind kind, KeyType key_type)
+    : kind_(kind), key_type_(key_type), tables_(new Tables) {}
+
+FieldIndex::~FieldIndex() {}
+
+size_t FieldIndex::GetSize() const {
+  switch (key_type_) {
+    case KeyType::kInt:
+      return tables_->int_table.rows.size();
+    case KeyType::kUInt:
+      return tables_->uint_table.rows.size();
+    case KeyType::kFloat:
+      return tables_->float_table.rows.size();
+    case KeyType::kString:
+      return tables_->string_table.rows.size();
+  }
+  return 0;
+}
+
+FieldIndex::RowSpan FieldIndex::FindKey(const Key& key) const {
+  switch (key_type_) {
+    case KeyType::kInt: {
+      int64_t value;
+      if (!Tables::ToInt(key, &value)) return RowSpan();
+      return tables_->int_table.Find(kind_, value);
+    }
+    case KeyType::kUInt: {
+      uint64_t value;
+      if (!Tables::ToUInt(key, &value)) return RowSpan();
+      return tables_->uint_table.Find(kind_, value);
+    }
+    case KeyType::kFloat: {
+      double value;
+      if (!Tables::ToFloat(key, &value) || std::isnan(value)) {
+        return RowSpan();
+      }
+      return tables_->float_table.Find(kind_, value);
+    }
+    case KeyType::kString:
+      if (key.type != KeyType::kString) return RowSpan();
+      return tables_->string_table.Find(kind_, key.string_value);
+  }
+  return RowSpan();
+}
+
+FieldIndex::RowSpan FieldIndex::FindKeyRange(const Key& lower,
+                                             const Key& upper) const {
+  switch (key_type_) {
+    case KeyType::kInt:
+      return Tables::FindRange(tables_->int_table, lower, upper);
+    case KeyType::kUInt:
+      return Tables::FindRange(tables_->uint_table, lower, upper);
+    case KeyType::kFloat:
+      return Tables::FindRange(tables_->float_table, lower, upper);
+    case KeyType::kString:
+      return Tables::FindRange(tables_->string_table, lower, upper);
+  }
+  return RowSpan();
+}
+
+}  // namespace reflection
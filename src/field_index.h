@@ -0,0 +1,193 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * Sort and lookup of arrays of reflected objects by a field chosen at runtime,
+ * addressed by a field path (see field_path.h), e.g. "pose.timestamp".
+ *
+ * Keys are extracted once into a typed column before anything is compared, so
+ * sorting and lookups compare native integers, doubles or strings without
+ * going through descriptors. Fields must be scalars, enums (compared by
+ * underlying value) or strings. Rows where the path can't be followed, e.g.
+ * through a null pointer, have no key: they are sorted last and never found.
+ *
+ * Usage:
+ *   SortByField(&obstacles, "distance_");
+ *
+ *   auto index = FieldIndex::Build(obstacles, "track_id_", IndexKind::kHash);
+ *   for (uint32_t row : index->Find(42)) Handle(obstacles[row]);
+ */
+
+// Type keys of a field are compared as, by its primitive type.
+enum class KeyType : uint8_t {
+  // bool, char, signed integers.
+  kInt = 0,
+  // Unsigned integers.
+  kUInt,
+  // float, double. NaN sorts after every number and equals nothing.
+  kFloat,
+  kString,
+};
+
+enum class SortOrder : uint8_t {
+  kAscending = 0,
+  kDescending,
+};
+
+// Get ids of |count| rows described by |desc| stored contiguously from |rows|
+// into |order|, sorted by the field at |path|. Rows of equal keys keep their
+// relative order. Return false if |path| doesn't address a scalar, enum or
+// string field, or if there are 2^32 rows or more, as ids are 32 bits.
+bool GetSortedOrder(const void* rows, size_t count, Descriptor* desc,
+                    const std::string& path, SortOrder sort_order,
+                    std::vector<uint32_t>* order);
+
+// Sort |rows| in place by the field at |path|, see GetSortedOrder().
+template <typename T>
+bool SortByField(std::vector<T>* rows, const std::string& path,
+                 SortOrder sort_order = SortOrder::kAscending) {
+  std::vector<uint32_t> order;
+  if (!GetSortedOrder(rows->data(), rows->size(),
+                      DescriptorAccessor<T>::Get(), path, sort_order,
+                      &order)) {
+    return false;
+  }
+  std::vector<T> sorted;
+  sorted.reserve(rows->size());
+  for (uint32_t row : order) sorted.push_back(std::move((*rows)[row]));
+  rows->swap(sorted);
+  return true;
+}
+
+enum class IndexKind : uint8_t {
+  // Sorted keys only. Find() is a binary search.
+  kSorted = 0,
+  // Sorted keys and a hash table of distinct keys. Find() is a hash probe.
+  kHash,
+};
+
+/**
+ * Secondary index of an array of reflected objects by one field. Keys are
+ * copied at build time, so the index stays consistent if rows change, but
+ * doesn't follow them: rebuild it after changes.
+ */
+class FieldIndex {
+ public:
+  // Contiguous ids of rows, valid until the index is destroyed.
+  class RowSpan {
+   public:
+    RowSpan() {}
+    RowSpan(const uint32_t* begin, const uint32_t* end)
+        : begin_(begin), end_(end) {}
+
+    const uint32_t* begin() const { return begin_; }
+    const uint32_t* end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+
+   private:
+    const uint32_t* begin_{nullptr};
+    const uint32_t* end_{nullptr};
+  };
+
+  // Index |count| rows described by |desc| stored contiguously from |rows| by
+  // the field at |path|. Return nullptr if |path| doesn't address a scalar,
+  // enum or string field, or if there are 2^32 rows or more, with the reason
+  // written into |error| if given.
+  static std::unique_ptr<FieldIndex> Build(const void* rows, size_t count,
+                                           Descriptor* desc,
+                                           const std::string& path,
+                                           IndexKind kind,
+                                           std::string* error = nullptr);
+
+  template <typename T>
+  static std::unique_ptr<FieldIndex> Build(const std::vector<T>& rows,
+                                           const std::string& path,
+                                           IndexKind kind,
+                                           std::string* error = nullptr) {
+    return Build(rows.data(), rows.size(), DescriptorAccessor<T>::Get(), path,
+                 kind, error);
+  }
+
+  ~FieldIndex();
+
+  FieldIndex(const FieldIndex&) = delete;
+  FieldIndex& operator=(const FieldIndex&) = delete;
+
+  IndexKind GetKind() const { return kind_; }
+
+  KeyType GetKeyType() const { return key_type_; }
+
+  // Get number of indexed rows, rows without key excluded.
+  size_t GetSize() const;
+
+  // Get ids of rows whose key equals |key|, in row order. Numbers are
+  // converted to the key type, so e.g. Find(3) works on a double field, and
+  // strings match string fields only.
+  template <typename K>
+  RowSpan Find(const K& key) const {
+    return FindKey(MakeKey(key, std::is_arithmetic<K>()));
+  }
+
+  // Get ids of rows whose key is in [lower, upper), in key order.
+  template <typename Lower, typename Upper>
+  RowSpan FindRange(const Lower& lower, const Upper& upper) const {
+    return FindKeyRange(MakeKey(lower, std::is_arithmetic<Lower>()),
+                        MakeKey(upper, std::is_arithmetic<Upper>()));
+  }
+
+ private:
+  // Probe key, of the type of argument given to Find().
+  struct Key {
+    KeyType type;
+    int64_t int_value;
+    uint64_t uint_value;
+    double float_value;
+    string_view string_value;
+  };
+
+  struct Tables;
+
+  FieldIndex(IndexKind kind, KeyType key_type);
+
+  template <typename K>
+  static Key MakeKey(const K& key, std::true_type) {
+    Key result{KeyType::kInt, 0, 0, static_cast<double>(key), string_view()};
+    if (std::is_floating_point<K>::value) {
+      result.type = KeyType::kFloat;
+    } else if (std::is_signed<K>::value) {
+      result.int_value = static_cast<int64_t>(key);
+    } else {
+      result.type = KeyType::kUInt;
+      result.uint_value = static_cast<uint64_t>(key);
+    }
+    return result;
+  }
+
+  template <typename K>
+  static Key MakeKey(const K& key, std::false_type) {
+    return Key{KeyType::kString, 0, 0, 0, string_view(key)};
+  }
+
+  RowSpan FindKey(const Key& key) const;
+
+  RowSpan FindKeyRange(const Key& lower, const Key& upper) const;
+
+  IndexKind kind_;
+  KeyType key_type_;
+  std::unique_ptr<Tables> tables_;
+};
+
+}  // namespace reflection
@@ -0,0 +1,328 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/field_path.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+
+#include <boost/functional/hash.hpp>
+
+namespace reflection {
+
+namespace {
+
+// Paths got last by a thread from any FieldPathCache, replaced in turn.
+const size_t kRecentPathSize = 4;
+
+struct RecentPath {
+  uint64_t cache_id{0};
+  const Descriptor* root{nullptr};
+  std::string path;
+  std::shared_ptr<const FieldPath> compiled;
+};
+
+struct RecentPaths {
+  RecentPath paths[kRecentPathSize];
+  size_t next{0};
+};
+
+std::atomic<uint64_t> g_next_cache_id{1};
+
+bool IsNameChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+bool ParseInt64(const std::string& text, int64_t* value) {
+  if (text.empty()) return false;
+  errno = 0;
+  char* end = nullptr;
+  long long parsed = std::strtoll(text.c_str(), &end, 10);
+  if (errno != 0 || end != text.c_str() + text.size()) return false;
+  *value = parsed;
+  return true;
+}
+
+bool SetError(std::string* error, const std::string& path, size_t pos,
+              const std::string& reason) {
+  if (error != nullptr) {
+    *error = StringUtil::Concat("invalid path \"", path, "\" at ", pos, ": ",
+                                reason);
+  }
+  return false;
+}
+
+// Build key of |key_desc| from text inside brackets.
+std::shared_ptr<const void> MakeKey(const Descriptor* key_desc,
+                                    const std::string& text) {
+  if (key_desc == DescriptorAccessor<std::string>::Get()) {
+    if (text.size() >= 2 && (text.front() == '"' || text.front() == '\'') &&
+        text.back() == text.front()) {
+      return std::make_shared<std::string>(text.substr(1, text.size() - 2));
+    }
+    return std::make_shared<std::string>(text);
+  }
+  int64_t value = 0;
+  if (!ParseInt64(text, &value)) return nullptr;
+  if (key_desc == DescriptorAccessor<int64_t>::Get()) {
+    return std::make_shared<int64_t>(value);
+  }
+  if (key_desc == DescriptorAccessor<int32_t>::Get()) {
+    if (value < std::numeric_limits<int32_t>::min() ||
+        value > std::numeric_limits<int32_t>::max()) {
+      return nullptr;
+    }
+    return std::make_shared<int32_t>(static_cast<int32_t>(value));
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+/* FieldPath methods */
+
+std::unique_ptr<FieldPath> FieldPath::Compile(Descriptor* root,
+                                              const std::string& path,
+                                              std::string* error) {
+  if (root == nullptr) {
+    SetError(error, path, 0, "null root descriptor");
+    return nullptr;
+  }
+  std::unique_ptr<FieldPath> compiled(new FieldPath);
+  compiled->path_ = path;
+  compiled->root_ = root;
+
+  Descriptor* curr = root;
+  size_t offset = 0;
+  // Dereference smart pointers before stepping into their content.
+  auto deref = [&]() {
+    while (auto* smart_ptr = SmartPtrDescriptor::ToSmartPtrDescriptor(curr)) {
+      Step step;
+      step.op = Op::kDeref;
+      step.offset = offset;
+      step.smart_ptr = smart_ptr;
+      compiled->steps_.push_back(std::move(step));
+      offset = 0;
+      curr = smart_ptr->GetContentDescriptor();
+    }
+  };
+
+  size_t pos = 0;
+  while (pos < path.size()) {
+    if (path[pos] == '[') {
+      size_t end = path.find(']', pos);
+      if (end == std::string::npos) {
+        SetError(error, path, pos, "unclosed '['");
+        return nullptr;
+      }
+      std::string text = path.substr(pos + 1, end - pos - 1);
+      deref();
+      auto* container = ContainerDescriptor::ToContainerDescriptor(curr);
+      if (container == nullptr) {
+        SetError(error, path, pos, "not a container");
+        return nullptr;
+      }
+      Step step;
+      step.offset = offset;
+      step.container = container;
+      if (container->GetKeyDescriptor() != nullptr) {
+        step.op = Op::kKey;
+        step.key = MakeKey(container->GetKeyDescriptor(), text);
+        if (step.key == nullptr) {
+          SetError(error, path, pos + 1, "unsupported key");
+          return nullptr;
+        }
+      } else {
+        int64_t index = -1;
+        if (!ParseInt64(text, &index) || index < 0 ||
+            index > std::numeric_limits<int32_t>::max()) {
+          SetError(error, path, pos + 1, "invalid index");
+          return nullptr;
+        }
+        step.op = Op::kIndex;
+        step.index = static_cast<int32_t>(index);
+      }
+      compiled->steps_.push_back(std::move(step));
+      offset = 0;
+      curr = container->GetValueDescriptor();
+      pos = end + 1;
+      continue;
+    }
+
+    if (pos > 0) {
+      if (path[pos] != '.') {
+        SetError(error, path, pos, "expect '.' or '['");
+        return nullptr;
+      }
+      ++pos;
+    }
+    size_t end = pos;
+    while (end < path.size() && IsNameChar(path[end])) ++end;
+    if (end == pos) {
+      SetError(error, path, pos, "expect field name");
+      return nullptr;
+    }
+    std::string name = path.substr(pos, end - pos);
+    deref();
+    auto* class_desc = ClassDescriptor::ToClassDescriptor(curr);
+    if (class_desc == nullptr) {
+      SetError(error, path, pos, "not a reflected class");
+      return nullptr;
+    }
+    int32_t id = class_desc->GetFieldId(name);
+    if (id < 0) {
+      SetError(error, path, pos, StringUtil::Concat("no field ", name));
+      return nullptr;
+    }
+    offset += class_desc->GetFieldOffset(id);
+    curr = class_desc->GetDescriptorById(id);
+    pos = end;
+  }
+
+  compiled->tail_offset_ = offset;
+  compiled->result_ = curr;
+  return compiled;
+}
+
+const void* FieldPath::Get(const void* obj) const {
+  const char* ptr = static_cast<const char*>(obj);
+  for (const auto& step : steps_) {
+    if (ptr == nullptr) return nullptr;
+    ptr += step.offset;
+    switch (step.op) {
+      case Op::kIndex:
+        ptr = static_cast<const char*>(
+            step.container->GetValueByIndex(ptr, step.index));
+        break;
+      case Op::kKey:
+        ptr = static_cast<const char*>(
+            step.container->GetValueByKey(ptr, step.key.get()));
+        break;
+      case Op::kDeref:
+        ptr = static_cast<const char*>(step.smart_ptr->GetRawPtr(ptr));
+        break;
+    }
+  }
+  if (ptr == nullptr) return nullptr;
+  return ptr + tail_offset_;
+}
+
+void* FieldPath::Mutable(void* obj) const {
+  char* ptr = static_cast<char*>(obj);
+  for (const auto& step : steps_) {
+    if (ptr == nullptr) return nullptr;
+    ptr += step.offset;
+    switch (step.op) {
+      case Op::kIndex:
+        ptr = static_cast<char*>(
+            step.container->MutableValueByIndex(ptr, step.index));
+        break;
+      case Op::kKey:
+        ptr = static_cast<char*>(
+            step.container->MutableValueByKey(ptr, step.key.get()));
+        break;
+      case Op::kDeref:
+        ptr = static_cast<char*>(step.smart_ptr->GetMutableRawPtr(ptr));
+        break;
+    }
+  }
+  if (ptr == nullptr) return nullptr;
+  return ptr + tail_offset_;
+}
+
+/* FieldPathCache methods */
+
+size_t FieldPathCache::KeyHash::operator()(const Key& key) const {
+  size_t seed = boost::hash_range(key.path.begin(), key.path.end());
+  boost::hash_combine(seed, key.root);
+  return seed;
+}
+
+FieldPathCache::FieldPathCache(size_t capacity)
+    : capacity_(capacity),
+      id_(g_next_cache_id++),
+      unregister_count_(ClassReflFactory::Get().GetUnregisterCount()) {}
+
+std::shared_ptr<const FieldPath> FieldPathCache::Get(Descriptor* root,
+                                                     const std::string& path) {
+  // Paths are usually got a few at a time over and over, such as per request
+  // of a server, so the last ones of this thread are checked first.
+  thread_local RecentPaths recent;
+  uint64_t unregister_count = ClassReflFactory::Get().GetUnregisterCount();
+  if (unregister_count != unregister_count_.load(std::memory_order_acquire)) {
+    DropUnregistered(unregister_count);
+  }
+  uint64_t id = id_.load(std::memory_order_acquire);
+  for (const auto& entry : recent.paths) {
+    if (entry.cache_id == id && entry.root == root && entry.path == path) {
+      return entry.compiled;
+    }
+  }
+  std::shared_ptr<const FieldPath> compiled = GetShared(root, path);
+  RecentPath& entry = recent.paths[recent.next];
+  recent.next = (recent.next + 1) % kRecentPathSize;
+  entry.cache_id = id;
+  entry.root = root;
+  entry.path = path;
+  entry.compiled = compiled;
+  return compiled;
+}
+
+std::shared_ptr<const FieldPath> FieldPathCache::GetShared(
+    Descriptor* root, const std::string& path) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = index_.find(Key{root, path});
+    if (iter != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, iter->second);
+      return iter->second->compiled;
+    }
+  }
+
+  // Compile without holding the lock. Racing threads may compile the same
+  // path, the first insertion wins.
+  std::shared_ptr<const FieldPath> compiled = FieldPath::Compile(root, path);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = index_.find(Key{root, path});
+  if (iter != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, iter->second);
+    return iter->second->compiled;
+  }
+  entries_.push_front(Entry{root, path, compiled});
+  index_.emplace(Key{root, entries_.front().path}, entries_.begin());
+  while (entries_.size() > capacity_ && entries_.size() > 1) {
+    const Entry& oldest = entries_.back();
+    index_.erase(Key{oldest.root, oldest.path});
+    entries_.pop_back();
+  }
+  return compiled;
+}
+
+size_t FieldPathCache::GetSize() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void FieldPathCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ClearLocked();
+}
+
+void FieldPathCache::DropUnregistered(uint64_t unregister_count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (unregister_count_.load(std::memory_order_relaxed) == unregister_count) {
+    return;
+  }
+  ClearLocked();
+  unregister_count_.store(unregister_count, std::memory_order_release);
+}
+
+void FieldPathCache::ClearLocked() {
+  id_.store(g_next_cache_id++, std::memory_order_release);
+  index_.clear();
+  entries_.clear();
+}
+
+}  // namespace reflection
@@ -0,0 +1,164 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * A field path compiled against a root descriptor, so that deep fields can be
+ * addressed by string without walking descriptors on every access.
+ *
+ * Syntax:
+ *   a.b.c          reflected fields of classes
+ *   v[3]           value of vector or set by index
+ *   m[12], m[key]  value of map by key. Keys can be int32_t, int64_t or
+ *   m["key"]       std::string. String keys can be quoted with '' or "".
+ * Smart pointers on the way are dereferenced automatically, e.g. "p.a" for a
+ * std::unique_ptr<A> p.
+ *
+ * Compilation folds consecutive field offsets into one and binds every
+ * container or smart pointer step to its descriptor, so an access costs one
+ * pointer addition per run of fields plus one call per dynamic step.
+ *
+ * Usage:
+ *   auto path = FieldPath::Compile(DESC("A"), "b.items[3].name");
+ *   const auto* name =
+ *       static_cast<const std::string*>(path->Get(&a));  // nullptr if absent
+ */
+class FieldPath {
+ public:
+  // Compile |path| against |root|. Return nullptr if path is malformed or
+  // doesn't match descriptors, with the reason written into |error| if given.
+  static std::unique_ptr<FieldPath> Compile(Descriptor* root,
+                                            const std::string& path,
+                                            std::string* error = nullptr);
+
+  // Get const pointer to the addressed value in |obj|. Return nullptr if any
+  // step fails, e.g. index out of range, absent key or null smart pointer.
+  const void* Get(const void* obj) const;
+
+  // Get non-const pointer to the addressed value in |obj|. Missing map keys
+  // are not inserted. Return nullptr if any step fails.
+  void* Mutable(void* obj) const;
+
+  // Get descriptor of root type.
+  Descriptor* GetRootDescriptor() const { return root_; }
+
+  // Get descriptor of the addressed value.
+  Descriptor* GetResultDescriptor() const { return result_; }
+
+  const std::string& GetPath() const { return path_; }
+
+  // Get number of dynamic (container or smart pointer) steps.
+  size_t GetStepSize() const { return steps_.size(); }
+
+ private:
+  enum class Op : uint8_t { kIndex, kKey, kDeref };
+
+  // Add |offset| to current address, then apply |op|.
+  struct Step {
+    Op op;
+    size_t offset{0};
+    ContainerDescriptor* container{nullptr};
+    SmartPtrDescriptor* smart_ptr{nullptr};
+    int32_t index{0};
+    // Key in its actual type (int32_t, int64_t or std::string).
+    std::shared_ptr<const void> key;
+  };
+
+  FieldPath() = default;
+
+  std::string path_;
+  Descriptor* root_{nullptr};
+  Descriptor* result_{nullptr};
+  std::vector<Step> steps_;
+  // Offset added after the last step.
+  size_t tail_offset_{0};
+};
+
+/**
+ * Thread-safe LRU cache of compiled paths keyed by (root descriptor, path).
+ * The last few paths got by each thread are found again without locking, even
+ * if evicted meanwhile. Other hits cost one locked hash probe without
+ * allocation. Paths failing to compile are cached too. Callers getting the
+ * same path over and over should rather keep the compiled FieldPath, which
+ * costs nothing to look up. All paths are dropped whenever a class is
+ * unregistered, as freed descriptors can be followed by new ones at the same
+ * address; paths already got must not be used past it.
+ *
+ * Usage:
+ *   FieldPathCache cache;
+ *   auto path = cache.Get(desc, "b.items[3].name");
+ *   if (path != nullptr) value = path->Get(obj);
+ */
+class FieldPathCache {
+ public:
+  explicit FieldPathCache(size_t capacity = 1024);
+
+  FieldPathCache(const FieldPathCache&) = delete;
+  FieldPathCache& operator=(const FieldPathCache&) = delete;
+
+  // Get |path| compiled against |root|, compiling it on miss. Return nullptr
+  // if path can't be compiled. Returned path stays valid after eviction.
+  std::shared_ptr<const FieldPath> Get(Descriptor* root,
+                                       const std::string& path);
+
+  size_t GetSize() const;
+
+  void Clear();
+
+ private:
+  struct Entry {
+    const Descriptor* root;
+    std::string path;
+    std::shared_ptr<const FieldPath> compiled;
+  };
+
+  // Views path of an Entry, or of the caller's string during lookup.
+  struct Key {
+    const Descriptor* root;
+    string_view path;
+
+    bool operator==(const Key& other) const {
+      return root == other.root && path == other.path;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  // Get() past the per-thread paths, under the lock.
+  std::shared_ptr<const FieldPath> GetShared(Descriptor* root,
+                                             const std::string& path);
+
+  // Clear() if classes were unregistered since paths were cached, see
+  // ClassReflFactory::GetUnregisterCount().
+  void DropUnregistered(uint64_t unregister_count);
+
+  void ClearLocked();
+
+  size_t capacity_;
+  // Identifies entries of this cache among per-thread paths. Replaced by
+  // Clear(), which drops them all at once.
+  std::atomic<uint64_t> id_;
+  // Unregister count of the factory when paths were last dropped.
+  std::atomic<uint64_t> unregister_count_;
+  mutable std::mutex mutex_;
+  // Most recently used first. List nodes never move, so keys can view them.
+  std::list<Entry> entries_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+};
+
+}  // namespace reflection
@@ -0,0 +1,207 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/footprint.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "src/object_walker.h"
+
+namespace reflection {
+
+namespace {
+
+// Sum heap bytes of every node, and attribute them to fields of root class.
+class FootprintVisitor : public ObjectVisitor {
+ public:
+  FootprintVisitor(const FootprintOptions& options, int32_t field_size)
+      : options_(options), field_heap_bytes_(field_size, 0) {}
+
+  WalkAction PreVisitClass(const WalkNode& node) override {
+    Add(node, node.desc->GetHeapBytes(node.obj));
+    return WalkAction::kContinue;
+  }
+
+  WalkAction PreVisitContainer(const WalkNode& node) override {
+    Add(node, node.desc->GetHeapBytes(node.obj));
+    auto* desc = ContainerDescriptor::ToContainerDescriptor(node.desc);
+    size_t size = desc->GetContainerSize(node.obj);
+    if (options_.sample_threshold == 0 || size <= options_.sample_threshold) {
+      return WalkAction::kContinue;
+    }
+    Add(node, SampleElements(desc, node.obj, size));
+    sampled_ = true;
+    return WalkAction::kSkipChildren;
+  }
+
+  WalkAction PreVisitSmartPtr(const WalkNode& node) override {
+    // Shared content reached again is already counted.
+    Add(node, node.revisit ? 0 : node.desc->GetHeapBytes(node.obj));
+    return WalkAction::kContinue;
+  }
+
+  WalkAction PreVisitVariant(const WalkNode& node) override {
+    Add(node, node.desc->GetHeapBytes(node.obj));
+    return WalkAction::kContinue;
+  }
+
+  WalkAction VisitMessage(const WalkNode& node) override {
+    Add(node, node.desc->GetHeapBytes(node.obj));
+    return WalkAction::kContinue;
+  }
+
+  WalkAction VisitLeaf(const WalkNode& node) override {
+    Add(node, node.desc->GetHeapBytes(node.obj));
+    return WalkAction::kContinue;
+  }
+
+  size_t GetHeapBytes() const { return heap_bytes_; }
+
+  const std::vector<size_t>& GetFieldHeapBytes() const {
+    return field_heap_bytes_;
+  }
+
+  bool IsSampled() const { return sampled_; }
+
+ private:
+  void Add(const WalkNode& node, size_t bytes) {
+    // Nodes are visited depth-first, so everything after a field of root and
+    // before the next one belongs to it.
+    if (node.depth == 1 && node.edge == WalkEdge::kField) {
+      current_field_ = node.index;
+    }
+    heap_bytes_ += bytes;
+    if (node.depth >= 1 && current_field_ >= 0 &&
+        current_field_ < static_cast<int64_t>(field_heap_bytes_.size())) {
+      field_heap_bytes_[current_field_] += bytes;
+    }
+  }
+
+  // Walk about options_.sample_size evenly spaced elements, and extrapolate
+  // their nested heap to all |size| elements.
+  size_t SampleElements(ContainerDescriptor* desc, const void* obj,
+                        size_t size) {
+    ObjectWalker walker;
+    FootprintVisitor visitor(options_, 0);
+    Descriptor* key_desc = desc->GetKeyDescriptor();
+    Descriptor* value_desc = desc->GetValueDescriptor();
+    size_t sample_size = std::max<size_t>(options_.sample_size, 1);
+    size_t sampled = 0;
+    auto walk = [&](const void* key, const void* value) {
+      if (key != nullptr) walker.Walk(key, key_desc, &visitor);
+      walker.Walk(value, value_desc, &visitor);
+      ++sampled;
+      return true;
+    };
+
+    // Jump to sampled partitions directly when possible.
+    size_t partition_size = desc->GetPartitionSize(obj);
+    if (partition_size > 0) {
+      size_t stride = std::max<size_t>(partition_size / sample_size, 1);
+      for (size_t i = 0; i < partition_size; i += stride) {
+        desc->ForEachElementInPartitions(obj, i, i + 1, walk);
+      }
+    }
+    if (sampled == 0) {
+      size_t stride = std::max<size_t>(size / sample_size, 1);
+      size_t index = 0;
+      desc->ForEachElement(obj, [&](const void* key, const void* value) {
+        if (index++ % stride == 0) walk(key, value);
+        return true;
+      });
+    }
+    if (sampled == 0) return 0;
+    return static_cast<size_t>(static_cast<double>(visitor.GetHeapBytes()) *
+                               size / sampled);
+  }
+
+  const FootprintOptions& options_;
+  size_t heap_bytes_{0};
+  int64_t current_field_{-1};
+  std::vector<size_t> field_heap_bytes_;
+  bool sampled_{false};
+};
+
+void AppendJsonString(std::ostringstream* stream, const std::string& str) {
+  *stream << '"' << StringUtil::JsonEscape(str) << '"';
+}
+
+}  // namespace
+
+/* FootprintReport methods */
+
+std::string FootprintReport::ToText() const {
+  std::ostringstream stream;
+  stream << type_name << ": total=" << total_bytes
+         << " inline=" << inline_bytes << " heap=" << heap_bytes;
+  if (sampled) stream << " (sampled)";
+  stream << "\n";
+  for (const auto& field : fields) {
+    stream << "  " << field.field_name << " (" << field.type_name
+           << "): heap=" << field.heap_bytes << "\n";
+  }
+  return stream.str();
+}
+
+std::string FootprintReport::ToJson() const {
+  std::ostringstream stream;
+  stream << "{\"type\":";
+  AppendJsonString(&stream, type_name);
+  stream << ",\"total_bytes\":" << total_bytes
+         << ",\"inline_bytes\":" << inline_bytes
+         << ",\"heap_bytes\":" << heap_bytes
+         << ",\"sampled\":" << (sampled ? "true" : "false") << ",\"fields\":[";
+  for (size_t i = 0; i < fields.size(); ++i) {
+    if (i > 0) stream << ",";
+    stream << "{\"name\":";
+    AppendJsonString(&stream, fields[i].field_name);
+    stream << ",\"type\":";
+    AppendJsonString(&stream, fields[i].type_name);
+    stream << ",\"heap_bytes\":" << fields[i].heap_bytes << "}";
+  }
+  stream << "]}";
+  return stream.str();
+}
+
+/* Footprint functions */
+
+size_t DeepSizeOf(const void* obj, Descriptor* desc,
+                  const FootprintOptions& options) {
+  if (obj == nullptr || desc == nullptr) return 0;
+  ObjectWalker walker;
+  FootprintVisitor visitor(options, 0);
+  walker.Walk(obj, desc, &visitor);
+  return desc->size_ + visitor.GetHeapBytes();
+}
+
+FootprintReport GetFootprintReport(const void* obj, Descriptor* desc,
+                                   const FootprintOptions& options) {
+  FootprintReport report;
+  if (obj == nullptr || desc == nullptr) return report;
+  auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+  int32_t field_size = class_desc == nullptr ? 0 : class_desc->GetFieldSize();
+
+  ObjectWalker walker;
+  FootprintVisitor visitor(options, field_size);
+  walker.Walk(obj, desc, &visitor);
+
+  report.type_name = desc->GetTypeName();
+  report.inline_bytes = desc->size_;
+  report.heap_bytes = visitor.GetHeapBytes();
+  report.total_bytes = report.inline_bytes + report.heap_bytes;
+  report.sampled = visitor.IsSampled();
+  for (int32_t i = 0; i < field_size; ++i) {
+    FieldFootprint field;
+    field.field_name = class_desc->GetFieldName(i);
+    field.type_name = class_desc->GetDescriptorById(i)->GetTypeName();
+    field.heap_bytes = visitor.GetFieldHeapBytes()[i];
+    report.fields.push_back(std::move(field));
+  }
+  std::stable_sort(report.fields.begin(), report.fields.end(),
+                   [](const FieldFootprint& lhs, const FieldFootprint& rhs) {
+                     return lhs.heap_bytes > rhs.heap_bytes;
+                   });
+  return report;
+}
+
+}  // namespace reflection
@@ -0,0 +1,70 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * Deep memory footprint of reflected objects: inline size plus all heap owned
+ * through reflected fields, i.e. string buffers beyond SSO, container buffers
+ * and nodes, smart pointer targets (shared ones counted once) and protobuf
+ * SpaceUsedLong(). Heap owned by fields not reflected is not visible.
+ *
+ * Large containers can be sampled: only some evenly spaced elements are
+ * walked, and their nested heap is extrapolated to the whole container, so
+ * the cost is bounded regardless of container size.
+ *
+ * Usage:
+ *   size_t bytes = DeepSizeOf(&a, DESC("A"));
+ *
+ *   FootprintOptions options;
+ *   options.sample_threshold = 1024;
+ *   std::cout << GetFootprintReport(&a, DESC("A"), options).ToText();
+ */
+
+struct FootprintOptions {
+  // Sample containers with more elements than it. 0 disables sampling.
+  size_t sample_threshold{0};
+  // Number of elements walked in a sampled container.
+  size_t sample_size{64};
+};
+
+struct FieldFootprint {
+  std::string field_name;
+  std::string type_name;
+  // Heap owned by the field, nested values included.
+  size_t heap_bytes{0};
+};
+
+struct FootprintReport {
+  std::string type_name;
+  size_t inline_bytes{0};
+  size_t heap_bytes{0};
+  size_t total_bytes{0};
+  // Whether any container is sampled, i.e. heap bytes are estimated.
+  bool sampled{false};
+  // Reflected fields of root class, largest heap first. Empty if root is not
+  // a class.
+  std::vector<FieldFootprint> fields;
+
+  std::string ToText() const;
+
+  std::string ToJson() const;
+};
+
+// Get inline size plus owned heap of |obj| in bytes.
+size_t DeepSizeOf(const void* obj, Descriptor* desc,
+                  const FootprintOptions& options = FootprintOptions());
+
+// Get footprint of |obj| with heap broken down by fields of root class.
+FootprintReport GetFootprintReport(
+    const void* obj, Descriptor* desc,
+    const FootprintOptions& options = FootprintOptions());
+
+}  // namespace reflection
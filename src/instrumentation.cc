@@ -0,0 +1,492 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/instrumentation.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/* LatencyHistogram methods */
+
+void LatencyHistogram::Record(int64_t nanos) {
+  int32_t index = 0;
+  while (nanos > 0 && index < kBucketSize - 1) {
+    nanos >>= 1;
+    ++index;
+  }
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (int32_t i = 0; i < kBucketSize; ++i) {
+    buckets_[i].fetch_add(other.GetBucket(i), std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+  uint64_t count = 0;
+  for (int32_t i = 0; i < kBucketSize; ++i) count += GetBucket(i);
+  return count;
+}
+
+int64_t LatencyHistogram::GetPercentile(double percentile) const {
+  uint64_t count = GetCount();
+  if (count == 0) return 0;
+  uint64_t target = static_cast<uint64_t>(count * percentile / 100.0);
+  if (target >= count) target = count - 1;
+  uint64_t seen = 0;
+  for (int32_t i = 0; i < kBucketSize; ++i) {
+    seen += GetBucket(i);
+    if (seen > target) return i == 0 ? 0 : (int64_t{1} << i);
+  }
+  return int64_t{1} << (kBucketSize - 1);
+}
+
+namespace {
+
+// Distinct factory names counted per shard. Further names are counted under
+// kOtherFactoryName, as requested names may come from arbitrary input.
+const size_t kMaxFactoryNames = 1024;
+const char kOtherFactoryName[] = "<other>";
+
+void Increase(std::atomic<uint64_t>* counter, uint64_t value = 1) {
+  counter->fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Load(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+// Counters of one class. Names are copied at creation, so that counters of
+// classes unregistered since can still be reported.
+struct DescriptorCounters {
+  DescriptorCounters(const ClassDescriptor* descriptor,
+                     const std::string& type_name,
+                     const std::vector<std::string>& field_names)
+      : descriptor(descriptor),
+        type_name(type_name),
+        field_names(field_names),
+        field_size(static_cast<int32_t>(field_names.size())),
+        fields(new std::atomic<uint64_t>[field_size]) {
+    for (int32_t i = 0; i < field_size; ++i) fields[i].store(0);
+  }
+
+  // Only compared, never dereferenced. nullptr once it may have been freed.
+  const ClassDescriptor* descriptor;
+  std::string type_name;
+  std::vector<std::string> field_names;
+  int32_t field_size;
+  std::unique_ptr<std::atomic<uint64_t>[]> fields;
+  std::atomic<uint64_t> by_id{0};
+  std::atomic<uint64_t> by_name{0};
+  std::atomic<uint64_t> by_name_misses{0};
+  LatencyHistogram latency;
+};
+
+struct FactoryCounters {
+  std::atomic<uint64_t> lookups{0};
+  std::atomic<uint64_t> misses{0};
+  std::atomic<uint64_t> instantiations{0};
+};
+
+// Counters written by one thread only. Counter values are atomics so that
+// snapshots can read them at any time; |mutex| guards the lists of counters,
+// which are only modified by the owner thread on first sight of a key, or by
+// merges.
+struct Shard {
+  DescriptorCounters* MutableDescriptor(const ClassDescriptor* desc) {
+    // Descriptors met so far may be freed once anything is unregistered, and
+    // their addresses taken by other classes, so they are met afresh.
+    uint64_t unregister_count = ClassReflFactory::Get().GetUnregisterCount();
+    if (unregister_count != seen_unregister_count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto& counters : descriptor_counters) counters->descriptor = nullptr;
+      descriptors.clear();
+      seen_unregister_count = unregister_count;
+    }
+    auto iter = descriptors.find(desc);
+    if (iter != descriptors.end()) return iter->second;
+    std::vector<std::string> field_names;
+    for (int32_t i = 0; i < desc->GetFieldSize(); ++i) {
+      field_names.push_back(desc->GetFieldName(i));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    descriptor_counters.emplace_back(
+        new DescriptorCounters(desc, desc->GetTypeName(), field_names));
+    return descriptors[desc] = descriptor_counters.back().get();
+  }
+
+  FactoryCounters* MutableFactory(const std::string& name) {
+    auto iter = factory.find(name);
+    if (iter != factory.end()) return iter->second.get();
+    std::lock_guard<std::mutex> lock(mutex);
+    return AddFactoryLocked(name);
+  }
+
+  // Get counters of |name|, added if absent, or of kOtherFactoryName once
+  // the shard holds kMaxFactoryNames names. Shard should be locked by caller.
+  FactoryCounters* AddFactoryLocked(const std::string& name) {
+    auto iter = factory.find(name);
+    if (iter != factory.end()) return iter->second.get();
+    auto& counters = factory.size() < kMaxFactoryNames
+                         ? factory[name]
+                         : factory[kOtherFactoryName];
+    if (counters == nullptr) counters.reset(new FactoryCounters);
+    return counters.get();
+  }
+
+  // Add all counters of |other| into this shard, merging counters of classes
+  // of the same name and fields. Both shards should be locked by caller.
+  void MergeLocked(const Shard& other) {
+    // Descriptors of |other| may have been freed if it hasn't recorded since
+    // the last unregistration.
+    bool live = other.seen_unregister_count ==
+                ClassReflFactory::Get().GetUnregisterCount();
+    for (const auto& src : other.descriptor_counters) {
+      auto& counters = merged[std::make_pair(src->type_name, src->field_size)];
+      if (counters == nullptr) {
+        descriptor_counters.emplace_back(
+            new DescriptorCounters(nullptr, src->type_name, src->field_names));
+        counters = descriptor_counters.back().get();
+      }
+      if (live && counters->descriptor == nullptr) {
+        counters->descriptor = src->descriptor;
+      }
+      for (int32_t i = 0; i < src->field_size; ++i) {
+        Increase(&counters->fields[i], Load(src->fields[i]));
+      }
+      Increase(&counters->by_id, Load(src->by_id));
+      Increase(&counters->by_name, Load(src->by_name));
+      Increase(&counters->by_name_misses, Load(src->by_name_misses));
+      counters->latency.Merge(src->latency);
+    }
+    for (const auto& pair : other.factory) {
+      auto* counters = AddFactoryLocked(pair.first);
+      Increase(&counters->lookups, Load(pair.second->lookups));
+      Increase(&counters->misses, Load(pair.second->misses));
+      Increase(&counters->instantiations, Load(pair.second->instantiations));
+    }
+    Increase(&rtti_lookups, Load(other.rtti_lookups));
+    Increase(&rtti_misses, Load(other.rtti_misses));
+    factory_latency.Merge(other.factory_latency);
+  }
+
+  // Zero all counters. Counters are kept, since the owner thread reads them
+  // without lock.
+  void ResetLocked() {
+    for (auto& counters : descriptor_counters) {
+      for (int32_t i = 0; i < counters->field_size; ++i) {
+        counters->fields[i].store(0);
+      }
+      counters->by_id.store(0);
+      counters->by_name.store(0);
+      counters->by_name_misses.store(0);
+      counters->latency.Reset();
+    }
+    for (auto& pair : factory) {
+      pair.second->lookups.store(0);
+      pair.second->misses.store(0);
+      pair.second->instantiations.store(0);
+    }
+    rtti_lookups.store(0);
+    rtti_misses.store(0);
+    factory_latency.Reset();
+  }
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<DescriptorCounters>> descriptor_counters;
+  // Counters by descriptor, only used by the owner thread.
+  std::unordered_map<const ClassDescriptor*, DescriptorCounters*> descriptors;
+  uint64_t seen_unregister_count{0};
+  // Counters by type name and field size, only used by merges.
+  std::map<std::pair<std::string, int32_t>, DescriptorCounters*> merged;
+  std::unordered_map<std::string, std::unique_ptr<FactoryCounters>> factory;
+  std::atomic<uint64_t> rtti_lookups{0};
+  std::atomic<uint64_t> rtti_misses{0};
+  LatencyHistogram factory_latency;
+  uint32_t sample_tick{0};
+};
+
+// All live shards, plus counters of exited threads. Never destroyed, so that
+// thread exits during static destruction are safe.
+class ShardRegistry {
+ public:
+  static ShardRegistry& Get() {
+    static ShardRegistry* instance = new ShardRegistry;
+    return *instance;
+  }
+
+  void Add(Shard* shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shards_.push_back(shard);
+  }
+
+  void Retire(Shard* shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    {
+      std::lock_guard<std::mutex> retired_lock(retired_.mutex);
+      std::lock_guard<std::mutex> shard_lock(shard->mutex);
+      retired_.MergeLocked(*shard);
+    }
+    shards_.erase(std::remove(shards_.begin(), shards_.end(), shard),
+                  shards_.end());
+  }
+
+  // Merge every shard into |target|.
+  void MergeInto(Shard* target) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> target_lock(target->mutex);
+    {
+      std::lock_guard<std::mutex> retired_lock(retired_.mutex);
+      target->MergeLocked(retired_);
+    }
+    for (auto* shard : shards_) {
+      std::lock_guard<std::mutex> shard_lock(shard->mutex);
+      target->MergeLocked(*shard);
+    }
+  }
+
+  void Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    {
+      std::lock_guard<std::mutex> retired_lock(retired_.mutex);
+      retired_.ResetLocked();
+    }
+    for (auto* shard : shards_) {
+      std::lock_guard<std::mutex> shard_lock(shard->mutex);
+      shard->ResetLocked();
+    }
+  }
+
+  std::atomic<uint32_t> sample_rate{64};
+
+ private:
+  ShardRegistry() = default;
+
+  std::mutex mutex_;
+  std::vector<Shard*> shards_;
+  Shard retired_;
+};
+
+class ShardOwner {
+ public:
+  ShardOwner() : shard_(new Shard) { ShardRegistry::Get().Add(shard_.get()); }
+
+  ~ShardOwner() { ShardRegistry::Get().Retire(shard_.get()); }
+
+  Shard* Get() { return shard_.get(); }
+
+ private:
+  std::unique_ptr<Shard> shard_;
+};
+
+Shard* LocalShard() {
+  thread_local ShardOwner owner;
+  return owner.Get();
+}
+
+void AppendJsonString(std::ostringstream* stream, const std::string& str) {
+  *stream << '"' << StringUtil::JsonEscape(str) << '"';
+}
+
+}  // namespace
+
+/* InstrumentationSnapshot methods */
+
+const DescriptorAccessStats* InstrumentationSnapshot::Find(
+    const Descriptor* desc) const {
+  for (const auto& stats : descriptors) {
+    if (stats.descriptor == desc) return &stats;
+  }
+  return nullptr;
+}
+
+std::string InstrumentationSnapshot::ToText() const {
+  std::ostringstream stream;
+  stream << "== Descriptors ==\n";
+  for (const auto& desc : descriptors) {
+    stream << desc.type_name << ": by_id=" << desc.by_id_accesses
+           << " by_name=" << desc.by_name_lookups
+           << " by_name_misses=" << desc.by_name_misses;
+    if (desc.latency_samples > 0) {
+      stream << " by_name_p50<=" << desc.latency_p50_ns
+             << "ns by_name_p99<=" << desc.latency_p99_ns << "ns";
+    }
+    stream << "\n";
+    for (const auto& field : desc.fields) {
+      if (field.accesses == 0) continue;
+      stream << "  " << field.field_name << ": " << field.accesses << "\n";
+    }
+  }
+  stream << "== Factory ==\n";
+  stream << "rtti_lookups=" << rtti_lookups << " rtti_misses=" << rtti_misses;
+  if (factory_latency_samples > 0) {
+    stream << " lookup_p50<=" << factory_latency_p50_ns
+           << "ns lookup_p99<=" << factory_latency_p99_ns << "ns";
+  }
+  stream << "\n";
+  for (const auto& entry : factory) {
+    stream << entry.name << ": lookups=" << entry.lookups
+           << " misses=" << entry.misses
+           << " instantiations=" << entry.instantiations << "\n";
+  }
+  return stream.str();
+}
+
+std::string InstrumentationSnapshot::ToJson() const {
+  std::ostringstream stream;
+  stream << "{\"descriptors\":[";
+  for (size_t i = 0; i < descriptors.size(); ++i) {
+    const auto& desc = descriptors[i];
+    if (i > 0) stream << ",";
+    stream << "{\"type\":";
+    AppendJsonString(&stream, desc.type_name);
+    stream << ",\"by_id\":" << desc.by_id_accesses
+           << ",\"by_name\":" << desc.by_name_lookups
+           << ",\"by_name_misses\":" << desc.by_name_misses
+           << ",\"latency_samples\":" << desc.latency_samples
+           << ",\"latency_p50_ns\":" << desc.latency_p50_ns
+           << ",\"latency_p99_ns\":" << desc.latency_p99_ns
+           << ",\"fields\":{";
+    for (size_t j = 0; j < desc.fields.size(); ++j) {
+      if (j > 0) stream << ",";
+      AppendJsonString(&stream, desc.fields[j].field_name);
+      stream << ":" << desc.fields[j].accesses;
+    }
+    stream << "}}";
+  }
+  stream << "],\"factory\":{\"rtti_lookups\":" << rtti_lookups
+         << ",\"rtti_misses\":" << rtti_misses
+         << ",\"latency_samples\":" << factory_latency_samples
+         << ",\"latency_p50_ns\":" << factory_latency_p50_ns
+         << ",\"latency_p99_ns\":" << factory_latency_p99_ns
+         << ",\"names\":[";
+  for (size_t i = 0; i < factory.size(); ++i) {
+    if (i > 0) stream << ",";
+    stream << "{\"name\":";
+    AppendJsonString(&stream, factory[i].name);
+    stream << ",\"lookups\":" << factory[i].lookups
+           << ",\"misses\":" << factory[i].misses
+           << ",\"instantiations\":" << factory[i].instantiations << "}";
+  }
+  stream << "]}}";
+  return stream.str();
+}
+
+/* Instrumentation methods */
+
+InstrumentationSnapshot Instrumentation::Snapshot() {
+  Shard merged;
+  ShardRegistry::Get().MergeInto(&merged);
+
+  InstrumentationSnapshot snapshot;
+  for (const auto& counters : merged.descriptor_counters) {
+    DescriptorAccessStats stats;
+    stats.descriptor = counters->descriptor;
+    stats.type_name = counters->type_name;
+    stats.by_id_accesses = Load(counters->by_id);
+    stats.by_name_lookups = Load(counters->by_name);
+    stats.by_name_misses = Load(counters->by_name_misses);
+    for (int32_t i = 0; i < counters->field_size; ++i) {
+      stats.fields.push_back(
+          {counters->field_names[i], Load(counters->fields[i])});
+    }
+    stats.latency_samples = counters->latency.GetCount();
+    stats.latency_p50_ns = counters->latency.GetPercentile(50);
+    stats.latency_p99_ns = counters->latency.GetPercentile(99);
+    snapshot.descriptors.push_back(std::move(stats));
+  }
+  std::sort(snapshot.descriptors.begin(), snapshot.descriptors.end(),
+            [](const DescriptorAccessStats& a, const DescriptorAccessStats& b) {
+              return a.by_id_accesses + a.by_name_lookups >
+                     b.by_id_accesses + b.by_name_lookups;
+            });
+
+  for (const auto& pair : merged.factory) {
+    snapshot.factory.push_back({pair.first, Load(pair.second->lookups),
+                                Load(pair.second->misses),
+                                Load(pair.second->instantiations)});
+  }
+  std::sort(snapshot.factory.begin(), snapshot.factory.end(),
+            [](const FactoryAccessStats& a, const FactoryAccessStats& b) {
+              return a.lookups > b.lookups;
+            });
+  snapshot.rtti_lookups = Load(merged.rtti_lookups);
+  snapshot.rtti_misses = Load(merged.rtti_misses);
+  snapshot.factory_latency_samples = merged.factory_latency.GetCount();
+  snapshot.factory_latency_p50_ns = merged.factory_latency.GetPercentile(50);
+  snapshot.factory_latency_p99_ns = merged.factory_latency.GetPercentile(99);
+  return snapshot;
+}
+
+void Instrumentation::Reset() { ShardRegistry::Get().Reset(); }
+
+void Instrumentation::SetLatencySampleRate(uint32_t every_n) {
+  ShardRegistry::Get().sample_rate.store(every_n);
+}
+
+void Instrumentation::RecordFieldById(const ClassDescriptor* desc,
+                                      int32_t id) {
+  auto* counters = LocalShard()->MutableDescriptor(desc);
+  Increase(&counters->by_id);
+  Increase(&counters->fields[id]);
+}
+
+void Instrumentation::RecordFieldByName(const ClassDescriptor* desc,
+                                        int32_t id, int64_t latency_ns) {
+  auto* counters = LocalShard()->MutableDescriptor(desc);
+  Increase(&counters->by_name);
+  if (id < 0) {
+    Increase(&counters->by_name_misses);
+  } else {
+    Increase(&counters->fields[id]);
+  }
+  if (latency_ns >= 0) counters->latency.Record(latency_ns);
+}
+
+void Instrumentation::RecordFactoryLookup(const std::string& name, bool hit,
+                                          int64_t latency_ns) {
+  auto* shard = LocalShard();
+  auto* counters = shard->MutableFactory(name);
+  Increase(&counters->lookups);
+  if (!hit) Increase(&counters->misses);
+  if (latency_ns >= 0) shard->factory_latency.Record(latency_ns);
+}
+
+void Instrumentation::RecordFactoryRttiLookup(bool hit) {
+  auto* shard = LocalShard();
+  Increase(&shard->rtti_lookups);
+  if (!hit) Increase(&shard->rtti_misses);
+}
+
+void Instrumentation::RecordFactoryInstantiation(const std::string& name,
+                                                 bool hit) {
+  auto* counters = LocalShard()->MutableFactory(name);
+  if (hit) {
+    Increase(&counters->instantiations);
+  } else {
+    Increase(&counters->misses);
+  }
+}
+
+bool Instrumentation::ShouldSampleLatency() {
+  uint32_t rate =
+      ShardRegistry::Get().sample_rate.load(std::memory_order_relaxed);
+  if (rate == 0) return false;
+  auto* shard = LocalShard();
+  return ++shard->sample_tick % rate == 0;
+}
+
+}  // namespace reflection
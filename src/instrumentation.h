@@ -0,0 +1,190 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace reflection {
+
+/**
+ * Hot-path instrumentation of descriptors and ClassReflFactory.
+ *
+ * Counters are only recorded when SSR_ENABLE_INSTRUMENTATION is defined at
+ * compile time (bazel build --define ssr_instrumentation=true). Otherwise all
+ * recording sites compile to nothing, while the snapshot API below is still
+ * available and returns empty results.
+ *
+ * Recorded data:
+ * - per ClassDescriptor: field accesses by id and by name, per-field access
+ *   counts, by-name lookups and misses.
+ * - per requested name in ClassReflFactory: descriptor lookups, misses and
+ *   instantiations, as well as RTTI lookups and misses. Each thread counts at
+ *   most 1024 distinct names, and names met beyond are counted together as
+ *   "<other>", so that lookups of arbitrary names can't grow counters without
+ *   bound.
+ * - sampled latency histograms of by-name lookups.
+ *
+ * Every thread writes into its own shard, so recording never contends. Shards
+ * are merged by Instrumentation::Snapshot().
+ *
+ * Usage:
+ *   auto snapshot = reflection::Instrumentation::Snapshot();
+ *   std::cout << snapshot.ToText();
+ *   WriteFile("refl_stats.json", snapshot.ToJson());
+ */
+
+class ClassDescriptor;
+class Descriptor;
+
+// Lock-free latency histogram with power-of-two nanosecond buckets. Bucket i
+// holds samples in [2^(i-1), 2^i) ns, bucket 0 holds zero-length samples.
+class LatencyHistogram {
+ public:
+  static constexpr int32_t kBucketSize = 48;
+
+  LatencyHistogram() {
+    for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+  }
+
+  void Record(int64_t nanos);
+
+  // Add all samples of |other| into this histogram.
+  void Merge(const LatencyHistogram& other);
+
+  void Reset();
+
+  uint64_t GetCount() const;
+
+  // Get an upper bound in ns of the given percentile (0-100). Return 0 if the
+  // histogram is empty.
+  int64_t GetPercentile(double percentile) const;
+
+  uint64_t GetBucket(int32_t index) const {
+    return buckets_[index].load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::array<std::atomic<uint64_t>, kBucketSize> buckets_;
+};
+
+struct FieldAccessStats {
+  std::string field_name;
+  uint64_t accesses{0};
+};
+
+struct DescriptorAccessStats {
+  // Only for comparison, e.g. by Find(). nullptr if the class may have been
+  // unregistered since it was recorded, in which case it is only known by
+  // name.
+  const Descriptor* descriptor{nullptr};
+  std::string type_name;
+  uint64_t by_id_accesses{0};
+  uint64_t by_name_lookups{0};
+  uint64_t by_name_misses{0};
+  std::vector<FieldAccessStats> fields;
+  // Percentiles of sampled by-name lookup latency in ns.
+  uint64_t latency_samples{0};
+  int64_t latency_p50_ns{0};
+  int64_t latency_p99_ns{0};
+};
+
+struct FactoryAccessStats {
+  // Name requested from ClassReflFactory, registered or not, or "<other>"
+  // for names beyond the cap.
+  std::string name;
+  uint64_t lookups{0};
+  uint64_t misses{0};
+  uint64_t instantiations{0};
+};
+
+struct InstrumentationSnapshot {
+  // Sorted by total accesses, hottest first.
+  std::vector<DescriptorAccessStats> descriptors;
+  // Sorted by lookups, hottest first.
+  std::vector<FactoryAccessStats> factory;
+  uint64_t rtti_lookups{0};
+  uint64_t rtti_misses{0};
+  uint64_t factory_latency_samples{0};
+  int64_t factory_latency_p50_ns{0};
+  int64_t factory_latency_p99_ns{0};
+
+  // Get stats of a certain descriptor. Return nullptr if never recorded.
+  const DescriptorAccessStats* Find(const Descriptor* desc) const;
+
+  std::string ToText() const;
+
+  std::string ToJson() const;
+};
+
+class Instrumentation {
+ public:
+  // Whether recording is compiled in.
+  static constexpr bool IsEnabled() {
+#ifdef SSR_ENABLE_INSTRUMENTATION
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Merge all thread shards into one snapshot.
+  static InstrumentationSnapshot Snapshot();
+
+  // Clear all recorded data.
+  static void Reset();
+
+  // Measure latency of one in every |every_n| by-name lookups per thread. 0
+  // disables latency sampling. Default is 64.
+  static void SetLatencySampleRate(uint32_t every_n);
+
+  /* Recording, called by instrumented code through SSR_INSTRUMENT. */
+
+  static void RecordFieldById(const ClassDescriptor* desc, int32_t id);
+
+  // |id| is the found field id, or -1 for a miss.
+  static void RecordFieldByName(const ClassDescriptor* desc, int32_t id,
+                                int64_t latency_ns);
+
+  static void RecordFactoryLookup(const std::string& name, bool hit,
+                                  int64_t latency_ns);
+
+  static void RecordFactoryRttiLookup(bool hit);
+
+  static void RecordFactoryInstantiation(const std::string& name, bool hit);
+
+  // Whether the calling thread should measure latency of current lookup.
+  static bool ShouldSampleLatency();
+};
+
+// Measure elapsed time of a scope if latency sampling picks it. Elapsed() is
+// -1 when not sampled.
+class SampledLatencyTimer {
+ public:
+  SampledLatencyTimer() : sampled_(Instrumentation::ShouldSampleLatency()) {
+    if (sampled_) start_ = std::chrono::steady_clock::now();
+  }
+
+  int64_t Elapsed() const {
+    if (!sampled_) return -1;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+
+ private:
+  bool sampled_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#ifdef SSR_ENABLE_INSTRUMENTATION
+#define SSR_INSTRUMENT(...) __VA_ARGS__
+#else
+#define SSR_INSTRUMENT(...)
+#endif
+
+}  // namespace reflection
@@ -0,0 +1,388 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/introspection_server.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include "src/string_util.h"
+
+namespace reflection {
+
+namespace {
+
+// Snapshot buffers kept for reuse.
+const size_t kPoolSize = 4;
+// Bound of a send to a client not reading, which is then disconnected.
+const int kSendTimeoutMs = 1000;
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string ToJsonString(const std::string& str) {
+  return "\"" + StringUtil::JsonEscape(str) + "\"";
+}
+
+std::string GetErrnoMessage(const char* what) {
+  return StringUtil::Concat(what, ": ", std::strerror(errno));
+}
+
+// Split |str| at its first space into |first| and |rest|, without spaces
+// around.
+void SplitFirst(const std::string& str, std::string* first,
+                std::string* rest) {
+  size_t begin = str.find_first_not_of(' ');
+  if (begin == std::string::npos) {
+    first->clear();
+    rest->clear();
+    return;
+  }
+  size_t end = str.find(' ', begin);
+  *first = str.substr(begin, end == std::string::npos ? end : end - begin);
+  size_t rest_begin =
+      end == std::string::npos ? end : str.find_first_not_of(' ', end);
+  if (rest_begin == std::string::npos) {
+    rest->clear();
+    return;
+  }
+  size_t rest_end = str.find_last_not_of(' ');
+  *rest = str.substr(rest_begin, rest_end + 1 - rest_begin);
+}
+
+bool SendAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t size =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) return false;
+    sent += size;
+  }
+  return true;
+}
+
+void CloseFd(int* fd) {
+  if (*fd < 0) return;
+  close(*fd);
+  *fd = -1;
+}
+
+struct Client {
+  int fd;
+  // Received bytes of an incomplete request.
+  std::string pending;
+};
+
+// Read available bytes of |client| and answer its complete requests. Return
+// false if it should be disconnected.
+bool ServeClient(IntrospectionServer* server, Client* client) {
+  char buffer[1024];
+  ssize_t size = recv(client->fd, buffer, sizeof(buffer), 0);
+  if (size < 0 && errno == EINTR) return true;
+  if (size <= 0) return false;
+  client->pending.append(buffer, size);
+
+  size_t begin = 0;
+  size_t end;
+  while ((end = client->pending.find('\n', begin)) != std::string::npos) {
+    std::string request = client->pending.substr(begin, end - begin);
+    if (!request.empty() && request.back() == '\r') request.pop_back();
+    begin = end + 1;
+    if (!SendAll(client->fd, server->HandleRequest(request))) return false;
+  }
+  client->pending.erase(0, begin);
+  return client->pending.size() <= IntrospectionServer::kMaxRequestSize;
+}
+
+}  // namespace
+
+/* IntrospectionStats methods */
+
+std::string IntrospectionStats::ToJson() const {
+  return StringUtil::Concat(
+      "{\"requests\":", requests, ",\"errors\":", errors, ",\"reads\":", reads,
+      ",\"hold_p50_ns\":", hold_p50_ns, ",\"hold_p99_ns\":", hold_p99_ns, "}");
+}
+
+/* IntrospectionServer methods */
+
+IntrospectionServer::IntrospectionServer(const std::string& socket_path)
+    : socket_path_(socket_path), pool_(kPoolSize) {}
+
+IntrospectionServer::~IntrospectionServer() {
+  Stop();
+  Snapshot* snapshot;
+  while (pool_.TryPop(&snapshot)) delete snapshot;
+}
+
+bool IntrospectionServer::Start() {
+  if (IsRunning()) return true;
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path_.empty() || socket_path_.size() >= sizeof(addr.sun_path)) {
+    error_ = "socket path is empty or too long: " + socket_path_;
+    return false;
+  }
+  std::memcpy(addr.sun_path, socket_path_.c_str(), socket_path_.size() + 1);
+
+  if (pipe2(wake_fds_, O_CLOEXEC) != 0) {
+    error_ = GetErrnoMessage("pipe2");
+    return false;
+  }
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    error_ = GetErrnoMessage("socket");
+    Stop();
+    return false;
+  }
+  // Replace a socket left by a process that crashed, but no other file, and
+  // no socket another server listens on.
+  struct stat status;
+  if (lstat(socket_path_.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+    int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool stale =
+        probe_fd >= 0 && connect(probe_fd, reinterpret_cast<sockaddr*>(&addr),
+                                 sizeof(addr)) != 0 &&
+        errno == ECONNREFUSED;
+    CloseFd(&probe_fd);
+    if (!stale) {
+      error_ = "socket in use: " + socket_path_;
+      CloseFd(&listen_fd_);
+      Stop();
+      return false;
+    }
+    unlink(socket_path_.c_str());
+  }
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) !=
+      0) {
+    error_ = GetErrnoMessage("bind");
+    CloseFd(&listen_fd_);
+    Stop();
+    return false;
+  }
+  // Restrict to owner before listening, so that no one else connects first.
+  if (chmod(socket_path_.c_str(), S_IRUSR | S_IWUSR) != 0) {
+    error_ = GetErrnoMessage("chmod");
+    Stop();
+    return false;
+  }
+  if (listen(listen_fd_, static_cast<int>(kMaxClients)) != 0) {
+    error_ = GetErrnoMessage("listen");
+    Stop();
+    return false;
+  }
+  error_.clear();
+  thread_ = std::thread(&IntrospectionServer::ServeLoop, this);
+  return true;
+}
+
+void IntrospectionServer::Stop() {
+  if (thread_.joinable()) {
+    char byte = 0;
+    while (write(wake_fds_[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+    thread_.join();
+  }
+  if (listen_fd_ >= 0) unlink(socket_path_.c_str());
+  CloseFd(&listen_fd_);
+  CloseFd(&wake_fds_[0]);
+  CloseFd(&wake_fds_[1]);
+}
+
+bool IntrospectionServer::RegisterRoot(const std::string& name,
+                                       const void* obj, Descriptor* desc,
+                                       std::mutex* mutex) {
+  if (name.empty() || name.find_first_of(" \r\n") != std::string::npos ||
+      obj == nullptr || desc == nullptr) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return roots_.emplace(name, Root{obj, desc, mutex}).second;
+}
+
+bool IntrospectionServer::UnregisterRoot(const std::string& name) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = roots_.find(name);
+  if (iter == roots_.end() || iter->second.unregistering) return false;
+  // Refuse new reads, and wait for those in progress.
+  iter->second.unregistering = true;
+  released_.wait(lock, [&iter]() { return iter->second.readers == 0; });
+  roots_.erase(iter);
+  return true;
+}
+
+std::string IntrospectionServer::HandleRequest(const std::string& request) {
+  ++requests_;
+  std::string command;
+  std::string args;
+  SplitFirst(request, &command, &args);
+
+  if (command == "GET") {
+    std::string name;
+    std::string path;
+    SplitFirst(args, &name, &path);
+    return HandleGet(name, path);
+  }
+  if (command == "LIST") {
+    auto& factory = ClassReflFactory::Get();
+    std::string out = "{\"classes\":[";
+    bool first = true;
+    for (const auto& name : factory.GetRegisteredNames()) {
+      auto* desc = ClassDescriptor::ToClassDescriptor(
+          factory.GetDescriptorByName(name));
+      if (desc == nullptr) continue;
+      if (!first) out += ',';
+      first = false;
+      out += StringUtil::Concat("{\"name\":", ToJsonString(name),
+                                ",\"fingerprint\":", desc->GetFingerprint(),
+                                ",\"fields\":", desc->GetFieldSize(), "}");
+    }
+    return out + "]}\n";
+  }
+  if (command == "ROOTS") {
+    std::string out = "{\"roots\":[";
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& entry : roots_) {
+      if (entry.second.unregistering) continue;
+      if (out.back() != '[') out += ',';
+      out += StringUtil::Concat(
+          "{\"name\":", ToJsonString(entry.first),
+          ",\"type\":", ToJsonString(entry.second.desc->GetTypeName()), "}");
+    }
+    return out + "]}\n";
+  }
+  if (command == "STATS") return GetStats().ToJson() + "\n";
+  return Fail("unknown request, expect LIST, ROOTS, GET <root> [<path>] or "
+              "STATS");
+}
+
+IntrospectionStats IntrospectionServer::GetStats() const {
+  IntrospectionStats stats;
+  stats.requests = requests_.load(std::memory_order_relaxed);
+  stats.errors = errors_.load(std::memory_order_relaxed);
+  stats.reads = hold_latency_.GetCount();
+  stats.hold_p50_ns = hold_latency_.GetPercentile(50);
+  stats.hold_p99_ns = hold_latency_.GetPercentile(99);
+  return stats;
+}
+
+std::string IntrospectionServer::HandleGet(const std::string& name,
+                                           const std::string& path) {
+  // Pin the root, so that it stays registered while it is read without
+  // holding mutex_, which would serialize reads behind the owner of any root.
+  // Map nodes never move, and only readers and unregistering change.
+  Root* root;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = roots_.find(name);
+    if (iter == roots_.end() || iter->second.unregistering) {
+      return Fail("no root named " + name);
+    }
+    ++iter->second.readers;
+    root = &iter->second;
+  }
+
+  Snapshot* snapshot = AcquireSnapshot();
+  std::string error;
+  std::shared_ptr<const FieldPath> field_path;
+  if (!path.empty()) {
+    field_path = paths_.Get(root->desc, path);
+    // Failures are cached without reason, so compile again for it.
+    if (field_path == nullptr) FieldPath::Compile(root->desc, path, &error);
+  }
+  if (error.empty()) {
+    if (root->mutex != nullptr) root->mutex->lock();
+    int64_t start = NowNanos();
+    const void* value =
+        field_path == nullptr ? root->obj : field_path->Get(root->obj);
+    if (value != nullptr) {
+      TakeSnapshot(value,
+                   field_path == nullptr ? root->desc
+                                         : field_path->GetResultDescriptor(),
+                   snapshot);
+    }
+    hold_latency_.Record(NowNanos() - start);
+    if (root->mutex != nullptr) root->mutex->unlock();
+    if (value == nullptr) error = "no value at " + path;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--root->readers == 0) released_.notify_all();
+  }
+
+  std::string out;
+  if (error.empty()) {
+    snapshot->sequence = next_sequence_++;
+    if (!EncodeSnapshotJson(*snapshot, &out)) error = "failed to encode";
+  }
+  ReleaseSnapshot(snapshot);
+  return error.empty() ? out : Fail(error);
+}
+
+std::string IntrospectionServer::Fail(const std::string& error) {
+  ++errors_;
+  return "{\"error\":" + ToJsonString(error) + "}\n";
+}
+
+Snapshot* IntrospectionServer::AcquireSnapshot() {
+  Snapshot* snapshot;
+  if (pool_.TryPop(&snapshot)) return snapshot;
+  return new Snapshot;
+}
+
+void IntrospectionServer::ReleaseSnapshot(Snapshot* snapshot) {
+  if (!pool_.TryPush(snapshot)) delete snapshot;
+}
+
+void IntrospectionServer::ServeLoop() {
+  std::vector<Client> clients;
+  std::vector<pollfd> fds;
+  timeval send_timeout{kSendTimeoutMs / 1000, kSendTimeoutMs % 1000 * 1000};
+  while (true) {
+    // Wake pipe, listening socket, then clients in order.
+    fds.clear();
+    fds.push_back({wake_fds_[0], POLLIN, 0});
+    fds.push_back({listen_fd_,
+                   static_cast<short>(clients.size() < kMaxClients ? POLLIN
+                                                                   : 0),
+                   0});
+    for (const auto& client : clients) fds.push_back({client.fd, POLLIN, 0});
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[0].revents != 0) break;
+
+    for (size_t i = clients.size(); i-- > 0;) {
+      if (fds[i + 2].revents == 0) continue;
+      if (!ServeClient(this, &clients[i])) {
+        close(clients[i].fd);
+        clients.erase(clients.begin() + i);
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) continue;
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout,
+                 sizeof(send_timeout));
+      clients.push_back({fd, std::string()});
+    }
+  }
+  for (auto& client : clients) close(client.fd);
+}
+
+}  // namespace reflection
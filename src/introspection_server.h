@@ -0,0 +1,152 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "src/bounded_queue.h"
+#include "src/field_path.h"
+#include "src/instrumentation.h"
+#include "src/snapshot.h"
+
+namespace reflection {
+
+/**
+ * Optional introspection endpoint of a live process on a Unix domain socket,
+ * to read reflected state without a debugger or extra logging.
+ *
+ * Clients send one request per line and get one JSON line back:
+ *   LIST                 reflected classes registered in ClassReflFactory:
+ *                        {"classes":[{"name":..., "fingerprint":...,
+ *                        "fields":...}, ...]}
+ *   ROOTS                registered roots: {"roots":[{"name":...,
+ *                        "type":...}, ...]}
+ *   GET <root> [<path>]  root, or its value at field path <path> (see
+ *                        field_path.h), as encoded by EncodeSnapshotJson()
+ *   STATS                request counts and time roots were held by reads
+ * Failures are answered {"error":...}.
+ *
+ * A read holds the root only while copying the addressed value into a pooled
+ * snapshot buffer (see snapshot.h), which is byte-wise for scalar fields;
+ * encoding and sending happen after release. Objects mutated by another
+ * thread are registered with the mutex guarding them, which reads lock around
+ * the copy, so the owner waits for one copy at most. Roots without mutex are
+ * read without locking and must not be mutated while served.
+ *
+ * One background thread serves all clients, one request at a time. The socket
+ * is only accessible by the owner of the process.
+ *
+ * Usage:
+ *   IntrospectionServer server("/tmp/planner.sock");
+ *   server.RegisterRoot("state", &state, DESC("State"), &state_mutex);
+ *   if (!server.Start()) LOG(ERROR) << server.GetError();
+ *
+ *   $ introspection_client /tmp/planner.sock GET state 'tracks[0].pose'
+ */
+
+struct IntrospectionStats {
+  uint64_t requests{0};
+  uint64_t errors{0};
+  // Time roots were held by reads.
+  uint64_t reads{0};
+  int64_t hold_p50_ns{0};
+  int64_t hold_p99_ns{0};
+
+  std::string ToJson() const;
+};
+
+class IntrospectionServer {
+ public:
+  // Requests longer than this are refused, and their client disconnected.
+  static const size_t kMaxRequestSize = 4096;
+  // Clients served at once. Further ones wait for a free slot.
+  static const size_t kMaxClients = 16;
+
+  explicit IntrospectionServer(const std::string& socket_path);
+
+  // Stop serving and remove socket.
+  ~IntrospectionServer();
+
+  IntrospectionServer(const IntrospectionServer&) = delete;
+  IntrospectionServer& operator=(const IntrospectionServer&) = delete;
+
+  // Bind socket and start serving. A socket left at the same path by a process
+  // that exited is replaced, but one another server listens on is not. Return
+  // false on failure, see GetError().
+  bool Start();
+
+  // Stop serving, disconnect clients and remove socket. Roots stay
+  // registered.
+  void Stop();
+
+  bool IsRunning() const { return thread_.joinable(); }
+
+  const std::string& GetSocketPath() const { return socket_path_; }
+
+  const std::string& GetError() const { return error_; }
+
+  // Serve |obj| described by |desc| as root |name|. Reads lock |mutex| if not
+  // nullptr. Return false if |name| is taken, empty or contains spaces, or
+  // |desc| is nullptr.
+  bool RegisterRoot(const std::string& name, const void* obj, Descriptor* desc,
+                    std::mutex* mutex = nullptr);
+
+  // Stop serving root |name|. Waits for reads of it in progress, so the
+  // object can be destroyed afterwards, and must not be called holding its
+  // mutex. Return whether it was registered.
+  bool UnregisterRoot(const std::string& name);
+
+  // Answer request line |request|, given without newline, with a JSON line as
+  // served on the socket. Safe to call from any thread.
+  std::string HandleRequest(const std::string& request);
+
+  IntrospectionStats GetStats() const;
+
+ private:
+  struct Root {
+    const void* obj;
+    Descriptor* desc;
+    std::mutex* mutex;
+    // Reads in progress, which UnregisterRoot() waits for.
+    size_t readers{0};
+    bool unregistering{false};
+  };
+
+  std::string HandleGet(const std::string& name, const std::string& path);
+
+  std::string Fail(const std::string& error);
+
+  Snapshot* AcquireSnapshot();
+
+  void ReleaseSnapshot(Snapshot* snapshot);
+
+  void ServeLoop();
+
+  std::string socket_path_;
+  std::string error_;
+  int listen_fd_{-1};
+  // Written to by Stop() to wake the serving thread.
+  int wake_fds_[2]{-1, -1};
+  std::thread thread_;
+
+  // Guards roots. Not held during copies, which pin their root instead.
+  std::mutex mutex_;
+  std::map<std::string, Root> roots_;
+  // Notified when the last read of a root ends.
+  std::condition_variable released_;
+  BoundedQueue<Snapshot*> pool_;
+  FieldPathCache paths_;
+  std::atomic<uint64_t> next_sequence_{0};
+
+  std::atomic<uint64_t> requests_{0};
+  std::atomic<uint64_t> errors_{0};
+  LatencyHistogram hold_latency_;
+};
+
+}  // namespace reflection
@@ -0,0 +1,334 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/layout_analyzer.h"
+
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+#include "src/string_util.h"
+
+namespace reflection {
+
+namespace {
+
+size_t AlignUp(size_t offset, size_t align) {
+  if (align <= 1) return offset;
+  return (offset + align - 1) / align * align;
+}
+
+// Pack |members| in given order from |offset| and get resulting end, before
+// tail padding.
+size_t PackedEnd(const std::vector<const MemberLayout*>& members,
+                 size_t offset) {
+  for (const auto* member : members) {
+    offset = AlignUp(offset, member->align) + member->size;
+  }
+  return offset;
+}
+
+// Order to pack members tightest: larger alignment first, then larger size.
+// Keeps original order among equals.
+bool PackBefore(const MemberLayout* lhs, const MemberLayout* rhs) {
+  if (lhs->align != rhs->align) return lhs->align > rhs->align;
+  return lhs->size > rhs->size;
+}
+
+void FillAccessStats(const DescriptorAccessStats& stats,
+                     const LayoutOptions& options, ClassLayout* layout) {
+  uint64_t total = 0;
+  for (auto& member : layout->members) {
+    for (const auto& field : stats.fields) {
+      if (field.field_name == member.field_name) {
+        member.accesses = field.accesses;
+        break;
+      }
+    }
+    total += member.accesses;
+  }
+  if (total == 0) return;
+  layout->has_access_stats = true;
+
+  // Members annotated kMemberHot or kMemberCold keep their annotation, so only
+  // the others are classified, against their own accesses.
+  std::vector<MemberLayout*> by_accesses;
+  uint64_t unannotated_total = 0;
+  for (auto& member : layout->members) {
+    if (member.hot || member.cold) continue;
+    by_accesses.push_back(&member);
+    unannotated_total += member.accesses;
+  }
+  std::stable_sort(by_accesses.begin(), by_accesses.end(),
+                   [](const MemberLayout* lhs, const MemberLayout* rhs) {
+                     return lhs->accesses > rhs->accesses;
+                   });
+  uint64_t covered = 0;
+  for (auto* member : by_accesses) {
+    if (member->accesses == 0 ||
+        covered >=
+            options.hot_access_ratio * static_cast<double>(unannotated_total)) {
+      break;
+    }
+    member->hot = true;
+    covered += member->accesses;
+  }
+}
+
+void FillHotColdSplit(size_t line_size, ClassLayout* layout) {
+  std::set<size_t> hot_lines;
+  std::vector<const MemberLayout*> hot;
+  for (const auto& member : layout->members) {
+    if (member.hot) {
+      layout->hot_fields.push_back(member.field_name);
+      layout->hot_bytes += member.size;
+      hot.push_back(&member);
+      if (member.size == 0) continue;
+      size_t first = member.offset / line_size;
+      size_t last = (member.offset + member.size - 1) / line_size;
+      for (size_t line = first; line <= last; ++line) hot_lines.insert(line);
+    } else {
+      layout->cold_fields.push_back(member.field_name);
+      layout->cold_bytes += member.size;
+    }
+  }
+  std::stable_sort(hot.begin(), hot.end(), PackBefore);
+  size_t hot_size = PackedEnd(hot, 0);
+  layout->hot_cache_lines = hot_lines.size();
+  layout->hot_cache_lines_after_split = (hot_size + line_size - 1) / line_size;
+  layout->split_suggested =
+      !layout->cold_fields.empty() &&
+      layout->hot_cache_lines_after_split < layout->hot_cache_lines;
+}
+
+void AppendJsonString(std::ostringstream* stream, const std::string& str) {
+  *stream << '"' << StringUtil::JsonEscape(str) << '"';
+}
+
+void AppendJsonStrings(std::ostringstream* stream,
+                       const std::vector<std::string>& strs) {
+  *stream << "[";
+  for (size_t i = 0; i < strs.size(); ++i) {
+    if (i > 0) *stream << ",";
+    AppendJsonString(stream, strs[i]);
+  }
+  *stream << "]";
+}
+
+std::string JoinNames(const std::vector<std::string>& names) {
+  std::string joined;
+  for (const auto& name : names) {
+    if (!joined.empty()) joined += ", ";
+    joined += name;
+  }
+  return joined;
+}
+
+}  // namespace
+
+/* LayoutReport methods */
+
+std::string LayoutReport::ToText() const {
+  std::ostringstream stream;
+  for (const auto& layout : classes) {
+    stream << layout.type_name << ": size=" << layout.size
+           << " align=" << layout.align << " padding=" << layout.padding_bytes
+           << " (tail " << layout.tail_padding_bytes
+           << ") straddling=" << layout.straddling_members;
+    if (layout.unreflected_prefix_bytes > 0) {
+      stream << " unreflected_prefix=" << layout.unreflected_prefix_bytes;
+    }
+    stream << "\n";
+    for (const auto& member : layout.members) {
+      stream << "  @" << member.offset << " +" << member.size << " "
+             << member.field_name << " (" << member.type_name << ")";
+      if (member.padding_before > 0) {
+        stream << " after " << member.padding_before << " byte gap";
+      }
+      if (member.straddles_cache_line) stream << " straddles cache line";
+      if (layout.has_access_stats) stream << " accesses=" << member.accesses;
+      if (member.hot) stream << " hot";
+      if (member.cold) stream << " cold";
+      stream << "\n";
+    }
+    if (layout.GetReorderSavings() > 0) {
+      stream << "  reorder to save " << layout.GetReorderSavings()
+             << " bytes: " << JoinNames(layout.suggested_order) << "\n";
+    }
+    if (layout.split_suggested) {
+      stream << "  split hot fields (" << JoinNames(layout.hot_fields)
+             << ") to touch " << layout.hot_cache_lines_after_split
+             << " cache lines instead of " << layout.hot_cache_lines << "\n";
+    }
+  }
+  return stream.str();
+}
+
+std::string LayoutReport::ToJson() const {
+  std::ostringstream stream;
+  stream << "{\"classes\":[";
+  for (size_t i = 0; i < classes.size(); ++i) {
+    const auto& layout = classes[i];
+    if (i > 0) stream << ",";
+    stream << "{\"type\":";
+    AppendJsonString(&stream, layout.type_name);
+    stream << ",\"size\":" << layout.size << ",\"align\":" << layout.align
+           << ",\"unreflected_prefix_bytes\":"
+           << layout.unreflected_prefix_bytes
+           << ",\"padding_bytes\":" << layout.padding_bytes
+           << ",\"tail_padding_bytes\":" << layout.tail_padding_bytes
+           << ",\"straddling_members\":" << layout.straddling_members
+           << ",\"members\":[";
+    for (size_t j = 0; j < layout.members.size(); ++j) {
+      const auto& member = layout.members[j];
+      if (j > 0) stream << ",";
+      stream << "{\"name\":";
+      AppendJsonString(&stream, member.field_name);
+      stream << ",\"type\":";
+      AppendJsonString(&stream, member.type_name);
+      stream << ",\"offset\":" << member.offset << ",\"size\":" << member.size
+             << ",\"align\":" << member.align
+             << ",\"padding_before\":" << member.padding_before
+             << ",\"straddles_cache_line\":"
+             << (member.straddles_cache_line ? "true" : "false")
+             << ",\"accesses\":" << member.accesses
+             << ",\"hot\":" << (member.hot ? "true" : "false")
+             << ",\"cold\":" << (member.cold ? "true" : "false") << "}";
+    }
+    stream << "],\"suggested_order\":";
+    AppendJsonStrings(&stream, layout.suggested_order);
+    stream << ",\"suggested_size\":" << layout.suggested_size
+           << ",\"reorder_savings\":" << layout.GetReorderSavings();
+    if (layout.has_access_stats || layout.has_annotations) {
+      stream << ",\"hot_cold\":{\"split_suggested\":"
+             << (layout.split_suggested ? "true" : "false") << ",\"hot\":";
+      AppendJsonStrings(&stream, layout.hot_fields);
+      stream << ",\"cold\":";
+      AppendJsonStrings(&stream, layout.cold_fields);
+      stream << ",\"hot_bytes\":" << layout.hot_bytes
+             << ",\"cold_bytes\":" << layout.cold_bytes
+             << ",\"hot_cache_lines\":" << layout.hot_cache_lines
+             << ",\"hot_cache_lines_after_split\":"
+             << layout.hot_cache_lines_after_split << "}";
+    }
+    stream << "}";
+  }
+  stream << "]}";
+  return stream.str();
+}
+
+/* Layout functions */
+
+ClassLayout AnalyzeLayout(const ClassDescriptor* desc,
+                          const InstrumentationSnapshot* access,
+                          const LayoutOptions& options) {
+  ClassLayout layout;
+  if (desc == nullptr) return layout;
+  layout.type_name = desc->GetTypeName();
+  layout.size = desc->size_;
+  layout.align = desc->align_;
+
+  for (int32_t i = 0; i < desc->GetFieldSize(); ++i) {
+    MemberLayout member;
+    member.field_name = desc->GetFieldName(i);
+    member.type_name = desc->GetDescriptorById(i)->GetTypeName();
+    member.offset = desc->GetFieldOffset(i);
+    member.size = desc->GetFieldByteSize(i);
+    member.align = desc->GetFieldAlignment(i);
+    member.hot = desc->HasFieldFlag(i, kMemberHot);
+    member.cold = desc->HasFieldFlag(i, kMemberCold);
+    if (member.hot || member.cold) layout.has_annotations = true;
+    layout.members.push_back(std::move(member));
+  }
+  std::stable_sort(layout.members.begin(), layout.members.end(),
+                   [](const MemberLayout& lhs, const MemberLayout& rhs) {
+                     return lhs.offset < rhs.offset;
+                   });
+
+  size_t line_size = std::max<size_t>(options.cache_line_size, 1);
+  // Nothing pads before the first member, so bytes there belong to a vtable
+  // pointer, base classes or members not reflected.
+  if (!layout.members.empty()) {
+    layout.unreflected_prefix_bytes = layout.members.front().offset;
+  }
+  size_t end = layout.unreflected_prefix_bytes;
+  for (auto& member : layout.members) {
+    if (member.offset > end) member.padding_before = member.offset - end;
+    layout.padding_bytes += member.padding_before;
+    end = std::max(end, member.offset + member.size);
+    if (member.size > 0 && member.size <= line_size) {
+      size_t first = member.offset / line_size;
+      size_t last = (member.offset + member.size - 1) / line_size;
+      member.straddles_cache_line = first != last;
+    }
+    if (member.straddles_cache_line) ++layout.straddling_members;
+  }
+  if (layout.size > end) layout.tail_padding_bytes = layout.size - end;
+  layout.padding_bytes += layout.tail_padding_bytes;
+
+  const DescriptorAccessStats* stats =
+      access == nullptr ? nullptr : access->Find(desc);
+  if (stats != nullptr) FillAccessStats(*stats, options, &layout);
+
+  std::vector<const MemberLayout*> order;
+  for (const auto& member : layout.members) order.push_back(&member);
+  std::stable_sort(order.begin(), order.end(),
+                   [](const MemberLayout* lhs, const MemberLayout* rhs) {
+                     if (lhs->hot != rhs->hot) return lhs->hot;
+                     if (lhs->cold != rhs->cold) return rhs->cold;
+                     return PackBefore(lhs, rhs);
+                   });
+  for (const auto* member : order) {
+    layout.suggested_order.push_back(member->field_name);
+  }
+  layout.suggested_size =
+      order.empty() ? layout.size
+                    : AlignUp(PackedEnd(order, layout.unreflected_prefix_bytes),
+                              layout.align);
+
+  if (layout.has_access_stats || layout.has_annotations) {
+    FillHotColdSplit(line_size, &layout);
+  }
+  return layout;
+}
+
+LayoutReport AnalyzeAllLayouts(const InstrumentationSnapshot* access,
+                               const LayoutOptions& options) {
+  LayoutReport report;
+  auto& factory = ClassReflFactory::Get();
+  for (const auto& name : factory.GetRegisteredNames()) {
+    auto* desc = ClassDescriptor::ToClassDescriptor(
+        factory.GetDescriptorByName(name));
+    if (desc == nullptr) continue;
+    report.classes.push_back(AnalyzeLayout(desc, access, options));
+  }
+  return report;
+}
+
+bool CheckLayout(Descriptor* desc, const LayoutBudget& budget,
+                 std::string* error, const LayoutOptions& options) {
+  auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+  if (class_desc == nullptr) {
+    if (error != nullptr) *error = "not a reflected class";
+    return false;
+  }
+  ClassLayout layout = AnalyzeLayout(class_desc, nullptr, options);
+
+  std::ostringstream stream;
+  auto check = [&](const char* what, size_t value, int64_t limit) {
+    if (limit < 0 || value <= static_cast<size_t>(limit)) return;
+    stream << layout.type_name << ": " << what << " " << value
+           << " exceeds budget " << limit << "\n";
+  };
+  check("size", layout.size, budget.max_size);
+  check("padding bytes", layout.padding_bytes, budget.max_padding_bytes);
+  check("straddling members", layout.straddling_members,
+        budget.max_straddling_members);
+  check("reorder savings", layout.GetReorderSavings(),
+        budget.max_reorder_savings);
+
+  std::string violations = stream.str();
+  if (error != nullptr) *error = violations;
+  return violations.empty();
+}
+
+}  // namespace reflection
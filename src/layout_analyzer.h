@@ -0,0 +1,132 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "src/instrumentation.h"
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * Memory layout analysis of reflected classes: padding, members straddling
+ * cache lines, a packed member order, and a hot/cold split when access
+ * counters are available (see instrumentation.h) or members are annotated
+ * kMemberHot or kMemberCold. Annotations take precedence over counters.
+ *
+ * Only reflected members are visible. Bytes before the first one (vtable
+ * pointer, base classes) are kept in place, but members not reflected in
+ * between are reported as padding. Reflect every member of structs whose
+ * layout matters.
+ *
+ * Usage:
+ *   std::cout << AnalyzeAllLayouts().ToText();
+ *
+ *   // In a test, keep a hot struct from regressing.
+ *   LayoutBudget budget;
+ *   budget.max_padding_bytes = 0;
+ *   budget.max_straddling_members = 0;
+ *   std::string error;
+ *   EXPECT_TRUE(CheckLayout(DESC("Pose"), budget, &error)) << error;
+ */
+
+struct LayoutOptions {
+  size_t cache_line_size{64};
+  // Hot fields are the most accessed ones covering this share of accesses of
+  // fields not annotated kMemberHot or kMemberCold.
+  double hot_access_ratio{0.9};
+};
+
+struct MemberLayout {
+  std::string field_name;
+  std::string type_name;
+  size_t offset{0};
+  size_t size{0};
+  size_t align{0};
+  // Gap between previous member, or class start, and this one.
+  size_t padding_before{0};
+  // Whether it spans two cache lines while it could fit in one.
+  bool straddles_cache_line{false};
+  // Accesses recorded by instrumentation, 0 if not available.
+  uint64_t accesses{0};
+  // Annotated kMemberHot, or not annotated and among the most accessed of
+  // members not annotated.
+  bool hot{false};
+  // Annotated kMemberCold.
+  bool cold{false};
+};
+
+struct ClassLayout {
+  std::string type_name;
+  size_t size{0};
+  size_t align{0};
+  // Reflected members in offset order.
+  std::vector<MemberLayout> members;
+  // Bytes before the first reflected member, which can't be padding.
+  size_t unreflected_prefix_bytes{0};
+  // Bytes not covered by any reflected member after the first one, tail
+  // padding included.
+  size_t padding_bytes{0};
+  size_t tail_padding_bytes{0};
+  size_t straddling_members{0};
+
+  // Member order packing reflected members tightest, hot ones first and cold
+  // ones last if known, and resulting class size.
+  std::vector<std::string> suggested_order;
+  size_t suggested_size{0};
+
+  // Hot/cold split, only filled with access counters or hot/cold annotations.
+  // Suggested when hot members packed alone touch fewer cache lines than in
+  // current layout.
+  bool has_access_stats{false};
+  bool has_annotations{false};
+  bool split_suggested{false};
+  std::vector<std::string> hot_fields;
+  std::vector<std::string> cold_fields;
+  size_t hot_bytes{0};
+  size_t cold_bytes{0};
+  size_t hot_cache_lines{0};
+  size_t hot_cache_lines_after_split{0};
+
+  // Bytes saved by suggested order.
+  size_t GetReorderSavings() const {
+    return size > suggested_size ? size - suggested_size : 0;
+  }
+};
+
+struct LayoutReport {
+  std::vector<ClassLayout> classes;
+
+  std::string ToText() const;
+
+  std::string ToJson() const;
+};
+
+// Limits checked by CheckLayout(). Negative values are not checked.
+struct LayoutBudget {
+  int64_t max_size{-1};
+  int64_t max_padding_bytes{-1};
+  int64_t max_straddling_members{-1};
+  int64_t max_reorder_savings{-1};
+};
+
+// Analyze layout of |desc|. |access| may be nullptr, otherwise its counters of
+// |desc| drive hot/cold suggestions.
+ClassLayout AnalyzeLayout(const ClassDescriptor* desc,
+                          const InstrumentationSnapshot* access = nullptr,
+                          const LayoutOptions& options = LayoutOptions());
+
+// Analyze every class registered in ClassReflFactory, in name order.
+LayoutReport AnalyzeAllLayouts(const InstrumentationSnapshot* access = nullptr,
+                               const LayoutOptions& options = LayoutOptions());
+
+// Check layout of |desc| against |budget|. Return false and describe every
+// violation in |error| if any, or if |desc| is not a class.
+bool CheckLayout(Descriptor* desc, const LayoutBudget& budget,
+                 std::string* error = nullptr,
+                 const LayoutOptions& options = LayoutOptions());
+
+}  // namespace reflection
@@ -0,0 +1,151 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/object_walker.h"
+
+#include <algorithm>
+
+namespace reflection {
+
+bool ObjectWalker::Walk(const void* obj, Descriptor* desc,
+                        ObjectVisitor* visitor) {
+  stack_.clear();
+  visited_.clear();
+  if (obj == nullptr || desc == nullptr) return true;
+
+  WalkNode root;
+  root.obj = obj;
+  root.desc = desc;
+  stack_.push_back({root, false});
+
+  while (!stack_.empty()) {
+    Frame frame = stack_.back();
+    stack_.pop_back();
+    WalkNode& node = frame.node;
+
+    if (frame.post) {
+      switch (node.desc->GetKind()) {
+        case DescriptorKind::kClass:
+          visitor->PostVisitClass(node);
+          break;
+        case DescriptorKind::kContainer:
+          visitor->PostVisitContainer(node);
+          break;
+        case DescriptorKind::kSmartPtr:
+          visitor->PostVisitSmartPtr(node);
+          break;
+        case DescriptorKind::kVariant:
+          visitor->PostVisitVariant(node);
+          break;
+        default:
+          break;
+      }
+      continue;
+    }
+
+    WalkAction action = WalkAction::kContinue;
+    switch (node.desc->GetKind()) {
+      case DescriptorKind::kClass:
+        action = visitor->PreVisitClass(node);
+        break;
+      case DescriptorKind::kContainer:
+        action = visitor->PreVisitContainer(node);
+        break;
+      case DescriptorKind::kSmartPtr: {
+        auto* ptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(node.desc);
+        if (options_.dedup_shared && ptr_desc->IsSharedOwnership()) {
+          const void* content = ptr_desc->GetRawPtr(node.obj);
+          node.revisit =
+              content != nullptr && !visited_.insert(content).second;
+        }
+        action = visitor->PreVisitSmartPtr(node);
+        break;
+      }
+      case DescriptorKind::kVariant:
+        action = visitor->PreVisitVariant(node);
+        break;
+      case DescriptorKind::kMessage:
+        action = visitor->VisitMessage(node);
+        if (action == WalkAction::kStop) return false;
+        continue;
+      default:
+        action = visitor->VisitLeaf(node);
+        if (action == WalkAction::kStop) return false;
+        continue;
+    }
+    if (action == WalkAction::kStop) return false;
+
+    stack_.push_back({node, true});
+    if (action == WalkAction::kSkipChildren || node.revisit) continue;
+    if (options_.max_depth >= 0 && node.depth >= options_.max_depth) continue;
+    PushChildren(node);
+  }
+  return true;
+}
+
+void ObjectWalker::PushChildren(const WalkNode& node) {
+  size_t first = stack_.size();
+  switch (node.desc->GetKind()) {
+    case DescriptorKind::kClass: {
+      auto* class_desc = ClassDescriptor::ToClassDescriptor(node.desc);
+      int32_t size = class_desc->GetFieldSize();
+      for (int32_t i = 0; i < size; ++i) {
+        PushChild(node, class_desc->GetFieldValueById(node.obj, i),
+                  class_desc->GetDescriptorById(i), WalkEdge::kField, i,
+                  nullptr);
+      }
+      break;
+    }
+    case DescriptorKind::kContainer: {
+      auto* container_desc =
+          ContainerDescriptor::ToContainerDescriptor(node.desc);
+      Descriptor* key_desc = container_desc->GetKeyDescriptor();
+      Descriptor* value_desc = container_desc->GetValueDescriptor();
+      int64_t index = 0;
+      container_desc->ForEachElement(
+          node.obj, [&](const void* key, const void* value) {
+            if (key != nullptr) {
+              PushChild(node, key, key_desc, WalkEdge::kKey, index, nullptr);
+            }
+            PushChild(node, value, value_desc, WalkEdge::kValue, index, key);
+            ++index;
+            return true;
+          });
+      break;
+    }
+    case DescriptorKind::kSmartPtr: {
+      auto* ptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(node.desc);
+      PushChild(node, ptr_desc->GetRawPtr(node.obj),
+                ptr_desc->GetContentDescriptor(), WalkEdge::kContent, -1,
+                nullptr);
+      break;
+    }
+    case DescriptorKind::kVariant: {
+      auto* variant_desc = VariantDescriptor::ToVariantDescriptor(node.desc);
+      PushChild(node, variant_desc->GetActiveValue(node.obj),
+                variant_desc->GetActiveDescriptor(node.obj), WalkEdge::kContent,
+                variant_desc->GetIndex(node.obj), nullptr);
+      break;
+    }
+    default:
+      break;
+  }
+  // Children are pushed in order, reverse them to pop the first one first.
+  std::reverse(stack_.begin() + first, stack_.end());
+}
+
+void ObjectWalker::PushChild(const WalkNode& parent, const void* obj,
+                             Descriptor* desc, WalkEdge edge, int64_t index,
+                             const void* key) {
+  if (obj == nullptr || desc == nullptr) return;
+  WalkNode child;
+  child.obj = obj;
+  child.desc = desc;
+  child.depth = parent.depth + 1;
+  child.edge = edge;
+  child.parent = parent.desc;
+  child.index = index;
+  child.key = key;
+  stack_.push_back({child, false});
+}
+
+}  // namespace reflection
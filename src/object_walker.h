@@ -0,0 +1,152 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+// How a node is reached from its parent.
+enum class WalkEdge : uint8_t {
+  kRoot = 0,
+  // Reflected field of a class.
+  kField,
+  // Key of a map-liked container element.
+  kKey,
+  // Value of a container element.
+  kValue,
+  // Content of a smart pointer, or active alternative of a variant.
+  kContent,
+};
+
+struct WalkNode {
+  const void* obj{nullptr};
+  Descriptor* desc{nullptr};
+  int32_t depth{0};
+  WalkEdge edge{WalkEdge::kRoot};
+  // Descriptor of parent node, nullptr for root.
+  Descriptor* parent{nullptr};
+  // Field id in parent class for kField (see ClassDescriptor::HasFieldFlag()
+  // for its annotations), element ordinal in parent container for kKey and
+  // kValue, active alternative index in parent variant for kContent, -1
+  // otherwise.
+  int64_t index{-1};
+  // Key of the element for kValue in map-liked containers, nullptr otherwise.
+  const void* key{nullptr};
+  // For shared smart pointers: content has been walked through another
+  // pointer already, so it is not walked again.
+  bool revisit{false};
+};
+
+enum class WalkAction : uint8_t {
+  kContinue = 0,
+  // Don't walk into children of current node. Post-visit is still called.
+  kSkipChildren,
+  // Stop the whole walk. No further callback is called.
+  kStop,
+};
+
+/**
+ * Callbacks of ObjectWalker. Override those of interest. Pre-visits are
+ * called before children of a node, post-visits after all of them. Messages
+ * and leaves (pre-defined types) have no children, so they have a single
+ * visit.
+ */
+class ObjectVisitor {
+ public:
+  virtual ~ObjectVisitor() {}
+
+  virtual WalkAction PreVisitClass(const WalkNode& node) {
+    return WalkAction::kContinue;
+  }
+  virtual void PostVisitClass(const WalkNode& node) {}
+
+  virtual WalkAction PreVisitContainer(const WalkNode& node) {
+    return WalkAction::kContinue;
+  }
+  virtual void PostVisitContainer(const WalkNode& node) {}
+
+  // Also called for null pointers, which have no content to walk.
+  virtual WalkAction PreVisitSmartPtr(const WalkNode& node) {
+    return WalkAction::kContinue;
+  }
+  virtual void PostVisitSmartPtr(const WalkNode& node) {}
+
+  virtual WalkAction PreVisitVariant(const WalkNode& node) {
+    return WalkAction::kContinue;
+  }
+  virtual void PostVisitVariant(const WalkNode& node) {}
+
+  virtual WalkAction VisitMessage(const WalkNode& node) {
+    return WalkAction::kContinue;
+  }
+
+  virtual WalkAction VisitLeaf(const WalkNode& node) {
+    return WalkAction::kContinue;
+  }
+};
+
+/**
+ * Depth-first traversal of an object graph by descriptors, in declaration
+ * order of fields and iteration order of containers. An explicit stack is
+ * used instead of recursion, so deep graphs never overflow the native stack,
+ * and the stack is kept between walks, so walking again doesn't allocate once
+ * warmed up. A walker is not thread-safe, use one per thread.
+ *
+ * Usage:
+ *   class CountStrings : public ObjectVisitor {
+ *    public:
+ *     WalkAction VisitLeaf(const WalkNode& node) override {
+ *       if (node.desc == DescriptorAccessor<std::string>::Get()) ++count;
+ *       return WalkAction::kContinue;
+ *     }
+ *     int32_t count{0};
+ *   };
+ *
+ *   ObjectWalker walker;
+ *   CountStrings visitor;
+ *   walker.Walk(&obj, DESC("A"), &visitor);
+ */
+class ObjectWalker {
+ public:
+  struct Options {
+    // Nodes deeper than it are not walked. Root is at depth 0. Negative means
+    // no limit.
+    int32_t max_depth{-1};
+    // Walk content shared by several std::shared_ptr only once, which also
+    // breaks reference cycles.
+    bool dedup_shared{true};
+  };
+
+  ObjectWalker() = default;
+  explicit ObjectWalker(const Options& options) : options_(options) {}
+
+  // Walk |obj| described by |desc|. Return false if stopped by visitor.
+  bool Walk(const void* obj, Descriptor* desc, ObjectVisitor* visitor);
+
+  const Options& GetOptions() const { return options_; }
+
+  void SetOptions(const Options& options) { options_ = options; }
+
+ private:
+  struct Frame {
+    WalkNode node;
+    bool post;
+  };
+
+  // Push children of |node| so that the first child is on top.
+  void PushChildren(const WalkNode& node);
+
+  void PushChild(const WalkNode& parent, const void* obj, Descriptor* desc,
+                 WalkEdge edge, int64_t index, const void* key);
+
+  Options options_;
+  std::vector<Frame> stack_;
+  std::unordered_set<const void*> visited_;
+};
+
+}  // namespace reflection
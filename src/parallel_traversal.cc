@@ -0,0 +1,89 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/parallel_traversal.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace reflection {
+
+/* ContainerChunks methods */
+
+ContainerChunks::ContainerChunks(const void* obj, ContainerDescriptor* desc,
+                                 size_t grain)
+    : obj_(obj), desc_(desc), grain_(std::max<size_t>(grain, 1)) {
+  if (obj_ == nullptr || desc_ == nullptr) return;
+  partition_size_ = desc_->GetPartitionSize(obj_);
+  if (partition_size_ == 0) {
+    // Ordered containers can't be split without iterating, so list elements
+    // in one sequential pass.
+    elements_.reserve(desc_->GetContainerSize(obj_));
+    desc_->ForEachElement(obj_, [this](const void* key, const void* value) {
+      elements_.emplace_back(key, value);
+      return true;
+    });
+    partition_size_ = elements_.size();
+  }
+  chunk_size_ = (partition_size_ + grain_ - 1) / grain_;
+}
+
+bool ContainerChunks::ForEachElementInChunk(
+    size_t chunk, const ContainerDescriptor::ElementVisitor& visitor) const {
+  if (chunk >= chunk_size_) return true;
+  size_t begin = chunk * grain_;
+  size_t end = std::min(begin + grain_, partition_size_);
+  if (elements_.empty()) {
+    return desc_->ForEachElementInPartitions(obj_, begin, end, visitor);
+  }
+  for (size_t i = begin; i < end; ++i) {
+    if (!visitor(elements_[i].first, elements_[i].second)) return false;
+  }
+  return true;
+}
+
+/* Parallel traversals */
+
+bool ParallelForEachElement(WorkStealingPool* pool,
+                            const ContainerChunks& chunks,
+                            const ChunkElementVisitor& visitor) {
+  std::atomic<bool> stopped{false};
+  pool->ParallelFor(chunks.GetChunkSize(), [&](size_t chunk) {
+    if (stopped.load(std::memory_order_relaxed)) return;
+    bool finished = chunks.ForEachElementInChunk(
+        chunk, [&](const void* key, const void* value) {
+          return visitor(chunk, key, value) &&
+                 !stopped.load(std::memory_order_relaxed);
+        });
+    if (!finished) stopped.store(true, std::memory_order_relaxed);
+  });
+  return !stopped.load();
+}
+
+bool ParallelWalk(
+    WorkStealingPool* pool, const ContainerChunks& chunks,
+    const std::function<ObjectVisitor*(size_t chunk)>& visitor_of_chunk,
+    const ObjectWalker::Options& options) {
+  ContainerDescriptor* desc = chunks.GetDescriptor();
+  if (desc == nullptr) return true;
+  Descriptor* key_desc = desc->GetKeyDescriptor();
+  Descriptor* value_desc = desc->GetValueDescriptor();
+
+  std::atomic<bool> stopped{false};
+  pool->ParallelFor(chunks.GetChunkSize(), [&](size_t chunk) {
+    if (stopped.load(std::memory_order_relaxed)) return;
+    ObjectWalker walker(options);
+    ObjectVisitor* visitor = visitor_of_chunk(chunk);
+    bool finished = chunks.ForEachElementInChunk(
+        chunk, [&](const void* key, const void* value) {
+          if (key != nullptr && !walker.Walk(key, key_desc, visitor)) {
+            return false;
+          }
+          return walker.Walk(value, value_desc, visitor) &&
+                 !stopped.load(std::memory_order_relaxed);
+        });
+    if (!finished) stopped.store(true, std::memory_order_relaxed);
+  });
+  return !stopped.load();
+}
+
+}  // namespace reflection
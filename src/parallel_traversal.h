@@ -0,0 +1,112 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "src/object_walker.h"
+#include "src/reflection.h"
+#include "src/work_stealing_pool.h"
+
+namespace reflection {
+
+/**
+ * Parallel traversal of large reflected containers.
+ *
+ * A container is split into chunks by ContainerChunks: index ranges for
+ * vectors, bucket ranges for unordered containers, and ranges of a one-pass
+ * element list for ordered ones. Chunks only depend on the container and the
+ * grain, never on the number of threads, and results of ParallelReduce() are
+ * combined in chunk order, so results are the same on any pool size.
+ *
+ * Usage:
+ *   WorkStealingPool pool;
+ *   ContainerChunks chunks(&obj.points_, points_desc);
+ *   double sum = ParallelReduce<double>(
+ *       &pool, chunks, 0.0,
+ *       [](double* partial, const void* key, const void* value) {
+ *         *partial += static_cast<const Point*>(value)->x_;
+ *       },
+ *       [](double* total, const double& partial) { *total += partial; });
+ */
+class ContainerChunks {
+ public:
+  // Split container |obj| into chunks of about |grain| partitions (elements,
+  // or buckets for unordered containers).
+  ContainerChunks(const void* obj, ContainerDescriptor* desc,
+                  size_t grain = 1024);
+
+  size_t GetChunkSize() const { return chunk_size_; }
+
+  ContainerDescriptor* GetDescriptor() const { return desc_; }
+
+  // Visit elements of |chunk| in container order. Return false if stopped by
+  // visitor.
+  bool ForEachElementInChunk(
+      size_t chunk, const ContainerDescriptor::ElementVisitor& visitor) const;
+
+ private:
+  const void* obj_;
+  ContainerDescriptor* desc_;
+  size_t grain_;
+  size_t partition_size_{0};
+  size_t chunk_size_{0};
+  // (key, value) of every element, only for containers without partitions.
+  std::vector<std::pair<const void*, const void*>> elements_;
+};
+
+// Called with chunk index, key (nullptr if none) and value of every element.
+// Return false to stop the traversal.
+typedef std::function<bool(size_t chunk, const void* key, const void* value)>
+    ChunkElementVisitor;
+
+// Visit all elements on |pool|, chunks in parallel. Return false if stopped by
+// visitor, in which case chunks not started yet are skipped.
+bool ParallelForEachElement(WorkStealingPool* pool,
+                            const ContainerChunks& chunks,
+                            const ChunkElementVisitor& visitor);
+
+// Reduce all elements on |pool|. Every chunk accumulates into a local partial
+// result starting from |init|, stored once the chunk is done, then partials
+// are combined into |init| in chunk order. |accumulate| is called as
+// void(Result*, const void* key, const void* value) and |combine| as
+// void(Result*, const Result&); both are inlined into the per-chunk loop, so
+// the only indirect call per element is the one of the container descriptor.
+template <typename Result, typename Accumulate, typename Combine>
+Result ParallelReduce(WorkStealingPool* pool, const ContainerChunks& chunks,
+                      const Result& init, const Accumulate& accumulate,
+                      const Combine& combine) {
+  // Slots are a cache line apart, so that chunks finishing on different
+  // threads don't invalidate each other's line.
+  struct Slot {
+    Result value;
+    char padding[64];
+  };
+  std::vector<Slot> partials(chunks.GetChunkSize(), Slot{init, {}});
+  pool->ParallelFor(chunks.GetChunkSize(), [&](size_t chunk) {
+    Result partial = init;
+    chunks.ForEachElementInChunk(chunk,
+                                 [&](const void* key, const void* value) {
+                                   accumulate(&partial, key, value);
+                                   return true;
+                                 });
+    partials[chunk].value = std::move(partial);
+  });
+  Result total = init;
+  for (const auto& partial : partials) combine(&total, partial.value);
+  return total;
+}
+
+// Walk keys and values of all elements with ObjectWalker on |pool|.
+// |visitor_of_chunk| is called once per chunk, and the returned visitor is
+// only used by that chunk, so visitors need no synchronization. Shared pointer
+// dedup applies within one element. Return false if any visitor stopped.
+bool ParallelWalk(
+    WorkStealingPool* pool, const ContainerChunks& chunks,
+    const std::function<ObjectVisitor*(size_t chunk)>& visitor_of_chunk,
+    const ObjectWalker::Options& options = ObjectWalker::Options());
+
+}  // namespace reflection
@@ -2,14 +2,127 @@
 // Author: Yuchen Liu (yuchenliu@deeproute.ai)
 #include "src/reflection.h"
 
+#include <algorithm>
+
 #include <boost/core/demangle.hpp>
 
+#include "src/instrumentation.h"
+
 namespace reflection {
 
-void* ClassReflFactory::GetClassByName(const std::string& name) {
-  if (util_.find(name) == util_.end()) return nullptr;
+namespace {
+
+const uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+const uint64_t kFnvPrime = 1099511628211ull;
+
+void HashBytes(const void* data, size_t size, uint64_t* hash) {
+  auto* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    *hash ^= bytes[i];
+    *hash *= kFnvPrime;
+  }
+}
+
+// Integers are widened, so that hashes don't depend on the widths of size_t
+// and enums.
+void HashInt(uint64_t value, uint64_t* hash) {
+  HashBytes(&value, sizeof(value), hash);
+}
+
+void HashString(const std::string& str, uint64_t* hash) {
+  HashInt(str.size(), hash);
+  HashBytes(str.data(), str.size(), hash);
+}
+
+// Hash schema of |desc| into |hash|. |path| holds classes being hashed, which
+// are hashed by their depth there when reached again.
+void HashDescriptor(Descriptor* desc, std::vector<const Descriptor*>* path,
+                    uint64_t* hash) {
+  if (desc == nullptr) {
+    HashInt(0, hash);
+    return;
+  }
+  HashInt(static_cast<uint64_t>(desc->GetKind()) + 1, hash);
+  HashString(desc->GetTypeName(), hash);
+  HashInt(desc->size_, hash);
+
+  if (auto* class_desc = ClassDescriptor::ToClassDescriptor(desc)) {
+    auto iter = std::find(path->begin(), path->end(), desc);
+    if (iter != path->end()) {
+      HashInt(iter - path->begin(), hash);
+      return;
+    }
+    path->push_back(desc);
+    HashInt(class_desc->GetFieldSize(), hash);
+    for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+      HashString(class_desc->GetFieldName(i), hash);
+      HashInt(class_desc->GetFieldOffset(i), hash);
+      // Only flags changing what is stored are hashed, and only if set, so
+      // fingerprints of classes without them are unchanged.
+      const auto& attributes = class_desc->GetFieldAttributes(i);
+      uint32_t stored_flags =
+          attributes.flags & (kMemberTransient | kMemberQuantized);
+      if (stored_flags != 0) {
+        HashInt(stored_flags, hash);
+        if (stored_flags & kMemberQuantized) {
+          HashBytes(&attributes.quantum, sizeof(attributes.quantum), hash);
+        }
+      }
+      HashDescriptor(class_desc->GetDescriptorById(i), path, hash);
+    }
+    path->pop_back();
+  } else if (auto* container_desc =
+                 ContainerDescriptor::ToContainerDescriptor(desc)) {
+    HashInt(container_desc->GetFixedSize(), hash);
+    HashDescriptor(container_desc->GetKeyDescriptor(), path, hash);
+    HashDescriptor(container_desc->GetValueDescriptor(), path, hash);
+  } else if (auto* ptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(desc)) {
+    HashDescriptor(ptr_desc->GetContentDescriptor(), path, hash);
+  } else if (auto* variant_desc =
+                 VariantDescriptor::ToVariantDescriptor(desc)) {
+    HashInt(variant_desc->GetAlternativeSize(), hash);
+    for (int32_t i = 0; i < variant_desc->GetAlternativeSize(); ++i) {
+      HashDescriptor(variant_desc->GetAlternativeDescriptor(i), path, hash);
+    }
+  } else if (auto* enum_desc = EnumDescriptor::ToEnumDescriptor(desc)) {
+    HashDescriptor(enum_desc->GetUnderlyingDescriptor(), path, hash);
+  }
+}
+
+}  // namespace
+
+struct ClassReflFactory::Registry {
+  std::unordered_map<std::string, ClassReflUtil> utils;
+};
+
+/* ClassReflFactory::ModuleScope methods */
 
-  return util_.at(name).func();
+ClassReflFactory::ModuleScope::ModuleScope(const std::string& module)
+    : previous_(GetCurrentModule()) {
+  MutableCurrentModule() = module;
+}
+
+ClassReflFactory::ModuleScope::~ModuleScope() {
+  MutableCurrentModule() = previous_;
+}
+
+/* ClassReflFactory methods */
+
+ClassReflFactory::ClassReflFactory()
+    : registry_(new Registry), staging_(new Registry) {}
+
+ClassReflFactory::~ClassReflFactory() { delete registry_.load(); }
+
+void* ClassReflFactory::GetClassByName(const std::string& name) {
+  PublishPending();
+  EpochReclaimer::Guard guard(&reclaimer_);
+  const auto& utils = registry_.load()->utils;
+  auto iter = utils.find(name);
+  SSR_INSTRUMENT(
+      Instrumentation::RecordFactoryInstantiation(name, iter != utils.end()));
+  if (iter == utils.end()) return nullptr;
+
+  return iter->second.func();
 }
 
 void* ClassReflFactory::FindClassByTypeInfo(const std::type_info& type_info) {
@@ -18,33 +131,174 @@ void* ClassReflFactory::FindClassByTypeInfo(const std::type_info& type_info) {
 }
 
 Descriptor* ClassReflFactory::GetDescriptorByName(const std::string& name) {
-  if (util_.find(name) == util_.end()) return nullptr;
-
-  return util_.at(name).desc;
+  SSR_INSTRUMENT(SampledLatencyTimer timer);
+  PublishPending();
+  EpochReclaimer::Guard guard(&reclaimer_);
+  const auto& utils = registry_.load()->utils;
+  auto iter = utils.find(name);
+  SSR_INSTRUMENT(Instrumentation::RecordFactoryLookup(
+      name, iter != utils.end() && iter->second.desc != nullptr,
+      timer.Elapsed()));
+  if (iter == utils.end()) return nullptr;
+
+  return iter->second.desc;
 }
 
 Descriptor* ClassReflFactory::FindDescriptorByTypeInfo(
     const std::type_info& type_info) {
   std::string typeid_name = boost::core::demangle(type_info.name());
-  return GetDescriptorByName(typeid_name);
+  auto* desc = GetDescriptorByName(typeid_name);
+  SSR_INSTRUMENT(Instrumentation::RecordFactoryRttiLookup(desc != nullptr));
+  return desc;
+}
+
+RegistrationId ClassReflFactory::RegisterClassFunc(const std::string& name,
+                                                   instance_ptr_creator func) {
+  return Register(name, &func, nullptr);
 }
 
-void ClassReflFactory::RegisterClassFunc(const std::string& name,
-                                         instance_ptr_creator func) {
-  if (util_.find(name) == util_.end()) util_.insert({name, {}});
-  util_.at(name).func = func;
+RegistrationId ClassReflFactory::RegisterClassDescriptor(
+    const std::string& name, Descriptor* desc) {
+  return Register(name, nullptr, desc);
 }
 
-void ClassReflFactory::RegisterClassDescriptor(const std::string& name,
-                                               Descriptor* desc) {
-  if (util_.find(name) == util_.end()) util_.insert({name, {}});
-  util_.at(name).desc = desc;
+ClassReflRegistration ClassReflFactory::RegisterScoped(
+    const std::string& name, instance_ptr_creator func) {
+  return ClassReflRegistration(name, RegisterClassFunc(name, std::move(func)));
+}
+
+ClassReflRegistration ClassReflFactory::RegisterScoped(const std::string& name,
+                                                       Descriptor* desc) {
+  return ClassReflRegistration(name, RegisterClassDescriptor(name, desc));
+}
+
+bool ClassReflFactory::Unregister(const std::string& name, RegistrationId id) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  auto& utils = staging_->utils;
+  auto iter = utils.find(name);
+  if (iter == utils.end()) return false;
+  if (iter->second.func_id != id && iter->second.desc_id != id) return false;
+
+  auto& util = iter->second;
+  if (util.func_id == id) {
+    util.func = ClassReflUtil().func;
+    util.func_id = 0;
+  }
+  if (util.desc_id == id) {
+    util.desc = nullptr;
+    util.desc_id = 0;
+  }
+  if (util.func_id == 0 && util.desc_id == 0) utils.erase(iter);
+  PublishStagingLocked();
+  unregister_count_.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+size_t ClassReflFactory::UnregisterModule(const std::string& module) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  auto& utils = staging_->utils;
+  size_t removed = 0;
+  for (auto iter = utils.begin(); iter != utils.end();) {
+    if (iter->second.module == module) {
+      iter = utils.erase(iter);
+      ++removed;
+    } else {
+      ++iter;
+    }
+  }
+  if (removed == 0) return 0;
+  PublishStagingLocked();
+  unregister_count_.fetch_add(1, std::memory_order_release);
+  return removed;
+}
+
+std::vector<std::string> ClassReflFactory::GetRegisteredNames() const {
+  std::vector<std::string> names;
+  PublishPending();
+  {
+    EpochReclaimer::Guard guard(&reclaimer_);
+    const auto& utils = registry_.load()->utils;
+    names.reserve(utils.size());
+    for (const auto& util : utils) names.push_back(util.first);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+uint64_t ClassReflFactory::GetFingerprint(const std::string& name) {
+  auto* desc = ClassDescriptor::ToClassDescriptor(GetDescriptorByName(name));
+  if (desc == nullptr) return 0;
+  return desc->GetFingerprint();
+}
+
+const std::string& ClassReflFactory::GetCurrentModule() {
+  return MutableCurrentModule();
+}
+
+RegistrationId ClassReflFactory::Register(const std::string& name,
+                                          instance_ptr_creator* func,
+                                          Descriptor* desc) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  auto& util = staging_->utils[name];
+  RegistrationId id = next_id_++;
+  if (func != nullptr) {
+    util.func = std::move(*func);
+    util.func_id = id;
+  } else {
+    util.desc = desc;
+    util.desc_id = id;
+  }
+  util.module = GetCurrentModule();
+  pending_.store(true, std::memory_order_release);
+  return id;
+}
+
+void ClassReflFactory::PublishStaging() const {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  if (pending_.load(std::memory_order_relaxed)) PublishStagingLocked();
+}
+
+void ClassReflFactory::PublishStagingLocked() const {
+  const Registry* old_registry = registry_.exchange(new Registry(*staging_));
+  // After the exchange, so that lookups seeing nothing pending see the table.
+  pending_.store(false, std::memory_order_release);
+  reclaimer_.Retire([old_registry]() { delete old_registry; });
+  reclaimer_.TryReclaim();
+}
+
+std::string& ClassReflFactory::MutableCurrentModule() {
+  thread_local std::string module;
+  return module;
+}
+
+/* Descriptor methods */
+
+bool Descriptor::IsByteCopyable() const {
+  switch (kind_) {
+    case DescriptorKind::kPreDefined:
+      return primitive_type_ != PrimitiveType::kString;
+    case DescriptorKind::kEnum:
+      return true;
+    case DescriptorKind::kContainer: {
+      auto* container_desc = ContainerDescriptor::ToContainerDescriptor(this);
+      return container_desc->GetFixedSize() >= 0 &&
+             container_desc->IsValueTriviallyCopyable();
+    }
+    default:
+      return false;
+  }
 }
 
 /* Pre-defined descriptors */
 
+ADD_PRE_DEFINED_DESC(int8_t, Int8);
+ADD_PRE_DEFINED_DESC(int16_t, Int16);
 ADD_PRE_DEFINED_DESC(int32_t, Int32);
 ADD_PRE_DEFINED_DESC(int64_t, Int64);
+ADD_PRE_DEFINED_DESC(uint8_t, UInt8);
+ADD_PRE_DEFINED_DESC(uint16_t, UInt16);
+ADD_PRE_DEFINED_DESC(uint32_t, UInt32);
+ADD_PRE_DEFINED_DESC(uint64_t, UInt64);
 ADD_PRE_DEFINED_DESC(float, Float);
 ADD_PRE_DEFINED_DESC(double, Double);
 ADD_PRE_DEFINED_DESC(bool, Bool);
@@ -56,6 +310,55 @@ ADD_PRE_DEFINED_DESC(glm::mat3, Mat3);
 ADD_PRE_DEFINED_DESC(glm::mat4, Mat4);
 ADD_PRE_DEFINED_DESC(glm::quat, Quaternion);
 
+/* StringDescriptor methods */
+
+size_t StringDescriptor::GetHeapBytes(const void* obj) const {
+  const auto* str = static_cast<const std::string*>(obj);
+  if (str == nullptr) return 0;
+  // Short strings are stored inside the object itself.
+  auto data = reinterpret_cast<uintptr_t>(str->data());
+  auto begin = reinterpret_cast<uintptr_t>(str);
+  if (data >= begin && data < begin + sizeof(std::string)) return 0;
+  return str->capacity() + 1;
+}
+
+/* EnumDescriptor methods */
+
+int64_t EnumDescriptor::GetValue(const void* obj) const {
+  if (obj == nullptr) return 0;
+  return get_val_(obj);
+}
+
+bool EnumDescriptor::SetValue(void* obj, int64_t value) {
+  if (obj == nullptr) return false;
+  set_val_(obj, value);
+  return true;
+}
+
+string_view EnumDescriptor::GetValueNameView(const void* obj) const {
+  if (obj == nullptr) return string_view();
+  int64_t value = get_val_(obj);
+  for (const auto& name : names_) {
+    if (name.value == value) return name.name;
+  }
+  return string_view();
+}
+
+bool EnumDescriptor::SetValueByName(void* obj, const std::string& name) {
+  if (obj == nullptr) return false;
+  for (const auto& value_name : names_) {
+    if (value_name.name == name) {
+      set_val_(obj, value_name.value);
+      return true;
+    }
+  }
+  return false;
+}
+
+void EnumDescriptor::InternalSetValueNames(std::vector<EnumValueName>&& names) {
+  names_ = std::move(names);
+}
+
 /* Message descriptor */
 
 template <>
@@ -64,16 +367,22 @@ Descriptor* GetDescriptor<google::protobuf::Message>() {
   return &desc;
 }
 
-/* UniquePtrDescriptor methods */
-
-std::string UniquePtrDescriptor::GetTypeName() const {
-  if (desc_ == nullptr) return "";
-  return StringUtil::Concat("std::unique_ptr<", desc_->GetTypeName(), ">");
+size_t MessageDescriptor::GetHeapBytes(const void* obj) const {
+  const auto* msg = ToMessage(obj);
+  if (msg == nullptr) return 0;
+  size_t used = msg->SpaceUsedLong();
+  const auto* prototype =
+      msg->GetReflection()->GetMessageFactory()->GetPrototype(
+          msg->GetDescriptor());
+  size_t base = prototype == nullptr ? 0 : prototype->SpaceUsedLong();
+  return used > base ? used - base : 0;
 }
 
-std::string UniquePtrDescriptor::GetContentTypeName() const {
+/* UniquePtrDescriptor methods */
+
+std::string UniquePtrDescriptor::BuildTypeName() const {
   if (desc_ == nullptr) return "";
-  return desc_->GetTypeName();
+  return StringUtil::Concat("std::unique_ptr<", desc_->GetTypeNameView(), ">");
 }
 
 void* UniquePtrDescriptor::GetMutableRawPtr(void* obj) { return mut_val_(obj); }
@@ -82,16 +391,19 @@ const void* UniquePtrDescriptor::GetRawPtr(const void* obj) const {
   return get_val_(obj);
 }
 
-/* SharedPtrDescriptor methods */
+void* UniquePtrDescriptor::EmplaceContent(void* obj) { return emplace_(obj); }
 
-std::string SharedPtrDescriptor::GetTypeName() const {
-  if (desc_ == nullptr) return "";
-  return StringUtil::Concat("std::shared_ptr<", desc_->GetTypeName(), ">");
+bool UniquePtrDescriptor::Reset(void* obj) { return reset_(obj); }
+
+size_t UniquePtrDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
 }
 
-std::string SharedPtrDescriptor::GetContentTypeName() const {
+/* SharedPtrDescriptor methods */
+
+std::string SharedPtrDescriptor::BuildTypeName() const {
   if (desc_ == nullptr) return "";
-  return desc_->GetTypeName();
+  return StringUtil::Concat("std::shared_ptr<", desc_->GetTypeNameView(), ">");
 }
 
 void* SharedPtrDescriptor::GetMutableRawPtr(void* obj) { return mut_val_(obj); }
@@ -100,14 +412,53 @@ const void* SharedPtrDescriptor::GetRawPtr(const void* obj) const {
   return get_val_(obj);
 }
 
-/* VectorDescriptor methods */
+void* SharedPtrDescriptor::EmplaceContent(void* obj) { return emplace_(obj); }
+
+bool SharedPtrDescriptor::Reset(void* obj) { return reset_(obj); }
+
+std::shared_ptr<void> SharedPtrDescriptor::GetSharedContent(
+    const void* obj) const {
+  return get_shared_(obj);
+}
+
+bool SharedPtrDescriptor::SetSharedContent(
+    void* obj, const std::shared_ptr<void>& content) {
+  return set_shared_(obj, content);
+}
+
+size_t SharedPtrDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
+/* OptionalDescriptor methods */
+
+std::string OptionalDescriptor::BuildTypeName() const {
+  if (desc_ == nullptr) return "";
+  // Insert content type name into "boost::optional<>" or "std::optional<>".
+  string_view prefix(type_name_);
+  prefix.remove_suffix(1);
+  return StringUtil::Concat(prefix, desc_->GetTypeNameView(), ">");
+}
+
+void* OptionalDescriptor::GetMutableRawPtr(void* obj) { return mut_val_(obj); }
 
-std::string VectorDescriptor::GetTypeName() const {
-  return StringUtil::Concat("std::vector<", desc_.value->GetTypeName(), ">");
+const void* OptionalDescriptor::GetRawPtr(const void* obj) const {
+  return get_val_(obj);
 }
 
-std::string VectorDescriptor::GetContainerTypeName() const {
-  return type_name_;
+bool OptionalDescriptor::HasValue(const void* obj) const {
+  return get_val_(obj) != nullptr;
+}
+
+void* OptionalDescriptor::EmplaceValue(void* obj) { return emplace_(obj); }
+
+bool OptionalDescriptor::Reset(void* obj) { return reset_(obj); }
+
+/* VectorDescriptor methods */
+
+std::string VectorDescriptor::BuildTypeName() const {
+  return StringUtil::Concat("std::vector<", desc_.value->GetTypeNameView(),
+                            ">");
 }
 
 size_t VectorDescriptor::GetContainerSize(const void* obj) const {
@@ -127,14 +478,55 @@ bool VectorDescriptor::AddValue(void* obj, const void* val) {
   return add_val_(obj, val);
 }
 
-/* MapDescriptor methods */
+bool VectorDescriptor::AddValueByMove(void* obj, void* val) {
+  return move_val_(obj, val);
+}
 
-std::string MapDescriptor::GetTypeName() const {
-  return StringUtil::Concat("std::map<", desc_.key->GetTypeName(), ", ",
-                            desc_.value->GetTypeName(), ">");
+bool VectorDescriptor::AddValues(void* obj, const void* begin, size_t count) {
+  return add_vals_(obj, begin, count);
 }
 
-std::string MapDescriptor::GetContainerTypeName() const { return type_name_; }
+bool VectorDescriptor::Reserve(void* obj, size_t count) {
+  return reserve_(obj, count);
+}
+
+void* VectorDescriptor::EmplaceDefault(void* obj) { return emplace_(obj); }
+
+bool VectorDescriptor::Clear(void* obj) { return clear_(obj); }
+
+bool VectorDescriptor::ForEachElement(const void* obj,
+                                      const ElementVisitor& visitor) const {
+  return for_each_(obj, visitor);
+}
+
+size_t VectorDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
+size_t VectorDescriptor::GetPartitionSize(const void* obj) const {
+  return get_partition_size_(obj);
+}
+
+bool VectorDescriptor::ForEachElementInPartitions(
+    const void* obj, size_t begin, size_t end,
+    const ElementVisitor& visitor) const {
+  return for_each_in_partitions_(obj, begin, end, visitor);
+}
+
+const void* VectorDescriptor::GetContiguousData(const void* obj) const {
+  return get_data_(obj);
+}
+
+void* VectorDescriptor::MutableContiguousData(void* obj) {
+  return mut_data_(obj);
+}
+
+/* MapDescriptor methods */
+
+std::string MapDescriptor::BuildTypeName() const {
+  return StringUtil::Concat("std::map<", desc_.key->GetTypeNameView(), ", ",
+                            desc_.value->GetTypeNameView(), ">");
+}
 
 size_t MapDescriptor::GetContainerSize(const void* obj) const {
   return get_size_(obj);
@@ -158,19 +550,39 @@ bool MapDescriptor::AddValue(void* obj, const void* val) {
   return add_val_(obj, val);
 }
 
+bool MapDescriptor::AddValueByMove(void* obj, void* val) {
+  return move_val_(obj, val);
+}
+
+bool MapDescriptor::AddValues(void* obj, const void* begin, size_t count) {
+  return add_vals_(obj, begin, count);
+}
+
+void* MapDescriptor::EmplaceByKey(void* obj, const void* key) {
+  return emplace_key_(obj, key);
+}
+
+bool MapDescriptor::Clear(void* obj) { return clear_(obj); }
+
+bool MapDescriptor::ForEachElement(const void* obj,
+                                   const ElementVisitor& visitor) const {
+  return for_each_(obj, visitor);
+}
+
+size_t MapDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
 bool MapDescriptor::HasKeyOrValue(const void* obj, const void* key_or_value) {
   return has_key_(obj, key_or_value);
 }
 
 /* UnorderedMapDescriptor methods */
 
-std::string UnorderedMapDescriptor::GetTypeName() const {
-  return StringUtil::Concat("std::unordered_map<", desc_.key->GetTypeName(),
-                            ", ", desc_.value->GetTypeName(), ">");
-}
-
-std::string UnorderedMapDescriptor::GetContainerTypeName() const {
-  return type_name_;
+std::string UnorderedMapDescriptor::BuildTypeName() const {
+  return StringUtil::Concat("std::unordered_map<",
+                            desc_.key->GetTypeNameView(), ", ",
+                            desc_.value->GetTypeNameView(), ">");
 }
 
 size_t UnorderedMapDescriptor::GetContainerSize(const void* obj) const {
@@ -195,18 +607,54 @@ bool UnorderedMapDescriptor::AddValue(void* obj, const void* val) {
   return add_val_(obj, val);
 }
 
+bool UnorderedMapDescriptor::AddValueByMove(void* obj, void* val) {
+  return move_val_(obj, val);
+}
+
+bool UnorderedMapDescriptor::AddValues(void* obj, const void* begin,
+                                       size_t count) {
+  return add_vals_(obj, begin, count);
+}
+
+bool UnorderedMapDescriptor::Reserve(void* obj, size_t count) {
+  return reserve_(obj, count);
+}
+
+void* UnorderedMapDescriptor::EmplaceByKey(void* obj, const void* key) {
+  return emplace_key_(obj, key);
+}
+
+bool UnorderedMapDescriptor::Clear(void* obj) { return clear_(obj); }
+
+bool UnorderedMapDescriptor::ForEachElement(
+    const void* obj, const ElementVisitor& visitor) const {
+  return for_each_(obj, visitor);
+}
+
+size_t UnorderedMapDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
+size_t UnorderedMapDescriptor::GetPartitionSize(const void* obj) const {
+  return get_partition_size_(obj);
+}
+
+bool UnorderedMapDescriptor::ForEachElementInPartitions(
+    const void* obj, size_t begin, size_t end,
+    const ElementVisitor& visitor) const {
+  return for_each_in_partitions_(obj, begin, end, visitor);
+}
+
 bool UnorderedMapDescriptor::HasKeyOrValue(const void* obj,
                                            const void* key_or_value) {
   return has_key_(obj, key_or_value);
 }
 
 /* SetDescriptor methods */
-std::string SetDescriptor::GetTypeName() const {
-  return StringUtil::Concat("std::set<", desc_.value->GetTypeName(), ">");
+std::string SetDescriptor::BuildTypeName() const {
+  return StringUtil::Concat("std::set<", desc_.value->GetTypeNameView(), ">");
 }
 
-std::string SetDescriptor::GetContainerTypeName() const { return type_name_; }
-
 size_t SetDescriptor::GetContainerSize(const void* obj) const {
   return get_size_(obj);
 }
@@ -224,18 +672,33 @@ bool SetDescriptor::AddValue(void* obj, const void* val) {
   return add_val_(obj, val);
 }
 
+bool SetDescriptor::AddValueByMove(void* obj, void* val) {
+  return move_val_(obj, val);
+}
+
+bool SetDescriptor::AddValues(void* obj, const void* begin, size_t count) {
+  return add_vals_(obj, begin, count);
+}
+
+bool SetDescriptor::Clear(void* obj) { return clear_(obj); }
+
+bool SetDescriptor::ForEachElement(const void* obj,
+                                   const ElementVisitor& visitor) const {
+  return for_each_(obj, visitor);
+}
+
+size_t SetDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
 bool SetDescriptor::HasKeyOrValue(const void* obj, const void* key_or_value) {
   return has_val_(obj, key_or_value);
 }
 
 /* UnorderedSetDescriptor methods */
-std::string UnorderedSetDescriptor::GetTypeName() const {
-  return StringUtil::Concat("std::unordered_set<", desc_.value->GetTypeName(),
-                            ">");
-}
-
-std::string UnorderedSetDescriptor::GetContainerTypeName() const {
-  return type_name_;
+std::string UnorderedSetDescriptor::BuildTypeName() const {
+  return StringUtil::Concat("std::unordered_set<",
+                            desc_.value->GetTypeNameView(), ">");
 }
 
 size_t UnorderedSetDescriptor::GetContainerSize(const void* obj) const {
@@ -255,59 +718,389 @@ bool UnorderedSetDescriptor::AddValue(void* obj, const void* val) {
   return add_val_(obj, val);
 }
 
+bool UnorderedSetDescriptor::AddValueByMove(void* obj, void* val) {
+  return move_val_(obj, val);
+}
+
+bool UnorderedSetDescriptor::AddValues(void* obj, const void* begin,
+                                       size_t count) {
+  return add_vals_(obj, begin, count);
+}
+
+bool UnorderedSetDescriptor::Reserve(void* obj, size_t count) {
+  return reserve_(obj, count);
+}
+
+bool UnorderedSetDescriptor::Clear(void* obj) { return clear_(obj); }
+
+bool UnorderedSetDescriptor::ForEachElement(
+    const void* obj, const ElementVisitor& visitor) const {
+  return for_each_(obj, visitor);
+}
+
+size_t UnorderedSetDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
+size_t UnorderedSetDescriptor::GetPartitionSize(const void* obj) const {
+  return get_partition_size_(obj);
+}
+
+bool UnorderedSetDescriptor::ForEachElementInPartitions(
+    const void* obj, size_t begin, size_t end,
+    const ElementVisitor& visitor) const {
+  return for_each_in_partitions_(obj, begin, end, visitor);
+}
+
 bool UnorderedSetDescriptor::HasKeyOrValue(const void* obj,
                                            const void* key_or_value) {
   return has_val_(obj, key_or_value);
 }
 
-/* ClassDescriptor methods */
+/* ArrayDescriptor methods */
+
+std::string ArrayDescriptor::BuildTypeName() const {
+  if (type_name_ == "std::array<>") {
+    return StringUtil::Concat("std::array<", desc_.value->GetTypeNameView(),
+                              ", ", fixed_size_, ">");
+  }
+  // Dimensions of nested C arrays are listed outermost first, e.g. float[4][3]
+  // is an array of 4 float[3].
+  std::string dims;
+  const Descriptor* value = this;
+  const ContainerDescriptor* array = this;
+  while (array != nullptr && array->GetContainerTypeNameView() == "[]") {
+    dims += StringUtil::Concat(
+        "[", static_cast<const ArrayDescriptor*>(array)->fixed_size_, "]");
+    value = array->desc_.value;
+    array = ContainerDescriptor::ToContainerDescriptor(value);
+  }
+  return StringUtil::Concat(value->GetTypeNameView(), dims);
+}
+
+size_t ArrayDescriptor::GetContainerSize(const void* obj) const {
+  return fixed_size_;
+}
 
-bool ClassDescriptor::IsTypePreDefined() const { return false; }
+const void* ArrayDescriptor::GetValueByIndex(const void* obj,
+                                             int32_t index) const {
+  return get_val_(obj, index);
+}
+
+void* ArrayDescriptor::MutableValueByIndex(void* obj, int32_t index) {
+  return mut_val_(obj, index);
+}
+
+bool ArrayDescriptor::AddValue(void* obj, const void* val) { return false; }
+
+bool ArrayDescriptor::ForEachElement(const void* obj,
+                                     const ElementVisitor& visitor) const {
+  return for_each_in_partitions_(obj, 0, fixed_size_, visitor);
+}
+
+size_t ArrayDescriptor::GetPartitionSize(const void* obj) const {
+  return fixed_size_;
+}
+
+bool ArrayDescriptor::ForEachElementInPartitions(
+    const void* obj, size_t begin, size_t end,
+    const ElementVisitor& visitor) const {
+  return for_each_in_partitions_(obj, begin, end, visitor);
+}
+
+const void* ArrayDescriptor::GetContiguousData(const void* obj) const {
+  return get_data_(obj);
+}
+
+void* ArrayDescriptor::MutableContiguousData(void* obj) {
+  return mut_data_(obj);
+}
+
+/* DequeDescriptor methods */
+
+std::string DequeDescriptor::BuildTypeName() const {
+  return StringUtil::Concat("std::deque<", desc_.value->GetTypeNameView(),
+                            ">");
+}
+
+size_t DequeDescriptor::GetContainerSize(const void* obj) const {
+  return get_size_(obj);
+}
+
+const void* DequeDescriptor::GetValueByIndex(const void* obj,
+                                             int32_t index) const {
+  return get_val_(obj, index);
+}
+
+void* DequeDescriptor::MutableValueByIndex(void* obj, int32_t index) {
+  return mut_val_(obj, index);
+}
+
+bool DequeDescriptor::AddValue(void* obj, const void* val) {
+  return add_val_(obj, val);
+}
+
+bool DequeDescriptor::AddValueByMove(void* obj, void* val) {
+  return move_val_(obj, val);
+}
+
+bool DequeDescriptor::AddValues(void* obj, const void* begin, size_t count) {
+  return add_vals_(obj, begin, count);
+}
+
+void* DequeDescriptor::EmplaceDefault(void* obj) { return emplace_(obj); }
+
+bool DequeDescriptor::Clear(void* obj) { return clear_(obj); }
+
+bool DequeDescriptor::ForEachElement(const void* obj,
+                                     const ElementVisitor& visitor) const {
+  return for_each_(obj, visitor);
+}
+
+size_t DequeDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
+size_t DequeDescriptor::GetPartitionSize(const void* obj) const {
+  return get_partition_size_(obj);
+}
+
+bool DequeDescriptor::ForEachElementInPartitions(
+    const void* obj, size_t begin, size_t end,
+    const ElementVisitor& visitor) const {
+  return for_each_in_partitions_(obj, begin, end, visitor);
+}
+
+/* ListDescriptor methods */
+
+std::string ListDescriptor::BuildTypeName() const {
+  return StringUtil::Concat("std::list<", desc_.value->GetTypeNameView(), ">");
+}
+
+size_t ListDescriptor::GetContainerSize(const void* obj) const {
+  return get_size_(obj);
+}
+
+const void* ListDescriptor::GetValueByIndex(const void* obj,
+                                            int32_t index) const {
+  return get_val_(obj, index);
+}
+
+void* ListDescriptor::MutableValueByIndex(void* obj, int32_t index) {
+  return mut_val_(obj, index);
+}
+
+bool ListDescriptor::AddValue(void* obj, const void* val) {
+  return add_val_(obj, val);
+}
+
+bool ListDescriptor::AddValueByMove(void* obj, void* val) {
+  return move_val_(obj, val);
+}
+
+bool ListDescriptor::AddValues(void* obj, const void* begin, size_t count) {
+  return add_vals_(obj, begin, count);
+}
+
+void* ListDescriptor::EmplaceDefault(void* obj) { return emplace_(obj); }
+
+bool ListDescriptor::Clear(void* obj) { return clear_(obj); }
+
+bool ListDescriptor::ForEachElement(const void* obj,
+                                    const ElementVisitor& visitor) const {
+  return for_each_(obj, visitor);
+}
+
+size_t ListDescriptor::GetHeapBytes(const void* obj) const {
+  return get_heap_(obj);
+}
+
+/* VariantDescriptor methods */
+
+std::string VariantDescriptor::BuildTypeName() const {
+  // Insert alternative type names into "boost::variant<>" or "std::variant<>".
+  string_view prefix(type_name_);
+  prefix.remove_suffix(1);
+  std::string name = prefix.to_string();
+  for (size_t i = 0; i < descs_.size(); ++i) {
+    if (i > 0) name += ", ";
+    name += descs_[i]->GetTypeName();
+  }
+  return name + ">";
+}
+
+int32_t VariantDescriptor::GetAlternativeSize() const { return descs_.size(); }
+
+Descriptor* VariantDescriptor::GetAlternativeDescriptor(int32_t index) const {
+  if (index < 0 || index >= GetAlternativeSize()) return nullptr;
+  return descs_[index];
+}
+
+int32_t VariantDescriptor::GetIndex(const void* obj) const {
+  return get_index_(obj);
+}
+
+Descriptor* VariantDescriptor::GetActiveDescriptor(const void* obj) const {
+  return GetAlternativeDescriptor(get_index_(obj));
+}
+
+const void* VariantDescriptor::GetActiveValue(const void* obj) const {
+  return get_val_(obj);
+}
+
+void* VariantDescriptor::MutableActiveValue(void* obj) { return mut_val_(obj); }
+
+void* VariantDescriptor::EmplaceAlternative(void* obj, int32_t index) {
+  if (index < 0 || index >= GetAlternativeSize()) return nullptr;
+  return emplacers_[index](obj);
+}
+
+/* ClassDescriptor methods */
 
 int32_t ClassDescriptor::GetFieldSize() const {
   return static_cast<int32_t>(members_.size());
 }
 
 std::string ClassDescriptor::GetFieldName(int32_t id) const {
-  int32_t size = members_.size();
-  if (id >= size) return "";
-  return members_.at(id).field_name_;
+  return GetFieldNameView(id).to_string();
 }
 
-Descriptor* ClassDescriptor::GetDescriptorById(int32_t id) {
-  int32_t size = members_.size();
-  if (id >= size) return nullptr;
-  return members_.at(id).desc_;
+string_view ClassDescriptor::GetFieldNameView(int32_t id) const {
+  if (!IsValidId(id)) return string_view();
+  return members_[id].field_name_;
 }
 
-Descriptor* ClassDescriptor::GetDescriptorByName(const std::string& name) {
-  for (auto& member : members_) {
-    if (member.field_name_ == name) {
-      return member.desc_;
+Descriptor* ClassDescriptor::GetDescriptorById(int32_t id) const {
+  if (!IsValidId(id)) return nullptr;
+  return members_[id].desc_;
+}
+
+int64_t ClassDescriptor::GetFieldOffset(int32_t id) const {
+  if (!IsValidId(id)) return -1;
+  return members_[id].offset_;
+}
+
+size_t ClassDescriptor::GetFieldByteSize(int32_t id) const {
+  if (!IsValidId(id)) return 0;
+  return members_[id].size_;
+}
+
+size_t ClassDescriptor::GetFieldAlignment(int32_t id) const {
+  if (!IsValidId(id)) return 0;
+  return members_[id].align_;
+}
+
+const MemberAttributes& ClassDescriptor::GetFieldAttributes(
+    int32_t id) const {
+  static const MemberAttributes kUnset;
+  if (!IsValidId(id)) return kUnset;
+  return members_[id].attributes_;
+}
+
+Descriptor* ClassDescriptor::GetDescriptorByName(
+    const std::string& name) const {
+  int32_t id = GetFieldId(name);
+  if (id < 0) return nullptr;
+  return members_[id].desc_;
+}
+
+int32_t ClassDescriptor::GetFieldId(const std::string& name) const {
+  SSR_INSTRUMENT(SampledLatencyTimer timer);
+  int32_t size = members_.size();
+  int32_t id = -1;
+  for (int32_t i = 0; i < size; ++i) {
+    if (members_[i].field_name_ == name) {
+      id = i;
+      break;
     }
   }
-  return nullptr;
+  SSR_INSTRUMENT(
+      Instrumentation::RecordFieldByName(this, id, timer.Elapsed()));
+  return id;
 }
 
 void* ClassDescriptor::MutableFieldValueById(void* obj, int32_t id) {
-  int32_t size = members_.size();
-  if (id >= size) return nullptr;
+  if (obj == nullptr || !IsValidId(id)) {
+    ReportAccessError(obj, id, nullptr);
+    return nullptr;
+  }
+  SSR_INSTRUMENT(Instrumentation::RecordFieldById(this, id));
 
-  return members_.at(id).desc_->MutableVal(obj + members_.at(id).offset_);
+  return MutableFieldValueById(obj, id, kUnchecked);
 }
 
 void* ClassDescriptor::MutableFieldValueByName(void* obj,
                                                const std::string& name) {
-  for (auto& member : members_) {
-    if (member.field_name_ == name) {
-      return member.desc_->MutableVal(obj + member.offset_);
-    }
+  int32_t id = GetFieldId(name);
+  if (id < 0) return nullptr;
+
+  const auto& member = members_[id];
+  return member.desc_->MutableVal(static_cast<char*>(obj) + member.offset_);
+}
+
+const void* ClassDescriptor::GetFieldValueById(const void* obj,
+                                               int32_t id) const {
+  if (obj == nullptr || !IsValidId(id)) {
+    ReportAccessError(obj, id, nullptr);
+    return nullptr;
   }
-  return nullptr;
+  SSR_INSTRUMENT(Instrumentation::RecordFieldById(this, id));
+
+  return GetFieldValueById(obj, id, kUnchecked);
+}
+
+const void* ClassDescriptor::GetFieldValueByName(
+    const void* obj, const std::string& name) const {
+  int32_t id = GetFieldId(name);
+  if (id < 0) return nullptr;
+
+  const auto& member = members_[id];
+  return member.desc_->GetVal(static_cast<const char*>(obj) + member.offset_);
+}
+
+uint64_t ClassDescriptor::GetFingerprint() const {
+  std::call_once(fingerprint_once_, [this]() {
+    std::vector<const Descriptor*> path;
+    uint64_t hash = kFnvOffsetBasis;
+    HashDescriptor(const_cast<ClassDescriptor*>(this), &path, &hash);
+    fingerprint_ = hash;
+  });
+  return fingerprint_;
+}
+
+void ClassDescriptor::ReportAccessError(const void* obj, int32_t id,
+                                        const Descriptor* desc) const {
+  AccessError error;
+  error.class_name = GetTypeNameView();
+  error.field_id = id;
+  if (obj == nullptr) {
+    error.code = AccessErrorCode::kNullObject;
+  } else if (!IsValidId(id)) {
+    error.code = AccessErrorCode::kInvalidId;
+  } else {
+    error.code = AccessErrorCode::kTypeMismatch;
+  }
+  if (IsValidId(id)) {
+    error.field_name = members_[id].field_name_;
+    error.actual_type = members_[id].desc_->GetTypeNameView();
+  }
+  if (desc != nullptr) error.expected_type = desc->GetTypeNameView();
+  InternalReportAccessError(error);
 }
 
 void ClassDescriptor::InternalSetMembers(std::vector<Member>&& members) {
   members_.assign(members.begin(), members.end());
 }
 
+bool ClassDescriptor::InternalSetFieldAttributes(
+    const std::string& name, const MemberAttributes& attributes) {
+  for (auto& member : members_) {
+    if (member.field_name_ == name) {
+      member.attributes_ = attributes;
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace reflection
\ No newline at end of file
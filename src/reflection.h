@@ -2,18 +2,41 @@
 // Author: Yuchen Liu (yuchenliu@deeproute.ai)
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/core/demangle.hpp>
+#include <boost/optional.hpp>
+#include <boost/variant.hpp>
+#include <cassert>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
+#if __cplusplus >= 201703L
+#include <optional>
+#include <variant>
+#endif
 
 #include "glm/glm.hpp"
 #include "glm/gtc/quaternion.hpp"
 #include "google/protobuf/message.h"
+#include "src/access_policy.h"
 #include "src/descriptor_base.h"
+#include "src/epoch_reclaimer.h"
 #include "src/reflection_macros.h"
 #include "src/string_util.h"
 
@@ -59,16 +82,66 @@ namespace reflection {
 
 typedef std::function<void*(void)> instance_ptr_creator;
 
+// Identify one registration of a class function or descriptor. 0 is never
+// used.
+typedef uint64_t RegistrationId;
+
 struct ClassReflUtil {
  public:
   ClassReflUtil() {}
 
   instance_ptr_creator func{[]() { return nullptr; }};
   Descriptor* desc{nullptr};
+  // Module this class is registered from, empty for the main program.
+  std::string module;
+  RegistrationId func_id{0};
+  RegistrationId desc_id{0};
 };
 
+class ClassReflRegistration;
+
+/**
+ * Registry of class functions and descriptors by name.
+ *
+ * Lookups never lock: they read an immutable table, published as a copy of
+ * a mutable staging table that writers modify under a writer mutex. Replaced
+ * tables are freed by EpochReclaimer once no lookup can still read them.
+ * Registrations only touch the staging table and are published by the next
+ * lookup, so static initializers of a program or module registering many
+ * classes cost one copy in all. Unregistrations are published at once, since
+ * descriptors may be freed right after. Registration is therefore safe while
+ * other threads call DESC or NEW_CLASS_PTR, but every publication costs a
+ * copy of the table, so batch unregistration by module is preferred.
+ *
+ * Plugins:
+ *   Open shared objects inside a ModuleScope. Everything REGISTERed by their
+ *   static initializers belongs to the module, and is unregistered
+ *   automatically when they are closed, or at once with UnregisterModule().
+ *
+ *   {
+ *     reflection::ClassReflFactory::ModuleScope scope("lidar_plugin");
+ *     handle = dlopen("liblidar_plugin.so", RTLD_NOW);
+ *   }
+ *   // ...
+ *   reflection::ClassReflFactory::Get().UnregisterModule("lidar_plugin");
+ *   dlclose(handle);
+ */
 class ClassReflFactory {
  public:
+  // Register everything from the calling thread into |module| while alive.
+  // Scopes can be nested, the innermost one wins.
+  class ModuleScope {
+   public:
+    explicit ModuleScope(const std::string& module);
+    ~ModuleScope();
+
+    ModuleScope(const ModuleScope&) = delete;
+    ModuleScope& operator=(const ModuleScope&) = delete;
+
+   private:
+    std::string previous_;
+  };
+
   explicit ClassReflFactory(const ClassReflFactory&) = delete;
   explicit ClassReflFactory(ClassReflFactory&&) noexcept = delete;
   ClassReflFactory& operator=(const ClassReflFactory&) = delete;
@@ -78,6 +151,8 @@ class ClassReflFactory {
     return instance;
   }
 
+  ~ClassReflFactory();
+
   void* GetClassByName(const std::string& name);
 
   void* FindClassByTypeInfo(const std::type_info& type_info);
@@ -91,25 +166,147 @@ class ClassReflFactory {
     return FindDescriptorByTypeInfo(typeid(*t));
   }
 
-  void RegisterClassFunc(const std::string& name, instance_ptr_creator func);
+  // Register into the module of current ModuleScope. Overwrite previous
+  // registration of the same name.
+  RegistrationId RegisterClassFunc(const std::string& name,
+                                   instance_ptr_creator func);
+
+  RegistrationId RegisterClassDescriptor(const std::string& name,
+                                         Descriptor* desc);
+
+  // Same as above, but unregister when the returned handle is destroyed.
+  ClassReflRegistration RegisterScoped(const std::string& name,
+                                       instance_ptr_creator func);
+
+  ClassReflRegistration RegisterScoped(const std::string& name,
+                                       Descriptor* desc);
+
+  // Remove a registration of |name|. Do nothing if |id| has already been
+  // unregistered or overwritten. Return whether anything is removed.
+  bool Unregister(const std::string& name, RegistrationId id);
+
+  // Remove all classes registered from |module|. Return the number removed.
+  size_t UnregisterModule(const std::string& module);
+
+  // Get number of unregistrations so far. Descriptors of a module are freed
+  // when it is closed, and their addresses may be taken by new ones, so
+  // caches keyed by descriptor address drop their entries when this changes.
+  uint64_t GetUnregisterCount() const {
+    return unregister_count_.load(std::memory_order_acquire);
+  }
+
+  // Get names of all registered classes, sorted.
+  std::vector<std::string> GetRegisteredNames() const;
 
-  void RegisterClassDescriptor(const std::string& name, Descriptor* desc);
+  // Get schema fingerprint of registered class |name|, see
+  // ClassDescriptor::GetFingerprint(). Return 0 if |name| is not a registered
+  // reflected class.
+  uint64_t GetFingerprint(const std::string& name);
+
+  // Get module of current ModuleScope, empty if none.
+  static const std::string& GetCurrentModule();
 
  private:
-  ClassReflFactory() = default;
+  struct Registry;
+
+  ClassReflFactory();
+
+  RegistrationId Register(const std::string& name, instance_ptr_creator* func,
+                          Descriptor* desc);
+
+  // Publish pending registrations, if any, before a lookup.
+  void PublishPending() const {
+    if (pending_.load(std::memory_order_acquire)) PublishStaging();
+  }
+
+  // Publish a copy of staging_ and retire the replaced table.
+  void PublishStaging() const;
+
+  // Same as above. Call with write_mutex_ held.
+  void PublishStagingLocked() const;
+
+  static std::string& MutableCurrentModule();
+
+  mutable std::atomic<const Registry*> registry_;
+  mutable EpochReclaimer reclaimer_;
+  mutable std::mutex write_mutex_;
+  // Table modified by writers, guarded by write_mutex_, and whether it holds
+  // changes not published yet.
+  std::unique_ptr<Registry> staging_;
+  mutable std::atomic<bool> pending_{false};
+  RegistrationId next_id_{1};
+  std::atomic<uint64_t> unregister_count_{0};
+};
+
+// A movable handle that unregisters on destruction.
+class ClassReflRegistration {
+ public:
+  ClassReflRegistration() = default;
+  ClassReflRegistration(const std::string& name, RegistrationId id)
+      : name_(name), id_(id) {}
+  ClassReflRegistration(ClassReflRegistration&& other) noexcept
+      : name_(std::move(other.name_)), id_(other.id_) {
+    other.id_ = 0;
+  }
+  ClassReflRegistration& operator=(ClassReflRegistration&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      name_ = std::move(other.name_);
+      id_ = other.id_;
+      other.id_ = 0;
+    }
+    return *this;
+  }
+  ClassReflRegistration(const ClassReflRegistration&) = delete;
+  ClassReflRegistration& operator=(const ClassReflRegistration&) = delete;
+
+  ~ClassReflRegistration() { Reset(); }
+
+  // Unregister now.
+  void Reset() {
+    if (id_ != 0) ClassReflFactory::Get().Unregister(name_, id_);
+    id_ = 0;
+  }
+
+  // Keep registered after destruction.
+  RegistrationId Release() {
+    RegistrationId id = id_;
+    id_ = 0;
+    return id;
+  }
+
+  bool IsValid() const { return id_ != 0; }
+
+  const std::string& GetName() const { return name_; }
 
-  std::map<std::string, ClassReflUtil> util_;
+ private:
+  std::string name_;
+  RegistrationId id_{0};
 };
 
+// Used by REGISTER. Registrations inside a ModuleScope are unregistered on
+// destruction, i.e. when the module is closed. Those of the main program live
+// until exit.
 class ClassReflRegister {
  public:
   ClassReflRegister(const std::string& name, instance_ptr_creator func) {
-    ClassReflFactory::Get().RegisterClassFunc(name, func);
+    Keep(ClassReflFactory::Get().RegisterScoped(name, func));
   }
 
   ClassReflRegister(const std::string& name, Descriptor* desc) {
-    ClassReflFactory::Get().RegisterClassDescriptor(name, desc);
+    Keep(ClassReflFactory::Get().RegisterScoped(name, desc));
+  }
+
+ private:
+  void Keep(ClassReflRegistration&& registration) {
+    if (ClassReflFactory::GetCurrentModule().empty()) {
+      registration.Release();
+    } else {
+      registration_ = std::move(registration);
+    }
   }
+
+  ClassReflRegistration registration_;
 };
 
 // Using SFINAE (substitution failure is not an error) here to determine if we
@@ -133,8 +330,9 @@ class DescriptorAccessorHelper {
     return &T::reflection;
   }
 
-  template <typename T,
-            typename std::enable_if<!HasReflection<T>::value, int>::type = 0>
+  template <typename T, typename std::enable_if<!HasReflection<T>::value &&
+                                                    !std::is_enum<T>::value,
+                                                int>::type = 0>
   static Descriptor* Get() {
     // Handle protobuf-defined message with special care, and use reflection
     // provided by protobuf.
@@ -143,6 +341,12 @@ class DescriptorAccessorHelper {
     }
     return GetDescriptor<T>();
   }
+
+  template <typename T,
+            typename std::enable_if<std::is_enum<T>::value, int>::type = 0>
+  static Descriptor* Get() {
+    return GetEnumDescriptor<T>();
+  }
 };
 
 // An interface for users to get Descriptor* when having a specific type.
@@ -155,38 +359,83 @@ class DescriptorAccessor {
   static Descriptor* Get() { return DescriptorAccessorHelper::Get<T>(); }
 };
 
+class Int8Descriptor : public Descriptor {
+ public:
+  Int8Descriptor()
+      : Descriptor("int8_t", sizeof(int8_t), PrimitiveType::kInt8) {}
+};
+
+class Int16Descriptor : public Descriptor {
+ public:
+  Int16Descriptor()
+      : Descriptor("int16_t", sizeof(int16_t), PrimitiveType::kInt16) {}
+};
+
 class Int32Descriptor : public Descriptor {
  public:
-  Int32Descriptor() : Descriptor("int32_t", sizeof(int32_t)) {}
+  Int32Descriptor()
+      : Descriptor("int32_t", sizeof(int32_t), PrimitiveType::kInt32) {}
 };
 
 class Int64Descriptor : public Descriptor {
  public:
-  Int64Descriptor() : Descriptor("int64_t", sizeof(int64_t)) {}
+  Int64Descriptor()
+      : Descriptor("int64_t", sizeof(int64_t), PrimitiveType::kInt64) {}
+};
+
+class UInt8Descriptor : public Descriptor {
+ public:
+  UInt8Descriptor()
+      : Descriptor("uint8_t", sizeof(uint8_t), PrimitiveType::kUInt8) {}
+};
+
+class UInt16Descriptor : public Descriptor {
+ public:
+  UInt16Descriptor()
+      : Descriptor("uint16_t", sizeof(uint16_t), PrimitiveType::kUInt16) {}
+};
+
+class UInt32Descriptor : public Descriptor {
+ public:
+  UInt32Descriptor()
+      : Descriptor("uint32_t", sizeof(uint32_t), PrimitiveType::kUInt32) {}
+};
+
+class UInt64Descriptor : public Descriptor {
+ public:
+  UInt64Descriptor()
+      : Descriptor("uint64_t", sizeof(uint64_t), PrimitiveType::kUInt64) {}
 };
 
 class FloatDescriptor : public Descriptor {
  public:
-  FloatDescriptor() : Descriptor("float", sizeof(float)) {}
+  FloatDescriptor()
+      : Descriptor("float", sizeof(float), PrimitiveType::kFloat) {}
 };
 
 class DoubleDescriptor : public Descriptor {
  public:
-  DoubleDescriptor() : Descriptor("double", sizeof(double)) {}
+  DoubleDescriptor()
+      : Descriptor("double", sizeof(double), PrimitiveType::kDouble) {}
 };
 
 class BoolDescriptor : public Descriptor {
  public:
-  BoolDescriptor() : Descriptor("bool", sizeof(bool)) {}
+  BoolDescriptor() : Descriptor("bool", sizeof(bool), PrimitiveType::kBool) {}
 };
 class StringDescriptor : public Descriptor {
  public:
-  StringDescriptor() : Descriptor("std::string", sizeof(std::string)) {}
+  StringDescriptor()
+      : Descriptor("std::string", sizeof(std::string), PrimitiveType::kString) {
+  }
+
+  // Get capacity of heap buffer, 0 for strings stored inline (SSO).
+  virtual size_t GetHeapBytes(const void* obj) const override;
 };
 
 class CharDescriptor : public Descriptor {
  public:
-  CharDescriptor() : Descriptor("char", sizeof(char)) {}
+  CharDescriptor() : Descriptor("char", sizeof(char), PrimitiveType::kChar) {}
 };
 
 class Vec3Descriptor : public Descriptor {
@@ -214,12 +463,103 @@ class QuaternionDescriptor : public Descriptor {
   QuaternionDescriptor() : Descriptor("glm::quat", sizeof(glm::quat)) {}
 };
 
+struct EnumValueName {
+  int64_t value;
+  std::string name;
+};
+
+// Descriptor of enums, scoped or not. Values are stored as the underlying
+// integer type, see GetUnderlyingDescriptor(), and read or written here widened
+// to int64_t. Names of values are only known if listed with
+// ADD_REFLECTION_ENUM().
+class EnumDescriptor : public Descriptor {
+ public:
+  template <typename Enum>
+  EnumDescriptor(Enum* type)
+      : Descriptor(boost::core::demangle(typeid(Enum).name()), sizeof(Enum),
+                   DescriptorKind::kEnum),
+        underlying_(reflection::DescriptorAccessor<
+                    typename std::underlying_type<Enum>::type>::Get()) {
+    primitive_type_ = underlying_->GetPrimitiveType();
+    get_val_ = [](const void* obj) -> int64_t {
+      return static_cast<int64_t>(*static_cast<const Enum*>(obj));
+    };
+    set_val_ = [](void* obj, int64_t value) {
+      *static_cast<Enum*>(obj) = static_cast<Enum>(value);
+    };
+  }
+  virtual ~EnumDescriptor() {}
+
+  // Get descriptor of the underlying integer type.
+  virtual Descriptor* GetUnderlyingDescriptor() const { return underlying_; }
+
+  virtual int64_t GetValue(const void* obj) const;
+
+  virtual bool SetValue(void* obj, int64_t value);
+
+  // Get name of value of |obj|. Return an empty view if it has no name.
+  virtual string_view GetValueNameView(const void* obj) const;
+
+  // Allocating convenience wrapper of GetValueNameView().
+  virtual std::string GetValueName(const void* obj) const {
+    return GetValueNameView(obj).to_string();
+  }
+
+  // Set |obj| to the value named |name|. Return false if no value is named so.
+  virtual bool SetValueByName(void* obj, const std::string& name);
+
+  // Get all named values in listed order.
+  virtual const std::vector<EnumValueName>& GetValueNames() const {
+    return names_;
+  }
+
+  // **FOR INTERNAL USE ONLY**
+  void InternalSetValueNames(std::vector<EnumValueName>&& names);
+
+  // Cast a Descriptor* to EnumDescriptor*. Return nullptr if failed.
+  static EnumDescriptor* ToEnumDescriptor(Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kEnum) {
+      return nullptr;
+    }
+    return static_cast<EnumDescriptor*>(desc);
+  }
+
+  static const EnumDescriptor* ToEnumDescriptor(const Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kEnum) {
+      return nullptr;
+    }
+    return static_cast<const EnumDescriptor*>(desc);
+  }
+
+ private:
+  Descriptor* underlying_;
+  std::vector<EnumValueName> names_;
+  std::function<int64_t(const void*)> get_val_;
+  std::function<void(void*, int64_t)> set_val_;
+};
+
+template <typename T>
+Descriptor* GetEnumDescriptor() {
+  static EnumDescriptor desc(static_cast<T*>(nullptr));
+  return &desc;
+}
+
+// Attach value names to an enum descriptor at static initialization, see
+// ADD_REFLECTION_ENUM().
+class EnumNamesRegister {
+ public:
+  EnumNamesRegister(Descriptor* desc, std::vector<EnumValueName>&& names) {
+    auto* enum_desc = EnumDescriptor::ToEnumDescriptor(desc);
+    if (enum_desc == nullptr) return;
+    enum_desc->InternalSetValueNames(std::move(names));
+  }
+};
+
 class MessageDescriptor : public Descriptor {
  public:
   MessageDescriptor()
-      : Descriptor("google::protobuf::Message", sizeof(int32_t)) {}
-
-  virtual bool IsProtobufMessage() const override { return true; }
+      : Descriptor("google::protobuf::Message", sizeof(int32_t),
+                   DescriptorKind::kMessage) {}
 
   static google::protobuf::Message* ToMessage(void* content_ptr) {
     return static_cast<google::protobuf::Message*>(content_ptr);
@@ -229,24 +569,72 @@ class MessageDescriptor : public Descriptor {
     return static_cast<const google::protobuf::Message*>(content_ptr);
   }
 
+  // Cast a Descriptor* to MessageDescriptor*. Return nullptr if failed.
   static MessageDescriptor* ToMessageDescriptor(Descriptor* desc) {
-    return dynamic_cast<MessageDescriptor*>(desc);
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kMessage) {
+      return nullptr;
+    }
+    return static_cast<MessageDescriptor*>(desc);
+  }
+
+  static const MessageDescriptor* ToMessageDescriptor(const Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kMessage) {
+      return nullptr;
+    }
+    return static_cast<const MessageDescriptor*>(desc);
   }
+
+  // Get SpaceUsedLong() of message beyond that of its default instance, which
+  // covers nested messages, repeated fields and strings.
+  virtual size_t GetHeapBytes(const void* obj) const override;
+};
+
+// Approximate allocation overheads of libstdc++, used by GetHeapBytes().
+struct HeapOverhead {
+  // Color and parent/left/right pointers of a red-black tree node.
+  static constexpr size_t kTreeNode = 4 * sizeof(void*);
+  // Next pointer and cached hash code of a hash table node.
+  static constexpr size_t kHashNode = sizeof(void*) + sizeof(size_t);
+  // Virtual table pointer and use/weak counts of a shared_ptr control block.
+  static constexpr size_t kSharedControlBlock =
+      sizeof(void*) + 2 * sizeof(int32_t);
+  // Prev/next pointers of a doubly linked list node.
+  static constexpr size_t kListNode = 2 * sizeof(void*);
+  // Bytes of a deque block, and minimum number of block pointers in its map.
+  static constexpr size_t kDequeBlock = 512;
+  static constexpr size_t kDequeMinMapSize = 8;
 };
 
 class SmartPtrDescriptor : public Descriptor {
  public:
   SmartPtrDescriptor(const std::string& name, size_t size, Descriptor* desc)
-      : Descriptor(name, size), desc_(desc) {}
+      : Descriptor(name, size, DescriptorKind::kSmartPtr), desc_(desc) {}
   virtual ~SmartPtrDescriptor() {}
 
-  virtual std::string GetTypeName() const = 0;
+  // Full type name with content type included, e.g.
+  // std::unique_ptr<std::string>. Interned on first call.
+  virtual string_view GetTypeNameView() const override {
+    return InternTypeName();
+  }
+
+  // Allocating convenience wrapper of GetSmartPtrTypeNameView().
+  virtual std::string GetSmartPtrTypeName() const {
+    return GetSmartPtrTypeNameView().to_string();
+  }
 
-  virtual bool IsSmartPtr() const override { return true; }
+  // Get smart pointer name without content typename, e.g. std::unique_ptr<>.
+  virtual string_view GetSmartPtrTypeNameView() const { return type_name_; }
 
-  virtual std::string GetSmartPtrTypeName() const { return type_name_; }
+  // Allocating convenience wrapper of GetContentTypeNameView().
+  virtual std::string GetContentTypeName() const {
+    return GetContentTypeNameView().to_string();
+  }
 
-  virtual std::string GetContentTypeName() const = 0;
+  // Get type name of pointed content.
+  virtual string_view GetContentTypeNameView() const {
+    if (desc_ == nullptr) return string_view();
+    return desc_->GetTypeNameView();
+  }
 
   virtual void* GetMutableRawPtr(void* obj) = 0;
 
@@ -254,8 +642,52 @@ class SmartPtrDescriptor : public Descriptor {
 
   virtual Descriptor* GetContentDescriptor() { return desc_; }
 
+  // Replace content of |obj| with a default constructed one, allocated on heap
+  // unless content is inline, and return a pointer to it. Return nullptr if
+  // content type is not default constructible.
+  virtual void* EmplaceContent(void* obj) { return nullptr; }
+
+  // Make |obj| empty, releasing content it owns. Return a bool to indicate
+  // status.
+  virtual bool Reset(void* obj) { return false; }
+
+  // Whether content can be owned by multiple pointers (std::shared_ptr), i.e.
+  // whether the same content may be reached more than once.
+  virtual bool IsSharedOwnership() const { return false; }
+
+  // Get a pointer sharing ownership of content of |obj|. Return nullptr for
+  // empty pointers and pointers without shared ownership.
+  virtual std::shared_ptr<void> GetSharedContent(const void* obj) const {
+    return nullptr;
+  }
+
+  // Make |obj| share ownership of |content|, got by GetSharedContent() from a
+  // pointer of the same descriptor. Return false for pointers without shared
+  // ownership.
+  virtual bool SetSharedContent(void* obj,
+                                const std::shared_ptr<void>& content) {
+    return false;
+  }
+
+  // Whether content is stored inside the pointer object itself rather than on
+  // heap (optional values). If it returns true, you can cast this descriptor
+  // to OptionalDescriptor.
+  virtual bool IsContentInline() const { return false; }
+
+  // Cast a Descriptor* to SmartPtrDescriptor*. Return nullptr if failed.
   static SmartPtrDescriptor* ToSmartPtrDescriptor(Descriptor* desc) {
-    return dynamic_cast<SmartPtrDescriptor*>(desc);
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kSmartPtr) {
+      return nullptr;
+    }
+    return static_cast<SmartPtrDescriptor*>(desc);
+  }
+
+  static const SmartPtrDescriptor* ToSmartPtrDescriptor(
+      const Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kSmartPtr) {
+      return nullptr;
+    }
+    return static_cast<const SmartPtrDescriptor*>(desc);
   }
 
   Descriptor* desc_;
@@ -277,21 +709,59 @@ class UniquePtrDescriptor final : public SmartPtrDescriptor {
       if (smart_ptr == nullptr) return nullptr;
       return smart_ptr->get();
     };
+    emplace_ = [](void* ptr) -> void* {
+      auto* smart_ptr = static_cast<std::unique_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr) return nullptr;
+      return Emplace(smart_ptr,
+                     std::integral_constant<
+                         bool, std::is_default_constructible<Type>::value>());
+    };
+    reset_ = [](void* ptr) -> bool {
+      auto* smart_ptr = static_cast<std::unique_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr) return false;
+      smart_ptr->reset();
+      return true;
+    };
+    get_heap_ = [](const void* ptr) -> size_t {
+      const auto* smart_ptr = static_cast<const std::unique_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr || *smart_ptr == nullptr) return 0;
+      return sizeof(Type);
+    };
   }
 
   ~UniquePtrDescriptor() {}
 
-  virtual std::string GetTypeName() const override;
-
-  virtual std::string GetContentTypeName() const override;
-
   virtual void* GetMutableRawPtr(void* obj) override;
 
   virtual const void* GetRawPtr(const void* obj) const override;
 
+  virtual void* EmplaceContent(void* obj) override;
+
+  virtual bool Reset(void* obj) override;
+
+  // Get size of pointed content (and its control block for shared pointers),
+  // 0 for null pointers.
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
  protected:
+  virtual std::string BuildTypeName() const override;
+
+  template <typename Type>
+  static void* Emplace(std::unique_ptr<Type>* smart_ptr, std::true_type) {
+    smart_ptr->reset(new Type());
+    return smart_ptr->get();
+  }
+
+  template <typename Type>
+  static void* Emplace(std::unique_ptr<Type>*, std::false_type) {
+    return nullptr;
+  }
+
   std::function<const void*(const void*)> get_val_;
   std::function<void*(void*)> mut_val_;
+  std::function<void*(void*)> emplace_;
+  std::function<bool(void*)> reset_;
+  std::function<size_t(const void*)> get_heap_;
 };
 
 template <typename Value>
@@ -319,21 +789,81 @@ class SharedPtrDescriptor final : public SmartPtrDescriptor {
       if (smart_ptr == nullptr) return nullptr;
       return smart_ptr->get();
     };
+    emplace_ = [](void* ptr) -> void* {
+      auto* smart_ptr = static_cast<std::shared_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr) return nullptr;
+      return Emplace(smart_ptr,
+                     std::integral_constant<
+                         bool, std::is_default_constructible<Type>::value>());
+    };
+    reset_ = [](void* ptr) -> bool {
+      auto* smart_ptr = static_cast<std::shared_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr) return false;
+      smart_ptr->reset();
+      return true;
+    };
+    get_shared_ = [](const void* ptr) -> std::shared_ptr<void> {
+      const auto* smart_ptr = static_cast<const std::shared_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr) return nullptr;
+      return std::const_pointer_cast<typename std::remove_cv<Type>::type>(
+          *smart_ptr);
+    };
+    set_shared_ = [](void* ptr, const std::shared_ptr<void>& content) -> bool {
+      auto* smart_ptr = static_cast<std::shared_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr) return false;
+      *smart_ptr = std::static_pointer_cast<Type>(content);
+      return true;
+    };
+    get_heap_ = [](const void* ptr) -> size_t {
+      const auto* smart_ptr = static_cast<const std::shared_ptr<Type>*>(ptr);
+      if (smart_ptr == nullptr || *smart_ptr == nullptr) return 0;
+      return sizeof(Type) + HeapOverhead::kSharedControlBlock;
+    };
   }
 
   ~SharedPtrDescriptor() {}
 
-  virtual std::string GetTypeName() const override;
-
-  virtual std::string GetContentTypeName() const override;
-
   virtual void* GetMutableRawPtr(void* obj) override;
 
   virtual const void* GetRawPtr(const void* obj) const override;
 
+  virtual void* EmplaceContent(void* obj) override;
+
+  virtual bool Reset(void* obj) override;
+
+  // Get size of pointed content (and its control block for shared pointers),
+  // 0 for null pointers.
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
+  virtual bool IsSharedOwnership() const override { return true; }
+
+  virtual std::shared_ptr<void> GetSharedContent(
+      const void* obj) const override;
+
+  virtual bool SetSharedContent(void* obj,
+                                const std::shared_ptr<void>& content) override;
+
  protected:
+  virtual std::string BuildTypeName() const override;
+
+  template <typename Type>
+  static void* Emplace(std::shared_ptr<Type>* smart_ptr, std::true_type) {
+    *smart_ptr = std::make_shared<Type>();
+    return smart_ptr->get();
+  }
+
+  template <typename Type>
+  static void* Emplace(std::shared_ptr<Type>*, std::false_type) {
+    return nullptr;
+  }
+
   std::function<const void*(const void*)> get_val_;
   std::function<void*(void*)> mut_val_;
+  std::function<void*(void*)> emplace_;
+  std::function<bool(void*)> reset_;
+  std::function<std::shared_ptr<void>(const void*)> get_shared_;
+  std::function<bool(void*, const std::shared_ptr<void>&)> set_shared_;
+  std::function<size_t(const void*)> get_heap_;
 };
 
 template <typename Value>
@@ -345,24 +875,148 @@ class DescriptorAccessor<std::shared_ptr<Value>> {
   }
 };
 
+// Optional values (boost::optional, and std::optional since C++17) are
+// described as smart pointers whose content is stored inline: the raw pointer
+// is nullptr when empty, and no heap is owned.
+class OptionalDescriptor final : public SmartPtrDescriptor {
+ public:
+  template <typename Optional>
+  OptionalDescriptor(const std::string& name, Optional* optional)
+      : SmartPtrDescriptor(name, sizeof(Optional),
+                           reflection::DescriptorAccessor<
+                               typename Optional::value_type>::Get()) {
+    get_val_ = [](const void* ptr) -> const void* {
+      const auto* opt_ptr = static_cast<const Optional*>(ptr);
+      if (opt_ptr == nullptr || !*opt_ptr) return nullptr;
+      return &**opt_ptr;
+    };
+    mut_val_ = [](void* ptr) -> void* {
+      auto* opt_ptr = static_cast<Optional*>(ptr);
+      if (opt_ptr == nullptr || !*opt_ptr) return nullptr;
+      return &**opt_ptr;
+    };
+    emplace_ = [](void* ptr) -> void* {
+      auto* opt_ptr = static_cast<Optional*>(ptr);
+      if (opt_ptr == nullptr) return nullptr;
+      return Emplace(
+          opt_ptr, std::integral_constant<
+                       bool, std::is_default_constructible<
+                                 typename Optional::value_type>::value>());
+    };
+    reset_ = [](void* ptr) -> bool {
+      auto* opt_ptr = static_cast<Optional*>(ptr);
+      if (opt_ptr == nullptr) return false;
+      *opt_ptr = Optional();
+      return true;
+    };
+  }
+
+  ~OptionalDescriptor() {}
+
+  virtual void* GetMutableRawPtr(void* obj) override;
+
+  virtual const void* GetRawPtr(const void* obj) const override;
+
+  // Whether |obj| holds a value.
+  virtual bool HasValue(const void* obj) const;
+
+  // Replace value of |obj| with a default constructed one and return a
+  // pointer to it. Return nullptr if value type is not default constructible.
+  virtual void* EmplaceValue(void* obj);
+
+  virtual void* EmplaceContent(void* obj) override { return EmplaceValue(obj); }
+
+  // Make |obj| empty. Return a bool to indicate status.
+  virtual bool Reset(void* obj) override;
+
+  virtual bool IsContentInline() const override { return true; }
+
+  // Cast a Descriptor* to OptionalDescriptor*. Return nullptr if failed.
+  static OptionalDescriptor* ToOptionalDescriptor(Descriptor* desc) {
+    auto* ptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(desc);
+    if (ptr_desc == nullptr || !ptr_desc->IsContentInline()) return nullptr;
+    return static_cast<OptionalDescriptor*>(ptr_desc);
+  }
+
+  static const OptionalDescriptor* ToOptionalDescriptor(
+      const Descriptor* desc) {
+    auto* ptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(desc);
+    if (ptr_desc == nullptr || !ptr_desc->IsContentInline()) return nullptr;
+    return static_cast<const OptionalDescriptor*>(ptr_desc);
+  }
+
+ protected:
+  virtual std::string BuildTypeName() const override;
+
+  template <typename Optional>
+  static void* Emplace(Optional* opt_ptr, std::true_type) {
+    opt_ptr->emplace();
+    return &**opt_ptr;
+  }
+
+  template <typename Optional>
+  static void* Emplace(Optional*, std::false_type) {
+    return nullptr;
+  }
+
+  std::function<const void*(const void*)> get_val_;
+  std::function<void*(void*)> mut_val_;
+  std::function<void*(void*)> emplace_;
+  std::function<bool(void*)> reset_;
+};
+
+template <typename Value>
+class DescriptorAccessor<boost::optional<Value>> {
+ public:
+  static Descriptor* Get() {
+    static OptionalDescriptor desc(
+        "boost::optional<>", static_cast<boost::optional<Value>*>(nullptr));
+    return &desc;
+  }
+};
+
+#if __cplusplus >= 201703L
+template <typename Value>
+class DescriptorAccessor<std::optional<Value>> {
+ public:
+  static Descriptor* Get() {
+    static OptionalDescriptor desc(
+        "std::optional<>", static_cast<std::optional<Value>*>(nullptr));
+    return &desc;
+  }
+};
+#endif
+
 // Base class of containers. Provide robust interface for different containers
 // to get and modify their values.
 class ContainerDescriptor : public Descriptor {
  public:
+  // Called with key (nullptr for containers without key) and value of each
+  // element. Return false to stop iteration.
+  typedef std::function<bool(const void* key, const void* value)>
+      ElementVisitor;
+
   template <typename... Args>
   ContainerDescriptor(const std::string& name, size_t size, Args&&... args)
-      : Descriptor(name, size), desc_(std::forward<Args>(args)...) {}
+      : Descriptor(name, size, DescriptorKind::kContainer),
+        desc_(std::forward<Args>(args)...) {}
   virtual ~ContainerDescriptor() {}
 
   // Get type name of current described target. For STL containers, template
-  // typename will be included too, e.g. std::vector<std::string>.
-  virtual std::string GetTypeName() const = 0;
+  // typename will be included too, e.g. std::vector<std::string>. Interned on
+  // first call.
+  virtual string_view GetTypeNameView() const override {
+    return InternTypeName();
+  }
 
-  virtual bool IsContainer() const override { return true; }
+  // Allocating convenience wrapper of GetContainerTypeNameView().
+  virtual std::string GetContainerTypeName() const {
+    return GetContainerTypeNameView().to_string();
+  }
 
   // Get container name of current described target, without template typename,
   // e.g. std::vector<>.
-  virtual std::string GetContainerTypeName() const = 0;
+  virtual string_view GetContainerTypeNameView() const { return type_name_; }
 
   virtual size_t GetContainerSize(const void* obj) const = 0;
 
@@ -396,30 +1050,295 @@ class ContainerDescriptor : public Descriptor {
     return nullptr;
   }
 
-  // Add a value to container. Actual type of second parameter is determined by
-  // container type. Return a bool to indicate add status.
+  // Add a value to container by copy. Actual type of second parameter is
+  // determined by container type (value type for vector and set-liked
+  // containers, std::pair<Key, Value> for map-liked containers). Return
+  // whether the value was inserted, which sets and maps don't when the key is
+  // already present, leaving the container unchanged. Always return false for
+  // move-only value types, use AddValueByMove() instead.
   virtual bool AddValue(void* obj, const void* val) = 0;
 
-  // Check whether a key exists (for map-liked containers) or a value exists
-  // (for set-liked containers) for search-targetted containers. Return a bool
-  // to indicate check status. Time compexity may vary for different containers.
-  virtual bool HasKeyOrValue(const void* obj, const void* key_or_value) {
+  // Add a value to container by moving from the second parameter, which is
+  // left in moved-from state. Works for move-only types such as
+  // std::unique_ptr. Return whether the value was inserted, see AddValue().
+  virtual bool AddValueByMove(void* obj, void* val) { return false; }
+
+  // Copy |count| values stored contiguously from |begin| (e.g. a C array or
+  // the data of a std::vector of the same value type) into container, with
+  // capacity reserved once. Return a bool to indicate add status.
+  virtual bool AddValues(void* obj, const void* begin, size_t count) {
     return false;
   }
 
-  // Get descriptor of key type. Return nullptr if key doesn't exist.
-  virtual Descriptor* GetKeyDescriptor() { return desc_.key; }
+  // Reserve capacity for |count| values in total. Only meaningful for
+  // containers with capacity (vector, unordered containers). Return false if
+  // not supported.
+  virtual bool Reserve(void* obj, size_t count) { return false; }
+
+  // Append a default constructed value to a sequence container and return a
+  // pointer to it, so that it can be filled in place. Return nullptr for
+  // containers that are not sequences.
+  virtual void* EmplaceDefault(void* obj) { return nullptr; }
+
+  // Get value by key for map-liked containers, inserting a default constructed
+  // value first if key is absent (operator[] semantic). Return nullptr for
+  // containers without key.
+  virtual void* EmplaceByKey(void* obj, const void* key) { return nullptr; }
+
+  // Remove all values from container. Return a bool to indicate status.
+  virtual bool Clear(void* obj) { return false; }
+
+  // Visit all elements in iteration order of container, which is linear for
+  // every container, unlike looping over GetValueByIndex() or
+  // GetContainerKeys(). Return false if stopped by visitor or not supported.
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const {
+    return false;
+  }
 
-  // Get descriptor of value type. Works for all containers (we consider items
-  // in vector, set, ... as value).
-  virtual Descriptor* GetValueDescriptor() { return desc_.value; }
+  // Get number of partitions container can be split into without iterating
+  // it, i.e. indices of vector-liked containers and buckets of unordered
+  // containers. Return 0 for containers that can't be split so (map, set).
+  virtual size_t GetPartitionSize(const void* obj) const { return 0; }
 
-  // Cast a Descriptor* to ContainerDescriptor*. Return nullptr if failed.
-  static ContainerDescriptor* ToContainerDescriptor(Descriptor* desc) {
-    return dynamic_cast<ContainerDescriptor*>(desc);
+  // Visit elements in partitions [begin, end), see GetPartitionSize(). Return
+  // false if stopped by visitor or not supported.
+  virtual bool ForEachElementInPartitions(const void* obj, size_t begin,
+                                          size_t end,
+                                          const ElementVisitor& visitor) const {
+    return false;
   }
 
-  DescPair desc_;
+  // Get const pointer to the first value if values are stored contiguously
+  // (C array, std::array, std::vector), so that all GetContainerSize() values
+  // can be read as one span. Return nullptr for other containers.
+  virtual const void* GetContiguousData(const void* obj) const {
+    return nullptr;
+  }
+
+  // Get non-const pointer to the first value of contiguous containers, see
+  // GetContiguousData().
+  virtual void* MutableContiguousData(void* obj) { return nullptr; }
+
+  // Get number of values fixed at compile time (C array, std::array). Return -1
+  // for containers of dynamic size.
+  virtual int64_t GetFixedSize() const { return -1; }
+
+  // Whether values of a contiguous container are trivially copyable, in which
+  // case all values can be copied with a single memcpy of size *
+  // GetValueDescriptor()->size_ bytes. Always false for other containers.
+  virtual bool IsValueTriviallyCopyable() const {
+    return value_trivially_copyable_;
+  }
+
+  // Check whether a key exists (for map-liked containers) or a value exists
+  // (for set-liked containers) for search-targetted containers. Return a bool
+  // to indicate check status. Time compexity may vary for different containers.
+  virtual bool HasKeyOrValue(const void* obj, const void* key_or_value) {
+    return false;
+  }
+
+  // Get descriptor of key type. Return nullptr if key doesn't exist.
+  virtual Descriptor* GetKeyDescriptor() { return desc_.key; }
+
+  // Get descriptor of value type. Works for all containers (we consider items
+  // in vector, set, ... as value).
+  virtual Descriptor* GetValueDescriptor() { return desc_.value; }
+
+  // Cast a Descriptor* to ContainerDescriptor*. Return nullptr if failed.
+  static ContainerDescriptor* ToContainerDescriptor(Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kContainer) {
+      return nullptr;
+    }
+    return static_cast<ContainerDescriptor*>(desc);
+  }
+
+  static const ContainerDescriptor* ToContainerDescriptor(
+      const Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kContainer) {
+      return nullptr;
+    }
+    return static_cast<const ContainerDescriptor*>(desc);
+  }
+
+  DescPair desc_;
+
+ protected:
+  bool value_trivially_copyable_{false};
+};
+
+// Copyability check used to select insertion paths. STL containers declare
+// copy constructors even if their values are move-only, so
+// std::is_copy_constructible alone is not enough for, e.g.,
+// std::vector<std::unique_ptr<T>>.
+template <typename T>
+struct IsCopyable : std::is_copy_constructible<T> {};
+
+template <typename T>
+struct IsCopyable<std::unique_ptr<T>> : std::false_type {};
+
+template <typename First, typename Second>
+struct IsCopyable<std::pair<First, Second>>
+    : std::integral_constant<bool, IsCopyable<First>::value &&
+                                       IsCopyable<Second>::value> {};
+
+template <typename T>
+struct IsCopyable<std::vector<T>> : IsCopyable<T> {};
+
+template <typename T>
+struct IsCopyable<std::deque<T>> : IsCopyable<T> {};
+
+template <typename T>
+struct IsCopyable<std::list<T>> : IsCopyable<T> {};
+
+template <typename T>
+struct IsCopyable<boost::optional<T>> : IsCopyable<T> {};
+
+template <typename T>
+struct IsCopyable<std::set<T>> : IsCopyable<T> {};
+
+template <typename T>
+struct IsCopyable<std::unordered_set<T>> : IsCopyable<T> {};
+
+template <typename Key, typename Value>
+struct IsCopyable<std::map<Key, Value>> : IsCopyable<std::pair<Key, Value>> {};
+
+template <typename Key, typename Value>
+struct IsCopyable<std::unordered_map<Key, Value>>
+    : IsCopyable<std::pair<Key, Value>> {};
+
+// Insertion routines shared by container descriptors. Each routine compiles to
+// a no-op returning false/nullptr when the value type does not support it, so
+// that descriptors of e.g. std::vector<std::unique_ptr<T>> still instantiate.
+// Copy() and Move() return whether the value was inserted: always for
+// sequences, and only for absent keys in sets and maps.
+class ContainerInsertHelper {
+ public:
+  template <typename Ctn, typename Val>
+  static bool Copy(Ctn* ctn, const Val& val) {
+    return Copy(ctn, val,
+                std::integral_constant<bool, IsCopyable<Val>::value>());
+  }
+
+  template <typename Ctn, typename Val>
+  static bool CopyRange(Ctn* ctn, const Val* begin, size_t count) {
+    return CopyRange(ctn, begin, count,
+                     std::integral_constant<bool, IsCopyable<Val>::value>());
+  }
+
+  template <typename Ctn, typename Val>
+  static bool Move(Ctn* ctn, Val* val) {
+    return InsertOne(ctn, std::move(*val));
+  }
+
+  template <typename Ctn>
+  static void* EmplaceBack(Ctn* ctn) {
+    using Val = typename Ctn::value_type;
+    return EmplaceBack(
+        ctn,
+        std::integral_constant<bool,
+                               std::is_default_constructible<Val>::value>());
+  }
+
+  template <typename Ctn, typename Key>
+  static void* EmplaceKey(Ctn* ctn, const Key& key) {
+    return EmplaceKey(
+        ctn, key,
+        std::integral_constant<
+            bool, IsCopyable<Key>::value &&
+                      std::is_default_constructible<
+                          typename Ctn::mapped_type>::value>());
+  }
+
+ private:
+  template <typename Ctn, typename Val>
+  static bool Copy(Ctn* ctn, const Val& val, std::true_type) {
+    return InsertOne(ctn, val);
+  }
+
+  template <typename Ctn, typename Val>
+  static bool Copy(Ctn*, const Val&, std::false_type) {
+    return false;
+  }
+
+  template <typename Val, typename Arg>
+  static bool InsertOne(std::vector<Val>* ctn, Arg&& val) {
+    ctn->insert(ctn->end(), std::forward<Arg>(val));
+    return true;
+  }
+
+  template <typename Val, typename Arg>
+  static bool InsertOne(std::deque<Val>* ctn, Arg&& val) {
+    ctn->insert(ctn->end(), std::forward<Arg>(val));
+    return true;
+  }
+
+  template <typename Val, typename Arg>
+  static bool InsertOne(std::list<Val>* ctn, Arg&& val) {
+    ctn->insert(ctn->end(), std::forward<Arg>(val));
+    return true;
+  }
+
+  template <typename Ctn, typename Arg>
+  static bool InsertOne(Ctn* ctn, Arg&& val) {
+    return ctn->insert(std::forward<Arg>(val)).second;
+  }
+
+  template <typename Ctn, typename Val>
+  static bool CopyRange(Ctn* ctn, const Val* begin, size_t count,
+                        std::true_type) {
+    InsertRange(ctn, begin, begin + count);
+    return true;
+  }
+
+  template <typename Val>
+  static void InsertRange(std::vector<Val>* ctn, const Val* begin,
+                          const Val* end) {
+    ctn->insert(ctn->end(), begin, end);
+  }
+
+  template <typename Val>
+  static void InsertRange(std::deque<Val>* ctn, const Val* begin,
+                          const Val* end) {
+    ctn->insert(ctn->end(), begin, end);
+  }
+
+  template <typename Val>
+  static void InsertRange(std::list<Val>* ctn, const Val* begin,
+                          const Val* end) {
+    ctn->insert(ctn->end(), begin, end);
+  }
+
+  template <typename Ctn, typename Val>
+  static void InsertRange(Ctn* ctn, const Val* begin, const Val* end) {
+    ctn->insert(begin, end);
+  }
+
+  template <typename Ctn, typename Val>
+  static bool CopyRange(Ctn*, const Val*, size_t, std::false_type) {
+    return false;
+  }
+
+  template <typename Ctn>
+  static void* EmplaceBack(Ctn* ctn, std::true_type) {
+    ctn->emplace_back();
+    return &ctn->back();
+  }
+
+  template <typename Ctn>
+  static void* EmplaceBack(Ctn*, std::false_type) {
+    return nullptr;
+  }
+
+  template <typename Ctn, typename Key>
+  static void* EmplaceKey(Ctn* ctn, const Key& key, std::true_type) {
+    return &(*ctn)[key];
+  }
+
+  template <typename Ctn, typename Key>
+  static void* EmplaceKey(Ctn*, const Key&, std::false_type) {
+    return nullptr;
+  }
 };
 
 class VectorDescriptor : public ContainerDescriptor {
@@ -428,6 +1347,7 @@ class VectorDescriptor : public ContainerDescriptor {
   VectorDescriptor(Type* type)
       : ContainerDescriptor("std::vector<>", sizeof(std::vector<Type>),
                             reflection::DescriptorAccessor<Type>::Get()) {
+    value_trivially_copyable_ = std::is_trivially_copyable<Type>::value;
     get_size_ = [](const void* ctn) -> size_t {
       const auto* ctn_ptr = static_cast<const std::vector<Type>*>(ctn);
       if (ctn_ptr == nullptr) return -1;
@@ -435,33 +1355,96 @@ class VectorDescriptor : public ContainerDescriptor {
     };
     get_val_ = [](const void* ctn, int32_t index) -> const void* {
       const auto* ctn_ptr = static_cast<const std::vector<Type>*>(ctn);
-      if (ctn_ptr == nullptr) return nullptr;
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
       int32_t size = ctn_ptr->size();
       if (size <= index) return nullptr;
-      return &ctn_ptr->at(index);
+      return &(*ctn_ptr)[index];
     };
     mut_val_ = [](void* ctn, int32_t index) -> void* {
       auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
-      if (ctn_ptr == nullptr) return nullptr;
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
       int32_t size = ctn_ptr->size();
       if (size <= index) return nullptr;
-      return &ctn_ptr->at(index);
+      return &(*ctn_ptr)[index];
     };
     add_val_ = [](void* ctn, const void* val) -> bool {
       auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
       const auto* val_ptr = static_cast<const Type*>(val);
       if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
-      // TODO(yuchen): requires further optimization for vector<unique_ptr>.
-      // ctn_ptr->push_back(std::move(*val_ptr));
+      return ContainerInsertHelper::Copy(ctn_ptr, *val_ptr);
+    };
+    move_val_ = [](void* ctn, void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
+      auto* val_ptr = static_cast<Type*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Move(ctn_ptr, val_ptr);
+    };
+    add_vals_ = [](void* ctn, const void* begin, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
+      const auto* begin_ptr = static_cast<const Type*>(begin);
+      if (ctn_ptr == nullptr || (begin_ptr == nullptr && count > 0)) {
+        return false;
+      }
+      return ContainerInsertHelper::CopyRange(ctn_ptr, begin_ptr, count);
+    };
+    reserve_ = [](void* ctn, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->reserve(count);
+      return true;
+    };
+    emplace_ = [](void* ctn) -> void* {
+      auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return nullptr;
+      return ContainerInsertHelper::EmplaceBack(ctn_ptr);
+    };
+    clear_ = [](void* ctn) -> bool {
+      auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->clear();
+      return true;
+    };
+    for_each_ = [](const void* ctn, const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      for (const auto& elem : *ctn_ptr) {
+        if (!visitor(nullptr, &elem)) return false;
+      }
+      return true;
+    };
+    get_partition_size_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->size();
+    };
+    for_each_in_partitions_ = [](const void* ctn, size_t begin, size_t end,
+                                 const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      end = std::min(end, ctn_ptr->size());
+      for (size_t i = begin; i < end; ++i) {
+        if (!visitor(nullptr, &(*ctn_ptr)[i])) return false;
+      }
       return true;
     };
+    get_heap_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->capacity() * sizeof(Type);
+    };
+    get_data_ = [](const void* ctn) -> const void* {
+      const auto* ctn_ptr = static_cast<const std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return nullptr;
+      return ctn_ptr->data();
+    };
+    mut_data_ = [](void* ctn) -> void* {
+      auto* ctn_ptr = static_cast<std::vector<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return nullptr;
+      return ctn_ptr->data();
+    };
   }
   virtual ~VectorDescriptor() {}
 
-  virtual std::string GetTypeName() const override;
-
-  virtual std::string GetContainerTypeName() const override;
-
   virtual size_t GetContainerSize(const void* obj) const override;
 
   virtual const void* GetValueByIndex(const void* obj,
@@ -471,11 +1454,50 @@ class VectorDescriptor : public ContainerDescriptor {
 
   virtual bool AddValue(void* obj, const void* val) override;
 
+  virtual bool AddValueByMove(void* obj, void* val) override;
+
+  virtual bool AddValues(void* obj, const void* begin, size_t count) override;
+
+  virtual bool Reserve(void* obj, size_t count) override;
+
+  virtual void* EmplaceDefault(void* obj) override;
+
+  virtual bool Clear(void* obj) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
+  virtual size_t GetPartitionSize(const void* obj) const override;
+
+  virtual bool ForEachElementInPartitions(
+      const void* obj, size_t begin, size_t end,
+      const ElementVisitor& visitor) const override;
+
+  virtual const void* GetContiguousData(const void* obj) const override;
+
+  virtual void* MutableContiguousData(void* obj) override;
+
  protected:
+  virtual std::string BuildTypeName() const override;
+
   std::function<size_t(const void*)> get_size_;
   std::function<const void*(const void*, int32_t)> get_val_;
   std::function<void*(void*, int32_t)> mut_val_;
   std::function<bool(void*, const void*)> add_val_;
+  std::function<bool(void*, void*)> move_val_;
+  std::function<bool(void*, const void*, size_t)> add_vals_;
+  std::function<bool(void*, size_t)> reserve_;
+  std::function<void*(void*)> emplace_;
+  std::function<bool(void*)> clear_;
+  std::function<bool(const void*, const ElementVisitor&)> for_each_;
+  std::function<size_t(const void*)> get_heap_;
+  std::function<size_t(const void*)> get_partition_size_;
+  std::function<bool(const void*, size_t, size_t, const ElementVisitor&)>
+      for_each_in_partitions_;
+  std::function<const void*(const void*)> get_data_;
+  std::function<void*(void*)> mut_data_;
 };
 
 template <typename Value>
@@ -512,37 +1534,71 @@ class MapDescriptor : public ContainerDescriptor {
       const auto* ctn_ptr = static_cast<const std::map<Key, Value>*>(ctn);
       const auto* key_ptr = static_cast<const Key*>(key);
       if (ctn_ptr == nullptr || key_ptr == nullptr) return nullptr;
-      if (ctn_ptr->find(*key_ptr) == ctn_ptr->end()) return nullptr;
-      return &ctn_ptr->at(*key_ptr);
+      auto iter = ctn_ptr->find(*key_ptr);
+      return iter == ctn_ptr->end() ? nullptr : &iter->second;
     };
     has_key_ = [](const void* ctn, const void* key) -> bool {
       const auto* ctn_ptr = static_cast<const std::map<Key, Value>*>(ctn);
       const auto* key_ptr = static_cast<const Key*>(key);
       if (ctn_ptr == nullptr || key_ptr == nullptr) return false;
-      if (ctn_ptr->find(*key_ptr) == ctn_ptr->end()) return false;
-      return true;
+      return ctn_ptr->find(*key_ptr) != ctn_ptr->end();
     };
     mut_val_ = [](void* ctn, const void* key) -> void* {
       auto* ctn_ptr = static_cast<std::map<Key, Value>*>(ctn);
       const auto* key_ptr = static_cast<const Key*>(key);
       if (ctn_ptr == nullptr || key_ptr == nullptr) return nullptr;
-      if (ctn_ptr->find(*key_ptr) == ctn_ptr->end()) return nullptr;
-      return &ctn_ptr->at(*key_ptr);
+      auto iter = ctn_ptr->find(*key_ptr);
+      return iter == ctn_ptr->end() ? nullptr : &iter->second;
     };
     add_val_ = [](void* ctn, const void* val) -> bool {
       auto* ctn_ptr = static_cast<std::map<Key, Value>*>(ctn);
       const auto* val_ptr = static_cast<const std::pair<Key, Value>*>(val);
       if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
-      ctn_ptr->insert(*val_ptr);
+      return ContainerInsertHelper::Copy(ctn_ptr, *val_ptr);
+    };
+    move_val_ = [](void* ctn, void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::map<Key, Value>*>(ctn);
+      auto* val_ptr = static_cast<std::pair<Key, Value>*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Move(ctn_ptr, val_ptr);
+    };
+    add_vals_ = [](void* ctn, const void* begin, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::map<Key, Value>*>(ctn);
+      const auto* begin_ptr = static_cast<const std::pair<Key, Value>*>(begin);
+      if (ctn_ptr == nullptr || (begin_ptr == nullptr && count > 0)) {
+        return false;
+      }
+      return ContainerInsertHelper::CopyRange(ctn_ptr, begin_ptr, count);
+    };
+    emplace_key_ = [](void* ctn, const void* key) -> void* {
+      auto* ctn_ptr = static_cast<std::map<Key, Value>*>(ctn);
+      const auto* key_ptr = static_cast<const Key*>(key);
+      if (ctn_ptr == nullptr || key_ptr == nullptr) return nullptr;
+      return ContainerInsertHelper::EmplaceKey(ctn_ptr, *key_ptr);
+    };
+    clear_ = [](void* ctn) -> bool {
+      auto* ctn_ptr = static_cast<std::map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->clear();
+      return true;
+    };
+    for_each_ = [](const void* ctn, const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      for (const auto& elem : *ctn_ptr) {
+        if (!visitor(&elem.first, &elem.second)) return false;
+      }
       return true;
     };
+    get_heap_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->size() *
+             (sizeof(std::pair<const Key, Value>) + HeapOverhead::kTreeNode);
+    };
   }
   virtual ~MapDescriptor() {}
 
-  virtual std::string GetTypeName() const override;
-
-  virtual std::string GetContainerTypeName() const override;
-
   virtual size_t GetContainerSize(const void* obj) const override;
 
   virtual std::vector<const void*> GetContainerKeys(
@@ -555,16 +1611,37 @@ class MapDescriptor : public ContainerDescriptor {
 
   virtual bool AddValue(void* obj, const void* val) override;
 
+  virtual bool AddValueByMove(void* obj, void* val) override;
+
+  virtual bool AddValues(void* obj, const void* begin, size_t count) override;
+
+  virtual void* EmplaceByKey(void* obj, const void* key) override;
+
+  virtual bool Clear(void* obj) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
   virtual bool HasKeyOrValue(const void* obj,
                              const void* key_or_value) override;
 
  protected:
+  virtual std::string BuildTypeName() const override;
+
   std::function<size_t(const void*)> get_size_;
   std::function<std::vector<const void*>(const void*)> get_keys_;
   std::function<const void*(const void*, const void*)> get_val_;
   std::function<bool(const void*, const void*)> has_key_;
   std::function<void*(void*, const void*)> mut_val_;
   std::function<bool(void*, const void*)> add_val_;
+  std::function<bool(void*, void*)> move_val_;
+  std::function<bool(void*, const void*, size_t)> add_vals_;
+  std::function<void*(void*, const void*)> emplace_key_;
+  std::function<bool(void*)> clear_;
+  std::function<bool(const void*, const ElementVisitor&)> for_each_;
+  std::function<size_t(const void*)> get_heap_;
 };
 
 template <typename Key, typename Value>
@@ -606,38 +1683,103 @@ class UnorderedMapDescriptor : public ContainerDescriptor {
           static_cast<const std::unordered_map<Key, Value>*>(ctn);
       const auto* key_ptr = static_cast<const Key*>(key);
       if (ctn_ptr == nullptr || key_ptr == nullptr) return nullptr;
-      if (ctn_ptr->find(*key_ptr) == ctn_ptr->end()) return nullptr;
-      return &ctn_ptr->at(*key_ptr);
+      auto iter = ctn_ptr->find(*key_ptr);
+      return iter == ctn_ptr->end() ? nullptr : &iter->second;
     };
     has_key_ = [](const void* ctn, const void* key) -> bool {
       const auto* ctn_ptr =
           static_cast<const std::unordered_map<Key, Value>*>(ctn);
       const auto* key_ptr = static_cast<const Key*>(key);
       if (ctn_ptr == nullptr || key_ptr == nullptr) return false;
-      if (ctn_ptr->find(*key_ptr) == ctn_ptr->end()) return false;
-      return true;
+      return ctn_ptr->find(*key_ptr) != ctn_ptr->end();
     };
     mut_val_ = [](void* ctn, const void* key) -> void* {
       auto* ctn_ptr = static_cast<std::unordered_map<Key, Value>*>(ctn);
       const auto* key_ptr = static_cast<const Key*>(key);
       if (ctn_ptr == nullptr || key_ptr == nullptr) return nullptr;
-      if (ctn_ptr->find(*key_ptr) == ctn_ptr->end()) return nullptr;
-      return &ctn_ptr->at(*key_ptr);
+      auto iter = ctn_ptr->find(*key_ptr);
+      return iter == ctn_ptr->end() ? nullptr : &iter->second;
     };
     add_val_ = [](void* ctn, const void* val) -> bool {
       auto* ctn_ptr = static_cast<std::unordered_map<Key, Value>*>(ctn);
       const auto* val_ptr = static_cast<const std::pair<Key, Value>*>(val);
       if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
-      ctn_ptr->insert(*val_ptr);
+      return ContainerInsertHelper::Copy(ctn_ptr, *val_ptr);
+    };
+    move_val_ = [](void* ctn, void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_map<Key, Value>*>(ctn);
+      auto* val_ptr = static_cast<std::pair<Key, Value>*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Move(ctn_ptr, val_ptr);
+    };
+    add_vals_ = [](void* ctn, const void* begin, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_map<Key, Value>*>(ctn);
+      const auto* begin_ptr = static_cast<const std::pair<Key, Value>*>(begin);
+      if (ctn_ptr == nullptr || (begin_ptr == nullptr && count > 0)) {
+        return false;
+      }
+      return ContainerInsertHelper::CopyRange(ctn_ptr, begin_ptr, count);
+    };
+    reserve_ = [](void* ctn, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->reserve(count);
+      return true;
+    };
+    emplace_key_ = [](void* ctn, const void* key) -> void* {
+      auto* ctn_ptr = static_cast<std::unordered_map<Key, Value>*>(ctn);
+      const auto* key_ptr = static_cast<const Key*>(key);
+      if (ctn_ptr == nullptr || key_ptr == nullptr) return nullptr;
+      return ContainerInsertHelper::EmplaceKey(ctn_ptr, *key_ptr);
+    };
+    clear_ = [](void* ctn) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->clear();
+      return true;
+    };
+    for_each_ = [](const void* ctn, const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr =
+          static_cast<const std::unordered_map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      for (const auto& elem : *ctn_ptr) {
+        if (!visitor(&elem.first, &elem.second)) return false;
+      }
+      return true;
+    };
+    get_partition_size_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr =
+          static_cast<const std::unordered_map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->bucket_count();
+    };
+    for_each_in_partitions_ = [](const void* ctn, size_t begin, size_t end,
+                                 const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr =
+          static_cast<const std::unordered_map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      end = std::min(end, ctn_ptr->bucket_count());
+      for (size_t bucket = begin; bucket < end; ++bucket) {
+        for (auto iter = ctn_ptr->begin(bucket); iter != ctn_ptr->end(bucket);
+             ++iter) {
+          const auto& elem = *iter;
+          if (!visitor(&elem.first, &elem.second)) return false;
+        }
+      }
       return true;
     };
+    get_heap_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr =
+          static_cast<const std::unordered_map<Key, Value>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      size_t node_size =
+          sizeof(std::pair<const Key, Value>) + HeapOverhead::kHashNode;
+      return ctn_ptr->bucket_count() * sizeof(void*) +
+             ctn_ptr->size() * node_size;
+    };
   }
   virtual ~UnorderedMapDescriptor() {}
 
-  virtual std::string GetTypeName() const override;
-
-  virtual std::string GetContainerTypeName() const override;
-
   virtual size_t GetContainerSize(const void* obj) const override;
 
   virtual std::vector<const void*> GetContainerKeys(
@@ -650,16 +1792,49 @@ class UnorderedMapDescriptor : public ContainerDescriptor {
 
   virtual bool AddValue(void* obj, const void* val) override;
 
+  virtual bool AddValueByMove(void* obj, void* val) override;
+
+  virtual bool AddValues(void* obj, const void* begin, size_t count) override;
+
+  virtual bool Reserve(void* obj, size_t count) override;
+
+  virtual void* EmplaceByKey(void* obj, const void* key) override;
+
+  virtual bool Clear(void* obj) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
+  virtual size_t GetPartitionSize(const void* obj) const override;
+
+  virtual bool ForEachElementInPartitions(
+      const void* obj, size_t begin, size_t end,
+      const ElementVisitor& visitor) const override;
+
   virtual bool HasKeyOrValue(const void* obj,
                              const void* key_or_value) override;
 
  protected:
+  virtual std::string BuildTypeName() const override;
+
   std::function<size_t(const void*)> get_size_;
   std::function<std::vector<const void*>(const void*)> get_keys_;
   std::function<const void*(const void*, const void*)> get_val_;
   std::function<bool(const void*, const void*)> has_key_;
   std::function<void*(void*, const void*)> mut_val_;
   std::function<bool(void*, const void*)> add_val_;
+  std::function<bool(void*, void*)> move_val_;
+  std::function<bool(void*, const void*, size_t)> add_vals_;
+  std::function<bool(void*, size_t)> reserve_;
+  std::function<void*(void*, const void*)> emplace_key_;
+  std::function<bool(void*)> clear_;
+  std::function<bool(const void*, const ElementVisitor&)> for_each_;
+  std::function<size_t(const void*)> get_heap_;
+  std::function<size_t(const void*)> get_partition_size_;
+  std::function<bool(const void*, size_t, size_t, const ElementVisitor&)>
+      for_each_in_partitions_;
 };
 
 template <typename Key, typename Value>
@@ -699,24 +1874,50 @@ class SetDescriptor : public ContainerDescriptor {
       const auto* ctn_ptr = static_cast<const std::set<Type>*>(ctn);
       const auto* val_ptr = static_cast<const Type*>(val);
       if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
-      if (ctn_ptr->find(*val_ptr) == ctn_ptr->end()) return false;
-      return true;
+      return ctn_ptr->find(*val_ptr) != ctn_ptr->end();
     };
     add_val_ = [](void* ctn, const void* val) -> bool {
       auto* ctn_ptr = static_cast<std::set<Type>*>(ctn);
       const auto* val_ptr = static_cast<const Type*>(val);
       if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
-      // TODO(yuchen): requires further optimization for vector<unique_ptr>.
-      // ctn_ptr->push_back(*val_ptr);
+      return ContainerInsertHelper::Copy(ctn_ptr, *val_ptr);
+    };
+    move_val_ = [](void* ctn, void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::set<Type>*>(ctn);
+      auto* val_ptr = static_cast<Type*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Move(ctn_ptr, val_ptr);
+    };
+    add_vals_ = [](void* ctn, const void* begin, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::set<Type>*>(ctn);
+      const auto* begin_ptr = static_cast<const Type*>(begin);
+      if (ctn_ptr == nullptr || (begin_ptr == nullptr && count > 0)) {
+        return false;
+      }
+      return ContainerInsertHelper::CopyRange(ctn_ptr, begin_ptr, count);
+    };
+    clear_ = [](void* ctn) -> bool {
+      auto* ctn_ptr = static_cast<std::set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->clear();
+      return true;
+    };
+    for_each_ = [](const void* ctn, const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      for (const auto& elem : *ctn_ptr) {
+        if (!visitor(nullptr, &elem)) return false;
+      }
       return true;
     };
+    get_heap_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->size() * (sizeof(Type) + HeapOverhead::kTreeNode);
+    };
   }
   virtual ~SetDescriptor() {}
 
-  virtual std::string GetTypeName() const override;
-
-  virtual std::string GetContainerTypeName() const override;
-
   virtual size_t GetContainerSize(const void* obj) const override;
 
   virtual const void* GetValueByIndex(const void* obj,
@@ -726,14 +1927,32 @@ class SetDescriptor : public ContainerDescriptor {
 
   virtual bool AddValue(void* obj, const void* val) override;
 
+  virtual bool AddValueByMove(void* obj, void* val) override;
+
+  virtual bool AddValues(void* obj, const void* begin, size_t count) override;
+
+  virtual bool Clear(void* obj) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
   virtual bool HasKeyOrValue(const void* obj,
                              const void* key_or_value) override;
 
  protected:
+  virtual std::string BuildTypeName() const override;
+
   std::function<size_t(const void*)> get_size_;
   std::function<const void*(const void*, int32_t)> get_val_;
   std::function<bool(const void*, const void*)> has_val_;
   std::function<bool(void*, const void*)> add_val_;
+  std::function<bool(void*, void*)> move_val_;
+  std::function<bool(void*, const void*, size_t)> add_vals_;
+  std::function<bool(void*)> clear_;
+  std::function<bool(const void*, const ElementVisitor&)> for_each_;
+  std::function<size_t(const void*)> get_heap_;
 };
 
 template <typename Value>
@@ -761,24 +1980,76 @@ class UnorderedSetDescriptor : public ContainerDescriptor {
       const auto* ctn_ptr = static_cast<const std::unordered_set<Type>*>(ctn);
       const auto* val_ptr = static_cast<const Type*>(val);
       if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
-      if (ctn_ptr->find(*val_ptr) == ctn_ptr->end()) return false;
-      return true;
+      return ctn_ptr->find(*val_ptr) != ctn_ptr->end();
     };
     add_val_ = [](void* ctn, const void* val) -> bool {
       auto* ctn_ptr = static_cast<std::unordered_set<Type>*>(ctn);
       const auto* val_ptr = static_cast<const Type*>(val);
       if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
-      // TODO(yuchen): requires further optimization for vector<unique_ptr>.
-      // ctn_ptr->push_back(*val_ptr);
+      return ContainerInsertHelper::Copy(ctn_ptr, *val_ptr);
+    };
+    move_val_ = [](void* ctn, void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_set<Type>*>(ctn);
+      auto* val_ptr = static_cast<Type*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Move(ctn_ptr, val_ptr);
+    };
+    add_vals_ = [](void* ctn, const void* begin, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_set<Type>*>(ctn);
+      const auto* begin_ptr = static_cast<const Type*>(begin);
+      if (ctn_ptr == nullptr || (begin_ptr == nullptr && count > 0)) {
+        return false;
+      }
+      return ContainerInsertHelper::CopyRange(ctn_ptr, begin_ptr, count);
+    };
+    reserve_ = [](void* ctn, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->reserve(count);
       return true;
     };
+    clear_ = [](void* ctn) -> bool {
+      auto* ctn_ptr = static_cast<std::unordered_set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->clear();
+      return true;
+    };
+    for_each_ = [](const void* ctn, const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::unordered_set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      for (const auto& elem : *ctn_ptr) {
+        if (!visitor(nullptr, &elem)) return false;
+      }
+      return true;
+    };
+    get_partition_size_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::unordered_set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->bucket_count();
+    };
+    for_each_in_partitions_ = [](const void* ctn, size_t begin, size_t end,
+                                 const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::unordered_set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      end = std::min(end, ctn_ptr->bucket_count());
+      for (size_t bucket = begin; bucket < end; ++bucket) {
+        for (auto iter = ctn_ptr->begin(bucket); iter != ctn_ptr->end(bucket);
+             ++iter) {
+          const auto& elem = *iter;
+          if (!visitor(nullptr, &elem)) return false;
+        }
+      }
+      return true;
+    };
+    get_heap_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::unordered_set<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->bucket_count() * sizeof(void*) +
+             ctn_ptr->size() * (sizeof(Type) + HeapOverhead::kHashNode);
+    };
   }
   virtual ~UnorderedSetDescriptor() {}
 
-  virtual std::string GetTypeName() const override;
-
-  virtual std::string GetContainerTypeName() const override;
-
   virtual size_t GetContainerSize(const void* obj) const override;
 
   virtual const void* GetValueByIndex(const void* obj,
@@ -788,13 +2059,43 @@ class UnorderedSetDescriptor : public ContainerDescriptor {
 
   virtual bool AddValue(void* obj, const void* val) override;
 
+  virtual bool AddValueByMove(void* obj, void* val) override;
+
+  virtual bool AddValues(void* obj, const void* begin, size_t count) override;
+
+  virtual bool Reserve(void* obj, size_t count) override;
+
+  virtual bool Clear(void* obj) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
+  virtual size_t GetPartitionSize(const void* obj) const override;
+
+  virtual bool ForEachElementInPartitions(
+      const void* obj, size_t begin, size_t end,
+      const ElementVisitor& visitor) const override;
+
   virtual bool HasKeyOrValue(const void* obj,
                              const void* key_or_value) override;
 
  protected:
+  virtual std::string BuildTypeName() const override;
+
   std::function<size_t(const void*)> get_size_;
   std::function<bool(const void*, const void*)> has_val_;
   std::function<bool(void*, const void*)> add_val_;
+  std::function<bool(void*, void*)> move_val_;
+  std::function<bool(void*, const void*, size_t)> add_vals_;
+  std::function<bool(void*, size_t)> reserve_;
+  std::function<bool(void*)> clear_;
+  std::function<bool(const void*, const ElementVisitor&)> for_each_;
+  std::function<size_t(const void*)> get_heap_;
+  std::function<size_t(const void*)> get_partition_size_;
+  std::function<bool(const void*, size_t, size_t, const ElementVisitor&)>
+      for_each_in_partitions_;
 };
 
 template <typename Value>
@@ -806,53 +2107,861 @@ class DescriptorAccessor<std::unordered_set<Value>> {
   }
 };
 
+// Fixed-size arrays described by ArrayDescriptor: C arrays and std::array.
+template <typename Array>
+struct FixedArrayTraits;
+
+template <typename Value, size_t N>
+struct FixedArrayTraits<Value[N]> {
+  typedef Value value_type;
+  static constexpr size_t kSize = N;
+
+  static const Value* Data(const Value (*array)[N]) { return *array; }
+
+  static Value* Data(Value (*array)[N]) { return *array; }
+};
+
+template <typename Value, size_t N>
+struct FixedArrayTraits<std::array<Value, N>> {
+  typedef Value value_type;
+  static constexpr size_t kSize = N;
+
+  static const Value* Data(const std::array<Value, N>* array) {
+    return array->data();
+  }
+
+  static Value* Data(std::array<Value, N>* array) { return array->data(); }
+};
+
+// Descriptor of C arrays (e.g. float[16]) and std::array. Length is known at
+// compile time and values are contiguous, see GetFixedSize() and
+// GetContiguousData(). Values can be read and modified in place, but never
+// added or removed.
+class ArrayDescriptor : public ContainerDescriptor {
+ public:
+  template <typename Array>
+  ArrayDescriptor(const std::string& name, Array* array)
+      : ContainerDescriptor(name, sizeof(Array),
+                            reflection::DescriptorAccessor<
+                                typename FixedArrayTraits<Array>::value_type>::
+                                Get()),
+        fixed_size_(FixedArrayTraits<Array>::kSize) {
+    using Traits = FixedArrayTraits<Array>;
+    using Type = typename Traits::value_type;
+    value_trivially_copyable_ = std::is_trivially_copyable<Type>::value;
+    get_val_ = [](const void* ctn, int32_t index) -> const void* {
+      const auto* ctn_ptr = static_cast<const Array*>(ctn);
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
+      if (static_cast<size_t>(index) >= Traits::kSize) return nullptr;
+      return Traits::Data(ctn_ptr) + index;
+    };
+    mut_val_ = [](void* ctn, int32_t index) -> void* {
+      auto* ctn_ptr = static_cast<Array*>(ctn);
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
+      if (static_cast<size_t>(index) >= Traits::kSize) return nullptr;
+      return Traits::Data(ctn_ptr) + index;
+    };
+    get_data_ = [](const void* ctn) -> const void* {
+      const auto* ctn_ptr = static_cast<const Array*>(ctn);
+      if (ctn_ptr == nullptr) return nullptr;
+      return Traits::Data(ctn_ptr);
+    };
+    mut_data_ = [](void* ctn) -> void* {
+      auto* ctn_ptr = static_cast<Array*>(ctn);
+      if (ctn_ptr == nullptr) return nullptr;
+      return Traits::Data(ctn_ptr);
+    };
+    for_each_in_partitions_ = [](const void* ctn, size_t begin, size_t end,
+                                 const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const Array*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      const Type* data = Traits::Data(ctn_ptr);
+      // A copy, as binding kSize to a reference needs its definition in C++14.
+      end = std::min(end, static_cast<size_t>(Traits::kSize));
+      for (size_t i = begin; i < end; ++i) {
+        if (!visitor(nullptr, data + i)) return false;
+      }
+      return true;
+    };
+  }
+  virtual ~ArrayDescriptor() {}
+
+  // Always return GetFixedSize().
+  virtual size_t GetContainerSize(const void* obj) const override;
+
+  virtual const void* GetValueByIndex(const void* obj,
+                                      int32_t index) const override;
+
+  virtual void* MutableValueByIndex(void* obj, int32_t index) override;
+
+  // Always return false, size of arrays is fixed.
+  virtual bool AddValue(void* obj, const void* val) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetPartitionSize(const void* obj) const override;
+
+  virtual bool ForEachElementInPartitions(
+      const void* obj, size_t begin, size_t end,
+      const ElementVisitor& visitor) const override;
+
+  virtual const void* GetContiguousData(const void* obj) const override;
+
+  virtual void* MutableContiguousData(void* obj) override;
+
+  virtual int64_t GetFixedSize() const override { return fixed_size_; }
+
+ protected:
+  virtual std::string BuildTypeName() const override;
+
+  size_t fixed_size_;
+  std::function<const void*(const void*, int32_t)> get_val_;
+  std::function<void*(void*, int32_t)> mut_val_;
+  std::function<const void*(const void*)> get_data_;
+  std::function<void*(void*)> mut_data_;
+  std::function<bool(const void*, size_t, size_t, const ElementVisitor&)>
+      for_each_in_partitions_;
+};
+
+template <typename Value, size_t N>
+class DescriptorAccessor<Value[N]> {
+ public:
+  static Descriptor* Get() {
+    static ArrayDescriptor desc("[]", static_cast<Value(*)[N]>(nullptr));
+    return &desc;
+  }
+};
+
+template <typename Value, size_t N>
+class DescriptorAccessor<std::array<Value, N>> {
+ public:
+  static Descriptor* Get() {
+    static ArrayDescriptor desc(
+        "std::array<>", static_cast<std::array<Value, N>*>(nullptr));
+    return &desc;
+  }
+};
+
+class DequeDescriptor : public ContainerDescriptor {
+ public:
+  template <typename Type>
+  DequeDescriptor(Type* type)
+      : ContainerDescriptor("std::deque<>", sizeof(std::deque<Type>),
+                            reflection::DescriptorAccessor<Type>::Get()) {
+    get_size_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return -1;
+      return ctn_ptr->size();
+    };
+    get_val_ = [](const void* ctn, int32_t index) -> const void* {
+      const auto* ctn_ptr = static_cast<const std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
+      int32_t size = ctn_ptr->size();
+      if (size <= index) return nullptr;
+      return &(*ctn_ptr)[index];
+    };
+    mut_val_ = [](void* ctn, int32_t index) -> void* {
+      auto* ctn_ptr = static_cast<std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
+      int32_t size = ctn_ptr->size();
+      if (size <= index) return nullptr;
+      return &(*ctn_ptr)[index];
+    };
+    add_val_ = [](void* ctn, const void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::deque<Type>*>(ctn);
+      const auto* val_ptr = static_cast<const Type*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Copy(ctn_ptr, *val_ptr);
+    };
+    move_val_ = [](void* ctn, void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::deque<Type>*>(ctn);
+      auto* val_ptr = static_cast<Type*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Move(ctn_ptr, val_ptr);
+    };
+    add_vals_ = [](void* ctn, const void* begin, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::deque<Type>*>(ctn);
+      const auto* begin_ptr = static_cast<const Type*>(begin);
+      if (ctn_ptr == nullptr || (begin_ptr == nullptr && count > 0)) {
+        return false;
+      }
+      return ContainerInsertHelper::CopyRange(ctn_ptr, begin_ptr, count);
+    };
+    emplace_ = [](void* ctn) -> void* {
+      auto* ctn_ptr = static_cast<std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return nullptr;
+      return ContainerInsertHelper::EmplaceBack(ctn_ptr);
+    };
+    clear_ = [](void* ctn) -> bool {
+      auto* ctn_ptr = static_cast<std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->clear();
+      return true;
+    };
+    for_each_ = [](const void* ctn, const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      for (const auto& elem : *ctn_ptr) {
+        if (!visitor(nullptr, &elem)) return false;
+      }
+      return true;
+    };
+    get_partition_size_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->size();
+    };
+    for_each_in_partitions_ = [](const void* ctn, size_t begin, size_t end,
+                                 const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      end = std::min(end, ctn_ptr->size());
+      for (size_t i = begin; i < end; ++i) {
+        if (!visitor(nullptr, &(*ctn_ptr)[i])) return false;
+      }
+      return true;
+    };
+    get_heap_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::deque<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      // Values live in fixed-size blocks, indexed by a map of block pointers.
+      size_t block_size = std::max<size_t>(
+          HeapOverhead::kDequeBlock / sizeof(Type), 1);
+      size_t blocks = ctn_ptr->size() / block_size + 1;
+      size_t map_size = std::max(blocks + 2, HeapOverhead::kDequeMinMapSize);
+      return blocks * block_size * sizeof(Type) + map_size * sizeof(void*);
+    };
+  }
+  virtual ~DequeDescriptor() {}
+
+  virtual size_t GetContainerSize(const void* obj) const override;
+
+  virtual const void* GetValueByIndex(const void* obj,
+                                      int32_t index) const override;
+
+  virtual void* MutableValueByIndex(void* obj, int32_t index) override;
+
+  virtual bool AddValue(void* obj, const void* val) override;
+
+  virtual bool AddValueByMove(void* obj, void* val) override;
+
+  virtual bool AddValues(void* obj, const void* begin, size_t count) override;
+
+  virtual void* EmplaceDefault(void* obj) override;
+
+  virtual bool Clear(void* obj) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
+  virtual size_t GetPartitionSize(const void* obj) const override;
+
+  virtual bool ForEachElementInPartitions(
+      const void* obj, size_t begin, size_t end,
+      const ElementVisitor& visitor) const override;
+
+ protected:
+  virtual std::string BuildTypeName() const override;
+
+  std::function<size_t(const void*)> get_size_;
+  std::function<const void*(const void*, int32_t)> get_val_;
+  std::function<void*(void*, int32_t)> mut_val_;
+  std::function<bool(void*, const void*)> add_val_;
+  std::function<bool(void*, void*)> move_val_;
+  std::function<bool(void*, const void*, size_t)> add_vals_;
+  std::function<void*(void*)> emplace_;
+  std::function<bool(void*)> clear_;
+  std::function<bool(const void*, const ElementVisitor&)> for_each_;
+  std::function<size_t(const void*)> get_heap_;
+  std::function<size_t(const void*)> get_partition_size_;
+  std::function<bool(const void*, size_t, size_t, const ElementVisitor&)>
+      for_each_in_partitions_;
+};
+
+template <typename Value>
+class DescriptorAccessor<std::deque<Value>> {
+ public:
+  static Descriptor* Get() {
+    static DequeDescriptor desc(static_cast<Value*>(nullptr));
+    return &desc;
+  }
+};
+
+class ListDescriptor : public ContainerDescriptor {
+ public:
+  template <typename Type>
+  ListDescriptor(Type* type)
+      : ContainerDescriptor("std::list<>", sizeof(std::list<Type>),
+                            reflection::DescriptorAccessor<Type>::Get()) {
+    get_size_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::list<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return -1;
+      return ctn_ptr->size();
+    };
+    get_val_ = [](const void* ctn, int32_t index) -> const void* {
+      const auto* ctn_ptr = static_cast<const std::list<Type>*>(ctn);
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
+      int32_t size = ctn_ptr->size();
+      if (size <= index) return nullptr;
+      return &*std::next(ctn_ptr->begin(), index);
+    };
+    mut_val_ = [](void* ctn, int32_t index) -> void* {
+      auto* ctn_ptr = static_cast<std::list<Type>*>(ctn);
+      if (ctn_ptr == nullptr || index < 0) return nullptr;
+      int32_t size = ctn_ptr->size();
+      if (size <= index) return nullptr;
+      return &*std::next(ctn_ptr->begin(), index);
+    };
+    add_val_ = [](void* ctn, const void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::list<Type>*>(ctn);
+      const auto* val_ptr = static_cast<const Type*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Copy(ctn_ptr, *val_ptr);
+    };
+    move_val_ = [](void* ctn, void* val) -> bool {
+      auto* ctn_ptr = static_cast<std::list<Type>*>(ctn);
+      auto* val_ptr = static_cast<Type*>(val);
+      if (ctn_ptr == nullptr || val_ptr == nullptr) return false;
+      return ContainerInsertHelper::Move(ctn_ptr, val_ptr);
+    };
+    add_vals_ = [](void* ctn, const void* begin, size_t count) -> bool {
+      auto* ctn_ptr = static_cast<std::list<Type>*>(ctn);
+      const auto* begin_ptr = static_cast<const Type*>(begin);
+      if (ctn_ptr == nullptr || (begin_ptr == nullptr && count > 0)) {
+        return false;
+      }
+      return ContainerInsertHelper::CopyRange(ctn_ptr, begin_ptr, count);
+    };
+    emplace_ = [](void* ctn) -> void* {
+      auto* ctn_ptr = static_cast<std::list<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return nullptr;
+      return ContainerInsertHelper::EmplaceBack(ctn_ptr);
+    };
+    clear_ = [](void* ctn) -> bool {
+      auto* ctn_ptr = static_cast<std::list<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      ctn_ptr->clear();
+      return true;
+    };
+    for_each_ = [](const void* ctn, const ElementVisitor& visitor) -> bool {
+      const auto* ctn_ptr = static_cast<const std::list<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return false;
+      for (const auto& elem : *ctn_ptr) {
+        if (!visitor(nullptr, &elem)) return false;
+      }
+      return true;
+    };
+    get_heap_ = [](const void* ctn) -> size_t {
+      const auto* ctn_ptr = static_cast<const std::list<Type>*>(ctn);
+      if (ctn_ptr == nullptr) return 0;
+      return ctn_ptr->size() * (sizeof(Type) + HeapOverhead::kListNode);
+    };
+  }
+  virtual ~ListDescriptor() {}
+
+  virtual size_t GetContainerSize(const void* obj) const override;
+
+  // Linear in |index|, prefer ForEachElement() to visit all values.
+  virtual const void* GetValueByIndex(const void* obj,
+                                      int32_t index) const override;
+
+  // Linear in |index|, prefer ForEachElement() to visit all values.
+  virtual void* MutableValueByIndex(void* obj, int32_t index) override;
+
+  virtual bool AddValue(void* obj, const void* val) override;
+
+  virtual bool AddValueByMove(void* obj, void* val) override;
+
+  virtual bool AddValues(void* obj, const void* begin, size_t count) override;
+
+  virtual void* EmplaceDefault(void* obj) override;
+
+  virtual bool Clear(void* obj) override;
+
+  virtual bool ForEachElement(const void* obj,
+                              const ElementVisitor& visitor) const override;
+
+  virtual size_t GetHeapBytes(const void* obj) const override;
+
+ protected:
+  virtual std::string BuildTypeName() const override;
+
+  std::function<size_t(const void*)> get_size_;
+  std::function<const void*(const void*, int32_t)> get_val_;
+  std::function<void*(void*, int32_t)> mut_val_;
+  std::function<bool(void*, const void*)> add_val_;
+  std::function<bool(void*, void*)> move_val_;
+  std::function<bool(void*, const void*, size_t)> add_vals_;
+  std::function<void*(void*)> emplace_;
+  std::function<bool(void*)> clear_;
+  std::function<bool(const void*, const ElementVisitor&)> for_each_;
+  std::function<size_t(const void*)> get_heap_;
+};
+
+template <typename Value>
+class DescriptorAccessor<std::list<Value>> {
+ public:
+  static Descriptor* Get() {
+    static ListDescriptor desc(static_cast<Value*>(nullptr));
+    return &desc;
+  }
+};
+
+// Alternatives and active value of variants described by VariantDescriptor.
+template <typename Variant>
+struct VariantTraits;
+
+template <typename T0, typename... TN>
+struct VariantTraits<boost::variant<T0, TN...>> {
+  typedef boost::variant<T0, TN...> Variant;
+  typedef std::tuple<T0, TN...> Alternatives;
+
+  static std::vector<Descriptor*> GetDescriptors() {
+    return {reflection::DescriptorAccessor<T0>::Get(),
+            reflection::DescriptorAccessor<TN>::Get()...};
+  }
+
+  static int32_t GetIndex(const Variant& variant) { return variant.which(); }
+
+  static const void* Get(const Variant& variant) {
+    return boost::apply_visitor(ConstAddressVisitor(), variant);
+  }
+
+  static void* Get(Variant* variant) {
+    return boost::apply_visitor(AddressVisitor(), *variant);
+  }
+
+  template <size_t Index>
+  static void* Emplace(Variant* variant) {
+    using Type = typename std::tuple_element<Index, Alternatives>::type;
+    *variant = Type();
+    return boost::get<Type>(variant);
+  }
+
+ private:
+  struct ConstAddressVisitor : boost::static_visitor<const void*> {
+    template <typename Type>
+    const void* operator()(const Type& value) const {
+      return &value;
+    }
+  };
+
+  struct AddressVisitor : boost::static_visitor<void*> {
+    template <typename Type>
+    void* operator()(Type& value) const {
+      return &value;
+    }
+  };
+};
+
+#if __cplusplus >= 201703L
+template <typename... Types>
+struct VariantTraits<std::variant<Types...>> {
+  typedef std::variant<Types...> Variant;
+  typedef std::tuple<Types...> Alternatives;
+
+  static std::vector<Descriptor*> GetDescriptors() {
+    return {reflection::DescriptorAccessor<Types>::Get()...};
+  }
+
+  static int32_t GetIndex(const Variant& variant) {
+    if (variant.valueless_by_exception()) return -1;
+    return variant.index();
+  }
+
+  static const void* Get(const Variant& variant) {
+    if (variant.valueless_by_exception()) return nullptr;
+    return std::visit([](const auto& value) -> const void* { return &value; },
+                      variant);
+  }
+
+  static void* Get(Variant* variant) {
+    if (variant->valueless_by_exception()) return nullptr;
+    return std::visit([](auto& value) -> void* { return &value; }, *variant);
+  }
+
+  template <size_t Index>
+  static void* Emplace(Variant* variant) {
+    return &variant->template emplace<Index>();
+  }
+};
+#endif
+
+// Descriptor of boost::variant, and std::variant since C++17. Exactly one
+// alternative is active at a time (none for a valueless std::variant), and
+// its value is stored inline.
+class VariantDescriptor : public Descriptor {
+ public:
+  template <typename Variant>
+  VariantDescriptor(const std::string& name, Variant* variant)
+      : Descriptor(name, sizeof(Variant), DescriptorKind::kVariant),
+        descs_(VariantTraits<Variant>::GetDescriptors()),
+        emplacers_(MakeEmplacers<Variant>(
+            std::make_index_sequence<
+                std::tuple_size<typename VariantTraits<
+                    Variant>::Alternatives>::value>())) {
+    get_index_ = [](const void* obj) -> int32_t {
+      const auto* var_ptr = static_cast<const Variant*>(obj);
+      if (var_ptr == nullptr) return -1;
+      return VariantTraits<Variant>::GetIndex(*var_ptr);
+    };
+    get_val_ = [](const void* obj) -> const void* {
+      const auto* var_ptr = static_cast<const Variant*>(obj);
+      if (var_ptr == nullptr) return nullptr;
+      return VariantTraits<Variant>::Get(*var_ptr);
+    };
+    mut_val_ = [](void* obj) -> void* {
+      auto* var_ptr = static_cast<Variant*>(obj);
+      if (var_ptr == nullptr) return nullptr;
+      return VariantTraits<Variant>::Get(var_ptr);
+    };
+  }
+  virtual ~VariantDescriptor() {}
+
+  // Full type name with alternatives included, e.g.
+  // boost::variant<int32_t, std::string>. Interned on first call.
+  virtual string_view GetTypeNameView() const override {
+    return InternTypeName();
+  }
+
+  virtual int32_t GetAlternativeSize() const;
+
+  // Get descriptor of alternative |index|. Return nullptr for invalid index.
+  virtual Descriptor* GetAlternativeDescriptor(int32_t index) const;
+
+  // Get index of active alternative. Return -1 for a valueless variant.
+  virtual int32_t GetIndex(const void* obj) const;
+
+  // Get descriptor of active alternative. Return nullptr for a valueless
+  // variant.
+  virtual Descriptor* GetActiveDescriptor(const void* obj) const;
+
+  // Get const pointer to value of active alternative. Return nullptr for a
+  // valueless variant.
+  virtual const void* GetActiveValue(const void* obj) const;
+
+  // Get non-const pointer to value of active alternative. Return nullptr for
+  // a valueless variant.
+  virtual void* MutableActiveValue(void* obj);
+
+  // Make alternative |index| active with a default constructed value and
+  // return a pointer to it. Return nullptr for invalid index or alternatives
+  // that are not default constructible.
+  virtual void* EmplaceAlternative(void* obj, int32_t index);
+
+  // Cast a Descriptor* to VariantDescriptor*. Return nullptr if failed.
+  static VariantDescriptor* ToVariantDescriptor(Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kVariant) {
+      return nullptr;
+    }
+    return static_cast<VariantDescriptor*>(desc);
+  }
+
+  static const VariantDescriptor* ToVariantDescriptor(const Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kVariant) {
+      return nullptr;
+    }
+    return static_cast<const VariantDescriptor*>(desc);
+  }
+
+ protected:
+  virtual std::string BuildTypeName() const override;
+
+  template <typename Variant, size_t Index>
+  static void* EmplaceAt(void* obj) {
+    using Type = typename std::tuple_element<
+        Index, typename VariantTraits<Variant>::Alternatives>::type;
+    auto* var_ptr = static_cast<Variant*>(obj);
+    if (var_ptr == nullptr) return nullptr;
+    return EmplaceAtIf<Variant, Index>(
+        var_ptr, std::is_default_constructible<Type>());
+  }
+
+  template <typename Variant, size_t Index>
+  static void* EmplaceAtIf(Variant* var_ptr, std::true_type) {
+    return VariantTraits<Variant>::template Emplace<Index>(var_ptr);
+  }
+
+  template <typename Variant, size_t Index>
+  static void* EmplaceAtIf(Variant*, std::false_type) {
+    return nullptr;
+  }
+
+  template <typename Variant, size_t... Indices>
+  static std::vector<void* (*)(void*)> MakeEmplacers(
+      std::index_sequence<Indices...>) {
+    return {&EmplaceAt<Variant, Indices>...};
+  }
+
+  std::vector<Descriptor*> descs_;
+  std::vector<void* (*)(void*)> emplacers_;
+  std::function<int32_t(const void*)> get_index_;
+  std::function<const void*(const void*)> get_val_;
+  std::function<void*(void*)> mut_val_;
+};
+
+template <typename T0, typename... TN>
+class DescriptorAccessor<boost::variant<T0, TN...>> {
+ public:
+  static Descriptor* Get() {
+    static VariantDescriptor desc(
+        "boost::variant<>",
+        static_cast<boost::variant<T0, TN...>*>(nullptr));
+    return &desc;
+  }
+};
+
+#if __cplusplus >= 201703L
+template <typename... Types>
+class DescriptorAccessor<std::variant<Types...>> {
+ public:
+  static Descriptor* Get() {
+    static VariantDescriptor desc(
+        "std::variant<>", static_cast<std::variant<Types...>*>(nullptr));
+    return &desc;
+  }
+};
+#endif
+
+// Flags of reflected members, set with ANNOTATE_REFLECTION_MEMBER(). Engines
+// check them per field instead of matching names.
+enum MemberFlag : uint32_t {
+  // Never serialized: left out of snapshots, replay logs and columnar files,
+  // and left untouched when restoring them, e.g. caches or mutexes.
+  kMemberTransient = 1u << 0,
+  // Identifies its object among others of the class, e.g. an id.
+  kMemberKey = 1u << 1,
+  // Accessed in most or few uses of the object. Layout analysis takes them
+  // over access counters, see layout_analyzer.h.
+  kMemberHot = 1u << 2,
+  kMemberCold = 1u << 3,
+  // Floating point values, glm components included, are stored as integer
+  // multiples of MemberAttributes::quantum where formats allow it (replay
+  // logs), dropping precision below it. A power of two quantum makes fixed
+  // point.
+  kMemberQuantized = 1u << 4,
+};
+
+struct MemberAttributes {
+  // MemberFlag values or-ed together.
+  uint32_t flags{0};
+  // Step of kMemberQuantized values, ignored if not positive.
+  double quantum{0.0};
+};
+
 struct Member {
  public:
   std::string field_name_;
   size_t offset_;
+  size_t size_;
+  size_t align_;
   Descriptor* desc_;
+  MemberAttributes attributes_{};
 };
 
 // Class descriptor definitions. All classes marked as 'using reflection' will
 // instantiate its own class descriptor instance with recorded members.
 class ClassDescriptor : public Descriptor {
  public:
-  ClassDescriptor(std::function<void(ClassDescriptor*)> init) : Descriptor() {
+  ClassDescriptor(std::function<void(ClassDescriptor*)> init)
+      : Descriptor(DescriptorKind::kClass) {
     init(this);
   }
   virtual ~ClassDescriptor() {}
 
-  virtual bool IsTypePreDefined() const override;
-
   // Get size of fields marked as using reflection in class.
   virtual int32_t GetFieldSize() const;
 
-  // Get variable name of a certain reflected field.
+  // Get variable name of a certain reflected field. Allocating convenience
+  // wrapper of GetFieldNameView().
   virtual std::string GetFieldName(int32_t id) const;
 
+  // Get variable name of a certain reflected field without allocation. Return
+  // an empty view for invalid id.
+  virtual string_view GetFieldNameView(int32_t id) const;
+
   // Get descriptor of a certain reflected field by id.
-  virtual Descriptor* GetDescriptorById(int32_t id);
+  virtual Descriptor* GetDescriptorById(int32_t id) const;
+
+  // Get byte offset of a certain reflected field in class by id. Return -1 for
+  // invalid id.
+  virtual int64_t GetFieldOffset(int32_t id) const;
+
+  // Get sizeof() of a certain reflected field by id. Return 0 for invalid id.
+  virtual size_t GetFieldByteSize(int32_t id) const;
+
+  // Get alignof() of a certain reflected field by id. Return 0 for invalid id.
+  virtual size_t GetFieldAlignment(int32_t id) const;
+
+  // Get flags and attributes of a certain reflected field by id, all unset for
+  // invalid id. See ANNOTATE_REFLECTION_MEMBER().
+  virtual const MemberAttributes& GetFieldAttributes(int32_t id) const;
+
+  // Whether a certain reflected field has |flag|. False for invalid id.
+  bool HasFieldFlag(int32_t id, MemberFlag flag) const {
+    return IsValidId(id) && (members_[id].attributes_.flags & flag) != 0;
+  }
 
   // Get descriptor of a certain reflected field by variable name.
-  virtual Descriptor* GetDescriptorByName(const std::string& name);
+  virtual Descriptor* GetDescriptorByName(const std::string& name) const;
+
+  // Get id of a certain reflected field by variable name. Return -1 if no
+  // field is named so. Resolve names once with it and access by id in loops.
+  virtual int32_t GetFieldId(const std::string& name) const;
 
-  // Get non-const pointer to certain value in class by id.
+  // Get non-const pointer to certain value in class by id. Return nullptr for
+  // invalid id or null object, see GetLastAccessError().
   virtual void* MutableFieldValueById(void* obj, int32_t id);
 
-  // Get non-const pointer to certain value in class by variable name.
+  // Get non-const pointer to certain value in class by variable name. Return
+  // nullptr if no field is named so.
   virtual void* MutableFieldValueByName(void* obj, const std::string& name);
 
+  // Get const pointer to certain value in class by id. Return nullptr for
+  // invalid id or null object, see GetLastAccessError().
+  virtual const void* GetFieldValueById(const void* obj, int32_t id) const;
+
+  // Get const pointer to certain value in class by variable name. Return
+  // nullptr if no field is named so.
+  virtual const void* GetFieldValueByName(const void* obj,
+                                          const std::string& name) const;
+
+  // Unchecked variants of the above for valid ids and non-null objects, see
+  // access_policy.h.
+  const void* GetFieldValueById(const void* obj, int32_t id,
+                                UncheckedAccess) const {
+    assert(obj != nullptr && IsValidId(id));
+    const auto& member = members_[id];
+    return member.desc_->GetVal(static_cast<const char*>(obj) +
+                                member.offset_);
+  }
+
+  void* MutableFieldValueById(void* obj, int32_t id, UncheckedAccess) {
+    assert(obj != nullptr && IsValidId(id));
+    const auto& member = members_[id];
+    return member.desc_->MutableVal(static_cast<char*>(obj) + member.offset_);
+  }
+
+  // Get typed const pointer to certain field by id, with the access policy
+  // selected by DefaultAccess. Type is checked by comparing descriptor
+  // identity with DescriptorAccessor<T>::Get(), so no RTTI is involved. Return
+  // nullptr on invalid id, null object or type mismatch. Note that all
+  // protobuf messages share one descriptor, so the check cannot tell message
+  // types apart.
+  template <typename T>
+  const T* GetField(const void* obj, int32_t id) const {
+    return GetField<T>(obj, id, DefaultAccess());
+  }
+
+  template <typename T>
+  const T* GetField(const void* obj, int32_t id, CheckedAccess) const {
+    if (!CheckField(obj, id, DescriptorAccessor<T>::Get())) return nullptr;
+    return static_cast<const T*>(GetFieldValueById(obj, id));
+  }
+
+  template <typename T>
+  const T* GetField(const void* obj, int32_t id, UncheckedAccess) const {
+    assert(IsFieldOfType(id, DescriptorAccessor<T>::Get()));
+    return static_cast<const T*>(GetFieldValueById(obj, id, kUnchecked));
+  }
+
+  // Get typed non-const pointer to certain field by id. See GetField().
+  template <typename T>
+  T* MutableField(void* obj, int32_t id) {
+    return MutableField<T>(obj, id, DefaultAccess());
+  }
+
+  template <typename T>
+  T* MutableField(void* obj, int32_t id, CheckedAccess) {
+    if (!CheckField(obj, id, DescriptorAccessor<T>::Get())) return nullptr;
+    return static_cast<T*>(MutableFieldValueById(obj, id));
+  }
+
+  template <typename T>
+  T* MutableField(void* obj, int32_t id, UncheckedAccess) {
+    assert(IsFieldOfType(id, DescriptorAccessor<T>::Get()));
+    return static_cast<T*>(MutableFieldValueById(obj, id, kUnchecked));
+  }
+
+  // Get a 64-bit FNV-1a hash of the schema: class name, size and, for each
+  // field, its name, offset, type and flags changing what serializers store
+  // (kMemberTransient, kMemberQuantized), recursing through nested classes,
+  // containers, smart pointers and variants. Types reached again while being
+  // hashed are hashed by depth, so recursive types are fine. Equal
+  // fingerprints mean objects can be copied field by field without name
+  // lookups. Computed once on first call, as nested descriptors may not be
+  // initialized yet at registration.
+  uint64_t GetFingerprint() const;
+
   // **FOR INTERNAL USE ONLY**
   void InternalSetMembers(std::vector<Member>&& members);
 
+  // **FOR INTERNAL USE ONLY**
+  // Return false if no field is named |name|.
+  bool InternalSetFieldAttributes(const std::string& name,
+                                  const MemberAttributes& attributes);
+
+  // alignof() of the class.
+  size_t align_{1};
+
  public:
   // Cast a Descriptor* to ClassDescriptor*. Return nullptr if failed.
   static ClassDescriptor* ToClassDescriptor(Descriptor* desc) {
-    return dynamic_cast<ClassDescriptor*>(desc);
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kClass) {
+      return nullptr;
+    }
+    return static_cast<ClassDescriptor*>(desc);
+  }
+
+  static const ClassDescriptor* ToClassDescriptor(const Descriptor* desc) {
+    if (desc == nullptr || desc->GetKind() != DescriptorKind::kClass) {
+      return nullptr;
+    }
+    return static_cast<const ClassDescriptor*>(desc);
   }
 
  private:
+  bool IsValidId(int32_t id) const {
+    return id >= 0 && id < static_cast<int32_t>(members_.size());
+  }
+
+  bool IsFieldOfType(int32_t id, const Descriptor* desc) const {
+    return IsValidId(id) && members_[id].desc_ == desc;
+  }
+
+  // Whether |obj| is not null and field |id| is of type |desc|. Report an
+  // access error otherwise.
+  bool CheckField(const void* obj, int32_t id, const Descriptor* desc) const {
+    if (obj != nullptr && IsFieldOfType(id, desc)) return true;
+    ReportAccessError(obj, id, desc);
+    return false;
+  }
+
+  // Report a failed access to field |id| of |obj|, of type |desc| if not
+  // nullptr.
+  void ReportAccessError(const void* obj, int32_t id,
+                         const Descriptor* desc) const;
+
   std::vector<Member> members_;
+  mutable std::once_flag fingerprint_once_;
+  mutable uint64_t fingerprint_{0};
+};
+
+// Attach flags and attributes to a member of a class descriptor at static
+// initialization, see ANNOTATE_REFLECTION_MEMBER().
+class MemberAnnotationRegister {
+ public:
+  MemberAnnotationRegister(Descriptor* desc, const std::string& field_name,
+                           const MemberAttributes& attributes) {
+    auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+    bool found = class_desc != nullptr &&
+                 class_desc->InternalSetFieldAttributes(field_name, attributes);
+    assert(found && "annotated member is not reflected");
+    (void)found;
+  }
 };
 
 }  // namespace reflection
@@ -26,6 +26,7 @@ namespace reflection {
   void class_name::InitReflection(reflection::ClassDescriptor* desc) { \
     desc->type_name_ = #class_name;                                    \
     desc->size_ = sizeof(class_name);                                  \
+    desc->align_ = alignof(class_name);                                \
     desc->InternalSetMembers({ADD_MEMBER(class_name, ##__VA_ARGS__)}); \
   }
 
@@ -55,8 +56,9 @@ namespace reflection {
 
 #define TO_CLASS_DESC(desc) reflection::ClassDescriptor::ToClassDescriptor(desc)
 
-#define ADD_MEMBER_LINE(class_name, a) \
-  {#a, offsetof(class_name, a),        \
+#define ADD_MEMBER_LINE(class_name, a)                           \
+  {#a, offsetof(class_name, a), sizeof(decltype(class_name::a)), \
+   alignof(decltype(class_name::a)),                             \
    reflection::DescriptorAccessor<decltype(class_name::a)>::Get()},
 
 #define ADD_MEMBER_1(class_name)
@@ -149,4 +151,118 @@ namespace reflection {
       ADD_MEMBER_2, ADD_MEMBER_1)                                              \
   (__VA_ARGS__)
 
+// List names of enum values, e.g.
+//   enum class Color { kRed, kGreen };
+//   ADD_REFLECTION_ENUM(Color, kRed, kGreen);
+// Enums not listed are still described, only without names. Up to 20 values.
+#define ADD_REFLECTION_ENUM(enum_type, ...)               \
+  static reflection::EnumNamesRegister REFLECTION_CONCAT( \
+      reflection_enum_names_, __COUNTER__)(               \
+      reflection::DescriptorAccessor<enum_type>::Get(),   \
+      {ADD_ENUM_VALUE(enum_type, ##__VA_ARGS__)})
+
+// Attach flags, see MemberFlag, and attributes to a reflected member, e.g.
+//   ANNOTATE_REFLECTION_MEMBER(Pose, cache_, reflection::kMemberTransient);
+//   ANNOTATE_REFLECTION_MEMBER(Pose, x_, reflection::kMemberQuantized, 1e-3);
+// Arguments after the member initialize MemberAttributes. Place it after
+// ADD_REFLECTION_CLASS_MEMBER() of the class, in the same file.
+#define ANNOTATE_REFLECTION_MEMBER(class_name, member, ...)       \
+  static reflection::MemberAnnotationRegister REFLECTION_CONCAT(  \
+      reflection_member_annotation_, __COUNTER__)(                \
+      reflection::DescriptorAccessor<class_name>::Get(), #member, \
+      reflection::MemberAttributes{__VA_ARGS__})
+
+#define REFLECTION_CONCAT_IMPL(a, b) a##b
+
+#define REFLECTION_CONCAT(a, b) REFLECTION_CONCAT_IMPL(a, b)
+
+#define ADD_ENUM_VALUE_LINE(enum_type, a) \
+  {static_cast<int64_t>(enum_type::a), #a},
+
+#define ADD_ENUM_VALUE_1(enum_type)
+
+#define ADD_ENUM_VALUE_2(enum_type, a) ADD_ENUM_VALUE_LINE(enum_type, a)
+
+#define ADD_ENUM_VALUE_3(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)         \
+  ADD_ENUM_VALUE_2(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_4(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)         \
+  ADD_ENUM_VALUE_3(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_5(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)         \
+  ADD_ENUM_VALUE_4(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_6(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)         \
+  ADD_ENUM_VALUE_5(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_7(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)         \
+  ADD_ENUM_VALUE_6(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_8(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)         \
+  ADD_ENUM_VALUE_7(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_9(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)         \
+  ADD_ENUM_VALUE_8(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_10(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_9(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_11(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_10(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_12(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_11(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_13(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_12(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_14(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_13(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_15(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_14(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_16(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_15(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_17(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_16(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_18(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_17(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_19(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_18(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE_20(enum_type, a, ...) \
+  ADD_ENUM_VALUE_LINE(enum_type, a)          \
+  ADD_ENUM_VALUE_19(enum_type, ##__VA_ARGS__)
+
+#define ADD_ENUM_VALUE(...)                                                    \
+  ADD_MEMBER_SELECTOR(__VA_ARGS__, ADD_ENUM_VALUE_20, ADD_ENUM_VALUE_19,       \
+                      ADD_ENUM_VALUE_18, ADD_ENUM_VALUE_17, ADD_ENUM_VALUE_16, \
+                      ADD_ENUM_VALUE_15, ADD_ENUM_VALUE_14, ADD_ENUM_VALUE_13, \
+                      ADD_ENUM_VALUE_12, ADD_ENUM_VALUE_11, ADD_ENUM_VALUE_10, \
+                      ADD_ENUM_VALUE_9, ADD_ENUM_VALUE_8, ADD_ENUM_VALUE_7,    \
+                      ADD_ENUM_VALUE_6, ADD_ENUM_VALUE_5, ADD_ENUM_VALUE_4,    \
+                      ADD_ENUM_VALUE_3, ADD_ENUM_VALUE_2, ADD_ENUM_VALUE_1)    \
+  (__VA_ARGS__)
+
 }  // namespace reflection
\ No newline at end of file
@@ -0,0 +1,992 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/replay_log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+#include <utility>
+
+#include <boost/functional/hash.hpp>
+
+namespace reflection {
+
+namespace {
+
+const char kMagic[4] = {'S', 'S', 'R', 'L'};
+const uint32_t kVersion = 2;
+// Magic, version, fingerprint and keyframe interval.
+const size_t kHeaderSize =
+    sizeof(kMagic) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+// Kind, timestamp and sizes of sections.
+const size_t kFrameHeaderSize =
+    sizeof(uint8_t) + sizeof(int64_t) + 2 * sizeof(uint32_t);
+// Index offset and magic at end of file.
+const size_t kTrailerSize = sizeof(uint64_t) + sizeof(kMagic);
+// Bound of decoded container sizes, against corrupted data.
+const uint64_t kMaxContainerSize = 1ull << 28;
+
+uint64_t GetFingerprint(Descriptor* desc) {
+  auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+  return class_desc == nullptr ? 0 : class_desc->GetFingerprint();
+}
+
+uint64_t ZigZag(uint64_t value) {
+  return (value << 1) ^
+         static_cast<uint64_t>(static_cast<int64_t>(value) >> 63);
+}
+
+uint64_t UnZigZag(uint64_t value) { return (value >> 1) ^ (0 - (value & 1)); }
+
+// Get quantum of floating point values in field |id| of |desc|, or |outer|
+// one of the enclosing field if not quantized.
+double GetQuantum(const ClassDescriptor* desc, int32_t id, double outer) {
+  if (!desc->HasFieldFlag(id, kMemberQuantized)) return outer;
+  double quantum = desc->GetFieldAttributes(id).quantum;
+  return quantum > 0 ? quantum : outer;
+}
+
+// Get |value| in multiples of |quantum|, clamped to +-2^62, NaN as 0.
+int64_t Quantize(double value, double quantum) {
+  const double kLimit = 4611686018427387904.0;
+  double steps = std::round(value / quantum);
+  if (std::isnan(steps)) return 0;
+  return static_cast<int64_t>(std::max(-kLimit, std::min(kLimit, steps)));
+}
+
+void PutVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Copy |size| bytes to |out| and return end of them.
+char* PutBytes(const void* data, size_t size, char* out) {
+  std::memcpy(out, data, size);
+  return out + size;
+}
+
+// Reads a section of a frame, failing past end.
+class SectionReader {
+ public:
+  SectionReader(const char* data, size_t size)
+      : pos_(data), end_(data + size) {}
+
+  bool ReadVarint(uint64_t* value) {
+    *value = 0;
+    for (int32_t shift = 0; shift < 64 && pos_ < end_; shift += 7) {
+      uint8_t byte = static_cast<uint8_t>(*pos_++);
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+  }
+
+  bool ReadBytes(size_t size, std::string* out) {
+    if (static_cast<size_t>(end_ - pos_) < size) return false;
+    out->assign(pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  bool IsEnd() const { return pos_ == end_; }
+
+ private:
+  const char* pos_;
+  const char* end_;
+};
+
+// Leaf values of a frame in descriptor order. Scalars are bit patterns:
+// integers sign or zero extended, floats and doubles as their bits. Strings
+// beyond |string_size| are spare buffers, kept to reuse their capacity.
+struct FrameValues {
+  std::vector<uint64_t> scalars;
+  std::vector<std::string> strings;
+  size_t string_size{0};
+
+  void Clear() {
+    scalars.clear();
+    string_size = 0;
+  }
+
+  std::string* AddString() {
+    if (string_size == strings.size()) strings.emplace_back();
+    return &strings[string_size++];
+  }
+};
+
+const FrameValues& GetEmptyValues() {
+  static const FrameValues values;
+  return values;
+}
+
+// Whether keys of maps and values of sets reachable from |desc| can be built
+// out of place when restoring, i.e. are scalars, enums or strings.
+bool CheckKeys(Descriptor* desc, std::unordered_set<Descriptor*>* visited,
+               std::string* error) {
+  if (desc == nullptr || !visited->insert(desc).second) return true;
+  auto is_key = [](Descriptor* key_desc) {
+    return key_desc != nullptr &&
+           key_desc->GetPrimitiveType() != PrimitiveType::kNone &&
+           (key_desc->GetPrimitiveType() == PrimitiveType::kString ||
+            key_desc->size_ <= sizeof(uint64_t));
+  };
+  switch (desc->GetKind()) {
+    case DescriptorKind::kClass: {
+      auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+      for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+        if (class_desc->HasFieldFlag(i, kMemberTransient)) continue;
+        if (!CheckKeys(class_desc->GetDescriptorById(i), visited, error)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case DescriptorKind::kContainer: {
+      auto* container_desc = static_cast<ContainerDescriptor*>(desc);
+      Descriptor* key_desc = container_desc->GetKeyDescriptor();
+      Descriptor* value_desc = container_desc->GetValueDescriptor();
+      string_view name = container_desc->GetContainerTypeNameView();
+      bool is_set = key_desc == nullptr && name.size() >= 5 &&
+                    name.substr(name.size() - 5) == "set<>";
+      if ((key_desc != nullptr && !is_key(key_desc)) ||
+          (is_set && !is_key(value_desc))) {
+        *error = "unsupported key type in " + desc->GetTypeName();
+        return false;
+      }
+      return CheckKeys(value_desc, visited, error);
+    }
+    case DescriptorKind::kSmartPtr:
+      return CheckKeys(
+          static_cast<SmartPtrDescriptor*>(desc)->GetContentDescriptor(),
+          visited, error);
+    case DescriptorKind::kVariant: {
+      auto* variant_desc = static_cast<VariantDescriptor*>(desc);
+      for (int32_t i = 0; i < variant_desc->GetAlternativeSize(); ++i) {
+        if (!CheckKeys(variant_desc->GetAlternativeDescriptor(i), visited,
+                       error)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    default:
+      return true;
+  }
+}
+
+// Identity of pointer content: pointers aliasing a member at the same address
+// as its object point to another content.
+using ContentKey = std::pair<const void*, const Descriptor*>;
+
+// Capture leaf values of an object into |current|, encoding each against the
+// value at the same position of |last|. Scalars past the end of |last| are
+// never counted as unchanged, so that decoders bound the scalars of a frame
+// by its size.
+class FrameEncoder {
+ public:
+  FrameEncoder(const FrameValues& last, FrameValues* current,
+               std::string* scalar_bytes, std::string* string_bytes)
+      : last_(last),
+        current_(current),
+        scalar_bytes_(scalar_bytes),
+        string_bytes_(string_bytes) {}
+
+  void Encode(const void* obj, Descriptor* desc) {
+    switch (desc->GetKind()) {
+      case DescriptorKind::kPreDefined:
+        return EncodePreDefined(obj, desc);
+      case DescriptorKind::kEnum:
+        return PutScalar(static_cast<uint64_t>(
+                             static_cast<EnumDescriptor*>(desc)->GetValue(obj)),
+                         false);
+      case DescriptorKind::kClass: {
+        auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+        const char* bytes = static_cast<const char*>(obj);
+        double outer = quantum_;
+        for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+          if (class_desc->HasFieldFlag(i, kMemberTransient)) continue;
+          quantum_ = GetQuantum(class_desc, i, outer);
+          Encode(bytes + class_desc->GetFieldOffset(i),
+                 class_desc->GetDescriptorById(i));
+        }
+        quantum_ = outer;
+        return;
+      }
+      case DescriptorKind::kContainer: {
+        auto* container_desc = static_cast<ContainerDescriptor*>(desc);
+        Descriptor* key_desc = container_desc->GetKeyDescriptor();
+        Descriptor* value_desc = container_desc->GetValueDescriptor();
+        if (container_desc->GetFixedSize() < 0) {
+          PutScalar(container_desc->GetContainerSize(obj), false);
+        }
+        container_desc->ForEachElement(
+            obj, [&](const void* key, const void* value) {
+              if (key_desc != nullptr) Encode(key, key_desc);
+              Encode(value, value_desc);
+              return true;
+            });
+        return;
+      }
+      case DescriptorKind::kSmartPtr: {
+        auto* ptr_desc = static_cast<SmartPtrDescriptor*>(desc);
+        const void* content = ptr_desc->GetRawPtr(obj);
+        PutScalar(content != nullptr, false);
+        if (content == nullptr) return;
+        // Content is recorded by value, which a cycle would repeat forever.
+        Descriptor* content_desc = ptr_desc->GetContentDescriptor();
+        ContentKey key(content, content_desc);
+        if (!path_.insert(key).second) {
+          cycle_ = true;
+          return;
+        }
+        Encode(content, content_desc);
+        path_.erase(key);
+        return;
+      }
+      case DescriptorKind::kVariant: {
+        auto* variant_desc = static_cast<VariantDescriptor*>(desc);
+        int32_t index = variant_desc->GetIndex(obj);
+        PutScalar(static_cast<uint64_t>(index + 1), false);
+        if (index >= 0) {
+          Encode(variant_desc->GetActiveValue(obj),
+                 variant_desc->GetActiveDescriptor(obj));
+        }
+        return;
+      }
+      case DescriptorKind::kMessage: {
+        std::string* value = current_->AddString();
+        MessageDescriptor::ToMessage(obj)->SerializeToString(value);
+        return EncodeString(*value);
+      }
+    }
+  }
+
+  // Write the pending run of unchanged scalars.
+  void Finish() {
+    if (unchanged_ > 0) PutVarint(unchanged_, scalar_bytes_);
+    unchanged_ = 0;
+  }
+
+  // Whether pointer content was met again within itself, in which case the
+  // frame is incomplete.
+  bool HasCycle() const { return cycle_; }
+
+ private:
+  void EncodePreDefined(const void* obj, Descriptor* desc) {
+    switch (desc->GetPrimitiveType()) {
+      case PrimitiveType::kBool:
+        return PutScalar(*static_cast<const bool*>(obj), false);
+      case PrimitiveType::kChar:
+      case PrimitiveType::kUInt8:
+        return PutScalar(*static_cast<const uint8_t*>(obj), false);
+      case PrimitiveType::kInt8:
+        return PutSigned(*static_cast<const int8_t*>(obj));
+      case PrimitiveType::kInt16:
+        return PutSigned(*static_cast<const int16_t*>(obj));
+      case PrimitiveType::kInt32:
+        return PutSigned(*static_cast<const int32_t*>(obj));
+      case PrimitiveType::kInt64:
+        return PutSigned(*static_cast<const int64_t*>(obj));
+      case PrimitiveType::kUInt16:
+        return PutScalar(*static_cast<const uint16_t*>(obj), false);
+      case PrimitiveType::kUInt32:
+        return PutScalar(*static_cast<const uint32_t*>(obj), false);
+      case PrimitiveType::kUInt64:
+        return PutScalar(*static_cast<const uint64_t*>(obj), false);
+      case PrimitiveType::kFloat:
+        return PutFloat(obj);
+      case PrimitiveType::kDouble: {
+        if (quantum_ > 0) {
+          return PutSigned(
+              Quantize(*static_cast<const double*>(obj), quantum_));
+        }
+        uint64_t bits;
+        std::memcpy(&bits, obj, sizeof(bits));
+        return PutScalar(bits, true);
+      }
+      case PrimitiveType::kString: {
+        const auto& value = *static_cast<const std::string*>(obj);
+        current_->AddString()->assign(value);
+        return EncodeString(value);
+      }
+      case PrimitiveType::kNone: {
+        // glm vectors, matrices and quaternions, made of floats only.
+        const char* bytes = static_cast<const char*>(obj);
+        for (size_t i = 0; i < desc->size_; i += sizeof(float)) {
+          PutFloat(bytes + i);
+        }
+        return;
+      }
+    }
+  }
+
+  void PutSigned(int64_t value) {
+    PutScalar(static_cast<uint64_t>(value), false);
+  }
+
+  void PutFloat(const void* obj) {
+    if (quantum_ > 0) {
+      float value;
+      std::memcpy(&value, obj, sizeof(value));
+      return PutSigned(Quantize(value, quantum_));
+    }
+    uint32_t bits;
+    std::memcpy(&bits, obj, sizeof(bits));
+    PutScalar(bits, true);
+  }
+
+  void PutScalar(uint64_t value, bool is_float) {
+    if (cycle_) return;
+    size_t index = current_->scalars.size();
+    bool known = index < last_.scalars.size();
+    uint64_t last = known ? last_.scalars[index] : 0;
+    current_->scalars.push_back(value);
+    uint64_t delta = is_float ? value ^ last : ZigZag(value - last);
+    if (delta == 0 && known) {
+      ++unchanged_;
+      return;
+    }
+    PutVarint(unchanged_, scalar_bytes_);
+    PutVarint(delta, scalar_bytes_);
+    unchanged_ = 0;
+  }
+
+  // Encode string just added to |current_|.
+  void EncodeString(const std::string& value) {
+    size_t index = current_->string_size - 1;
+    if (index < last_.string_size && last_.strings[index] == value) {
+      PutVarint(0, string_bytes_);
+      return;
+    }
+    PutVarint(value.size() + 1, string_bytes_);
+    string_bytes_->append(value);
+  }
+
+  const FrameValues& last_;
+  FrameValues* current_;
+  std::string* scalar_bytes_;
+  std::string* string_bytes_;
+  uint64_t unchanged_{0};
+  // Quantum of floating point values of the current field, 0 if stored as
+  // bits.
+  double quantum_{0.0};
+  // Pointer contents being encoded, from the root down.
+  std::unordered_set<ContentKey, boost::hash<ContentKey>> path_;
+  bool cycle_{false};
+};
+
+// Decode leaf values of a frame into |current|, against |last|, following
+// descriptors only.
+class FrameDecoder {
+ public:
+  FrameDecoder(const FrameValues& last, FrameValues* current,
+               SectionReader scalar_reader, SectionReader string_reader)
+      : last_(last),
+        current_(current),
+        scalar_reader_(scalar_reader),
+        string_reader_(string_reader) {}
+
+  bool Decode(Descriptor* desc) {
+    switch (desc->GetKind()) {
+      case DescriptorKind::kPreDefined:
+        return DecodePreDefined(desc);
+      case DescriptorKind::kEnum:
+        return GetScalar(false);
+      case DescriptorKind::kClass: {
+        auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+        double outer = quantum_;
+        for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+          if (class_desc->HasFieldFlag(i, kMemberTransient)) continue;
+          quantum_ = GetQuantum(class_desc, i, outer);
+          if (!Decode(class_desc->GetDescriptorById(i))) return false;
+        }
+        quantum_ = outer;
+        return true;
+      }
+      case DescriptorKind::kContainer: {
+        auto* container_desc = static_cast<ContainerDescriptor*>(desc);
+        Descriptor* key_desc = container_desc->GetKeyDescriptor();
+        Descriptor* value_desc = container_desc->GetValueDescriptor();
+        uint64_t size = container_desc->GetFixedSize();
+        if (container_desc->GetFixedSize() < 0) {
+          if (!GetScalar(false)) return false;
+          size = current_->scalars.back();
+          if (size > kMaxContainerSize) return false;
+        }
+        for (uint64_t i = 0; i < size; ++i) {
+          if (key_desc != nullptr && !Decode(key_desc)) return false;
+          if (!Decode(value_desc)) return false;
+        }
+        return true;
+      }
+      case DescriptorKind::kSmartPtr: {
+        if (!GetScalar(false)) return false;
+        uint64_t present = current_->scalars.back();
+        if (present > 1) return false;
+        return present == 0 ||
+               Decode(static_cast<SmartPtrDescriptor*>(desc)
+                          ->GetContentDescriptor());
+      }
+      case DescriptorKind::kVariant: {
+        auto* variant_desc = static_cast<VariantDescriptor*>(desc);
+        if (!GetScalar(false)) return false;
+        uint64_t index = current_->scalars.back();
+        if (index > static_cast<uint64_t>(variant_desc->GetAlternativeSize())) {
+          return false;
+        }
+        return index == 0 || Decode(variant_desc->GetAlternativeDescriptor(
+                                 static_cast<int32_t>(index - 1)));
+      }
+      case DescriptorKind::kMessage:
+        return GetString();
+    }
+    return false;
+  }
+
+  // Whether sections were consumed exactly.
+  bool IsEnd() const {
+    return unchanged_ == 0 && scalar_reader_.IsEnd() &&
+           string_reader_.IsEnd();
+  }
+
+ private:
+  bool DecodePreDefined(Descriptor* desc) {
+    switch (desc->GetPrimitiveType()) {
+      case PrimitiveType::kFloat:
+      case PrimitiveType::kDouble:
+        return GetScalar(quantum_ <= 0);
+      case PrimitiveType::kString:
+        return GetString();
+      case PrimitiveType::kNone:
+        for (size_t i = 0; i < desc->size_; i += sizeof(float)) {
+          if (!GetScalar(quantum_ <= 0)) return false;
+        }
+        return true;
+      default:
+        return GetScalar(false);
+    }
+  }
+
+  bool GetScalar(bool is_float) {
+    uint64_t delta = 0;
+    if (unchanged_ == 0 && !changed_pending_) {
+      if (!scalar_reader_.ReadVarint(&unchanged_)) return false;
+      changed_pending_ = true;
+    }
+    size_t index = current_->scalars.size();
+    if (unchanged_ > 0) {
+      // Unchanged scalars repeat the last frame, so that every scalar past
+      // its end takes bytes of this one.
+      if (index >= last_.scalars.size()) return false;
+      --unchanged_;
+    } else {
+      if (!scalar_reader_.ReadVarint(&delta)) return false;
+      changed_pending_ = false;
+    }
+    uint64_t last = index < last_.scalars.size() ? last_.scalars[index] : 0;
+    current_->scalars.push_back(is_float ? delta ^ last
+                                         : last + UnZigZag(delta));
+    return true;
+  }
+
+  bool GetString() {
+    uint64_t tag = 0;
+    if (!string_reader_.ReadVarint(&tag)) return false;
+    size_t index = current_->string_size;
+    std::string* value = current_->AddString();
+    if (tag == 0) {
+      if (index >= last_.string_size) return false;
+      value->assign(last_.strings[index]);
+      return true;
+    }
+    return string_reader_.ReadBytes(tag - 1, value);
+  }
+
+  const FrameValues& last_;
+  FrameValues* current_;
+  SectionReader scalar_reader_;
+  SectionReader string_reader_;
+  // Unchanged scalars left in the current run, and whether a changed one
+  // follows the run.
+  uint64_t unchanged_{0};
+  bool changed_pending_{false};
+  // See FrameEncoder.
+  double quantum_{0.0};
+};
+
+// Key or set value of a scalar, enum or string type built out of place.
+struct KeyBuffer {
+  alignas(8) char scalar[8];
+  std::string string;
+};
+
+// Restore an object from decoded leaf values.
+class FrameBuilder {
+ public:
+  explicit FrameBuilder(const FrameValues& values) : values_(values) {}
+
+  bool Build(void* obj, Descriptor* desc) {
+    switch (desc->GetKind()) {
+      case DescriptorKind::kPreDefined:
+        return BuildPreDefined(obj, desc);
+      case DescriptorKind::kEnum:
+        return static_cast<EnumDescriptor*>(desc)->SetValue(
+            obj, static_cast<int64_t>(NextScalar()));
+      case DescriptorKind::kClass: {
+        auto* class_desc = ClassDescriptor::ToClassDescriptor(desc);
+        char* bytes = static_cast<char*>(obj);
+        double outer = quantum_;
+        for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+          if (class_desc->HasFieldFlag(i, kMemberTransient)) continue;
+          quantum_ = GetQuantum(class_desc, i, outer);
+          if (!Build(bytes + class_desc->GetFieldOffset(i),
+                     class_desc->GetDescriptorById(i))) {
+            return false;
+          }
+        }
+        quantum_ = outer;
+        return true;
+      }
+      case DescriptorKind::kContainer:
+        return BuildContainer(obj, static_cast<ContainerDescriptor*>(desc));
+      case DescriptorKind::kSmartPtr: {
+        auto* ptr_desc = static_cast<SmartPtrDescriptor*>(desc);
+        if (NextScalar() == 0) return ptr_desc->Reset(obj);
+        // Content of shared pointers may be held elsewhere, so it is
+        // replaced rather than overwritten.
+        void* content = ptr_desc->IsSharedOwnership()
+                            ? nullptr
+                            : ptr_desc->GetMutableRawPtr(obj);
+        if (content == nullptr) content = ptr_desc->EmplaceContent(obj);
+        return content != nullptr &&
+               Build(content, ptr_desc->GetContentDescriptor());
+      }
+      case DescriptorKind::kVariant: {
+        auto* variant_desc = static_cast<VariantDescriptor*>(desc);
+        int32_t index = static_cast<int32_t>(NextScalar()) - 1;
+        if (index < 0) return variant_desc->GetIndex(obj) < 0;
+        void* value = variant_desc->GetIndex(obj) == index
+                          ? variant_desc->MutableActiveValue(obj)
+                          : variant_desc->EmplaceAlternative(obj, index);
+        return value != nullptr &&
+               Build(value, variant_desc->GetAlternativeDescriptor(index));
+      }
+      case DescriptorKind::kMessage:
+        return MessageDescriptor::ToMessage(obj)->ParseFromString(
+            NextString());
+    }
+    return false;
+  }
+
+ private:
+  bool BuildPreDefined(void* obj, Descriptor* desc) {
+    switch (desc->GetPrimitiveType()) {
+      case PrimitiveType::kBool:
+        *static_cast<bool*>(obj) = NextScalar() != 0;
+        return true;
+      case PrimitiveType::kChar:
+      case PrimitiveType::kUInt8:
+        *static_cast<uint8_t*>(obj) = static_cast<uint8_t>(NextScalar());
+        return true;
+      case PrimitiveType::kInt8:
+        *static_cast<int8_t*>(obj) = static_cast<int8_t>(NextScalar());
+        return true;
+      case PrimitiveType::kInt16:
+        *static_cast<int16_t*>(obj) = static_cast<int16_t>(NextScalar());
+        return true;
+      case PrimitiveType::kInt32:
+        *static_cast<int32_t*>(obj) = static_cast<int32_t>(NextScalar());
+        return true;
+      case PrimitiveType::kInt64:
+        *static_cast<int64_t*>(obj) = static_cast<int64_t>(NextScalar());
+        return true;
+      case PrimitiveType::kUInt16:
+        *static_cast<uint16_t*>(obj) = static_cast<uint16_t>(NextScalar());
+        return true;
+      case PrimitiveType::kUInt32:
+        *static_cast<uint32_t*>(obj) = static_cast<uint32_t>(NextScalar());
+        return true;
+      case PrimitiveType::kUInt64:
+        *static_cast<uint64_t*>(obj) = NextScalar();
+        return true;
+      case PrimitiveType::kFloat:
+        NextFloat(obj);
+        return true;
+      case PrimitiveType::kDouble: {
+        if (quantum_ > 0) {
+          *static_cast<double*>(obj) = NextQuantized();
+          return true;
+        }
+        uint64_t bits = NextScalar();
+        std::memcpy(obj, &bits, sizeof(bits));
+        return true;
+      }
+      case PrimitiveType::kString:
+        static_cast<std::string*>(obj)->assign(NextString());
+        return true;
+      case PrimitiveType::kNone: {
+        char* bytes = static_cast<char*>(obj);
+        for (size_t i = 0; i < desc->size_; i += sizeof(float)) {
+          NextFloat(bytes + i);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool BuildContainer(void* obj, ContainerDescriptor* desc) {
+    Descriptor* key_desc = desc->GetKeyDescriptor();
+    Descriptor* value_desc = desc->GetValueDescriptor();
+    int64_t fixed_size = desc->GetFixedSize();
+    if (fixed_size >= 0) {
+      for (int64_t i = 0; i < fixed_size; ++i) {
+        void* value = desc->MutableValueByIndex(obj, i);
+        if (value == nullptr || !Build(value, value_desc)) return false;
+      }
+      return true;
+    }
+    uint64_t size = NextScalar();
+    desc->Clear(obj);
+    if (size == 0) return true;
+    KeyBuffer key;
+    if (key_desc != nullptr) {
+      for (uint64_t i = 0; i < size; ++i) {
+        void* key_ptr = BuildKey(key_desc, &key);
+        void* value =
+            key_ptr == nullptr ? nullptr : desc->EmplaceByKey(obj, key_ptr);
+        if (value == nullptr || !Build(value, value_desc)) return false;
+      }
+      return true;
+    }
+    desc->Reserve(obj, size);
+    for (uint64_t i = 0; i < size; ++i) {
+      void* value = desc->EmplaceDefault(obj);
+      if (value != nullptr) {
+        if (!Build(value, value_desc)) return false;
+        continue;
+      }
+      // Sets.
+      value = BuildKey(value_desc, &key);
+      if (value == nullptr || !desc->AddValue(obj, value)) return false;
+    }
+    return true;
+  }
+
+  void* BuildKey(Descriptor* desc, KeyBuffer* key) {
+    if (desc->GetPrimitiveType() == PrimitiveType::kString) {
+      key->string.assign(NextString());
+      return &key->string;
+    }
+    if (desc->GetPrimitiveType() == PrimitiveType::kNone ||
+        desc->size_ > sizeof(key->scalar) || !Build(key->scalar, desc)) {
+      return nullptr;
+    }
+    return key->scalar;
+  }
+
+  uint64_t NextScalar() { return values_.scalars[scalar_pos_++]; }
+
+  void NextFloat(void* obj) {
+    if (quantum_ > 0) {
+      float value = static_cast<float>(NextQuantized());
+      std::memcpy(obj, &value, sizeof(value));
+      return;
+    }
+    uint32_t bits = static_cast<uint32_t>(NextScalar());
+    std::memcpy(obj, &bits, sizeof(bits));
+  }
+
+  double NextQuantized() {
+    return static_cast<int64_t>(NextScalar()) * quantum_;
+  }
+
+  const std::string& NextString() { return values_.strings[string_pos_++]; }
+
+  const FrameValues& values_;
+  size_t scalar_pos_{0};
+  size_t string_pos_{0};
+  // See FrameEncoder.
+  double quantum_{0.0};
+};
+
+}  // namespace
+
+struct ReplayLogWriter::FrameState : public FrameValues {};
+
+struct ReplayLogReader::FrameState : public FrameValues {};
+
+/* ReplayLogWriter methods */
+
+ReplayLogWriter::ReplayLogWriter(Descriptor* desc, std::ostream* out,
+                                 const ReplayLogOptions& options)
+    : desc_(desc),
+      out_(out),
+      options_(options),
+      last_(new FrameState),
+      current_(new FrameState) {
+  if (desc_ == nullptr || out_ == nullptr) {
+    Fail("no descriptor or stream");
+    return;
+  }
+  std::unordered_set<Descriptor*> visited;
+  if (!CheckKeys(desc_, &visited, &error_)) return;
+  if (options_.keyframe_interval == 0) options_.keyframe_interval = 1;
+  uint64_t fingerprint = GetFingerprint(desc_);
+  Write(kMagic, sizeof(kMagic));
+  Write(&kVersion, sizeof(kVersion));
+  Write(&fingerprint, sizeof(fingerprint));
+  Write(&options_.keyframe_interval, sizeof(options_.keyframe_interval));
+  valid_ = out_->good() || Fail("failed to write stream");
+}
+
+ReplayLogWriter::~ReplayLogWriter() {
+  if (valid_ && !finished_) Finish();
+}
+
+bool ReplayLogWriter::Append(const void* obj, int64_t timestamp_ns) {
+  if (!valid_ || finished_) return Fail("log is invalid or finished");
+  bool keyframe = frames_.size() % options_.keyframe_interval == 0;
+  current_->Clear();
+  scalar_bytes_.clear();
+  string_bytes_.clear();
+  FrameEncoder encoder(keyframe ? GetEmptyValues() : *last_, current_.get(),
+                       &scalar_bytes_, &string_bytes_);
+  encoder.Encode(obj, desc_);
+  if (encoder.HasCycle()) {
+    return Fail("pointer cycle in " + desc_->GetTypeName());
+  }
+  encoder.Finish();
+  last_.swap(current_);
+
+  frames_.push_back(ReplayFrame{offset_, timestamp_ns, keyframe});
+  uint8_t kind = keyframe ? 1 : 0;
+  uint32_t scalar_size = static_cast<uint32_t>(scalar_bytes_.size());
+  uint32_t string_size = static_cast<uint32_t>(string_bytes_.size());
+  char header[kFrameHeaderSize];
+  char* pos = PutBytes(&kind, sizeof(kind), header);
+  pos = PutBytes(&timestamp_ns, sizeof(timestamp_ns), pos);
+  pos = PutBytes(&scalar_size, sizeof(scalar_size), pos);
+  PutBytes(&string_size, sizeof(string_size), pos);
+  Write(header, sizeof(header));
+  Write(scalar_bytes_.data(), scalar_bytes_.size());
+  Write(string_bytes_.data(), string_bytes_.size());
+  return out_->good() || Fail("failed to write stream");
+}
+
+bool ReplayLogWriter::Finish() {
+  if (!valid_ || finished_) return Fail("log is invalid or finished");
+  finished_ = true;
+  uint64_t index_offset = offset_;
+  uint64_t frame_size = frames_.size();
+  Write(&frame_size, sizeof(frame_size));
+  for (const auto& frame : frames_) {
+    uint8_t kind = frame.keyframe ? 1 : 0;
+    Write(&frame.offset, sizeof(frame.offset));
+    Write(&frame.timestamp_ns, sizeof(frame.timestamp_ns));
+    Write(&kind, sizeof(kind));
+  }
+  Write(&index_offset, sizeof(index_offset));
+  Write(kMagic, sizeof(kMagic));
+  out_->flush();
+  return out_->good() || Fail("failed to write stream");
+}
+
+bool ReplayLogWriter::Fail(const std::string& error) {
+  error_ = error;
+  return false;
+}
+
+void ReplayLogWriter::Write(const void* data, size_t size) {
+  out_->write(static_cast<const char*>(data), size);
+  offset_ += size;
+}
+
+/* ReplayLogReader methods */
+
+ReplayLogReader::ReplayLogReader(Descriptor* desc, std::istream* in)
+    : desc_(desc),
+      in_(in),
+      state_(new FrameState),
+      scratch_(new FrameState) {
+  valid_ = ReadIndex();
+}
+
+ReplayLogReader::~ReplayLogReader() {}
+
+bool ReplayLogReader::ReadIndex() {
+  if (desc_ == nullptr || in_ == nullptr) {
+    return Fail("no descriptor or stream");
+  }
+  in_->seekg(0, std::ios::end);
+  auto end = in_->tellg();
+  if (end < 0) return Fail("stream is not seekable");
+  uint64_t file_size = static_cast<uint64_t>(end);
+  if (file_size < kHeaderSize) return Fail("file too small");
+
+  char header[kHeaderSize];
+  in_->seekg(0);
+  in_->read(header, sizeof(header));
+  if (!in_->good()) return Fail("failed to read stream");
+  uint32_t version = 0;
+  uint64_t fingerprint = 0;
+  std::memcpy(&version, header + sizeof(kMagic), sizeof(version));
+  std::memcpy(&fingerprint, header + sizeof(kMagic) + sizeof(version),
+              sizeof(fingerprint));
+  if (std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+    return Fail("not a replay log");
+  }
+  if (version != kVersion) return Fail("unsupported version");
+  if (fingerprint != GetFingerprint(desc_)) {
+    return Fail("log was not recorded from " + desc_->GetTypeName());
+  }
+
+  // Read index if the log was finished, otherwise scan frames.
+  uint64_t index_offset = 0;
+  if (file_size >= kHeaderSize + kTrailerSize) {
+    char trailer[kTrailerSize];
+    in_->seekg(file_size - kTrailerSize);
+    in_->read(trailer, sizeof(trailer));
+    if (!in_->good()) return Fail("failed to read stream");
+    if (std::memcmp(trailer + sizeof(uint64_t), kMagic, sizeof(kMagic)) == 0) {
+      std::memcpy(&index_offset, trailer, sizeof(index_offset));
+    }
+  }
+  if (index_offset < kHeaderSize ||
+      index_offset > file_size - kTrailerSize - sizeof(uint64_t)) {
+    return ScanFrames(kHeaderSize, file_size);
+  }
+  uint64_t frame_size = 0;
+  in_->seekg(index_offset);
+  in_->read(reinterpret_cast<char*>(&frame_size), sizeof(frame_size));
+  const size_t entry_size = sizeof(uint64_t) + sizeof(int64_t) + 1;
+  uint64_t index_size = file_size - kTrailerSize - index_offset;
+  if (!in_->good() || (index_size - sizeof(frame_size)) / entry_size !=
+                          frame_size ||
+      (index_size - sizeof(frame_size)) % entry_size != 0) {
+    return Fail("corrupted index");
+  }
+  buffer_.resize(frame_size * entry_size);
+  in_->read(&buffer_[0], buffer_.size());
+  if (!in_->good()) return Fail("failed to read stream");
+  frames_.resize(frame_size);
+  for (uint64_t i = 0; i < frame_size; ++i) {
+    const char* entry = buffer_.data() + i * entry_size;
+    ReplayFrame& frame = frames_[i];
+    std::memcpy(&frame.offset, entry, sizeof(frame.offset));
+    std::memcpy(&frame.timestamp_ns, entry + sizeof(frame.offset),
+                sizeof(frame.timestamp_ns));
+    frame.keyframe = entry[entry_size - 1] != 0;
+    uint64_t begin = i == 0 ? kHeaderSize : frames_[i - 1].offset;
+    if (frame.offset < begin || frame.offset > index_offset ||
+        (i == 0 && (frame.offset != kHeaderSize || !frame.keyframe))) {
+      return Fail("corrupted index");
+    }
+  }
+  frames_end_ = index_offset;
+  return true;
+}
+
+bool ReplayLogReader::ScanFrames(uint64_t begin, uint64_t end) {
+  uint64_t offset = begin;
+  char header[kFrameHeaderSize];
+  while (end - offset >= kFrameHeaderSize) {
+    in_->seekg(offset);
+    in_->read(header, sizeof(header));
+    if (!in_->good()) return Fail("failed to read stream");
+    ReplayFrame frame{offset, 0, header[0] == 1};
+    uint32_t scalar_size = 0, string_size = 0;
+    std::memcpy(&frame.timestamp_ns, header + 1, sizeof(frame.timestamp_ns));
+    std::memcpy(&scalar_size, header + 9, sizeof(scalar_size));
+    std::memcpy(&string_size, header + 13, sizeof(string_size));
+    uint64_t frame_end = offset + kFrameHeaderSize + scalar_size + string_size;
+    if (static_cast<uint8_t>(header[0]) > 1 || frame_end > end ||
+        (frames_.empty() && !frame.keyframe)) {
+      break;
+    }
+    frames_.push_back(frame);
+    offset = frame_end;
+  }
+  frames_end_ = offset;
+  in_->clear();
+  return true;
+}
+
+bool ReplayLogReader::Seek(size_t frame) {
+  if (!valid_ || frame > frames_.size()) return false;
+  position_ = frame;
+  return true;
+}
+
+bool ReplayLogReader::SeekToTime(int64_t timestamp_ns) {
+  auto it = std::lower_bound(frames_.begin(), frames_.end(), timestamp_ns,
+                             [](const ReplayFrame& frame, int64_t timestamp) {
+                               return frame.timestamp_ns < timestamp;
+                             });
+  return Seek(it - frames_.begin());
+}
+
+bool ReplayLogReader::Next(void* obj, int64_t* timestamp_ns) {
+  if (!valid_ || position_ >= frames_.size()) return false;
+  // Decode frames from the keyframe before, unless the previous frame is
+  // decoded already.
+  if (decoded_ != position_ + 1) {
+    size_t begin = position_;
+    while (!frames_[begin].keyframe) --begin;
+    if (decoded_ > begin && decoded_ <= position_) begin = decoded_;
+    for (size_t frame = begin; frame <= position_; ++frame) {
+      if (!DecodeFrame(frame)) return false;
+    }
+  }
+  if (!FrameBuilder(*state_).Build(obj, desc_)) {
+    return Fail("failed to restore frame");
+  }
+  if (timestamp_ns != nullptr) *timestamp_ns = frames_[position_].timestamp_ns;
+  ++position_;
+  return true;
+}
+
+bool ReplayLogReader::DecodeFrame(size_t frame) {
+  const ReplayFrame& entry = frames_[frame];
+  uint64_t end =
+      frame + 1 < frames_.size() ? frames_[frame + 1].offset : frames_end_;
+  buffer_.resize(end - entry.offset);
+  in_->seekg(entry.offset);
+  in_->read(&buffer_[0], buffer_.size());
+  if (!in_->good() || buffer_.size() < kFrameHeaderSize) {
+    in_->clear();
+    decoded_ = 0;
+    return Fail("failed to read frame");
+  }
+  uint32_t scalar_size = 0;
+  std::memcpy(&scalar_size, buffer_.data() + 9, sizeof(scalar_size));
+  size_t payload_size = buffer_.size() - kFrameHeaderSize;
+  if (scalar_size > payload_size) {
+    decoded_ = 0;
+    return Fail("corrupted frame");
+  }
+  scratch_->Clear();
+  const char* payload = buffer_.data() + kFrameHeaderSize;
+  FrameDecoder decoder(
+      entry.keyframe ? GetEmptyValues() : *state_, scratch_.get(),
+      SectionReader(payload, scalar_size),
+      SectionReader(payload + scalar_size, payload_size - scalar_size));
+  if (!decoder.Decode(desc_) || !decoder.IsEnd()) {
+    decoded_ = 0;
+    return Fail("corrupted frame");
+  }
+  state_.swap(scratch_);
+  decoded_ = frame + 1;
+  return true;
+}
+
+bool ReplayLogReader::Fail(const std::string& error) {
+  error_ = error;
+  return false;
+}
+
+}  // namespace reflection
@@ -0,0 +1,197 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * Record and replay of a stream of reflected objects of one type, e.g. state
+ * recorded every cycle for debugging.
+ *
+ * A frame is the sequence of leaf values of an object in descriptor order:
+ * scalars (integers, floating point numbers, enums, components of glm types,
+ * sizes of containers, presence of pointers, indices of variants) and strings
+ * (strings and serialized protobuf messages). Keyframes store every value.
+ * Other frames store every value against the one at the same position in the
+ * previous frame: integers as zigzag differences, floating point numbers as
+ * XOR of their bits, both varint encoded with runs of unchanged values
+ * collapsed, and strings as a single byte if unchanged. Frames of slowly
+ * changing objects thus take a few bytes per changed field.
+ *
+ * File layout, all integers in native byte order:
+ *   magic "SSRL", version (uint32), fingerprint of the recorded class (see
+ *   ClassDescriptor::GetFingerprint(), 0 for other types), keyframe interval
+ *   frames: kind (uint8, 1 for keyframes), timestamp (int64), sizes of
+ *           scalar and string sections (uint32), sections
+ *   index: frame count, then offset (uint64), timestamp and kind of every
+ *          frame
+ *   index offset (uint64) and magic "SSRL"
+ * A log without index, e.g. cut short by a crash, is indexed by scanning its
+ * complete frames when read.
+ *
+ * Members annotated kMemberTransient are not recorded and left untouched on
+ * replay. Floating point values under members annotated kMemberQuantized are
+ * recorded as integer multiples of their quantum, so small changes below it
+ * take no space.
+ *
+ * Shared pointers are recorded by value, so content reached through several
+ * of them is restored as separate copies, and objects with pointer cycles are
+ * refused. Keys of maps and values of sets must be scalars, enums or strings.
+ *
+ * Usage:
+ *   std::ofstream out("state.ssrl", std::ios::binary);
+ *   ReplayLogWriter writer(DESC("State"), &out);
+ *   writer.Append(&state, timestamp_ns);
+ *   ...
+ *   writer.Finish();
+ *
+ *   std::ifstream in("state.ssrl", std::ios::binary);
+ *   ReplayLogReader reader(DESC("State"), &in);
+ *   reader.Seek(1000);
+ *   while (reader.Next(&state)) Replay(state);
+ */
+
+struct ReplayLogOptions {
+  // Every |keyframe_interval|-th frame is a keyframe, starting with the
+  // first. Readers seek to a frame by decoding frames from the keyframe
+  // before it.
+  uint32_t keyframe_interval{100};
+};
+
+// Index entry of a frame.
+struct ReplayFrame {
+  // Byte offset of frame header in log.
+  uint64_t offset;
+  int64_t timestamp_ns;
+  bool keyframe;
+};
+
+class ReplayLogWriter {
+ public:
+  // Write header of a log of objects described by |desc| to |out|, which must
+  // outlive the writer. Check IsValid() afterwards.
+  ReplayLogWriter(Descriptor* desc, std::ostream* out,
+                  const ReplayLogOptions& options = ReplayLogOptions());
+
+  // Finish() if not done yet.
+  ~ReplayLogWriter();
+
+  ReplayLogWriter(const ReplayLogWriter&) = delete;
+  ReplayLogWriter& operator=(const ReplayLogWriter&) = delete;
+
+  bool IsValid() const { return valid_; }
+
+  // Append |obj| as the next frame. Return false on stream failure, if |obj|
+  // holds a pointer cycle, in which case nothing is written, or if the log is
+  // finished, see GetError().
+  bool Append(const void* obj, int64_t timestamp_ns = 0);
+
+  // Write index and trailer. Return false on stream failure.
+  bool Finish();
+
+  size_t GetFrameSize() const { return frames_.size(); }
+
+  // Get bytes written so far, header included.
+  uint64_t GetOffset() const { return offset_; }
+
+  const std::string& GetError() const { return error_; }
+
+ private:
+  struct FrameState;
+
+  bool Fail(const std::string& error);
+
+  void Write(const void* data, size_t size);
+
+  Descriptor* desc_;
+  std::ostream* out_;
+  ReplayLogOptions options_;
+  bool valid_{false};
+  bool finished_{false};
+  uint64_t offset_{0};
+  std::vector<ReplayFrame> frames_;
+  // Values of the last frame, and of the frame being written.
+  std::unique_ptr<FrameState> last_;
+  std::unique_ptr<FrameState> current_;
+  std::string scalar_bytes_;
+  std::string string_bytes_;
+  std::string error_;
+};
+
+class ReplayLogReader {
+ public:
+  // Read header and index of |in|, which must be seekable and outlive the
+  // reader, as a log of objects described by |desc|. Check IsValid()
+  // afterwards.
+  ReplayLogReader(Descriptor* desc, std::istream* in);
+
+  ~ReplayLogReader();
+
+  ReplayLogReader(const ReplayLogReader&) = delete;
+  ReplayLogReader& operator=(const ReplayLogReader&) = delete;
+
+  bool IsValid() const { return valid_; }
+
+  size_t GetFrameSize() const { return frames_.size(); }
+
+  const std::vector<ReplayFrame>& GetFrames() const { return frames_; }
+
+  // Get index of the frame read by the next Next().
+  size_t GetPosition() const { return position_; }
+
+  // Make |frame| the next frame to read. Nothing is decoded until Next().
+  // Return false if |frame| is beyond the last frame.
+  bool Seek(size_t frame);
+
+  // Seek to the first frame with timestamp not before |timestamp_ns|,
+  // assuming timestamps don't decrease.
+  bool SeekToTime(int64_t timestamp_ns);
+
+  // Restore the next frame into |obj|, whose fields are overwritten, and
+  // advance. Frames are decoded on top of the previous one when read in
+  // order, otherwise from the keyframe before. Return false at end of log,
+  // or if data is corrupted or can't be restored, see GetError().
+  bool Next(void* obj, int64_t* timestamp_ns = nullptr);
+
+  const std::string& GetError() const { return error_; }
+
+ private:
+  struct FrameState;
+
+  bool ReadIndex();
+
+  // Index frames between |begin| and |end| by their headers, stopping at the
+  // first incomplete one.
+  bool ScanFrames(uint64_t begin, uint64_t end);
+
+  // Decode |frame| into |state_|, which holds the frame before unless
+  // |frame| is a keyframe.
+  bool DecodeFrame(size_t frame);
+
+  bool Fail(const std::string& error);
+
+  Descriptor* desc_;
+  std::istream* in_;
+  bool valid_{false};
+  std::vector<ReplayFrame> frames_;
+  // Offset where frames end, i.e. of index if any.
+  uint64_t frames_end_{0};
+  size_t position_{0};
+  // Number of the frame |state_| holds plus one, 0 if none.
+  size_t decoded_{0};
+  std::unique_ptr<FrameState> state_;
+  std::unique_ptr<FrameState> scratch_;
+  std::string buffer_;
+  std::string error_;
+};
+
+}  // namespace reflection
@@ -0,0 +1,565 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/row_filter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+#include "src/columnar.h"
+
+namespace reflection {
+
+namespace {
+
+const size_t kWordBits = 64;
+const size_t kBlockWords = RowFilter::kBlockSize / kWordBits;
+const double kTwoPow63 = 9223372036854775808.0;
+const double kTwoPow64 = 18446744073709551616.0;
+
+enum class CompareOp : uint8_t { kEq, kNe, kLt, kLe, kGt, kGe };
+
+bool SetError(std::string* error, const std::string& expression,
+              const std::string& reason) {
+  if (error != nullptr) {
+    *error =
+        StringUtil::Concat("invalid filter \"", expression, "\": ", reason);
+  }
+  return false;
+}
+
+std::string Trim(const std::string& text) {
+  size_t begin = text.find_first_not_of(" \t\n");
+  if (begin == std::string::npos) return std::string();
+  size_t end = text.find_last_not_of(" \t\n");
+  return text.substr(begin, end - begin + 1);
+}
+
+// Call |visitor| with position of every character of |text| outside quotes
+// and brackets, until it returns false.
+template <typename Visitor>
+void ForEachTopLevelChar(const std::string& text, const Visitor& visitor) {
+  char quote = 0;
+  int32_t depth = 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if (quote != 0) {
+      if (c == '\\') {
+        ++i;
+      } else if (c == quote) {
+        quote = 0;
+      }
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '[') {
+      ++depth;
+    } else if (c == ']') {
+      --depth;
+    } else if (depth == 0 && !visitor(i)) {
+      return;
+    }
+  }
+}
+
+std::vector<std::string> SplitTerms(const std::string& expression) {
+  std::vector<std::string> terms;
+  size_t begin = 0;
+  ForEachTopLevelChar(expression, [&](size_t i) {
+    if (expression.compare(i, 2, "&&") == 0) {
+      terms.push_back(Trim(expression.substr(begin, i - begin)));
+      begin = i + 2;
+    }
+    return true;
+  });
+  terms.push_back(Trim(expression.substr(begin)));
+  return terms;
+}
+
+// Split |term| at its comparison operator.
+bool SplitTerm(const std::string& term, std::string* path, CompareOp* op,
+               std::string* literal) {
+  size_t op_pos = std::string::npos;
+  size_t op_size = 0;
+  ForEachTopLevelChar(term, [&](size_t i) {
+    char c = term[i];
+    char next = i + 1 < term.size() ? term[i + 1] : 0;
+    if ((c == '=' || c == '!') && next == '=') {
+      *op = c == '=' ? CompareOp::kEq : CompareOp::kNe;
+      op_size = 2;
+    } else if (c == '<' || c == '>') {
+      op_size = next == '=' ? 2 : 1;
+      if (c == '<') {
+        *op = op_size == 2 ? CompareOp::kLe : CompareOp::kLt;
+      } else {
+        *op = op_size == 2 ? CompareOp::kGe : CompareOp::kGt;
+      }
+    } else {
+      return true;
+    }
+    op_pos = i;
+    return false;
+  });
+  if (op_pos == std::string::npos) return false;
+  *path = Trim(term.substr(0, op_pos));
+  *literal = Trim(term.substr(op_pos + op_size));
+  return !path->empty() && !literal->empty();
+}
+
+bool ParseString(const std::string& text, std::string* value) {
+  if (text.size() < 2 || (text.front() != '"' && text.front() != '\'') ||
+      text.back() != text.front()) {
+    return false;
+  }
+  value->clear();
+  for (size_t i = 1; i + 1 < text.size(); ++i) {
+    if (text[i] == '\\' && i + 2 < text.size()) ++i;
+    value->push_back(text[i]);
+  }
+  return true;
+}
+
+// A number literal, either an integer as sign and magnitude, or a double.
+struct Number {
+  bool is_integer;
+  bool negative;
+  uint64_t magnitude;
+  double value;
+};
+
+bool ParseNumber(const std::string& text, Number* number) {
+  if (text == "true" || text == "false") {
+    *number = Number{true, false, text == "true", text == "true" ? 1.0 : 0.0};
+    return true;
+  }
+  errno = 0;
+  char* end = nullptr;
+  if (text.find_first_of(".eEnN") == std::string::npos) {
+    bool negative = text[0] == '-';
+    uint64_t magnitude =
+        std::strtoull(text.c_str() + (negative ? 1 : 0), &end, 10);
+    if (errno == 0 && end == text.c_str() + text.size() &&
+        text[negative ? 1 : 0] != '-' && text[negative ? 1 : 0] != '+') {
+      double value = static_cast<double>(magnitude);
+      *number = Number{true, negative, magnitude, negative ? -value : value};
+      return true;
+    }
+    errno = 0;
+  }
+  double value = std::strtod(text.c_str(), &end);
+  if (errno != 0 || end != text.c_str() + text.size()) return false;
+  *number = Number{false, false, 0, value};
+  return true;
+}
+
+bool ParseEnumName(const Descriptor* desc, const std::string& text,
+                   Number* number) {
+  if (!desc->IsEnum()) return false;
+  auto* enum_desc = static_cast<const EnumDescriptor*>(desc);
+  for (const auto& value_name : enum_desc->GetValueNames()) {
+    if (value_name.name != text) continue;
+    uint64_t magnitude = value_name.value < 0
+                             ? 0 - static_cast<uint64_t>(value_name.value)
+                             : static_cast<uint64_t>(value_name.value);
+    *number = Number{true, value_name.value < 0, magnitude,
+                     static_cast<double>(value_name.value)};
+    return true;
+  }
+  return false;
+}
+
+template <typename Lhs, typename Rhs>
+bool Apply(CompareOp op, const Lhs& lhs, const Rhs& rhs) {
+  switch (op) {
+    case CompareOp::kEq:
+      return lhs == rhs;
+    case CompareOp::kNe:
+      return lhs != rhs;
+    case CompareOp::kLt:
+      return lhs < rhs;
+    case CompareOp::kLe:
+      return lhs <= rhs;
+    case CompareOp::kGt:
+      return lhs > rhs;
+    case CompareOp::kGe:
+      return lhs >= rhs;
+  }
+  return false;
+}
+
+// Pack 64 bytes of 0 or 1 into bits, byte i into bit i. Each multiplication
+// gathers the low bits of 8 bytes into the top byte.
+uint64_t PackBits(const uint8_t* mask) {
+  uint64_t bits = 0;
+  for (size_t i = 0; i < kWordBits / 8; ++i) {
+    uint64_t bytes;
+    memcpy(&bytes, mask + i * 8, sizeof(bytes));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bytes = __builtin_bswap64(bytes);
+#endif
+    bits |= ((bytes * 0x0102040810204080ull) >> 56) << (i * 8);
+  }
+  return bits;
+}
+
+// And comparisons of gathered |values| into |bitmap|, skipping words already
+// cleared. |values| are padded to whole words, so that the inner loop has a
+// fixed trip count and no branches, and is vectorized. Bits of padding are
+// already cleared.
+template <typename T, typename Op>
+void CompareColumn(const T* values, size_t count, T literal, Op op,
+                   uint64_t* bitmap) {
+  uint8_t mask[kWordBits];
+  for (size_t word = 0; word * kWordBits < count; ++word) {
+    if (bitmap[word] == 0) continue;
+    const T* word_values = values + word * kWordBits;
+    for (size_t i = 0; i < kWordBits; ++i) {
+      mask[i] = op(word_values[i], literal);
+    }
+    bitmap[word] &= PackBits(mask);
+  }
+}
+
+template <typename T>
+void CompareColumn(CompareOp op, const T* values, size_t count, T literal,
+                   uint64_t* bitmap) {
+  switch (op) {
+    case CompareOp::kEq:
+      return CompareColumn(values, count, literal, std::equal_to<T>(), bitmap);
+    case CompareOp::kNe:
+      return CompareColumn(values, count, literal, std::not_equal_to<T>(),
+                           bitmap);
+    case CompareOp::kLt:
+      return CompareColumn(values, count, literal, std::less<T>(), bitmap);
+    case CompareOp::kLe:
+      return CompareColumn(values, count, literal, std::less_equal<T>(),
+                           bitmap);
+    case CompareOp::kGt:
+      return CompareColumn(values, count, literal, std::greater<T>(), bitmap);
+    case CompareOp::kGe:
+      return CompareColumn(values, count, literal, std::greater_equal<T>(),
+                           bitmap);
+  }
+}
+
+bool IsBlockEmpty(const uint64_t* bitmap, size_t words) {
+  for (size_t word = 0; word < words; ++word) {
+    if (bitmap[word] != 0) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+/* RowFilter::Term methods */
+
+struct RowFilter::Term {
+  std::unique_ptr<FieldPath> path;
+  PrimitiveType type;
+  size_t width;
+  CompareOp op;
+  // Result of comparisons folded at compile time: -1 if not folded, else 0 or
+  // 1 for every row.
+  int32_t constant{-1};
+  // Literal of integer, floating point and string fields.
+  int64_t int_value{0};
+  uint64_t uint_value{0};
+  double float_value{0};
+  std::string string_value;
+
+  // Bind |number| to an integer field of type |T|. Non-integers are rounded
+  // toward rows that satisfy the comparison, and literals out of range of
+  // |T| fold the comparison.
+  template <typename T>
+  void BindInteger(Number number) {
+    if (!number.is_integer) {
+      double value = number.value;
+      if (std::isnan(value)) {
+        constant = op == CompareOp::kNe;
+        return;
+      }
+      if (value != std::floor(value)) {
+        if (op == CompareOp::kEq || op == CompareOp::kNe) {
+          constant = op == CompareOp::kNe;
+          return;
+        }
+        value = op == CompareOp::kLt || op == CompareOp::kGe
+                    ? std::ceil(value)
+                    : std::floor(value);
+      }
+      number.negative = value < 0;
+      double magnitude = std::fabs(value);
+      number.magnitude = magnitude >= kTwoPow64
+                             ? std::numeric_limits<uint64_t>::max()
+                             : static_cast<uint64_t>(magnitude);
+      if (number.negative && magnitude > kTwoPow63) {
+        number.magnitude = std::numeric_limits<uint64_t>::max();
+      }
+    }
+    const int64_t min = std::numeric_limits<T>::min();
+    const uint64_t max = std::numeric_limits<T>::max();
+    const uint64_t min_magnitude = 0 - static_cast<uint64_t>(min);
+    bool below = number.negative && number.magnitude > min_magnitude;
+    bool above = !number.negative && number.magnitude > max;
+    if (below || above) {
+      switch (op) {
+        case CompareOp::kEq:
+          constant = 0;
+          break;
+        case CompareOp::kNe:
+          constant = 1;
+          break;
+        case CompareOp::kLt:
+        case CompareOp::kLe:
+          constant = above;
+          break;
+        case CompareOp::kGt:
+        case CompareOp::kGe:
+          constant = below;
+          break;
+      }
+      return;
+    }
+    if (number.negative) {
+      int_value = static_cast<int64_t>(0 - number.magnitude);
+    } else {
+      int_value = static_cast<int64_t>(number.magnitude);
+      uint_value = number.magnitude;
+    }
+  }
+
+  template <typename T>
+  T GetLiteral() const {
+    return std::is_signed<T>::value ? static_cast<T>(int_value)
+                                    : static_cast<T>(uint_value);
+  }
+
+  // And comparisons of a column gathered from rows into |bitmap|.
+  void CompareGathered(const void* column, size_t count,
+                       uint64_t* bitmap) const {
+    switch (type) {
+#define REFLECTION_COMPARE_COLUMN(primitive_type, T)                       \
+  case PrimitiveType::primitive_type:                                      \
+    return CompareColumn<T>(op, static_cast<const T*>(column), count,      \
+                            GetLiteral<T>(), bitmap);
+      REFLECTION_COMPARE_COLUMN(kBool, bool)
+      REFLECTION_COMPARE_COLUMN(kChar, char)
+      REFLECTION_COMPARE_COLUMN(kInt8, int8_t)
+      REFLECTION_COMPARE_COLUMN(kInt16, int16_t)
+      REFLECTION_COMPARE_COLUMN(kInt32, int32_t)
+      REFLECTION_COMPARE_COLUMN(kInt64, int64_t)
+      REFLECTION_COMPARE_COLUMN(kUInt8, uint8_t)
+      REFLECTION_COMPARE_COLUMN(kUInt16, uint16_t)
+      REFLECTION_COMPARE_COLUMN(kUInt32, uint32_t)
+      REFLECTION_COMPARE_COLUMN(kUInt64, uint64_t)
+#undef REFLECTION_COMPARE_COLUMN
+      case PrimitiveType::kFloat: {
+        // Compare as double, so that literals aren't rounded to float.
+        alignas(64) double values[kBlockSize];
+        auto* floats = static_cast<const float*>(column);
+        for (size_t i = 0; i < count; ++i) values[i] = floats[i];
+        for (size_t i = count; i % kWordBits != 0; ++i) values[i] = 0;
+        return CompareColumn<double>(op, values, count, float_value, bitmap);
+      }
+      case PrimitiveType::kDouble:
+        return CompareColumn<double>(op, static_cast<const double*>(column),
+                                     count, float_value, bitmap);
+      default:
+        return;
+    }
+  }
+
+  // Compare one field value.
+  bool CompareValue(const void* value) const {
+    switch (type) {
+#define REFLECTION_COMPARE_VALUE(primitive_type, T) \
+  case PrimitiveType::primitive_type:               \
+    return Apply(op, *static_cast<const T*>(value), GetLiteral<T>());
+      REFLECTION_COMPARE_VALUE(kBool, bool)
+      REFLECTION_COMPARE_VALUE(kChar, char)
+      REFLECTION_COMPARE_VALUE(kInt8, int8_t)
+      REFLECTION_COMPARE_VALUE(kInt16, int16_t)
+      REFLECTION_COMPARE_VALUE(kInt32, int32_t)
+      REFLECTION_COMPARE_VALUE(kInt64, int64_t)
+      REFLECTION_COMPARE_VALUE(kUInt8, uint8_t)
+      REFLECTION_COMPARE_VALUE(kUInt16, uint16_t)
+      REFLECTION_COMPARE_VALUE(kUInt32, uint32_t)
+      REFLECTION_COMPARE_VALUE(kUInt64, uint64_t)
+#undef REFLECTION_COMPARE_VALUE
+      case PrimitiveType::kFloat:
+        return Apply(op, static_cast<double>(*static_cast<const float*>(value)),
+                     float_value);
+      case PrimitiveType::kDouble:
+        return Apply(op, *static_cast<const double*>(value), float_value);
+      case PrimitiveType::kString:
+        return Apply(
+            op, static_cast<const std::string*>(value)->compare(string_value),
+            0);
+      default:
+        return false;
+    }
+  }
+};
+
+/* RowFilter methods */
+
+const size_t RowFilter::kBlockSize;
+
+std::unique_ptr<RowFilter> RowFilter::Compile(Descriptor* desc,
+                                              const std::string& expression,
+                                              std::string* error) {
+  if (desc == nullptr) {
+    SetError(error, expression, "null descriptor");
+    return nullptr;
+  }
+  std::unique_ptr<RowFilter> filter(new RowFilter);
+  filter->desc_ = desc;
+  for (const auto& text : SplitTerms(expression)) {
+    std::unique_ptr<Term> term(new Term);
+    std::string path, literal;
+    if (!SplitTerm(text, &path, &term->op, &literal)) {
+      SetError(error, expression, "expected <path> <op> <literal> in \"" +
+                                      text + "\"");
+      return nullptr;
+    }
+    std::string path_error;
+    term->path = FieldPath::Compile(desc, path, &path_error);
+    if (term->path == nullptr) {
+      SetError(error, expression, path_error);
+      return nullptr;
+    }
+    Descriptor* field_desc = term->path->GetResultDescriptor();
+    term->type = field_desc->GetPrimitiveType();
+    term->width = field_desc->size_;
+
+    Number number;
+    bool is_number = ParseNumber(literal, &number) ||
+                     ParseEnumName(field_desc, literal, &number);
+    bool bound = true;
+    switch (term->type) {
+#define REFLECTION_BIND_INTEGER(primitive_type, T) \
+  case PrimitiveType::primitive_type:              \
+    if (is_number) term->BindInteger<T>(number);   \
+    bound = is_number;                             \
+    break;
+      REFLECTION_BIND_INTEGER(kBool, bool)
+      REFLECTION_BIND_INTEGER(kChar, char)
+      REFLECTION_BIND_INTEGER(kInt8, int8_t)
+      REFLECTION_BIND_INTEGER(kInt16, int16_t)
+      REFLECTION_BIND_INTEGER(kInt32, int32_t)
+      REFLECTION_BIND_INTEGER(kInt64, int64_t)
+      REFLECTION_BIND_INTEGER(kUInt8, uint8_t)
+      REFLECTION_BIND_INTEGER(kUInt16, uint16_t)
+      REFLECTION_BIND_INTEGER(kUInt32, uint32_t)
+      REFLECTION_BIND_INTEGER(kUInt64, uint64_t)
+#undef REFLECTION_BIND_INTEGER
+      case PrimitiveType::kFloat:
+      case PrimitiveType::kDouble:
+        term->float_value = number.value;
+        bound = is_number;
+        break;
+      case PrimitiveType::kString:
+        bound = ParseString(literal, &term->string_value);
+        break;
+      default:
+        SetError(error, expression,
+                 StringUtil::Concat("field ", path, " of type ",
+                                    field_desc->GetTypeName(),
+                                    " is not a scalar, enum or string"));
+        return nullptr;
+    }
+    if (!bound) {
+      SetError(error, expression,
+               StringUtil::Concat("literal ", literal, " doesn't match type ",
+                                  field_desc->GetTypeName(), " of ", path));
+      return nullptr;
+    }
+    filter->terms_.push_back(std::move(term));
+  }
+  return filter;
+}
+
+RowFilter::~RowFilter() {}
+
+void RowFilter::EvaluateBlock(const char* rows, size_t count,
+                              uint64_t* bitmap) const {
+  size_t words = (count + kWordBits - 1) / kWordBits;
+  for (size_t word = 0; word < words; ++word) bitmap[word] = ~0ull;
+  if (count % kWordBits != 0) {
+    bitmap[words - 1] = (1ull << (count % kWordBits)) - 1;
+  }
+  size_t stride = desc_->size_;
+  alignas(64) char column[kBlockSize * sizeof(uint64_t)];
+  for (const auto& term : terms_) {
+    if (IsBlockEmpty(bitmap, words)) return;
+    if (term->constant == 1) continue;
+    if (term->constant == 0) {
+      memset(bitmap, 0, words * sizeof(uint64_t));
+      return;
+    }
+    // Fields at a fixed offset are gathered into a column.
+    if (term->path->GetStepSize() == 0 &&
+        term->type != PrimitiveType::kString) {
+      size_t offset = static_cast<const char*>(term->path->Get(rows)) - rows;
+      GatherStrided(rows + offset, stride, count, term->width, column);
+      memset(column + count * term->width, 0,
+             (words * kWordBits - count) * term->width);
+      term->CompareGathered(column, count, bitmap);
+      continue;
+    }
+    for (size_t word = 0; word < words; ++word) {
+      uint64_t bits = bitmap[word];
+      while (bits != 0) {
+        size_t bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        const void* value =
+            term->path->Get(rows + (word * kWordBits + bit) * stride);
+        if (value == nullptr || !term->CompareValue(value)) {
+          bitmap[word] &= ~(1ull << bit);
+        }
+      }
+    }
+  }
+}
+
+size_t RowFilter::Select(const void* rows, size_t count,
+                         std::vector<uint32_t>* ids) const {
+  auto* bytes = static_cast<const char*>(rows);
+  size_t stride = desc_->size_;
+  size_t selected = 0;
+  uint64_t bitmap[kBlockWords];
+  for (size_t begin = 0; begin < count; begin += kBlockSize) {
+    size_t size = std::min(kBlockSize, count - begin);
+    EvaluateBlock(bytes + begin * stride, size, bitmap);
+    for (size_t word = 0; word * kWordBits < size; ++word) {
+      uint64_t bits = bitmap[word];
+      while (bits != 0) {
+        ids->push_back(begin + word * kWordBits + __builtin_ctzll(bits));
+        bits &= bits - 1;
+        ++selected;
+      }
+    }
+  }
+  return selected;
+}
+
+size_t RowFilter::Count(const void* rows, size_t count) const {
+  auto* bytes = static_cast<const char*>(rows);
+  size_t stride = desc_->size_;
+  size_t selected = 0;
+  uint64_t bitmap[kBlockWords];
+  for (size_t begin = 0; begin < count; begin += kBlockSize) {
+    size_t size = std::min(kBlockSize, count - begin);
+    EvaluateBlock(bytes + begin * stride, size, bitmap);
+    for (size_t word = 0; word * kWordBits < size; ++word) {
+      selected += __builtin_popcountll(bitmap[word]);
+    }
+  }
+  return selected;
+}
+
+}  // namespace reflection
@@ -0,0 +1,95 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/field_path.h"
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * Predicates over arrays of reflected objects, compiled once from expressions
+ * like
+ *   speed_ > 3.0 && lane_id_ == 2 && type_ != kPedestrian && name_ == "ego"
+ * A term compares a field path (see field_path.h) with a literal by ==, !=, <,
+ * <=, > or >=, and terms are joined by &&. Literals are numbers, true and
+ * false, quoted strings with backslash escapes, or value names of enum
+ * fields. Fields must be scalars, enums or strings.
+ *
+ * Rows are evaluated in blocks. Each term gathers its field of a block into a
+ * column, compares the column with the literal in a branch-free loop, and
+ * ands the result into the selection bitmap of the block. Later terms skip
+ * words of the bitmap already cleared, and blocks once empty. Literals are
+ * converted to field types at compile time, e.g. "id_ < 2.5" on an integer
+ * is "id_ <= 2", and comparisons that can't hold are folded. Strings and
+ * fields behind containers or pointers are compared row by row.
+ *
+ * Usage:
+ *   auto filter = RowFilter::Compile(DESC("Obstacle"), "speed_ > 3.0");
+ *   std::vector<uint32_t> ids;
+ *   filter->Select(obstacles, &ids);
+ */
+class RowFilter {
+ public:
+  // Rows evaluated per block.
+  static const size_t kBlockSize = 1024;
+
+  // Compile |expression| against rows described by |desc|. Return nullptr if
+  // it is malformed or doesn't match descriptors, with the reason written into
+  // |error| if given.
+  static std::unique_ptr<RowFilter> Compile(Descriptor* desc,
+                                            const std::string& expression,
+                                            std::string* error = nullptr);
+
+  ~RowFilter();
+
+  RowFilter(const RowFilter&) = delete;
+  RowFilter& operator=(const RowFilter&) = delete;
+
+  Descriptor* GetDescriptor() const { return desc_; }
+
+  size_t GetTermSize() const { return terms_.size(); }
+
+  // Append ids of matching rows among |count| rows stored contiguously from
+  // |rows| to |ids|, in row order. Return number of matching rows.
+  size_t Select(const void* rows, size_t count,
+                std::vector<uint32_t>* ids) const;
+
+  // Return 0 if |T| is not described by the descriptor of this filter.
+  template <typename T>
+  size_t Select(const std::vector<T>& rows, std::vector<uint32_t>* ids) const {
+    if (DescriptorAccessor<T>::Get() != desc_) return 0;
+    return Select(rows.data(), rows.size(), ids);
+  }
+
+  // Count matching rows without collecting them.
+  size_t Count(const void* rows, size_t count) const;
+
+  // Append copies of matching rows to |out|. Return number of matching rows.
+  template <typename T>
+  size_t Compact(const std::vector<T>& rows, std::vector<T>* out) const {
+    std::vector<uint32_t> ids;
+    size_t size = Select(rows, &ids);
+    out->reserve(out->size() + size);
+    for (uint32_t id : ids) out->push_back(rows[id]);
+    return size;
+  }
+
+ private:
+  struct Term;
+
+  RowFilter() = default;
+
+  // Evaluate |count| <= kBlockSize rows into |bitmap|, one bit per row.
+  void EvaluateBlock(const char* rows, size_t count, uint64_t* bitmap) const;
+
+  Descriptor* desc_{nullptr};
+  std::vector<std::unique_ptr<Term>> terms_;
+};
+
+}  // namespace reflection
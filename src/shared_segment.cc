@@ -0,0 +1,473 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/shared_segment.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+
+#include "src/copy_plan.h"
+
+namespace reflection {
+
+namespace {
+
+const uint64_t kSegmentMagic = 0x544e454d47455353;  // "SSEGMENT"
+
+// Alignment of out-of-line values, enough for every reflected type.
+const size_t kValueAlign = 16;
+
+// Size of a span {offset, size} and of a content offset in a slot.
+const size_t kSpanSize = 2 * sizeof(uint64_t);
+const size_t kOffsetSize = sizeof(uint64_t);
+
+// Whether values are stored as a span of characters.
+bool IsString(const Descriptor* desc) {
+  return desc->GetPrimitiveType() == PrimitiveType::kString;
+}
+
+// Whether values are stored as a span of elements.
+bool IsSpanContainer(Descriptor* desc) {
+  auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc);
+  return container_desc != nullptr && container_desc->GetFixedSize() < 0 &&
+         container_desc->GetKeyDescriptor() == nullptr &&
+         desc->size_ >= kSpanSize;
+}
+
+// Whether values are stored as an offset of content.
+bool IsOffsetPointer(const Descriptor* desc) {
+  return desc->GetKind() == DescriptorKind::kSmartPtr &&
+         desc->size_ >= kOffsetSize;
+}
+
+enum class StepKind { kString, kSpan, kFixedArray, kPointer };
+
+struct RelocationPlan;
+
+// A field holding pointers, which are replaced by offsets.
+struct RelocationStep {
+  StepKind kind;
+  size_t offset;
+  Descriptor* desc;
+  // Plan of container values or pointer content.
+  const RelocationPlan* plan{nullptr};
+  // Whether container values are copied with one memcpy.
+  bool bulk{false};
+};
+
+// How to lay out values of a descriptor, built once per descriptor. Runs copy
+// bytes at the same offset in object and slot.
+struct RelocationPlan {
+  Descriptor* desc{nullptr};
+  std::vector<CopyRun> runs;
+  std::vector<RelocationStep> steps;
+};
+
+// Adds pointer steps to relocation plans, see PlanCache.
+struct RelocationPlanBuilder {
+  static void AddStep(PlanCache<RelocationPlan, RelocationPlanBuilder>* cache,
+                      Descriptor* desc, size_t offset, RelocationPlan* plan) {
+    RelocationStep step;
+    step.offset = offset;
+    step.desc = desc;
+    if (IsString(desc)) {
+      step.kind = StepKind::kString;
+    } else if (IsSpanContainer(desc)) {
+      auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc);
+      step.kind = StepKind::kSpan;
+      step.bulk = IsBulkCopyable(container_desc);
+      step.plan = cache->GetPlanLocked(container_desc->GetValueDescriptor());
+    } else if (desc->GetKind() == DescriptorKind::kContainer &&
+               ContainerDescriptor::ToContainerDescriptor(desc)
+                       ->GetFixedSize() >= 0) {
+      // Elements of fixed arrays stay in place.
+      auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc);
+      step.kind = StepKind::kFixedArray;
+      step.bulk = IsBulkCopyable(container_desc);
+      step.plan = cache->GetPlanLocked(container_desc->GetValueDescriptor());
+    } else if (IsOffsetPointer(desc)) {
+      auto* ptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(desc);
+      step.kind = StepKind::kPointer;
+      step.plan = cache->GetPlanLocked(ptr_desc->GetContentDescriptor());
+    } else {
+      // Maps, variants and protobuf messages are not relocatable.
+      return;
+    }
+    plan->steps.push_back(step);
+  }
+
+  static void Finish(RelocationPlan* plan) {}
+};
+
+using RelocationPlanCache = PlanCache<RelocationPlan, RelocationPlanBuilder>;
+
+// Call inside a guard, see PlanCache::GetPlan().
+const RelocationPlan* GetPlan(Descriptor* desc) {
+  return GetCachedPlan<RelocationPlan, RelocationPlanBuilder>(desc);
+}
+
+}  // namespace
+
+struct SharedSegment::Header {
+  uint64_t magic;
+  uint64_t size;
+  std::atomic<uint64_t> used;
+  std::atomic<uint64_t> root_offset;
+  std::atomic<uint64_t> root_fingerprint;
+};
+
+/* RelocatableView methods */
+
+RelocatableView::RelocatableView(const SharedSegment* segment, uint64_t offset,
+                                 Descriptor* desc) {
+  if (desc == nullptr || offset == 0) return;
+  data_ = segment->GetBytes(offset, desc->size_);
+  if (data_ == nullptr) return;
+  segment_ = segment;
+  offset_ = offset;
+  desc_ = desc;
+}
+
+const void* RelocatableView::GetData() const {
+  if (!IsValid() || !desc_->IsByteCopyable()) return nullptr;
+  return data_;
+}
+
+RelocatableView RelocatableView::GetField(int32_t id) const {
+  if (!IsValid()) return RelocatableView();
+  auto* class_desc = ClassDescriptor::ToClassDescriptor(desc_);
+  if (class_desc == nullptr || id < 0 || id >= class_desc->GetFieldSize() ||
+      class_desc->HasFieldFlag(id, kMemberTransient)) {
+    return RelocatableView();
+  }
+  return RelocatableView(segment_, offset_ + class_desc->GetFieldOffset(id),
+                         class_desc->GetDescriptorById(id));
+}
+
+RelocatableView RelocatableView::GetField(const std::string& name) const {
+  if (!IsValid()) return RelocatableView();
+  auto* class_desc = ClassDescriptor::ToClassDescriptor(desc_);
+  if (class_desc == nullptr) return RelocatableView();
+  return GetField(class_desc->GetFieldId(name));
+}
+
+bool RelocatableView::GetSpan(uint64_t* offset, uint64_t* size) const {
+  if (!IsValid() || !(IsString(desc_) || IsSpanContainer(desc_))) {
+    return false;
+  }
+  memcpy(offset, data_, sizeof(uint64_t));
+  memcpy(size, data_ + sizeof(uint64_t), sizeof(uint64_t));
+  return true;
+}
+
+string_view RelocatableView::GetString() const {
+  uint64_t offset, size;
+  if (!IsString(desc_) || !GetSpan(&offset, &size) || size == 0) {
+    return string_view();
+  }
+  const char* bytes = segment_->GetBytes(offset, size);
+  if (bytes == nullptr) return string_view();
+  return string_view(bytes, size);
+}
+
+size_t RelocatableView::GetSize() const {
+  auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc_);
+  if (!IsValid() || container_desc == nullptr) return 0;
+  if (container_desc->GetFixedSize() >= 0) {
+    return container_desc->GetFixedSize();
+  }
+  uint64_t offset, size;
+  if (!GetSpan(&offset, &size)) return 0;
+  size_t stride = container_desc->GetValueDescriptor()->size_;
+  if (stride != 0 && size > segment_->GetSize() / stride) return 0;
+  if (size == 0 || segment_->GetBytes(offset, size * stride) == nullptr) {
+    return 0;
+  }
+  return size;
+}
+
+RelocatableView RelocatableView::GetElement(size_t index) const {
+  if (index >= GetSize()) return RelocatableView();
+  auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc_);
+  Descriptor* value_desc = container_desc->GetValueDescriptor();
+  uint64_t offset = offset_;
+  if (container_desc->GetFixedSize() < 0) {
+    uint64_t size;
+    GetSpan(&offset, &size);
+  }
+  return RelocatableView(segment_, offset + index * value_desc->size_,
+                         value_desc);
+}
+
+RelocatableView RelocatableView::GetContent() const {
+  if (!IsValid() || !IsOffsetPointer(desc_)) return RelocatableView();
+  uint64_t offset;
+  memcpy(&offset, data_, sizeof(uint64_t));
+  auto* ptr_desc = static_cast<SmartPtrDescriptor*>(desc_);
+  return RelocatableView(segment_, offset, ptr_desc->GetContentDescriptor());
+}
+
+/* SharedSegment::Writer methods */
+
+class SharedSegment::Writer {
+ public:
+  explicit Writer(SharedSegment* segment) : segment_(segment) {}
+
+  // Allocate a slot and lay out |obj| in it. Return its offset, 0 if out of
+  // space.
+  uint64_t Write(const RelocationPlan* plan, const char* obj) {
+    uint64_t offset = segment_->Allocate(plan->desc->size_, kValueAlign);
+    if (offset == 0) return 0;
+    root_ = {{obj, plan->desc}, offset};
+    if (!WriteValue(plan, obj, offset)) return 0;
+    return offset;
+  }
+
+ private:
+  // Identity of pointer content: pointers aliasing a member at the same
+  // address as its object point to another content.
+  using ContentKey = std::pair<const void*, const Descriptor*>;
+
+  // Get offset of content |key| written so far by this writer, 0 if none.
+  uint64_t FindContent(const ContentKey& key) {
+    // Only filled by objects with pointers. The root is added on first use,
+    // so that pointers back to it are found too.
+    if (offsets_.empty()) offsets_.insert(root_);
+    auto iter = offsets_.find(key);
+    return iter == offsets_.end() ? 0 : iter->second;
+  }
+
+  // Lay out |obj| at |offset|, where desc->size_ zeroed bytes are allocated.
+  bool WriteValue(const RelocationPlan* plan, const char* obj,
+                  uint64_t offset) {
+    char* slot = segment_->data_ + offset;
+    for (const auto& run : plan->runs) {
+      memcpy(slot + run.offset, obj + run.offset, run.size);
+    }
+    for (const auto& step : plan->steps) {
+      if (!WriteStep(step, obj + step.offset, offset + step.offset)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool WriteStep(const RelocationStep& step, const char* field,
+                 uint64_t offset) {
+    switch (step.kind) {
+      case StepKind::kString: {
+        const auto& str = *reinterpret_cast<const std::string*>(field);
+        uint64_t span[2] = {0, str.size()};
+        if (!str.empty()) {
+          span[0] = segment_->Allocate(str.size(), 1);
+          if (span[0] == 0) return false;
+          memcpy(segment_->data_ + span[0], str.data(), str.size());
+        }
+        memcpy(segment_->data_ + offset, span, kSpanSize);
+        return true;
+      }
+      case StepKind::kSpan: {
+        auto* container_desc = static_cast<ContainerDescriptor*>(step.desc);
+        size_t stride = step.plan->desc->size_;
+        uint64_t span[2] = {0, container_desc->GetContainerSize(field)};
+        if (span[1] > 0 && stride > 0) {
+          if (span[1] > segment_->size_ / stride) return false;
+          span[0] = segment_->Allocate(span[1] * stride, kValueAlign);
+          if (span[0] == 0) return false;
+        }
+        memcpy(segment_->data_ + offset, span, kSpanSize);
+        if (span[0] == 0) return true;
+        return WriteElements(step, field, span[0], span[1] * stride);
+      }
+      case StepKind::kFixedArray:
+        return WriteElements(step, field, offset, step.desc->size_);
+      case StepKind::kPointer: {
+        auto* ptr_desc = static_cast<SmartPtrDescriptor*>(step.desc);
+        const void* content = ptr_desc->GetRawPtr(field);
+        if (content == nullptr) return true;
+        // Content is written once and shared by all of its owners, which
+        // also ends cycles. Its offset is known before it is laid out, so
+        // that pointers back to it from within find it.
+        ContentKey key(content, step.plan->desc);
+        uint64_t content_offset = FindContent(key);
+        if (content_offset == 0) {
+          content_offset =
+              segment_->Allocate(step.plan->desc->size_, kValueAlign);
+          if (content_offset == 0) return false;
+          offsets_.emplace(key, content_offset);
+          if (!WriteValue(step.plan, static_cast<const char*>(content),
+                          content_offset)) {
+            return false;
+          }
+        }
+        memcpy(segment_->data_ + offset, &content_offset, kOffsetSize);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Lay out container elements back to back from |offset|, in |size| bytes.
+  bool WriteElements(const RelocationStep& step, const char* field,
+                     uint64_t offset, size_t size) {
+    auto* container_desc = static_cast<ContainerDescriptor*>(step.desc);
+    const void* contiguous = container_desc->GetContiguousData(field);
+    if (step.bulk && contiguous != nullptr) {
+      memcpy(segment_->data_ + offset, contiguous, size);
+      return true;
+    }
+    bool written = true;
+    container_desc->ForEachElement(
+        field, [&](const void* key, const void* value) {
+          written =
+              WriteValue(step.plan, static_cast<const char*>(value), offset);
+          offset += step.plan->desc->size_;
+          return written;
+        });
+    return written;
+  }
+
+  SharedSegment* segment_;
+  std::pair<ContentKey, uint64_t> root_;
+  std::unordered_map<ContentKey, uint64_t, boost::hash<ContentKey>> offsets_;
+};
+
+/* SharedSegment methods */
+
+std::unique_ptr<SharedSegment> SharedSegment::Create(const std::string& name,
+                                                     size_t size) {
+  if (size <= sizeof(Header)) return nullptr;
+  // A fresh segment is zero filled, which Allocate() relies on.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) return nullptr;
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  auto* header = new (data) Header();
+  header->magic = kSegmentMagic;
+  header->size = size;
+  header->used = sizeof(Header);
+  return std::unique_ptr<SharedSegment>(
+      new SharedSegment(fd, static_cast<char*>(data), size, false));
+}
+
+std::unique_ptr<SharedSegment> SharedSegment::Open(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) <= sizeof(Header)) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+  std::unique_ptr<SharedSegment> segment(
+      new SharedSegment(fd, static_cast<char*>(data), size, true));
+  Header* header = segment->GetHeader();
+  if (header->magic != kSegmentMagic || header->size != size) return nullptr;
+  return segment;
+}
+
+bool SharedSegment::Unlink(const std::string& name) {
+  return shm_unlink(name.c_str()) == 0;
+}
+
+SharedSegment::SharedSegment(int fd, char* data, size_t size, bool read_only)
+    : fd_(fd), data_(data), size_(size), read_only_(read_only) {}
+
+SharedSegment::~SharedSegment() {
+  munmap(data_, size_);
+  close(fd_);
+}
+
+SharedSegment::Header* SharedSegment::GetHeader() const {
+  return reinterpret_cast<Header*>(data_);
+}
+
+size_t SharedSegment::GetUsedSize() const {
+  return GetHeader()->used.load(std::memory_order_relaxed);
+}
+
+uint64_t SharedSegment::Allocate(size_t size, size_t align) {
+  if (read_only_ || size == 0) return 0;
+  std::atomic<uint64_t>& used = GetHeader()->used;
+  uint64_t begin = used.load(std::memory_order_relaxed);
+  uint64_t offset;
+  do {
+    offset = (begin + align - 1) & ~static_cast<uint64_t>(align - 1);
+    if (offset > size_ || size > size_ - offset) return 0;
+  } while (!used.compare_exchange_weak(begin, offset + size,
+                                       std::memory_order_relaxed));
+  return offset;
+}
+
+bool SharedSegment::Reset() {
+  if (read_only_) return false;
+  Header* header = GetHeader();
+  header->root_offset.store(0, std::memory_order_release);
+  header->root_fingerprint.store(0, std::memory_order_relaxed);
+  uint64_t used = header->used.load(std::memory_order_relaxed);
+  memset(data_ + sizeof(Header), 0, used - sizeof(Header));
+  header->used.store(sizeof(Header), std::memory_order_relaxed);
+  return true;
+}
+
+uint64_t SharedSegment::Write(const void* obj, Descriptor* desc) {
+  if (desc == nullptr) return 0;
+  EpochReclaimer::Guard guard(RelocationPlanCache::Get().GetReclaimer());
+  return Writer(this).Write(GetPlan(desc), static_cast<const char*>(obj));
+}
+
+bool SharedSegment::SetRoot(uint64_t offset, const ClassDescriptor* desc) {
+  if (read_only_ || desc == nullptr ||
+      GetBytes(offset, desc->size_) == nullptr) {
+    return false;
+  }
+  Header* header = GetHeader();
+  header->root_fingerprint.store(desc->GetFingerprint(),
+                                 std::memory_order_relaxed);
+  header->root_offset.store(offset, std::memory_order_release);
+  return true;
+}
+
+RelocatableView SharedSegment::GetRoot(const ClassDescriptor* desc) const {
+  if (desc == nullptr) return RelocatableView();
+  Header* header = GetHeader();
+  uint64_t offset = header->root_offset.load(std::memory_order_acquire);
+  if (offset == 0 || header->root_fingerprint.load(
+                         std::memory_order_relaxed) != desc->GetFingerprint()) {
+    return RelocatableView();
+  }
+  return RelocatableView(this, offset, const_cast<ClassDescriptor*>(desc));
+}
+
+const char* SharedSegment::GetBytes(uint64_t offset, uint64_t size) const {
+  if (offset > size_ || size > size_ - offset) return nullptr;
+  return data_ + offset;
+}
+
+}  // namespace reflection
@@ -0,0 +1,178 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * POSIX shared memory segment holding reflected objects in a relocatable
+ * form, so that other processes map it and read fields in place, without
+ * copies or deserialization.
+ *
+ * An object is laid out like in memory, with every field at its usual offset,
+ * but pointers are replaced by offsets from segment start:
+ *   byte-copyable fields (scalars, glm, enums, fixed arrays): copied as they
+ *       are
+ *   nested classes: laid out in place the same way
+ *   strings, and containers without keys (vector, deque, list, set,
+ *       unordered_set): a span {uint64 offset, uint64 size} of characters or
+ *       elements, elements laid out back to back with their usual size
+ *   unique_ptr, shared_ptr, and optionals of at least 8 bytes: uint64 offset
+ *       of content, 0 if empty. Content shared by several pointers is written
+ *       once per Write(), so cycles of shared_ptr are written too.
+ * Other fields (maps, variants, protobuf messages) are left zeroed, and can't
+ * be read from views. So are members annotated kMemberTransient, for which
+ * views of fields are invalid. Layout depends on the build like the memory
+ * layout, so the root is published with the fingerprint of its class, and
+ * readers of a different schema are refused.
+ *
+ * Memory is taken with a lock-free bump allocator and never freed one value at
+ * a time: a segment is filled, then reset or replaced as a whole.
+ *
+ * Usage:
+ *   // Producer
+ *   auto segment = SharedSegment::Create("/lidar_frame", 64 << 20);
+ *   uint64_t offset = segment->Write(&frame, DESC("Frame"));
+ *   segment->SetRoot(offset, TO_CLASS_DESC(DESC("Frame")));
+ *
+ *   // Consumer
+ *   auto segment = SharedSegment::Open("/lidar_frame");
+ *   RelocatableView frame = segment->GetRoot(TO_CLASS_DESC(DESC("Frame")));
+ *   RelocatableView points = frame.GetField("points_");
+ *   for (size_t i = 0; i < points.GetSize(); ++i) {
+ *     const float* x = points.GetElement(i).GetField("x_").As<float>();
+ *   }
+ */
+
+class SharedSegment;
+
+// Read-only view of a relocatable value in a segment. Invalid views are
+// returned for missing and transient fields, out of range indices,
+// unsupported types, and offsets outside the segment, so chains of calls need
+// one check at the end.
+class RelocatableView {
+ public:
+  RelocatableView() {}
+
+  bool IsValid() const { return data_ != nullptr; }
+
+  Descriptor* GetDescriptor() const { return desc_; }
+
+  // Get bytes of a byte-copyable value, nullptr for other values.
+  const void* GetData() const;
+
+  // Get typed pointer to a byte-copyable value, nullptr if |T| is not its
+  // type. See ClassDescriptor::GetField() for how types are checked.
+  template <typename T>
+  const T* As() const {
+    if (desc_ != DescriptorAccessor<T>::Get()) return nullptr;
+    return static_cast<const T*>(GetData());
+  }
+
+  // Get field of a class value by id or name.
+  RelocatableView GetField(int32_t id) const;
+
+  RelocatableView GetField(const std::string& name) const;
+
+  // Get characters of a string value, empty for other values.
+  string_view GetString() const;
+
+  // Get number of elements of a container value, 0 for other values.
+  size_t GetSize() const;
+
+  RelocatableView GetElement(size_t index) const;
+
+  // Get content of a smart pointer or optional value, invalid if empty.
+  RelocatableView GetContent() const;
+
+ private:
+  friend class SharedSegment;
+
+  RelocatableView(const SharedSegment* segment, uint64_t offset,
+                  Descriptor* desc);
+
+  // Get span {offset, size} stored in a string or container slot.
+  bool GetSpan(uint64_t* offset, uint64_t* size) const;
+
+  const SharedSegment* segment_{nullptr};
+  uint64_t offset_{0};
+  const char* data_{nullptr};
+  Descriptor* desc_{nullptr};
+};
+
+class SharedSegment {
+ public:
+  // Create segment |name| (e.g. "/frame") of |size| bytes, replacing any
+  // existing one. Return nullptr on failure.
+  static std::unique_ptr<SharedSegment> Create(const std::string& name,
+                                               size_t size);
+
+  // Map existing segment |name| read-only. Return nullptr on failure or if it
+  // is not a segment created by Create().
+  static std::unique_ptr<SharedSegment> Open(const std::string& name);
+
+  // Remove segment |name|. Mappings stay valid until destroyed.
+  static bool Unlink(const std::string& name);
+
+  ~SharedSegment();
+
+  SharedSegment(const SharedSegment&) = delete;
+  SharedSegment& operator=(const SharedSegment&) = delete;
+
+  bool IsReadOnly() const { return read_only_; }
+
+  size_t GetSize() const { return size_; }
+
+  // Get bytes allocated so far, header included.
+  size_t GetUsedSize() const;
+
+  // Allocate |size| zeroed bytes aligned to |align|, a power of two. Return
+  // offset of them, or 0 if out of space or read-only.
+  uint64_t Allocate(size_t size, size_t align = 8);
+
+  // Discard all values and the root, so that the segment is filled again
+  // without faulting in fresh pages. Readers must be done with old values,
+  // e.g. told so through a pipe.
+  bool Reset();
+
+  // Write |obj| described by |desc| in relocatable form. Return its offset,
+  // or 0 if out of space.
+  uint64_t Write(const void* obj, Descriptor* desc);
+
+  // Publish the value at |offset| as root, written from class |desc|. Call
+  // once, after the value is written.
+  bool SetRoot(uint64_t offset, const ClassDescriptor* desc);
+
+  // Get root value, invalid if none is published or it was written from a
+  // class of another fingerprint than |desc|.
+  RelocatableView GetRoot(const ClassDescriptor* desc) const;
+
+  // Get view of a value of |desc| at |offset|, invalid if out of range.
+  RelocatableView GetView(uint64_t offset, Descriptor* desc) const {
+    return RelocatableView(this, offset, desc);
+  }
+
+  // Get bytes at |offset| if |size| bytes fit from there, nullptr otherwise.
+  const char* GetBytes(uint64_t offset, uint64_t size) const;
+
+ private:
+  struct Header;
+  class Writer;
+
+  SharedSegment(int fd, char* data, size_t size, bool read_only);
+
+  Header* GetHeader() const;
+
+  int fd_;
+  char* data_;
+  size_t size_;
+  bool read_only_;
+};
+
+}  // namespace reflection
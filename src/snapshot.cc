@@ -0,0 +1,777 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/snapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/functional/hash.hpp>
+
+#include "src/copy_plan.h"
+#include "src/string_util.h"
+
+namespace reflection {
+
+namespace {
+
+enum class StepKind { kString, kContainer, kSmartPtr, kVariant, kMessage };
+
+struct SnapshotPlan;
+
+// A field stored out of line, in field order.
+struct OutOfLineStep {
+  StepKind kind;
+  size_t offset;
+  Descriptor* desc;
+  // Key (nullptr if none) and value of containers, content of smart pointers,
+  // or alternatives of variants.
+  std::vector<const SnapshotPlan*> plans;
+  // Whether container values are copied with one memcpy.
+  bool bulk{false};
+};
+
+// How to snapshot values of a descriptor, built once per descriptor. Runs
+// copy bytes at the same offset in object and image.
+struct SnapshotPlan {
+  Descriptor* desc{nullptr};
+  // desc->size_, or 0 if nothing is copied byte-wise.
+  size_t image_size{0};
+  std::vector<CopyRun> runs;
+  std::vector<OutOfLineStep> steps;
+};
+
+// Adds out-of-line steps to snapshot plans, see PlanCache.
+struct SnapshotPlanBuilder {
+  static void AddStep(PlanCache<SnapshotPlan, SnapshotPlanBuilder>* cache,
+                      Descriptor* desc, size_t offset, SnapshotPlan* plan) {
+    OutOfLineStep step;
+    step.offset = offset;
+    step.desc = desc;
+    switch (desc->GetKind()) {
+      case DescriptorKind::kPreDefined:
+        step.kind = StepKind::kString;
+        break;
+      case DescriptorKind::kMessage:
+        step.kind = StepKind::kMessage;
+        break;
+      case DescriptorKind::kContainer: {
+        auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc);
+        step.kind = StepKind::kContainer;
+        step.bulk = IsBulkCopyable(container_desc);
+        Descriptor* key_desc = container_desc->GetKeyDescriptor();
+        step.plans.push_back(
+            key_desc == nullptr ? nullptr : cache->GetPlanLocked(key_desc));
+        step.plans.push_back(
+            cache->GetPlanLocked(container_desc->GetValueDescriptor()));
+        break;
+      }
+      case DescriptorKind::kSmartPtr: {
+        auto* ptr_desc = SmartPtrDescriptor::ToSmartPtrDescriptor(desc);
+        step.kind = StepKind::kSmartPtr;
+        step.plans.push_back(
+            cache->GetPlanLocked(ptr_desc->GetContentDescriptor()));
+        break;
+      }
+      case DescriptorKind::kVariant: {
+        auto* variant_desc = VariantDescriptor::ToVariantDescriptor(desc);
+        step.kind = StepKind::kVariant;
+        for (int32_t i = 0; i < variant_desc->GetAlternativeSize(); ++i) {
+          step.plans.push_back(
+              cache->GetPlanLocked(variant_desc->GetAlternativeDescriptor(i)));
+        }
+        break;
+      }
+      default:
+        return;
+    }
+    plan->steps.push_back(std::move(step));
+  }
+
+  static void Finish(SnapshotPlan* plan) {
+    if (!plan->runs.empty()) plan->image_size = plan->desc->size_;
+  }
+};
+
+using SnapshotPlanCache = PlanCache<SnapshotPlan, SnapshotPlanBuilder>;
+
+// Call inside a guard, see PlanCache::GetPlan().
+const SnapshotPlan* GetPlan(Descriptor* desc) {
+  return GetCachedPlan<SnapshotPlan, SnapshotPlanBuilder>(desc);
+}
+
+// Tags of smart pointers in snapshot data.
+const uint8_t kNullTag = 0;
+const uint8_t kContentTag = 1;
+const uint8_t kReferenceTag = 2;
+
+// Bound of decoded container sizes, against corrupted data.
+const uint64_t kMaxContainerSize = 1ull << 28;
+
+// Identity of shared content: pointers aliasing a member at the same address
+// as its object point to another content.
+using SharedKey = std::pair<const void*, const Descriptor*>;
+
+// Ids of shared pointer contents met so far while taking a snapshot, in order
+// of first visit.
+using SharedIds =
+    std::unordered_map<SharedKey, uint64_t, boost::hash<SharedKey>>;
+
+template <typename T>
+void AppendInt(T value, std::string* data) {
+  data->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void AppendValue(const SnapshotPlan& plan, const char* obj, SharedIds* shared,
+                 std::string* data);
+
+void AppendStep(const OutOfLineStep& step, const char* field,
+                SharedIds* shared, std::string* data) {
+  switch (step.kind) {
+    case StepKind::kString: {
+      const auto& str = *reinterpret_cast<const std::string*>(field);
+      AppendInt<uint64_t>(str.size(), data);
+      data->append(str);
+      break;
+    }
+    case StepKind::kMessage: {
+      const auto* message = MessageDescriptor::ToMessage(field);
+      size_t size = message->ByteSizeLong();
+      AppendInt<uint64_t>(size, data);
+      size_t base = data->size();
+      data->resize(base + size);
+      message->SerializeWithCachedSizesToArray(
+          reinterpret_cast<uint8_t*>(&(*data)[base]));
+      break;
+    }
+    case StepKind::kContainer: {
+      auto* container_desc = static_cast<ContainerDescriptor*>(step.desc);
+      size_t size = container_desc->GetContainerSize(field);
+      AppendInt<uint64_t>(size, data);
+      if (step.bulk) {
+        if (size == 0) break;
+        data->append(
+            static_cast<const char*>(container_desc->GetContiguousData(field)),
+            size * step.plans[1]->desc->size_);
+        break;
+      }
+      container_desc->ForEachElement(
+          field, [&](const void* key, const void* value) {
+            if (key != nullptr) {
+              AppendValue(*step.plans[0], static_cast<const char*>(key), shared,
+                          data);
+            }
+            AppendValue(*step.plans[1], static_cast<const char*>(value),
+                        shared, data);
+            return true;
+          });
+      break;
+    }
+    case StepKind::kSmartPtr: {
+      auto* ptr_desc = static_cast<SmartPtrDescriptor*>(step.desc);
+      const void* content = ptr_desc->GetRawPtr(field);
+      if (content == nullptr) {
+        AppendInt<uint8_t>(kNullTag, data);
+        break;
+      }
+      if (ptr_desc->IsSharedOwnership()) {
+        // Register before recursing, so that cycles end in references.
+        auto result = shared->emplace(SharedKey(content, step.plans[0]->desc),
+                                      shared->size());
+        if (!result.second) {
+          AppendInt<uint8_t>(kReferenceTag, data);
+          AppendInt<uint64_t>(result.first->second, data);
+          break;
+        }
+      }
+      AppendInt<uint8_t>(kContentTag, data);
+      AppendValue(*step.plans[0], static_cast<const char*>(content), shared,
+                  data);
+      break;
+    }
+    case StepKind::kVariant: {
+      auto* variant_desc = static_cast<VariantDescriptor*>(step.desc);
+      int32_t index = variant_desc->GetIndex(field);
+      AppendInt<int32_t>(index, data);
+      if (index >= 0) {
+        AppendValue(
+            *step.plans[index],
+            static_cast<const char*>(variant_desc->GetActiveValue(field)),
+            shared, data);
+      }
+      break;
+    }
+  }
+}
+
+void AppendValue(const SnapshotPlan& plan, const char* obj, SharedIds* shared,
+                 std::string* data) {
+  if (plan.image_size > 0) {
+    size_t base = data->size();
+    data->resize(base + plan.image_size);
+    char* image = &(*data)[base];
+    for (const auto& run : plan.runs) {
+      std::memcpy(image + run.offset, obj + run.offset, run.size);
+    }
+  }
+  for (const auto& step : plan.steps) {
+    AppendStep(step, obj + step.offset, shared, data);
+  }
+}
+
+// Reads snapshot data, failing past end.
+class SnapshotCursor {
+ public:
+  explicit SnapshotCursor(const std::string& data)
+      : pos_(data.data()), end_(data.data() + data.size()) {}
+
+  bool Take(size_t size, const char** bytes) {
+    if (static_cast<size_t>(end_ - pos_) < size) return false;
+    *bytes = pos_;
+    pos_ += size;
+    return true;
+  }
+
+  template <typename T>
+  bool ReadInt(T* value) {
+    const char* bytes;
+    if (!Take(sizeof(T), &bytes)) return false;
+    std::memcpy(value, bytes, sizeof(T));
+    return true;
+  }
+
+  size_t GetRemaining() const { return end_ - pos_; }
+
+  bool IsEnd() const { return pos_ == end_; }
+
+ private:
+  const char* pos_;
+  const char* end_;
+};
+
+template <typename T>
+T Load(const char* bytes) {
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+void AppendJsonString(const char* str, size_t size, std::string* out) {
+  *out += '"';
+  *out += StringUtil::JsonEscape(std::string(str, size));
+  *out += '"';
+}
+
+void AppendJsonFloat(double value, int32_t precision, std::string* out) {
+  if (!std::isfinite(value)) {
+    *out += "null";
+    return;
+  }
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+  *out += buffer;
+}
+
+void AppendBase64(const char* bytes, size_t size, std::string* out) {
+  static const char* kChars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  *out += '"';
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t group = static_cast<uint8_t>(bytes[i]) << 16;
+    if (i + 1 < size) group |= static_cast<uint8_t>(bytes[i + 1]) << 8;
+    if (i + 2 < size) group |= static_cast<uint8_t>(bytes[i + 2]);
+    *out += kChars[(group >> 18) & 0x3f];
+    *out += kChars[(group >> 12) & 0x3f];
+    *out += i + 1 < size ? kChars[(group >> 6) & 0x3f] : '=';
+    *out += i + 2 < size ? kChars[group & 0x3f] : '=';
+  }
+  *out += '"';
+}
+
+class JsonEncoder {
+ public:
+  JsonEncoder(SnapshotCursor* cursor, std::string* out)
+      : cursor_(cursor), out_(out) {}
+
+  // Encode image and out-of-line data of a value of |plan|.
+  bool EncodeValue(const SnapshotPlan& plan) {
+    const char* image = nullptr;
+    if (plan.image_size > 0 && !cursor_->Take(plan.image_size, &image)) {
+      return false;
+    }
+    return EncodeImage(plan, image);
+  }
+
+  // Encode a value of |plan| whose image is at |image|.
+  bool EncodeImage(const SnapshotPlan& plan, const char* image) {
+    size_t step = 0;
+    return Encode(plan.desc, image, plan, &step);
+  }
+
+ private:
+  // Encode a value of |desc| at |image|, a field of |plan| or plan value
+  // itself. Out-of-line fields consume steps of |plan| from |*step| on.
+  bool Encode(Descriptor* desc, const char* image, const SnapshotPlan& plan,
+              size_t* step) {
+    if (desc == nullptr) {
+      *out_ += "null";
+      return true;
+    }
+    if (auto* class_desc = ClassDescriptor::ToClassDescriptor(desc)) {
+      *out_ += '{';
+      bool first = true;
+      for (int32_t i = 0; i < class_desc->GetFieldSize(); ++i) {
+        if (class_desc->HasFieldFlag(i, kMemberTransient)) continue;
+        if (!first) *out_ += ',';
+        first = false;
+        string_view name = class_desc->GetFieldNameView(i);
+        AppendJsonString(name.data(), name.size(), out_);
+        *out_ += ':';
+        const char* field =
+            image == nullptr ? nullptr : image + class_desc->GetFieldOffset(i);
+        if (!Encode(class_desc->GetDescriptorById(i), field, plan, step)) {
+          return false;
+        }
+      }
+      *out_ += '}';
+      return true;
+    }
+    if (desc->IsByteCopyable()) {
+      if (image == nullptr) return false;
+      auto* container_desc = ContainerDescriptor::ToContainerDescriptor(desc);
+      if (container_desc == nullptr) return EncodeBytes(desc, image);
+      // Fixed arrays. Byte-copyable elements take no steps of |plan|.
+      Descriptor* value_desc = container_desc->GetValueDescriptor();
+      *out_ += '[';
+      for (int64_t i = 0; i < container_desc->GetFixedSize(); ++i) {
+        if (i > 0) *out_ += ',';
+        if (!Encode(value_desc, image + i * value_desc->size_, plan, step)) {
+          return false;
+        }
+      }
+      *out_ += ']';
+      return true;
+    }
+    if (*step >= plan.steps.size()) return false;
+    return EncodeStep(plan.steps[(*step)++]);
+  }
+
+  // Encode an enum or scalar stored at |bytes|.
+  bool EncodeBytes(Descriptor* desc, const char* bytes) {
+    if (auto* enum_desc = EnumDescriptor::ToEnumDescriptor(desc)) {
+      alignas(8) char value[8] = {0};
+      std::memcpy(value, bytes, std::min(desc->size_, sizeof(value)));
+      string_view name = enum_desc->GetValueNameView(value);
+      if (!name.empty()) {
+        AppendJsonString(name.data(), name.size(), out_);
+      } else {
+        *out_ += std::to_string(enum_desc->GetValue(value));
+      }
+      return true;
+    }
+    switch (desc->GetPrimitiveType()) {
+      case PrimitiveType::kBool:
+        *out_ += Load<bool>(bytes) ? "true" : "false";
+        break;
+      case PrimitiveType::kChar:
+        *out_ += std::to_string(Load<char>(bytes));
+        break;
+      case PrimitiveType::kInt8:
+        *out_ += std::to_string(Load<int8_t>(bytes));
+        break;
+      case PrimitiveType::kInt16:
+        *out_ += std::to_string(Load<int16_t>(bytes));
+        break;
+      case PrimitiveType::kInt32:
+        *out_ += std::to_string(Load<int32_t>(bytes));
+        break;
+      case PrimitiveType::kInt64:
+        *out_ += std::to_string(Load<int64_t>(bytes));
+        break;
+      case PrimitiveType::kUInt8:
+        *out_ += std::to_string(Load<uint8_t>(bytes));
+        break;
+      case PrimitiveType::kUInt16:
+        *out_ += std::to_string(Load<uint16_t>(bytes));
+        break;
+      case PrimitiveType::kUInt32:
+        *out_ += std::to_string(Load<uint32_t>(bytes));
+        break;
+      case PrimitiveType::kUInt64:
+        *out_ += std::to_string(Load<uint64_t>(bytes));
+        break;
+      case PrimitiveType::kFloat:
+        AppendJsonFloat(Load<float>(bytes), 9, out_);
+        break;
+      case PrimitiveType::kDouble:
+        AppendJsonFloat(Load<double>(bytes), 17, out_);
+        break;
+      default:
+        // glm vectors, matrices and quaternions are arrays of floats.
+        *out_ += '[';
+        for (size_t i = 0; i < desc->size_ / sizeof(float); ++i) {
+          if (i > 0) *out_ += ',';
+          AppendJsonFloat(Load<float>(bytes + i * sizeof(float)), 9, out_);
+        }
+        *out_ += ']';
+    }
+    return true;
+  }
+
+  bool EncodeStep(const OutOfLineStep& step) {
+    switch (step.kind) {
+      case StepKind::kString:
+      case StepKind::kMessage: {
+        uint64_t size = 0;
+        const char* bytes = nullptr;
+        if (!cursor_->ReadInt(&size) || !cursor_->Take(size, &bytes)) {
+          return false;
+        }
+        if (step.kind == StepKind::kString) {
+          AppendJsonString(bytes, size, out_);
+        } else {
+          AppendBase64(bytes, size, out_);
+        }
+        return true;
+      }
+      case StepKind::kContainer: {
+        uint64_t size = 0;
+        if (!cursor_->ReadInt(&size)) return false;
+        const SnapshotPlan& value_plan = *step.plans[1];
+        *out_ += '[';
+        if (step.bulk) {
+          size_t value_size = value_plan.desc->size_;
+          const char* values = nullptr;
+          if (value_size > 0 && size > cursor_->GetRemaining() / value_size) {
+            return false;
+          }
+          if (!cursor_->Take(size * value_size, &values)) return false;
+          for (uint64_t i = 0; i < size; ++i) {
+            if (i > 0) *out_ += ',';
+            if (!EncodeImage(value_plan, values + i * value_size)) return false;
+          }
+        } else {
+          for (uint64_t i = 0; i < size; ++i) {
+            if (i > 0) *out_ += ',';
+            if (step.plans[0] != nullptr) {
+              *out_ += '[';
+              if (!EncodeValue(*step.plans[0])) return false;
+              *out_ += ',';
+            }
+            if (!EncodeValue(value_plan)) return false;
+            if (step.plans[0] != nullptr) *out_ += ']';
+          }
+        }
+        *out_ += ']';
+        return true;
+      }
+      case StepKind::kSmartPtr: {
+        bool is_shared =
+            static_cast<SmartPtrDescriptor*>(step.desc)->IsSharedOwnership();
+        uint8_t tag = 0;
+        if (!cursor_->ReadInt(&tag)) return false;
+        if (tag == kNullTag) {
+          *out_ += "null";
+          return true;
+        }
+        if (tag == kReferenceTag && is_shared) {
+          uint64_t id = 0;
+          if (!cursor_->ReadInt(&id) || id >= shared_size_) return false;
+          *out_ += "{\"$ref\":" + std::to_string(id) + "}";
+          return true;
+        }
+        if (tag != kContentTag) return false;
+        if (is_shared) ++shared_size_;
+        return EncodeValue(*step.plans[0]);
+      }
+      case StepKind::kVariant: {
+        int32_t index = 0;
+        if (!cursor_->ReadInt(&index)) return false;
+        if (index < 0) {
+          *out_ += "null";
+          return true;
+        }
+        if (index >= static_cast<int32_t>(step.plans.size())) return false;
+        return EncodeValue(*step.plans[index]);
+      }
+    }
+    return false;
+  }
+
+  SnapshotCursor* cursor_;
+  std::string* out_;
+  // Number of shared pointer contents encoded so far.
+  uint64_t shared_size_{0};
+};
+
+// Key of a map or value of a set restored out of place: byte-copyable values
+// up to 64 bytes, or strings.
+struct KeyBuffer {
+  alignas(16) char bytes[64];
+  std::string string;
+};
+
+// Shared pointer content restored so far, by id.
+struct SharedContent {
+  const Descriptor* desc;
+  std::shared_ptr<void> content;
+};
+
+// Least bytes of snapshot data taken by a value of |plan|, to bound sizes
+// read from corrupted data.
+size_t GetMinBytes(const SnapshotPlan& plan) {
+  return plan.image_size + (plan.steps.empty() ? 0 : 1);
+}
+
+class SnapshotRestorer {
+ public:
+  explicit SnapshotRestorer(SnapshotCursor* cursor) : cursor_(cursor) {}
+
+  // Restore a value of |plan| into |obj|.
+  bool RestoreValue(const SnapshotPlan& plan, char* obj) {
+    if (plan.image_size > 0) {
+      const char* image = nullptr;
+      if (!cursor_->Take(plan.image_size, &image)) return false;
+      for (const auto& run : plan.runs) {
+        std::memcpy(obj + run.offset, image + run.offset, run.size);
+      }
+    }
+    for (const auto& step : plan.steps) {
+      if (!RestoreStep(step, obj + step.offset)) return false;
+    }
+    return true;
+  }
+
+ private:
+  bool RestoreStep(const OutOfLineStep& step, char* field) {
+    switch (step.kind) {
+      case StepKind::kString:
+      case StepKind::kMessage: {
+        uint64_t size = 0;
+        const char* bytes = nullptr;
+        if (!cursor_->ReadInt(&size) || !cursor_->Take(size, &bytes)) {
+          return false;
+        }
+        if (step.kind == StepKind::kString) {
+          reinterpret_cast<std::string*>(field)->assign(bytes, size);
+          return true;
+        }
+        return MessageDescriptor::ToMessage(static_cast<void*>(field))
+            ->ParseFromArray(bytes, static_cast<int>(size));
+      }
+      case StepKind::kContainer:
+        return RestoreContainer(step, field);
+      case StepKind::kSmartPtr:
+        return RestoreSmartPtr(step, field);
+      case StepKind::kVariant: {
+        auto* variant_desc = static_cast<VariantDescriptor*>(step.desc);
+        int32_t index = 0;
+        if (!cursor_->ReadInt(&index)) return false;
+        if (index < 0) return variant_desc->GetIndex(field) < 0;
+        if (index >= static_cast<int32_t>(step.plans.size())) return false;
+        void* value = variant_desc->GetIndex(field) == index
+                          ? variant_desc->MutableActiveValue(field)
+                          : variant_desc->EmplaceAlternative(field, index);
+        return value != nullptr &&
+               RestoreValue(*step.plans[index], static_cast<char*>(value));
+      }
+    }
+    return false;
+  }
+
+  bool RestoreContainer(const OutOfLineStep& step, char* field) {
+    auto* container_desc = static_cast<ContainerDescriptor*>(step.desc);
+    const SnapshotPlan* key_plan = step.plans[0];
+    const SnapshotPlan& value_plan = *step.plans[1];
+    uint64_t size = 0;
+    if (!cursor_->ReadInt(&size)) return false;
+    int64_t fixed_size = container_desc->GetFixedSize();
+    if (fixed_size >= 0 && size != static_cast<uint64_t>(fixed_size)) {
+      return false;
+    }
+    size_t min_bytes = GetMinBytes(value_plan) +
+                       (key_plan == nullptr ? 0 : GetMinBytes(*key_plan));
+    // Elements stored in zero bytes, as empty structs, are only bounded by
+    // kMaxContainerSize.
+    if (min_bytes > 0 ? size > cursor_->GetRemaining() / min_bytes
+                      : size > kMaxContainerSize) {
+      return false;
+    }
+    if (step.bulk) {
+      size_t value_size = value_plan.desc->size_;
+      const char* values = nullptr;
+      if (!cursor_->Take(size * value_size, &values)) return false;
+      if (fixed_size >= 0) {
+        if (size > 0) {
+          std::memcpy(container_desc->MutableContiguousData(field), values,
+                      size * value_size);
+        }
+        return true;
+      }
+      container_desc->Clear(field);
+      container_desc->Reserve(field, size);
+      for (uint64_t i = 0; i < size; ++i) {
+        void* value = container_desc->EmplaceDefault(field);
+        if (value == nullptr) return false;
+        std::memcpy(value, values + i * value_size, value_size);
+      }
+      return true;
+    }
+    if (fixed_size >= 0) {
+      for (int64_t i = 0; i < fixed_size; ++i) {
+        void* value = container_desc->MutableValueByIndex(field, i);
+        if (value == nullptr ||
+            !RestoreValue(value_plan, static_cast<char*>(value))) {
+          return false;
+        }
+      }
+      return true;
+    }
+    container_desc->Clear(field);
+    KeyBuffer key;
+    if (key_plan != nullptr) {
+      for (uint64_t i = 0; i < size; ++i) {
+        void* key_ptr = RestoreKey(*key_plan, &key);
+        void* value = key_ptr == nullptr
+                          ? nullptr
+                          : container_desc->EmplaceByKey(field, key_ptr);
+        if (value == nullptr ||
+            !RestoreValue(value_plan, static_cast<char*>(value))) {
+          return false;
+        }
+      }
+      return true;
+    }
+    container_desc->Reserve(field, size);
+    for (uint64_t i = 0; i < size; ++i) {
+      void* value = container_desc->EmplaceDefault(field);
+      if (value != nullptr) {
+        if (!RestoreValue(value_plan, static_cast<char*>(value))) return false;
+        continue;
+      }
+      // Sets.
+      value = RestoreKey(value_plan, &key);
+      if (value == nullptr || !container_desc->AddValue(field, value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool RestoreSmartPtr(const OutOfLineStep& step, char* field) {
+    auto* ptr_desc = static_cast<SmartPtrDescriptor*>(step.desc);
+    const SnapshotPlan& content_plan = *step.plans[0];
+    bool is_shared = ptr_desc->IsSharedOwnership();
+    uint8_t tag = 0;
+    if (!cursor_->ReadInt(&tag)) return false;
+    if (tag == kNullTag) return ptr_desc->Reset(field);
+    if (tag == kReferenceTag && is_shared) {
+      uint64_t id = 0;
+      if (!cursor_->ReadInt(&id) || id >= shared_.size() ||
+          shared_[id].desc != content_plan.desc) {
+        return false;
+      }
+      return ptr_desc->SetSharedContent(field, shared_[id].content);
+    }
+    if (tag != kContentTag) return false;
+    // Shared content may be owned elsewhere, so it is replaced rather than
+    // overwritten, and registered before recursing, so that cycles resolve.
+    void* content = is_shared ? nullptr : ptr_desc->GetMutableRawPtr(field);
+    if (content == nullptr) content = ptr_desc->EmplaceContent(field);
+    if (content == nullptr) return false;
+    if (is_shared) {
+      shared_.push_back({content_plan.desc, ptr_desc->GetSharedContent(field)});
+    }
+    return RestoreValue(content_plan, static_cast<char*>(content));
+  }
+
+  // Restore a key of |plan| into |key| and return a pointer to it. Return
+  // nullptr for keys neither byte-copyable nor strings.
+  void* RestoreKey(const SnapshotPlan& plan, KeyBuffer* key) {
+    Descriptor* desc = plan.desc;
+    if (desc == nullptr) return nullptr;
+    if (desc->GetPrimitiveType() == PrimitiveType::kString) {
+      if (!RestoreValue(plan, reinterpret_cast<char*>(&key->string))) {
+        return nullptr;
+      }
+      return &key->string;
+    }
+    if (!desc->IsByteCopyable() || desc->size_ > sizeof(key->bytes) ||
+        !RestoreValue(plan, key->bytes)) {
+      return nullptr;
+    }
+    return key->bytes;
+  }
+
+  SnapshotCursor* cursor_;
+  std::vector<SharedContent> shared_;
+};
+
+}  // namespace
+
+/* Snapshot functions */
+
+void TakeSnapshot(const void* obj, Descriptor* desc, Snapshot* snapshot) {
+  snapshot->desc = desc;
+  snapshot->timestamp_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+  snapshot->data.clear();
+  if (obj == nullptr || desc == nullptr) return;
+  // Only filled by objects with shared pointers, so only cleared if used.
+  thread_local SharedIds shared;
+  if (!shared.empty()) shared.clear();
+  EpochReclaimer::Guard guard(SnapshotPlanCache::Get().GetReclaimer());
+  AppendValue(*GetPlan(desc), static_cast<const char*>(obj), &shared,
+              &snapshot->data);
+}
+
+bool RestoreSnapshot(const Snapshot& snapshot, void* obj) {
+  if (obj == nullptr || snapshot.desc == nullptr) return false;
+  SnapshotCursor cursor(snapshot.data);
+  SnapshotRestorer restorer(&cursor);
+  EpochReclaimer::Guard guard(SnapshotPlanCache::Get().GetReclaimer());
+  return restorer.RestoreValue(*GetPlan(snapshot.desc),
+                               static_cast<char*>(obj)) &&
+         cursor.IsEnd();
+}
+
+bool EncodeSnapshotBinary(const Snapshot& snapshot, std::string* out) {
+  if (snapshot.desc == nullptr) return false;
+  auto* class_desc = ClassDescriptor::ToClassDescriptor(snapshot.desc);
+  AppendInt<uint64_t>(class_desc == nullptr ? 0 : class_desc->GetFingerprint(),
+                      out);
+  AppendInt<uint64_t>(snapshot.sequence, out);
+  AppendInt<uint64_t>(snapshot.timestamp_ns, out);
+  AppendInt<uint64_t>(snapshot.data.size(), out);
+  out->append(snapshot.data);
+  return true;
+}
+
+bool EncodeSnapshotJson(const Snapshot& snapshot, std::string* out) {
+  if (snapshot.desc == nullptr) return false;
+  size_t rollback = out->size();
+  *out += "{\"type\":";
+  std::string type_name = snapshot.desc->GetTypeName();
+  AppendJsonString(type_name.data(), type_name.size(), out);
+  *out += ",\"sequence\":" + std::to_string(snapshot.sequence) +
+          ",\"timestamp_ns\":" + std::to_string(snapshot.timestamp_ns) +
+          ",\"value\":";
+  SnapshotCursor cursor(snapshot.data);
+  JsonEncoder encoder(&cursor, out);
+  EpochReclaimer::Guard guard(SnapshotPlanCache::Get().GetReclaimer());
+  if (!encoder.EncodeValue(*GetPlan(snapshot.desc)) || !cursor.IsEnd()) {
+    out->resize(rollback);
+    return false;
+  }
+  *out += "}\n";
+  return true;
+}
+
+}  // namespace reflection
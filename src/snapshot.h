@@ -0,0 +1,84 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "src/reflection.h"
+
+namespace reflection {
+
+/**
+ * Fast descriptor-driven copies of reflected objects into flat buffers, to be
+ * encoded later, e.g. by another thread (see snapshot_pipeline.h), or restored
+ * into objects.
+ *
+ * A value is stored as an image of its inline bytes, followed by out-of-line
+ * data of its fields. Fields that can be copied byte-wise (scalars, glm types,
+ * enums, fixed arrays of them) are copied into the image in place, with
+ * adjacent ones merged into one memcpy, nested classes included. Bytes of
+ * other fields and padding are zero in the image. Members annotated
+ * kMemberTransient are skipped: zero in the image, left out of JSON and left
+ * untouched by RestoreSnapshot(), except in elements of dynamic containers,
+ * which are recreated default constructed. Out-of-line data follows in field
+ * order:
+ *   string: uint64 size, bytes
+ *   container: uint64 size, then values as one memcpy when contiguous,
+ *              trivially copyable and without transient members, otherwise
+ *              every key and value as above
+ *   smart pointer, optional: uint8 1 and content, or uint8 0 if empty
+ *   shared pointer: as above the first time its content is met, then uint8 2
+ *                   and uint64 id of content, numbered from 0 in order of
+ *                   first visit
+ *   variant: int32 index (-1 if valueless) and active alternative
+ *   protobuf message: uint64 size, serialized message
+ * Values without byte-wise copyable fields have no image. Content shared by
+ * several shared pointers is stored once, so graphs with cycles of shared
+ * pointers are fine. Snapshots are in native byte order and layout, and only
+ * readable by the same build; use the encoders below to export them.
+ *
+ * Usage:
+ *   Snapshot snapshot;
+ *   TakeSnapshot(&pose, DESC("Pose"), &snapshot);  // reuses buffer capacity
+ *   std::string json;
+ *   EncodeSnapshotJson(snapshot, &json);
+ *   Pose copy;
+ *   RestoreSnapshot(snapshot, &copy);
+ */
+
+struct Snapshot {
+  Descriptor* desc{nullptr};
+  // Set by the taker, e.g. SnapshotPipeline numbers submissions.
+  uint64_t sequence{0};
+  // Steady clock time when taken.
+  int64_t timestamp_ns{0};
+  std::string data;
+};
+
+// Copy |obj| described by |desc| into |snapshot|, replacing its data but
+// keeping buffer capacity.
+void TakeSnapshot(const void* obj, Descriptor* desc, Snapshot* snapshot);
+
+// Restore |obj| described by snapshot.desc from |snapshot|, taken by the same
+// build. Fields are overwritten, contents of shared pointers replaced, and
+// pointers that shared content when taken share one new content. Return false
+// if data is corrupted or can't be restored: keys of maps and values of sets
+// must be byte-copyable and up to 64 bytes, or strings.
+bool RestoreSnapshot(const Snapshot& snapshot, void* obj);
+
+// Append a record to |out|: fingerprint of root class (0 if not a class),
+// sequence, timestamp (all uint64), data size (uint64) and data. Return false
+// for snapshots without descriptor.
+bool EncodeSnapshotBinary(const Snapshot& snapshot, std::string* out);
+
+// Append a JSON line to |out|: {"type":..., "sequence":..., "timestamp_ns":...,
+// "value":...}. Classes become objects, containers arrays (map elements
+// [key, value] pairs), empty pointers null, shared content met before
+// {"$ref": id} with id as in snapshot data, enums their value name if any,
+// glm types arrays of floats and protobuf messages base64 strings of
+// serialized bytes. Return false if data is corrupted.
+bool EncodeSnapshotJson(const Snapshot& snapshot, std::string* out);
+
+}  // namespace reflection
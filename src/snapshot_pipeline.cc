@@ -0,0 +1,226 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/snapshot_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+namespace reflection {
+
+namespace {
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+PipelineStageStats GetStageStats(const LatencyHistogram& histogram) {
+  PipelineStageStats stats;
+  stats.count = histogram.GetCount();
+  stats.p50_ns = histogram.GetPercentile(50);
+  stats.p99_ns = histogram.GetPercentile(99);
+  return stats;
+}
+
+void AppendStageText(std::ostringstream* stream, const char* name,
+                     const PipelineStageStats& stage) {
+  *stream << "  " << name << ": count=" << stage.count
+          << " p50=" << stage.p50_ns << "ns p99=" << stage.p99_ns << "ns\n";
+}
+
+void AppendStageJson(std::ostringstream* stream, const char* name,
+                     const PipelineStageStats& stage) {
+  *stream << ",\"" << name << "\":{\"count\":" << stage.count
+          << ",\"p50_ns\":" << stage.p50_ns << ",\"p99_ns\":" << stage.p99_ns
+          << "}";
+}
+
+}  // namespace
+
+/* PipelineStats methods */
+
+std::string PipelineStats::ToText() const {
+  std::ostringstream stream;
+  stream << "submitted=" << submitted << " dropped=" << dropped
+         << " written=" << written << " encode_failures=" << encode_failures
+         << " sink_failures=" << sink_failures << "\n";
+  AppendStageText(&stream, "snapshot", snapshot);
+  AppendStageText(&stream, "queue", queue);
+  AppendStageText(&stream, "encode", encode);
+  AppendStageText(&stream, "sink", sink);
+  return stream.str();
+}
+
+std::string PipelineStats::ToJson() const {
+  std::ostringstream stream;
+  stream << "{\"submitted\":" << submitted << ",\"dropped\":" << dropped
+         << ",\"written\":" << written
+         << ",\"encode_failures\":" << encode_failures
+         << ",\"sink_failures\":" << sink_failures;
+  AppendStageJson(&stream, "snapshot", snapshot);
+  AppendStageJson(&stream, "queue", queue);
+  AppendStageJson(&stream, "encode", encode);
+  AppendStageJson(&stream, "sink", sink);
+  stream << "}";
+  return stream.str();
+}
+
+/* SnapshotPipeline methods */
+
+SnapshotPipeline::SnapshotPipeline(SnapshotSink sink,
+                                   const PipelineOptions& options)
+    : sink_(std::move(sink)),
+      options_(options),
+      queue_(std::max<size_t>(options.queue_capacity, 1)),
+      pool_(std::max<size_t>(options.pool_size, 1)) {
+  size_t worker_size = std::max<size_t>(options.worker_size, 1);
+  for (size_t i = 0; i < worker_size; ++i) {
+    workers_.emplace_back(&SnapshotPipeline::WorkerLoop, this);
+  }
+}
+
+SnapshotPipeline::~SnapshotPipeline() {
+  {
+    // Under the mutex, so that no worker misses it between check and wait.
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& worker : workers_) worker.join();
+  Snapshot* snapshot;
+  while (pool_.TryPop(&snapshot)) delete snapshot;
+}
+
+bool SnapshotPipeline::Submit(const void* obj, Descriptor* desc) {
+  int64_t start = NowNanos();
+  Snapshot* snapshot = AcquireSnapshot();
+  TakeSnapshot(obj, desc, snapshot);
+  snapshot->sequence = next_sequence_.fetch_add(1, std::memory_order_relaxed);
+  ++submitted_;
+  ++pending_;
+
+  QueuedSnapshot entry{snapshot, NowNanos()};
+  bool queued = true;
+  switch (options_.overflow_policy) {
+    case OverflowPolicy::kBlock:
+      while (!queue_.TryPush(entry)) std::this_thread::yield();
+      break;
+    case OverflowPolicy::kDropNewest:
+      queued = queue_.TryPush(entry);
+      break;
+    case OverflowPolicy::kDropOldest:
+      while (!queue_.TryPush(entry)) {
+        QueuedSnapshot oldest;
+        if (queue_.TryPop(&oldest)) {
+          ++dropped_;
+          FinishSnapshot(oldest.snapshot);
+        }
+      }
+      break;
+  }
+  snapshot_latency_.Record(NowNanos() - start);
+  if (!queued) {
+    ++dropped_;
+    FinishSnapshot(snapshot);
+    return false;
+  }
+  // Pairs with the increment of sleeping_workers_ in WorkerLoop(): either the
+  // worker sees the snapshot queued, or this sees the worker.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_workers_.load() > 0) {
+    // A worker counted is in its wait once the mutex is free.
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    wake_.notify_one();
+  }
+  return true;
+}
+
+void SnapshotPipeline::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return pending_.load() == 0; });
+}
+
+PipelineStats SnapshotPipeline::GetStats() const {
+  PipelineStats stats;
+  stats.submitted = submitted_.load();
+  stats.dropped = dropped_.load();
+  stats.written = written_.load();
+  stats.encode_failures = encode_failures_.load();
+  stats.sink_failures = sink_failures_.load();
+  stats.snapshot = GetStageStats(snapshot_latency_);
+  stats.queue = GetStageStats(queue_latency_);
+  stats.encode = GetStageStats(encode_latency_);
+  stats.sink = GetStageStats(sink_latency_);
+  return stats;
+}
+
+Snapshot* SnapshotPipeline::AcquireSnapshot() {
+  Snapshot* snapshot;
+  if (pool_.TryPop(&snapshot)) return snapshot;
+  return new Snapshot;
+}
+
+void SnapshotPipeline::ReleaseSnapshot(Snapshot* snapshot) {
+  if (!pool_.TryPush(snapshot)) delete snapshot;
+}
+
+void SnapshotPipeline::FinishSnapshot(Snapshot* snapshot) {
+  ReleaseSnapshot(snapshot);
+  if (pending_.fetch_sub(1) == 1) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.notify_all();
+  }
+}
+
+void SnapshotPipeline::WorkerLoop() {
+  std::string record;
+  while (true) {
+    QueuedSnapshot queued;
+    if (queue_.TryPop(&queued)) {
+      Process(queued, &record);
+      FinishSnapshot(queued.snapshot);
+      continue;
+    }
+    // Queue is drained, and nothing is submitted after destruction starts.
+    if (stopping_) break;
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++sleeping_workers_;
+    wake_.wait(lock, [this]() {
+      return stopping_ || queue_.GetSizeHint() > 0;
+    });
+    --sleeping_workers_;
+  }
+}
+
+void SnapshotPipeline::Process(const QueuedSnapshot& queued,
+                               std::string* record) {
+  const Snapshot* snapshot = queued.snapshot;
+  int64_t start = NowNanos();
+  queue_latency_.Record(start - queued.queued_ns);
+  record->clear();
+  bool encoded = options_.encoding == SnapshotEncoding::kJson
+                     ? EncodeSnapshotJson(*snapshot, record)
+                     : EncodeSnapshotBinary(*snapshot, record);
+  int64_t encode_end = NowNanos();
+  encode_latency_.Record(encode_end - start);
+  if (!encoded) {
+    ++encode_failures_;
+    return;
+  }
+
+  bool sunk;
+  {
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    sunk = sink_(*record);
+  }
+  sink_latency_.Record(NowNanos() - encode_end);
+  if (sunk) {
+    ++written_;
+  } else {
+    ++sink_failures_;
+  }
+}
+
+}  // namespace reflection
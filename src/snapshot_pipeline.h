@@ -0,0 +1,165 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/bounded_queue.h"
+#include "src/instrumentation.h"
+#include "src/snapshot.h"
+
+namespace reflection {
+
+/**
+ * Serialization of reflected objects off the calling thread. Submit() takes a
+ * snapshot (see snapshot.h) into a pooled buffer and queues it, which is all
+ * the caller pays. Background workers encode snapshots and hand records to a
+ * sink.
+ *
+ * The sink is called by one worker at a time, so it needs no locking, but
+ * with more than one worker records may arrive out of sequence order.
+ *
+ * Usage:
+ *   std::ofstream file("state.jsonl");
+ *   PipelineOptions options;
+ *   options.encoding = SnapshotEncoding::kJson;
+ *   SnapshotPipeline pipeline(
+ *       [&](const std::string& record) {
+ *         file << record;
+ *         return file.good();
+ *       },
+ *       options);
+ *   while (running) {
+ *     Step(&state);
+ *     pipeline.Submit(&state, DESC("State"));
+ *   }
+ *   pipeline.Flush();
+ *   std::cout << pipeline.GetStats().ToText();
+ */
+
+enum class SnapshotEncoding {
+  // See EncodeSnapshotBinary().
+  kBinary,
+  // See EncodeSnapshotJson().
+  kJson,
+};
+
+// What Submit() does when the queue is full.
+enum class OverflowPolicy {
+  // Wait until a worker makes room.
+  kBlock,
+  // Drop the snapshot being submitted.
+  kDropNewest,
+  // Drop the oldest queued snapshot to make room.
+  kDropOldest,
+};
+
+struct PipelineOptions {
+  size_t queue_capacity{1024};
+  size_t worker_size{1};
+  OverflowPolicy overflow_policy{OverflowPolicy::kDropNewest};
+  SnapshotEncoding encoding{SnapshotEncoding::kBinary};
+  // Snapshot buffers kept for reuse. Buffers beyond are freed after use.
+  size_t pool_size{1024};
+};
+
+// Receive an encoded record. Return false on failure, which is counted.
+using SnapshotSink = std::function<bool(const std::string& record)>;
+
+struct PipelineStageStats {
+  uint64_t count{0};
+  int64_t p50_ns{0};
+  int64_t p99_ns{0};
+};
+
+struct PipelineStats {
+  uint64_t submitted{0};
+  uint64_t dropped{0};
+  uint64_t written{0};
+  uint64_t encode_failures{0};
+  uint64_t sink_failures{0};
+  // Snapshot taken in Submit(), time from queueing until a worker picks it
+  // up, encoding, and sink call.
+  PipelineStageStats snapshot;
+  PipelineStageStats queue;
+  PipelineStageStats encode;
+  PipelineStageStats sink;
+
+  std::string ToText() const;
+
+  std::string ToJson() const;
+};
+
+class SnapshotPipeline {
+ public:
+  SnapshotPipeline(SnapshotSink sink,
+                   const PipelineOptions& options = PipelineOptions());
+
+  // Write all queued snapshots, then join workers.
+  ~SnapshotPipeline();
+
+  SnapshotPipeline(const SnapshotPipeline&) = delete;
+  SnapshotPipeline& operator=(const SnapshotPipeline&) = delete;
+
+  // Snapshot |obj| described by |desc| and queue it. Safe to call from many
+  // threads. Return false if the snapshot is dropped.
+  bool Submit(const void* obj, Descriptor* desc);
+
+  // Wait until every snapshot submitted so far is written or dropped.
+  void Flush();
+
+  PipelineStats GetStats() const;
+
+ private:
+  struct QueuedSnapshot {
+    Snapshot* snapshot{nullptr};
+    // Steady clock time when queued, after the snapshot was taken.
+    int64_t queued_ns{0};
+  };
+
+  Snapshot* AcquireSnapshot();
+
+  void ReleaseSnapshot(Snapshot* snapshot);
+
+  // Mark a snapshot submitted earlier as done, written or dropped.
+  void FinishSnapshot(Snapshot* snapshot);
+
+  void WorkerLoop();
+
+  void Process(const QueuedSnapshot& queued, std::string* record);
+
+  SnapshotSink sink_;
+  PipelineOptions options_;
+  BoundedQueue<QueuedSnapshot> queue_;
+  BoundedQueue<Snapshot*> pool_;
+  std::vector<std::thread> workers_;
+  std::mutex sink_mutex_;
+
+  std::atomic<uint64_t> next_sequence_{0};
+  // Snapshots submitted and not yet written or dropped.
+  std::atomic<uint64_t> pending_{0};
+  std::atomic<size_t> sleeping_workers_{0};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::atomic<bool> stopping_{false};
+
+  std::atomic<uint64_t> submitted_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> written_{0};
+  std::atomic<uint64_t> encode_failures_{0};
+  std::atomic<uint64_t> sink_failures_{0};
+  LatencyHistogram snapshot_latency_;
+  LatencyHistogram queue_latency_;
+  LatencyHistogram encode_latency_;
+  LatencyHistogram sink_latency_;
+};
+
+}  // namespace reflection
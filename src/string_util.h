@@ -29,6 +29,41 @@ class StringUtil {
     AddToStream(s, std::forward<Args>(args)...);
     return s.str();
   }
+
+  // Escape a string to be embedded in a JSON string literal, without quotes.
+  static std::string JsonEscape(const std::string& str) {
+    std::string escaped;
+    escaped.reserve(str.size());
+    for (char c : str) {
+      switch (c) {
+        case '"':
+          escaped += "\\\"";
+          break;
+        case '\\':
+          escaped += "\\\\";
+          break;
+        case '\n':
+          escaped += "\\n";
+          break;
+        case '\r':
+          escaped += "\\r";
+          break;
+        case '\t':
+          escaped += "\\t";
+          break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20) {
+            static const char* kHex = "0123456789abcdef";
+            escaped += "\\u00";
+            escaped += kHex[(c >> 4) & 0xf];
+            escaped += kHex[c & 0xf];
+          } else {
+            escaped += c;
+          }
+      }
+    }
+    return escaped;
+  }
 };
 
 }  // namespace reflection
\ No newline at end of file
@@ -8,25 +8,25 @@ REGISTER(ReflectionTestPtr, ReflectionTestPtr)
 
 void DumpItem(const void* val, reflection::Descriptor* field_desc) {
   // Dump base types.
-  if (field_desc->GetTypeName() == "int32_t") {
+  if (field_desc->GetTypeNameView() == "int32_t") {
     std::cout << "Field val: " << *field_desc->ToTypePtr<int32_t>(val)
               << std::endl;
-  } else if (field_desc->GetTypeName() == "float") {
+  } else if (field_desc->GetTypeNameView() == "float") {
     std::cout << "Field val: " << *field_desc->ToTypePtr<float>(val)
               << std::endl;
-  } else if (field_desc->GetTypeName() == "int64_t") {
+  } else if (field_desc->GetTypeNameView() == "int64_t") {
     std::cout << "Field val: " << *field_desc->ToTypePtr<int64_t>(val)
               << std::endl;
-  } else if (field_desc->GetTypeName() == "double") {
+  } else if (field_desc->GetTypeNameView() == "double") {
     std::cout << "Field val: " << *field_desc->ToTypePtr<double>(val)
               << std::endl;
-  } else if (field_desc->GetTypeName() == "std::string") {
+  } else if (field_desc->GetTypeNameView() == "std::string") {
     std::cout << "Field val: " << *field_desc->ToTypePtr<std::string>(val)
               << std::endl;
-  } else if (field_desc->GetTypeName() == "char") {
+  } else if (field_desc->GetTypeNameView() == "char") {
     std::cout << "Field val: " << *field_desc->ToTypePtr<char>(val)
               << std::endl;
-  } else if (field_desc->GetTypeName() == "glm::vec3") {
+  } else if (field_desc->GetTypeNameView() == "glm::vec3") {
     const auto& val_ref = *field_desc->ToTypePtr<glm::vec3>(val);
     std::cout << "Field val: " << val_ref.x << " " << val_ref.y << " "
               << val_ref.z << std::endl;
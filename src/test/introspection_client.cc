@@ -0,0 +1,103 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+//
+// Local client of IntrospectionServer, see src/introspection_server.h.
+//
+// Usage:
+//   introspection_client <socket> LIST
+//   introspection_client <socket> GET state 'tracks[0].pose'
+//   introspection_client <socket>  # one request per line from stdin
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+
+int Connect(const std::string& path) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "socket path too long: " << path << std::endl;
+    return -1;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    std::cerr << "connect " << path << ": " << std::strerror(errno)
+              << std::endl;
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Send |request| and read one response line into |response|, keeping bytes
+// past it in |pending|.
+bool Request(int fd, const std::string& request, std::string* pending,
+             std::string* response) {
+  std::string line = request + "\n";
+  size_t sent = 0;
+  while (sent < line.size()) {
+    ssize_t size =
+        send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) return false;
+    sent += size;
+  }
+  size_t end;
+  while ((end = pending->find('\n')) == std::string::npos) {
+    char buffer[4096];
+    ssize_t size = recv(fd, buffer, sizeof(buffer), 0);
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) return false;
+    pending->append(buffer, size);
+  }
+  response->assign(*pending, 0, end);
+  pending->erase(0, end + 1);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <socket> [request...]"
+              << std::endl;
+    return 2;
+  }
+  int fd = Connect(argv[1]);
+  if (fd < 0) return 1;
+
+  std::string pending;
+  std::string response;
+  int status = 0;
+  if (argc > 2) {
+    std::string request = argv[2];
+    for (int i = 3; i < argc; ++i) request += std::string(" ") + argv[i];
+    if (Request(fd, request, &pending, &response)) {
+      std::cout << response << std::endl;
+    } else {
+      status = 1;
+    }
+  } else {
+    std::string request;
+    while (std::getline(std::cin, request)) {
+      if (request.empty()) continue;
+      if (!Request(fd, request, &pending, &response)) {
+        status = 1;
+        break;
+      }
+      std::cout << response << std::endl;
+    }
+  }
+  if (status != 0) std::cerr << "connection closed" << std::endl;
+  close(fd);
+  return status;
+}
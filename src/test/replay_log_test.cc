@@ -0,0 +1,227 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+//
+// Replay logs restore every recorded frame, whether read in order, after a
+// seek into a run of delta frames, or from a log cut short without index.
+// Quantized fields are restored at multiples of their quantum.
+#include <cmath>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "src/replay_log.h"
+
+namespace {
+
+struct ReplayPose {
+  USE_REFLECTION_CLASS();
+
+  double x{0.0};
+  float heading{0.0f};
+  glm::vec3 velocity{0.0f, 0.0f, 0.0f};
+};
+
+ADD_REFLECTION_CLASS_MEMBER(ReplayPose, x, heading, velocity);
+ANNOTATE_REFLECTION_MEMBER(ReplayPose, heading, reflection::kMemberQuantized,
+                           0.25);
+ANNOTATE_REFLECTION_MEMBER(ReplayPose, velocity, reflection::kMemberQuantized,
+                           1.0 / 64);
+REGISTER(ReplayPose, ReplayPose);
+
+struct ReplayState {
+  USE_REFLECTION_CLASS();
+
+  int64_t id{0};
+  std::string name;
+  ReplayPose pose;
+  std::vector<int32_t> samples;
+  std::set<std::string> tags;
+  std::set<int16_t> codes;
+  boost::variant<int32_t, std::string> value;
+  int32_t cache_{0};
+};
+
+ADD_REFLECTION_CLASS_MEMBER(ReplayState, id, name, pose, samples, tags, codes,
+                            value, cache_);
+ANNOTATE_REFLECTION_MEMBER(ReplayState, cache_, reflection::kMemberTransient);
+REGISTER(ReplayState, ReplayState);
+
+const uint32_t kKeyframeInterval = 8;
+const size_t kFrameSize = 40;
+
+int64_t GetTimestamp(size_t frame) { return 1000 + 10 * frame; }
+
+// A slowly changing state, with quantized fields already at multiples of
+// their quantum, so that they are restored exactly.
+ReplayState MakeState(size_t frame) {
+  ReplayState state;
+  state.id = 100 + frame;
+  state.name = "track_" + std::to_string(frame / 5);
+  state.pose.x = 0.1 * frame;
+  state.pose.heading = 0.25f * frame;
+  state.pose.velocity = glm::vec3(1.0f, -0.5f * frame, 3.0f / 64);
+  for (size_t i = 0; i < frame % 4; ++i) state.samples.push_back(i * frame);
+  state.tags.insert("moving");
+  if (frame % 3 == 0) state.tags.insert("occluded");
+  state.codes.insert(static_cast<int16_t>(frame % 7));
+  state.codes.insert(-3);
+  if (frame % 6 < 3) {
+    state.value = static_cast<int32_t>(frame);
+  } else {
+    state.value = "value_" + std::to_string(frame);
+  }
+  state.cache_ = 42;
+  return state;
+}
+
+void ExpectState(size_t frame, const ReplayState& state) {
+  SCOPED_TRACE("frame " + std::to_string(frame));
+  ReplayState expected = MakeState(frame);
+  EXPECT_EQ(state.id, expected.id);
+  EXPECT_EQ(state.name, expected.name);
+  EXPECT_EQ(state.pose.x, expected.pose.x);
+  EXPECT_EQ(state.pose.heading, expected.pose.heading);
+  EXPECT_EQ(state.pose.velocity.x, expected.pose.velocity.x);
+  EXPECT_EQ(state.pose.velocity.y, expected.pose.velocity.y);
+  EXPECT_EQ(state.pose.velocity.z, expected.pose.velocity.z);
+  EXPECT_EQ(state.samples, expected.samples);
+  EXPECT_EQ(state.tags, expected.tags);
+  EXPECT_EQ(state.codes, expected.codes);
+  EXPECT_EQ(state.value, expected.value);
+}
+
+// Write kFrameSize frames to |out|, finished with an index if |finish|.
+std::string WriteLog(bool finish) {
+  std::stringstream out;
+  reflection::ReplayLogOptions options;
+  options.keyframe_interval = kKeyframeInterval;
+  reflection::ReplayLogWriter writer(DESC("ReplayState"), &out, options);
+  EXPECT_TRUE(writer.IsValid()) << writer.GetError();
+  for (size_t i = 0; i < kFrameSize; ++i) {
+    ReplayState state = MakeState(i);
+    EXPECT_TRUE(writer.Append(&state, GetTimestamp(i))) << writer.GetError();
+  }
+  if (finish) {
+    EXPECT_TRUE(writer.Finish()) << writer.GetError();
+  }
+  return out.str();
+}
+
+}  // namespace
+
+namespace reflection {
+
+TEST(ReplayLogTest, RoundTripsKeyframesAndDeltas) {
+  std::stringstream in(WriteLog(true));
+  ReplayLogReader reader(DESC("ReplayState"), &in);
+  ASSERT_TRUE(reader.IsValid()) << reader.GetError();
+  ASSERT_EQ(reader.GetFrameSize(), kFrameSize);
+
+  const auto& frames = reader.GetFrames();
+  for (size_t i = 0; i < kFrameSize; ++i) {
+    EXPECT_EQ(frames[i].keyframe, i % kKeyframeInterval == 0) << i;
+    EXPECT_EQ(frames[i].timestamp_ns, GetTimestamp(i)) << i;
+  }
+  // Delta frames of a slowly changing state take less than keyframes.
+  EXPECT_LT(frames[10].offset - frames[9].offset,
+            frames[9].offset - frames[8].offset);
+
+  ReplayState state;
+  state.cache_ = 7;
+  int64_t timestamp_ns = 0;
+  for (size_t i = 0; i < kFrameSize; ++i) {
+    ASSERT_TRUE(reader.Next(&state, &timestamp_ns)) << reader.GetError();
+    EXPECT_EQ(timestamp_ns, GetTimestamp(i));
+    ExpectState(i, state);
+  }
+  EXPECT_EQ(state.cache_, 7);
+  EXPECT_FALSE(reader.Next(&state));
+}
+
+TEST(ReplayLogTest, QuantizesAnnotatedFields) {
+  std::stringstream log;
+  {
+    ReplayLogWriter writer(DESC("ReplayState"), &log);
+    ReplayState state = MakeState(1);
+    state.pose.x = 0.3;
+    state.pose.heading = 0.3f;
+    state.pose.velocity = glm::vec3(0.01f, -1.1f, 2.0f);
+    ASSERT_TRUE(writer.Append(&state)) << writer.GetError();
+  }
+
+  ReplayLogReader reader(DESC("ReplayState"), &log);
+  ASSERT_TRUE(reader.IsValid()) << reader.GetError();
+  ReplayState state;
+  ASSERT_TRUE(reader.Next(&state)) << reader.GetError();
+  EXPECT_EQ(state.pose.x, 0.3);
+  EXPECT_EQ(state.pose.heading, 0.25f);
+  EXPECT_EQ(state.pose.velocity.x, 1.0f / 64);
+  EXPECT_EQ(state.pose.velocity.y, -70.0f / 64);
+  EXPECT_EQ(state.pose.velocity.z, 2.0f);
+}
+
+TEST(ReplayLogTest, SeeksIntoDeltaRuns) {
+  std::stringstream in(WriteLog(true));
+  ReplayLogReader reader(DESC("ReplayState"), &in);
+  ASSERT_TRUE(reader.IsValid()) << reader.GetError();
+
+  ReplayState state;
+  // Between keyframes 8 and 16, decoded from the keyframe before.
+  ASSERT_TRUE(reader.Seek(13));
+  ASSERT_TRUE(reader.Next(&state)) << reader.GetError();
+  ExpectState(13, state);
+  ASSERT_TRUE(reader.Next(&state)) << reader.GetError();
+  ExpectState(14, state);
+
+  // Backwards, into the first run.
+  ASSERT_TRUE(reader.Seek(5));
+  ASSERT_TRUE(reader.Next(&state)) << reader.GetError();
+  ExpectState(5, state);
+
+  // Between timestamps of frames 20 and 21.
+  ASSERT_TRUE(reader.SeekToTime(GetTimestamp(20) + 1));
+  EXPECT_EQ(reader.GetPosition(), 21u);
+  int64_t timestamp_ns = 0;
+  ASSERT_TRUE(reader.Next(&state, &timestamp_ns)) << reader.GetError();
+  EXPECT_EQ(timestamp_ns, GetTimestamp(21));
+  ExpectState(21, state);
+
+  ASSERT_TRUE(reader.Seek(kFrameSize - 1));
+  ASSERT_TRUE(reader.Next(&state)) << reader.GetError();
+  ExpectState(kFrameSize - 1, state);
+  EXPECT_FALSE(reader.Seek(kFrameSize + 1));
+}
+
+TEST(ReplayLogTest, ScansUnfinishedLog) {
+  std::string log = WriteLog(false);
+  std::string finished = WriteLog(true);
+  ASSERT_LT(log.size(), finished.size());
+
+  // Every frame complete, only the index missing.
+  {
+    std::stringstream in(log);
+    ReplayLogReader reader(DESC("ReplayState"), &in);
+    ASSERT_TRUE(reader.IsValid()) << reader.GetError();
+    ASSERT_EQ(reader.GetFrameSize(), kFrameSize);
+    ASSERT_TRUE(reader.Seek(27));
+    ReplayState state;
+    ASSERT_TRUE(reader.Next(&state)) << reader.GetError();
+    ExpectState(27, state);
+  }
+
+  // Last frame cut short, e.g. by a crash while writing it.
+  std::stringstream in(log.substr(0, log.size() - 3));
+  ReplayLogReader reader(DESC("ReplayState"), &in);
+  ASSERT_TRUE(reader.IsValid()) << reader.GetError();
+  ASSERT_EQ(reader.GetFrameSize(), kFrameSize - 1);
+  ReplayState state;
+  for (size_t i = 0; i + 1 < kFrameSize; ++i) {
+    ASSERT_TRUE(reader.Next(&state)) << reader.GetError();
+    ExpectState(i, state);
+  }
+  EXPECT_FALSE(reader.Next(&state));
+}
+
+}  // namespace reflection
@@ -0,0 +1,118 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+//
+// Members annotated kMemberTransient are never copied, including inside
+// elements of containers and fixed arrays that are otherwise copied with one
+// memcpy.
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "src/columnar.h"
+#include "src/shared_segment.h"
+#include "src/snapshot.h"
+
+namespace {
+
+struct CachedPoint {
+  USE_REFLECTION_CLASS();
+
+  int32_t id{0};
+  int32_t cache_{0};
+  float x{0.0f};
+};
+
+ADD_REFLECTION_CLASS_MEMBER(CachedPoint, id, cache_, x);
+ANNOTATE_REFLECTION_MEMBER(CachedPoint, cache_, reflection::kMemberTransient);
+REGISTER(CachedPoint, CachedPoint);
+
+struct Track {
+  USE_REFLECTION_CLASS();
+
+  std::vector<CachedPoint> points;
+  std::array<CachedPoint, 2> corners;
+  CachedPoint center;
+};
+
+ADD_REFLECTION_CLASS_MEMBER(Track, points, corners, center);
+REGISTER(Track, Track);
+
+Track MakeTrack(int32_t cache) {
+  Track track;
+  track.points = {{1, cache, 1.5f}, {2, cache, 2.5f}};
+  track.corners = {{{3, cache, 3.5f}, {4, cache, 4.5f}}};
+  track.center = {5, cache, 5.5f};
+  return track;
+}
+
+}  // namespace
+
+namespace reflection {
+
+TEST(TransientMemberTest, SnapshotRestoreLeavesTransientBytes) {
+  Track track = MakeTrack(42);
+  Snapshot snapshot;
+  TakeSnapshot(&track, DESC("Track"), &snapshot);
+
+  std::string json;
+  ASSERT_TRUE(EncodeSnapshotJson(snapshot, &json));
+  EXPECT_EQ(json.find("cache_"), std::string::npos);
+  EXPECT_EQ(json.find("42"), std::string::npos);
+
+  Track restored = MakeTrack(7);
+  ASSERT_TRUE(RestoreSnapshot(snapshot, &restored));
+  // Fixed arrays and nested classes are restored in place.
+  EXPECT_EQ(restored.corners[0].cache_, 7);
+  EXPECT_EQ(restored.corners[1].cache_, 7);
+  EXPECT_EQ(restored.center.cache_, 7);
+  EXPECT_EQ(restored.corners[1].id, 4);
+  EXPECT_EQ(restored.center.x, 5.5f);
+  // Elements of vectors are recreated, without the snapshot's cache.
+  ASSERT_EQ(restored.points.size(), 2u);
+  EXPECT_EQ(restored.points[0].cache_, 0);
+  EXPECT_EQ(restored.points[1].cache_, 0);
+  EXPECT_EQ(restored.points[1].id, 2);
+  EXPECT_EQ(restored.points[1].x, 2.5f);
+}
+
+TEST(TransientMemberTest, SharedSegmentLeavesTransientBytesZero) {
+  const std::string name = "/transient_test_" + std::to_string(getpid());
+  auto segment = SharedSegment::Create(name, 1 << 20);
+  ASSERT_NE(segment, nullptr);
+  SharedSegment::Unlink(name);
+
+  Track track = MakeTrack(42);
+  uint64_t offset = segment->Write(&track, DESC("Track"));
+  ASSERT_NE(offset, 0u);
+  RelocatableView root = segment->GetView(offset, DESC("Track"));
+  RelocatableView points = root.GetField("points");
+  ASSERT_EQ(points.GetSize(), 2u);
+  for (const RelocatableView& point :
+       {points.GetElement(0), points.GetElement(1), root.GetField("center")}) {
+    EXPECT_FALSE(point.GetField("cache_").IsValid());
+    const int32_t* id = point.GetField("id").As<int32_t>();
+    ASSERT_NE(id, nullptr);
+    int32_t cache = -1;
+    std::memcpy(&cache,
+                reinterpret_cast<const char*>(id) -
+                    offsetof(CachedPoint, id) + offsetof(CachedPoint, cache_),
+                sizeof(cache));
+    EXPECT_EQ(cache, 0);
+  }
+  EXPECT_EQ(*points.GetElement(1).GetField("id").As<int32_t>(), 2);
+}
+
+TEST(TransientMemberTest, ColumnarSkipsArraysWithTransientMembers) {
+  ColumnarWriter writer(TO_CLASS_DESC(DESC("Track")));
+  for (const auto& column : writer.GetColumns()) {
+    EXPECT_EQ(column.name.find("cache_"), std::string::npos) << column.name;
+    EXPECT_NE(column.name, "corners");
+  }
+}
+
+}  // namespace reflection
@@ -0,0 +1,158 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#include "src/work_stealing_pool.h"
+
+#include <chrono>
+
+namespace reflection {
+
+namespace {
+
+// Pool and worker index of current thread, if it is a pool worker.
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t thread_size) {
+  if (thread_size == 0) thread_size = std::thread::hardware_concurrency();
+  if (thread_size == 0) thread_size = 1;
+  for (size_t i = 0; i < thread_size; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  for (size_t i = 0; i < thread_size; ++i) {
+    threads_.emplace_back([this, i]() { WorkerLoop(i); });
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+void WorkStealingPool::Submit(std::function<void()> task) {
+  size_t worker = GetCurrentWorker();
+  if (worker >= workers_.size()) {
+    worker = next_worker_.fetch_add(1, std::memory_order_relaxed) %
+             workers_.size();
+  }
+  PushTask(worker, std::move(task));
+  WakeWorkers(false);
+}
+
+void WorkStealingPool::ParallelFor(size_t count,
+                                   const std::function<void(size_t)>& func) {
+  if (count == 0) return;
+  if (count == 1) {
+    func(0);
+    return;
+  }
+
+  struct State {
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  auto state = std::make_shared<State>();
+  state->remaining.store(count);
+
+  // Deal tasks round-robin, so that workers start with balanced deques.
+  size_t first = next_worker_.fetch_add(1, std::memory_order_relaxed);
+  for (size_t i = 0; i < count; ++i) {
+    PushTask((first + i) % workers_.size(), [state, &func, i]() {
+      func(i);
+      if (state->remaining.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->done.notify_all();
+      }
+    });
+  }
+  WakeWorkers(true);
+
+  while (state->remaining.load() > 0) {
+    if (RunPendingTask()) continue;
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait_for(lock, std::chrono::milliseconds(1),
+                         [&state]() { return state->remaining.load() == 0; });
+  }
+}
+
+bool WorkStealingPool::RunPendingTask() {
+  std::function<void()> task;
+  if (!PopTask(GetCurrentWorker(), &task)) return false;
+  task();
+  return true;
+}
+
+bool WorkStealingPool::PopTask(size_t self, std::function<void()>* task) {
+  if (pending_.load() == 0) return false;
+  size_t size = workers_.size();
+  if (self < size) {
+    Worker& worker = *workers_[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      *task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  size_t start = self < size ? self + 1 : 0;
+  for (size_t i = 0; i < size; ++i) {
+    Worker& victim = *workers_[(start + i) % size];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::PushTask(size_t worker, std::function<void()> task) {
+  // Count first, so that pending_ never underflows when the task is popped
+  // right after push.
+  pending_.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+    workers_[worker]->tasks.push_back(std::move(task));
+  }
+}
+
+void WorkStealingPool::WakeWorkers(bool all) {
+  // Lock so that a worker about to sleep can't miss the wake-up.
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  if (all) {
+    wake_.notify_all();
+  } else {
+    wake_.notify_one();
+  }
+}
+
+void WorkStealingPool::WorkerLoop(size_t index) {
+  current_pool = this;
+  current_worker = index;
+  std::function<void()> task;
+  while (true) {
+    if (PopTask(index, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    if (stopping_ && pending_.load() == 0) return;
+    wake_.wait(lock, [this]() { return stopping_ || pending_.load() > 0; });
+  }
+}
+
+size_t WorkStealingPool::GetCurrentWorker() const {
+  return current_pool == this ? current_worker : workers_.size();
+}
+
+}  // namespace reflection
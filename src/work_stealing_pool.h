@@ -0,0 +1,83 @@
+// Copyright 2022 Yuchen Liu. All Rights Reserved.
+// Author: Yuchen Liu (yuchenliu@deeproute.ai)
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace reflection {
+
+/**
+ * Thread pool where every worker owns a task deque. Workers run their own
+ * tasks newest first, and steal the oldest tasks of others when idle, so
+ * uneven tasks balance themselves without a shared queue to contend on.
+ *
+ * Usage:
+ *   WorkStealingPool pool(8);
+ *   pool.ParallelFor(chunks, [&](size_t chunk) { Process(chunk); });
+ */
+class WorkStealingPool {
+ public:
+  // Start |thread_size| workers. 0 means one per hardware thread.
+  explicit WorkStealingPool(size_t thread_size = 0);
+
+  // Run all pending tasks, then join workers.
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  size_t GetThreadSize() const { return threads_.size(); }
+
+  // Schedule a task. Tasks submitted by a worker go to its own deque, others
+  // are spread over all workers.
+  void Submit(std::function<void()> task);
+
+  // Run func(0), ..., func(count - 1) on the pool and wait for all of them.
+  // The calling thread runs tasks too while waiting, so it is safe to call
+  // from inside a task.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& func);
+
+  // Run one pending task in the calling thread. Return false if there is
+  // none.
+  bool RunPendingTask();
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // Pop from deque of |self| (newest first), or steal from others (oldest
+  // first). |self| out of range means the caller owns no deque.
+  bool PopTask(size_t self, std::function<void()>* task);
+
+  // Queue a task without waking workers, see WakeWorkers().
+  void PushTask(size_t worker, std::function<void()> task);
+
+  void WakeWorkers(bool all);
+
+  void WorkerLoop(size_t index);
+
+  // Get worker index of the calling thread in this pool, or GetThreadSize()
+  // if it is not a worker of this pool.
+  size_t GetCurrentWorker() const;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_worker_{0};
+
+  // Number of tasks queued and not yet popped.
+  std::atomic<size_t> pending_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_{false};
+};
+
+}  // namespace reflection
@@ -49,3 +49,17 @@ def ssr_deps():
             remote = "https://github.com/protocolbuffers/protobuf.git",
             shallow_since = "1597443653 -0700",
         )
+
+    if "com_github_google_benchmark" not in native.existing_rules():
+        git_repository(
+            name = "com_github_google_benchmark",
+            remote = "https://github.com/google/benchmark.git",
+            tag = "v1.6.1",
+        )
+
+    if "com_google_googletest" not in native.existing_rules():
+        git_repository(
+            name = "com_google_googletest",
+            remote = "https://github.com/google/googletest.git",
+            tag = "release-1.11.0",
+        )